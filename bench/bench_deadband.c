@@ -0,0 +1,133 @@
+/**
+ * @file    bench_deadband.c
+ * @brief   Cost and traffic reduction of the deadband filter
+ *
+ * Feeds drifting, noisy O3 and NO2 readings with occasional events to the
+ * filter, one cycle of 6 s (virtual time) for all sensors at once, and once
+ * sensor by sensor with deadband_check() for comparison. Reports the time per
+ * result and the fraction of results passed on.
+ *
+ * Usage: bench_deadband [cycles]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "deadband.h"
+
+#define CYCLE_MS (6000)
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t lcg(uint32_t *state)
+{
+    *state = *state * 1664525U + 1013904223U;
+    return *state >> 8;
+}
+
+/* uniform in [-1, 1) */
+static float noise(uint32_t *state)
+{
+    return (float)lcg(state) / (float)(1U << 23) - 1.0F;
+}
+
+typedef struct {
+    float *o3, *no2;
+    int32_t *fast, *epa, *status;
+    float *level;
+} readings_t;
+
+static void next_cycle(readings_t *x, uint32_t n, uint32_t *seed)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        /* slow drift, 0.3 ppb noise and an event in 1 of 500 cycles */
+        x->level[i] += 0.05F * noise(seed);
+        if (lcg(seed) % 500 == 0) {
+            x->level[i] += 20.0F;
+        }
+        x->level[i] -= (x->level[i] - 30.0F) * 0.01F;
+        x->o3[i] = x->level[i] + 0.3F * noise(seed);
+        x->no2[i] = 0.5F * x->level[i] + 0.3F * noise(seed);
+        x->fast[i] = (int32_t)(x->o3[i] * 1.5F);
+        x->epa[i] = (int32_t)(x->level[i] * 1.5F);
+        x->status[i] = 0;
+    }
+}
+
+static int run(uint32_t n, uint32_t cycles, int batched)
+{
+    readings_t x;
+    deadband_t f;
+    uint8_t *emit = malloc(n);
+    uint32_t seed = 1;
+    double t = 0, t0;
+
+    x.o3 = malloc(n * sizeof(float));
+    x.no2 = malloc(n * sizeof(float));
+    x.level = malloc(n * sizeof(float));
+    x.fast = malloc(n * sizeof(int32_t));
+    x.epa = malloc(n * sizeof(int32_t));
+    x.status = malloc(n * sizeof(int32_t));
+    if (!emit || !x.o3 || !x.no2 || !x.level || !x.fast || !x.epa ||
+        !x.status || deadband_init(&f, n, NULL)) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        x.level[i] = 30.0F;
+    }
+    for (uint32_t c = 0; c < cycles; c++) {
+        deadband_batch_t in = { x.o3, x.no2, x.fast, x.epa, x.status };
+        int64_t now = (int64_t)c * CYCLE_MS;
+
+        next_cycle(&x, n, &seed);
+        t0 = seconds();
+        if (batched) {
+            for (uint32_t i = 0; i < n; i++) {
+                emit[i] = 1;
+            }
+            deadband_filter(&f, 0, n, &in, now, emit);
+        } else {
+            for (uint32_t i = 0; i < n; i++) {
+                sensor_results_t r = { .o3_ppb = x.o3[i], .no2_ppb = x.no2[i],
+                                       .fast_aqi = x.fast[i],
+                                       .epa_aqi = x.epa[i],
+                                       .status = x.status[i] };
+                emit[i] = (uint8_t)deadband_check(&f, i, &r, now);
+            }
+        }
+        t += seconds() - t0;
+    }
+
+    printf("bench=deadband mode=%s sensors=%u cycles=%u ns_per_result=%.2f "
+           "passed_ratio=%.4f\n",
+           batched ? "batch" : "single", n, cycles,
+           t * 1e9 / ((double)n * cycles), (double)f.passed / f.results);
+    deadband_free(&f);
+    free(x.o3);
+    free(x.no2);
+    free(x.level);
+    free(x.fast);
+    free(x.epa);
+    free(x.status);
+    free(emit);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t cycles = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 2000;
+    static const uint32_t sizes[] = { 16, 64, 256, 1000 };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        if (run(sizes[s], cycles, 1) || run(sizes[s], cycles, 0)) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,217 @@
+/**
+ * @file    bench_driver.c
+ * @brief   Driver micro-benchmarks and bus traffic against the simulated HAL
+ *
+ * Measures the cost of zmod4xxx_calc_rmox(), its ZMOD4510 specialization
+ * zmod4510_calc_rmox(), the table lookup zmod4510_calc_rmox_lut() at several
+ * table sizes and zmod4xxx_calc_factor(), and
+ * counts the I2C transactions and bytes of sensor bring-up (init, sensor
+ * info, prepare) and of one host-triggered measurement cycle.
+ *
+ * Every result is printed as one line of key=value pairs. Each table size is
+ * first checked against zmod4xxx_calc_rmox() for all 65536 ADC words; any
+ * mismatch fails the benchmark.
+ *
+ * Usage: bench_driver [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "zmod4xxx.h"
+#include "zmod4xxx_hal.h"
+#include "zmod4510.h"
+#include "hal/sim/sim.h"
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Compare a table against the generic conversion for every ADC word */
+static uint32_t lut_mismatches(const zmod4xxx_dev_t *dev,
+                               const zmod4510_rmox_lut_t *lut)
+{
+    uint8_t adc[ZMOD4510_ADC_DATA_LEN];
+    float ref[ZMOD4510_RMOX_COUNT], out[ZMOD4510_RMOX_COUNT];
+    uint32_t bad = 0;
+
+    for (uint32_t w = 0; w < ZMOD4510_RMOX_LUT_FULL; w += ZMOD4510_RMOX_COUNT) {
+        for (int i = 0; i < ZMOD4510_RMOX_COUNT; i++) {
+            adc[2 * i] = (uint8_t)((w + i) >> 8);
+            adc[2 * i + 1] = (uint8_t)(w + i);
+        }
+        zmod4xxx_calc_rmox((zmod4xxx_dev_t *)dev, adc, ref);
+        zmod4510_calc_rmox_lut(lut, adc, out);
+        for (int i = 0; i < ZMOD4510_RMOX_COUNT; i++) {
+            bad += 0 != memcmp(&ref[i], &out[i], sizeof(float));
+        }
+    }
+    return bad;
+}
+
+static int bench_lut(const zmod4xxx_dev_t *dev, uint8_t *adc, uint32_t n,
+                     const char *name, uint16_t first, uint32_t count)
+{
+    static float table[ZMOD4510_RMOX_LUT_FULL];
+    float rmox[ZMOD4510_RMOX_COUNT];
+    volatile float sink = 0;
+    zmod4510_rmox_lut_t lut;
+    uint32_t bad;
+    double t0, build, t;
+
+    t0 = seconds();
+    zmod4510_rmox_lut_init(&lut, dev, count ? table : NULL, first, count);
+    build = seconds() - t0;
+    bad = lut_mismatches(dev, &lut);
+    if (bad) {
+        fprintf(stderr, "rmox table %s: %u mismatches\n", name, bad);
+        return -1;
+    }
+
+    t0 = seconds();
+    for (uint32_t i = 0; i < n; i++) {
+        adc[(i & 15) * 2 + 1] = (uint8_t)i;
+        zmod4510_calc_rmox_lut(&lut, adc, rmox);
+        sink += rmox[i & 15];
+    }
+    t = seconds() - t0;
+    printf("bench=driver op=calc_rmox_lut table=%s entries=%u kib=%u "
+           "build_us=%.1f calls=%u ns_per_call=%.1f ns_per_value=%.2f "
+           "mismatches=0\n",
+           name, lut.count, (unsigned)(lut.count * sizeof(float) / 1024),
+           build * 1e6, n, t * 1e9 / n, t * 1e9 / n / ZMOD4510_RMOX_COUNT);
+    (void)sink;
+    return 0;
+}
+
+static void report_traffic(const char *phase, const SimDevice_t *sim,
+                           const SimDevice_t *before, double wall_s,
+                           uint64_t virtual_ms)
+{
+    printf("bench=driver phase=%s reads=%u writes=%u bytes=%u wall_us=%.1f "
+           "sensor_ms=%llu\n",
+           phase, sim->nRead - before->nRead, sim->nWrite - before->nWrite,
+           sim->nBytes - before->nBytes, wall_s * 1e6,
+           (unsigned long long)virtual_ms);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t n = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 1000000;
+    static uint8_t prod_data[ZMOD4510_PROD_DATA_LEN];
+    uint8_t adc[ZMOD4510_ADC_DATA_LEN];
+    uint8_t hsp[HSP_MAX * 2];
+    float rmox[ZMOD4510_RMOX_COUNT];
+    volatile float sink = 0;
+    zmod4xxx_dev_t dev = { 0 };
+    Interface_t hal;
+    SimDevice_t sim, before;
+    double t0, t;
+    uint64_t v0;
+    uint32_t span;
+    uint16_t first;
+    uint8_t status;
+    int ret;
+
+    /* Bring-up: zmod4xxx_init, read_sensor_info, prepare_sensor */
+    SIM_Init(&hal, &sim, NULL);
+    dev.i2c_addr = ZMOD4510_I2C_ADDR;
+    dev.pid = ZMOD4510_PID;
+    dev.init_conf = &zmod_no2_o3_sensor_cfg[INIT];
+    dev.meas_conf = &zmod_no2_o3_sensor_cfg[MEASUREMENT];
+    dev.prod_data = prod_data;
+
+    before = sim;
+    v0 = SIM_Clock();
+    t0 = seconds();
+    ret = zmod4xxx_init(&dev, &hal);
+    if (!ret) {
+        ret = zmod4xxx_read_sensor_info(&dev);
+    }
+    t = seconds() - t0;
+    report_traffic("detect", &sim, &before, t, SIM_Clock() - v0);
+
+    before = sim;
+    v0 = SIM_Clock();
+    t0 = seconds();
+    if (!ret) {
+        ret = zmod4xxx_prepare_sensor(&dev);
+    }
+    t = seconds() - t0;
+    report_traffic("prepare", &sim, &before, t, SIM_Clock() - v0);
+    if (ret) {
+        fprintf(stderr, "bring-up failed: %d\n", ret);
+        return EXIT_FAILURE;
+    }
+
+    /* One host-triggered cycle as run by sensor_step */
+    before = sim;
+    v0 = SIM_Clock();
+    t0 = seconds();
+    ret = zmod4xxx_start_measurement(&dev);
+    dev.delay_ms(SIM_DefaultConfig.seqTime - ZMOD4510_WAIT_GUARD_TIME);
+    ret |= zmod4xxx_wait_measurement(&dev, ZMOD4510_WAIT_POLL_TIME,
+                                     ZMOD4510_WAIT_TIMEOUT, NULL);
+    ret |= zmod4xxx_read_status(&dev, &status);
+    ret |= zmod4xxx_read_adc_result(&dev, adc);
+    ret |= zmod4xxx_check_error_event(&dev);
+    t = seconds() - t0;
+    report_traffic("cycle", &sim, &before, t, SIM_Clock() - v0);
+    if (ret) {
+        fprintf(stderr, "measurement cycle failed: %d\n", ret);
+        return EXIT_FAILURE;
+    }
+
+    /* zmod4xxx_calc_rmox on the ADC words of the cycle, varied per call */
+    t0 = seconds();
+    for (uint32_t i = 0; i < n; i++) {
+        adc[(i & 15) * 2 + 1] = (uint8_t)i;
+        zmod4xxx_calc_rmox(&dev, adc, rmox);
+        sink += rmox[i & 15];
+    }
+    t = seconds() - t0;
+    printf("bench=driver op=calc_rmox calls=%u ns_per_call=%.1f "
+           "ns_per_value=%.2f\n",
+           n, t * 1e9 / n, t * 1e9 / n / ZMOD4510_RMOX_COUNT);
+
+    /* the same with loop bounds fixed at compile time */
+    t0 = seconds();
+    for (uint32_t i = 0; i < n; i++) {
+        adc[(i & 15) * 2 + 1] = (uint8_t)i;
+        zmod4510_calc_rmox(&dev, adc, rmox);
+        sink += rmox[i & 15];
+    }
+    t = seconds() - t0;
+    printf("bench=driver op=calc_rmox_4510 calls=%u ns_per_call=%.1f "
+           "ns_per_value=%.2f\n",
+           n, t * 1e9 / n, t * 1e9 / n / ZMOD4510_RMOX_COUNT);
+
+    /* table lookup: full, the non-clamped span, a 4K window in the middle
+     * of the span and no table at all */
+    span = zmod4510_rmox_lut_span(&dev, &first);
+    if (bench_lut(&dev, adc, n, "full", 0, ZMOD4510_RMOX_LUT_FULL) ||
+        bench_lut(&dev, adc, n, "span", first, span) ||
+        bench_lut(&dev, adc, n, "window",
+                  first + (span > 4096 ? (span - 4096) / 2 : 0), 4096) ||
+        bench_lut(&dev, adc, n, "none", 0, 0)) {
+        return EXIT_FAILURE;
+    }
+
+    /* zmod4xxx_calc_factor for the measurement heater profile */
+    t0 = seconds();
+    for (uint32_t i = 0; i < n; i++) {
+        dev.config[5] = (uint8_t)i;
+        zmod4xxx_calc_factor(dev.meas_conf, hsp, dev.config);
+        sink += hsp[i & 7];
+    }
+    t = seconds() - t0;
+    printf("bench=driver op=calc_factor calls=%u ns_per_call=%.1f\n", n,
+           t * 1e9 / n);
+
+    (void)sink;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+/**
+ * @file    bench_export.c
+ * @brief   Cost of exporting results, batched against one sync per record
+ *
+ * Exports simulated results spaced 6 s apart (virtual time), once per format
+ * with the default batching and sync policy (export_arrow_config for Arrow)
+ * and once with a write and fdatasync per record, as ad-hoc loggers do.
+ * bytes_per_record is the size of the file per result. Run it on the target storage,
+ * e.g. the SD card, to see the difference that matters.
+ *
+ * Usage: bench_export [records] [directory]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "export.h"
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int run(const char *mode, const char *dir, uint32_t n,
+               const export_config_t *cfg)
+{
+    char path[256];
+    exporter_t x;
+    sensor_results_t r = { 0 };
+    struct stat st;
+    double t0, t;
+
+    snprintf(path, sizeof(path), "%s/bench_export_%s.out", dir, mode);
+    unlink(path);
+    if (export_open(&x, path, cfg)) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return -1;
+    }
+    t0 = seconds();
+    for (uint32_t i = 0; i < n; i++) {
+        r.timestamp_ms = 1700000000000LL + (int64_t)i * 6000;
+        r.o3_ppb = 20.0F + (float)(i % 97) * 0.125F;
+        r.no2_ppb = 10.0F + (float)(i % 89) * 0.25F;
+        r.fast_aqi = (int32_t)(i % 50);
+        r.epa_aqi = (int32_t)(i % 60);
+        for (int k = 0; k < 4; k++) {
+            r.rmox[k] = 1e5F * (k + 1) + (float)i;
+        }
+        if (export_append(&x, &r)) {
+            fprintf(stderr, "export failed\n");
+            return -1;
+        }
+    }
+    export_close(&x);
+    t = seconds() - t0;
+    if (stat(path, &st)) {
+        st.st_size = 0;
+    }
+
+    printf("bench=export mode=%s records=%u writes=%u syncs=%u "
+           "us_per_record=%.2f records_per_s=%.0f bytes_per_record=%.1f\n",
+           mode, n, x.writes, x.syncs, t * 1e6 / n, n / t,
+           (double)st.st_size / n);
+    unlink(path);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t n = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 20000;
+    const char *dir = argc > 2 ? argv[2] : ".";
+    export_config_t cfg = export_default_config;
+    static const char *const names[] = { "csv", "jsonl", "line" };
+
+    for (int f = EXPORT_CSV; f <= EXPORT_LINE; f++) {
+        cfg.format = (export_format_t)f;
+        if (run(names[f], dir, n, &cfg)) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (run("arrow", dir, n, &export_arrow_config)) {
+        return EXIT_FAILURE;
+    }
+    /* one write and one fdatasync per record */
+    cfg.format = EXPORT_CSV;
+    cfg.flush_bytes = 0;
+    cfg.sync_ms = 1;
+    if (run("csv_sync_each", dir, n / 10 ? n / 10 : 1, &cfg)) {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file    bench_faults.c
+ * @brief   Samples lost and time to recover per fault class
+ *
+ * A simulated sensor behind the fault injecting HAL (fault.h) is brought up
+ * with fleet_bring_up and measured like zmodd does: start, sleep until just
+ * before the sequence ends, wait for it, read the results, check the error
+ * register and, after a failed cycle, fleet_recover. Time is virtual.
+ *
+ * For every fault class, trials faults are injected one at a time at a
+ * random point of a cycle once the sensor delivers again. Reported per class:
+ *   - lost_avg/max: cycles without a result from the fault on
+ *   - recover_ms_avg/p95/max: from the fault to the next result; this
+ *     includes the rest of the cycle, so without loss it is below one cycle
+ *   - over_budget: trials that took longer than budget_ms
+ *   - not_i2c: NACK and timeout trials in which no cycle failed with
+ *     ERROR_I2C, i.e. the HAL error did not reach the driver
+ * A final soak injects all classes at random and reports the overall loss.
+ * The exit status is nonzero if any trial exceeded the budget or a NACK or
+ * timeout was not reported as ERROR_I2C.
+ *
+ * Usage: bench_faults [trials] [budget_ms] [soak_cycles]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "fleet.h"
+#include "zmod4xxx.h"
+#include "zmod4510.h"
+#include "hal/fault/fault.h"
+#include "hal/sim/sim.h"
+
+/* cycles in a row without a result after which a trial is abandoned */
+#define GIVE_UP_CYCLES (20)
+
+static Interface_t sim_hal, fault_hal;
+static SimDevice_t sim;
+static FaultInjector_t fi;
+static fleet_bus_t bus;
+static fleet_sensor_t sensor;
+static uint8_t prod_data[ZMOD4510_PROD_DATA_LEN];
+static uint32_t meas_time_ms = ZMOD4510_NO2_O3_SAMPLE_TIME;
+static uint64_t cycle_start_ms;
+static int saw_i2c; /**< a cycle failed with ERROR_I2C */
+
+static uint64_t now_ms(void)
+{
+    return fault_hal.msClock();
+}
+
+static void sleep_until(uint64_t t)
+{
+    uint64_t now = now_ms();
+
+    if (t > now) {
+        fault_hal.msSleep((uint32_t)(t - now));
+    }
+}
+
+/* One cycle on the 6 s grid as in zmodd; returns 0 if it gave a result and
+ * sets *at to the time the result was read */
+static int cycle(uint64_t *at)
+{
+    zmod4xxx_dev_t *dev = &sensor.dev;
+    uint8_t adc[ZMOD4510_ADC_DATA_LEN];
+    uint64_t start;
+    uint32_t waited;
+    int ret;
+
+    if (cycle_start_ms) {
+        sleep_until(cycle_start_ms + ZMOD4510_NO2_O3_SAMPLE_TIME);
+    }
+    start = now_ms();
+    cycle_start_ms = start;
+    ret = zmod4xxx_start_measurement(dev);
+    if (!ret) {
+        sleep_until(start + meas_time_ms - ZMOD4510_WAIT_GUARD_TIME);
+        ret = zmod4xxx_wait_measurement(dev, ZMOD4510_WAIT_POLL_TIME,
+                                        ZMOD4510_WAIT_TIMEOUT, &waited);
+    }
+    if (!ret) {
+        if (waited) {
+            meas_time_ms = (uint32_t)(now_ms() - start);
+        } else if (meas_time_ms > 2 * ZMOD4510_WAIT_GUARD_TIME) {
+            meas_time_ms -= meas_time_ms / 16;
+        }
+        ret = zmod4510_read_adc_result(dev, adc);
+    }
+    if (!ret) {
+        ret = zmod4xxx_check_error_event(dev);
+    }
+    *at = now_ms();
+    saw_i2c |= ERROR_I2C == ret;
+    if (ret) {
+        fleet_recover(&sensor, ret);
+    }
+    return ret;
+}
+
+/* Cycles until one gives a result; returns the cycles lost, -1 if none */
+static int until_result(uint64_t *at)
+{
+    for (int lost = 0; lost < GIVE_UP_CYCLES; lost++) {
+        if (!cycle(at)) {
+            return lost;
+        }
+    }
+    return -1;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int run_class(FaultClass_t fault, uint32_t trials, uint32_t budget_ms)
+{
+    uint32_t *recover = calloc(trials, sizeof(*recover));
+    uint32_t lost_sum = 0, lost_max = 0, over = 0, failed = 0, not_i2c = 0;
+    int bus_fault = fcNack == fault || fcTimeout == fault;
+    uint64_t rec_sum = 0, at;
+    uint32_t seed = 7 + fault, done = 0;
+
+    if (!recover) {
+        return -1;
+    }
+    for (uint32_t t = 0; t < trials; t++) {
+        uint32_t injected = fi.injected[fault];
+        int lost;
+
+        if (until_result(&at) < 0) {
+            failed++;
+            continue;
+        }
+        seed = seed * 1664525U + 1013904223U;
+        FAULT_Inject(&fi, fault,
+                     at + (seed >> 8) % ZMOD4510_NO2_O3_SAMPLE_TIME);
+        /* cycles before the fault fires are not lost */
+        saw_i2c = 0;
+        do {
+            lost = until_result(&at);
+        } while (lost == 0 && fi.injected[fault] == injected);
+        if (lost < 0) {
+            failed++;
+            continue;
+        }
+        not_i2c += bus_fault && !saw_i2c;
+        recover[done] = (uint32_t)(at - fi.lastMs[fault]);
+        rec_sum += recover[done];
+        over += recover[done] > budget_ms;
+        lost_sum += (uint32_t)lost;
+        lost_max = (uint32_t)lost > lost_max ? (uint32_t)lost : lost_max;
+        done++;
+    }
+    qsort(recover, done, sizeof(*recover), cmp_u32);
+
+    printf("bench=faults class=%s trials=%u lost_avg=%.2f lost_max=%u "
+           "recover_ms_avg=%.0f recover_ms_p95=%u recover_ms_max=%u "
+           "budget_ms=%u over_budget=%u not_recovered=%u not_i2c=%u\n",
+           FAULT_Name(fault), trials, done ? (double)lost_sum / done : 0,
+           lost_max, done ? (double)rec_sum / done : 0,
+           done ? recover[done * 95 / 100] : 0, done ? recover[done - 1] : 0,
+           budget_ms, over, failed, not_i2c);
+    free(recover);
+    return over + failed + not_i2c ? 1 : 0;
+}
+
+static void soak(uint32_t cycles)
+{
+    uint32_t lost = 0, total = 0;
+    uint64_t at;
+
+    for (int f = 0; f < fcCount; f++) {
+        fi.cfg.rate[f] = 50;
+        fi.injected[f] = 0;
+    }
+    for (uint32_t c = 0; c < cycles; c++) {
+        lost += cycle(&at) != 0;
+    }
+    for (int f = 0; f < fcCount; f++) {
+        total += fi.injected[f];
+        fi.cfg.rate[f] = 0;
+    }
+    printf("bench=faults class=random cycles=%u faults=%u nack=%u timeout=%u "
+           "por=%u conflict=%u delay=%u lost=%u lost_pct=%.2f\n",
+           cycles, total, fi.injected[fcNack], fi.injected[fcTimeout],
+           fi.injected[fcPor], fi.injected[fcConflict], fi.injected[fcDelay],
+           lost, 100.0 * lost / cycles);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t trials = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 100;
+    uint32_t budget = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) : 18000;
+    uint32_t soak_cycles =
+        argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 0) : 2000;
+    zmod4xxx_dev_t *dev = &sensor.dev;
+    int ret = EXIT_SUCCESS;
+
+    SIM_Init(&sim_hal, &sim, NULL);
+    FAULT_Init(&fault_hal, &fi, &sim_hal, NULL);
+    fleet_bus_init(&bus, &fault_hal, NULL, NULL);
+    fleet_sensor_init(&sensor, &bus, -1);
+    dev->i2c_addr = ZMOD4510_I2C_ADDR;
+    dev->pid = ZMOD4510_PID;
+    dev->init_conf = &zmod_no2_o3_sensor_cfg[INIT];
+    dev->meas_conf = &zmod_no2_o3_sensor_cfg[MEASUREMENT];
+    dev->prod_data = prod_data;
+    if (fleet_bring_up(&sensor, 1, 1, NULL, NULL)) {
+        fprintf(stderr, "bring-up failed: %d\n", sensor.error);
+        return EXIT_FAILURE;
+    }
+    fleet_select(&sensor);
+
+    for (int f = 0; f < fcCount; f++) {
+        if (run_class((FaultClass_t)f, trials, budget)) {
+            ret = EXIT_FAILURE;
+        }
+    }
+    soak(soak_cycles);
+    fleet_bus_destroy(&bus);
+    return ret;
+}
@@ -0,0 +1,438 @@
+/**
+ * @file    bench_fleet.c
+ * @brief   Load test of a gateway serving a growing fleet of virtual sensors
+ *
+ * Every sensor is a simulated ZMOD4510 with its own waveform: baseline drift,
+ * noise and O3/NO2 events (sim.h). The sensors are spread over a number of
+ * virtual buses, each behind an unlimited multiplexer, brought up with
+ * fleet_bring_up and served like zmodd does: one thread per bus starts all
+ * of its sensors, sleeps until the sequences end, then reads, checks and
+ * evaluates every result with calc_no2_o3.
+ *
+ * Bring-up and a warm-up of the algorithms past their stabilization run in
+ * virtual time. The measured cycles then run in real time, with the
+ * sequence shortened to seq_ms but the cycle keeping
+ * the 400 ms of slack the NO2/O3 cycle leaves for reading and evaluating the
+ * results, which is what limits the sensors per bus. Reported per fleet size:
+ *   - cpu_us_per_sample, cpu_pct_per_sensor: host CPU, user and system;
+ *     the percentage is of one core at the real 6 s cycle
+ *   - kb_per_sensor: resident memory growth per sensor, including the
+ *     simulator; bytes_per_sensor: the state a gateway keeps per sensor
+ *   - jitter_ms_avg/p99/max: lateness of the cycle starts against the grid
+ *   - dropped_cycles: grid points skipped because a bus overran its cycle
+ *   - bus_load: I2C time a real bus at bus_hz would need per cycle, as a
+ *     fraction of the slack, for the busiest bus; above 1 it cannot keep up
+ *
+ * Usage: bench_fleet [max_sensors] [buses] [cycles] [warmup] [seq_ms] [bus_hz]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "fleet.h"
+#include "no2_o3.h"
+#include "zmod4xxx.h"
+#include "zmod4510.h"
+#include "hal/sim/sim.h"
+
+#define SLACK_MS      (ZMOD4510_NO2_O3_SAMPLE_TIME - 5600U)
+#define MAX_PARALLEL  (64)
+#define WARMUP_CYCLES (1)
+
+/* Per-sensor state of the gateway besides its fleet_sensor_t, as in zmodd */
+typedef struct {
+    no2_o3_handle_t algo;
+    uint8_t prod_data[ZMOD4510_PROD_DATA_LEN];
+} sensor_t;
+
+typedef struct {
+    Interface_t hal;       /**< forwards to chan[current] */
+    Interface_t *chan;
+    SimDevice_t *dev;
+    int current;
+    fleet_bus_t fleet;
+    fleet_sensor_t *fs;
+    sensor_t *sensors;
+    uint32_t count;
+    pthread_t thread;
+    /* results */
+    uint32_t failed;
+    uint32_t dropped;
+    uint32_t starts;
+    float *late_ms;        /**< lateness of every measured cycle start */
+    uint32_t algo_ok;
+    uint32_t algo_stabilizing;
+    uint32_t algo_other;
+} vbus_t;
+
+static uint64_t t0_ms;
+static uint32_t cycles, warmup, seq_ms, period_ms;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(uint64_t t)
+{
+    struct timespec ts = { (time_t)(t / 1000000), (long)(t % 1000000) * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) {
+    }
+}
+
+static double cpu_s(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+}
+
+static long rss_kb(void)
+{
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int vbus_read(void *handle, uint8_t addr, uint8_t *wr, int wr_len,
+                     uint8_t *rd, int rd_len)
+{
+    vbus_t *b = handle;
+    Interface_t *c = &b->chan[b->current];
+    return c->i2cRead(c->handle, addr, wr, wr_len, rd, rd_len);
+}
+
+static int vbus_write(void *handle, uint8_t addr, uint8_t *wr1, int len1,
+                      uint8_t *wr2, int len2)
+{
+    vbus_t *b = handle;
+    Interface_t *c = &b->chan[b->current];
+    return c->i2cWrite(c->handle, addr, wr1, len1, wr2, len2);
+}
+
+static int vbus_select(void *ctx, Interface_t *hal, int channel)
+{
+    (void)hal;
+    ((vbus_t *)ctx)->current = channel;
+    return 0;
+}
+
+static int vbus_open(vbus_t *b, fleet_sensor_t *fs, sensor_t *sensors,
+                     uint32_t count, uint32_t first_seed)
+{
+    SimConfig_t cfg = SIM_DefaultConfig;
+
+    memset(b, 0, sizeof(*b));
+    b->chan = calloc(count, sizeof(*b->chan));
+    b->dev = calloc(count, sizeof(*b->dev));
+    b->late_ms = calloc(cycles, sizeof(*b->late_ms));
+    if (!b->chan || !b->dev || !b->late_ms) {
+        return -1;
+    }
+    cfg.seqTime = seq_ms;
+    cfg.period = period_ms;
+    cfg.drift = 0.05F;
+    cfg.noise = 0.02F;
+    cfg.eventRate = 4;
+    cfg.eventDepth = 0.25F;
+    for (uint32_t c = 0; c < count; c++) {
+        cfg.seed = first_seed + c;
+        SIM_Init(&b->chan[c], &b->dev[c], &cfg);
+    }
+    b->hal = b->chan[0];
+    b->hal.handle = b;
+    b->hal.i2cRead = vbus_read;
+    b->hal.i2cWrite = vbus_write;
+    b->hal.i2cBatch = NULL;
+    fleet_bus_init(&b->fleet, &b->hal, vbus_select, b);
+
+    b->fs = fs;
+    b->sensors = sensors;
+    b->count = count;
+    for (uint32_t c = 0; c < count; c++) {
+        zmod4xxx_dev_t *dev = &fs[c].dev;
+
+        fleet_sensor_init(&fs[c], &b->fleet, (int)c);
+        dev->i2c_addr = ZMOD4510_I2C_ADDR;
+        dev->pid = ZMOD4510_PID;
+        dev->init_conf = &zmod_no2_o3_sensor_cfg[INIT];
+        dev->meas_conf = &zmod_no2_o3_sensor_cfg[MEASUREMENT];
+        dev->prod_data = sensors[c].prod_data;
+    }
+    return 0;
+}
+
+static void vbus_close(vbus_t *b)
+{
+    if (b->chan) {
+        fleet_bus_destroy(&b->fleet);
+    }
+    free(b->chan);
+    free(b->dev);
+    free(b->late_ms);
+}
+
+/* I2C bytes moved on the bus so far, counting address and framing */
+static uint64_t vbus_bits(const vbus_t *b)
+{
+    uint64_t bits = 0;
+
+    for (uint32_t c = 0; c < b->count; c++) {
+        bits += 9ULL * (b->dev[c].nBytes +
+                        2ULL * (b->dev[c].nRead + b->dev[c].nWrite));
+    }
+    return bits;
+}
+
+static void measure(vbus_t *b, uint32_t i)
+{
+    zmod4xxx_dev_t *dev = &b->fs[i].dev;
+    uint8_t adc[ZMOD4510_ADC_DATA_LEN];
+    no2_o3_inputs_t in = { adc, 50, -300 };
+    no2_o3_results_t r;
+    int ret;
+
+    fleet_select(&b->fs[i]);
+    ret = zmod4xxx_wait_measurement(dev, ZMOD4510_WAIT_POLL_TIME,
+                                    seq_ms + period_ms, NULL);
+    if (!ret) {
+        ret = zmod4510_read_adc_result(dev, adc);
+    }
+    if (!ret) {
+        ret = zmod4xxx_check_error_event(dev);
+    }
+    if (ret) {
+        b->failed++;
+        return;
+    }
+    ret = calc_no2_o3(&b->sensors[i].algo, dev, &in, &r);
+    if (NO2_O3_OK == ret) {
+        b->algo_ok++;
+    } else if (NO2_O3_STABILIZATION == ret) {
+        b->algo_stabilizing++;
+    } else {
+        b->algo_other++;
+    }
+}
+
+/* Run all buses in virtual time, one thread, so the virtual clock advances
+ * by one sequence per cycle */
+static void warm_up(vbus_t *bus, uint32_t nbus)
+{
+    for (uint32_t w = 0; w < warmup; w++) {
+        for (uint32_t k = 0; k < nbus; k++) {
+            for (uint32_t i = 0; i < bus[k].count; i++) {
+                if (FLEET_READY == bus[k].fs[i].stage) {
+                    fleet_select(&bus[k].fs[i]);
+                    zmod4xxx_start_measurement(&bus[k].fs[i].dev);
+                }
+            }
+        }
+        bus[0].chan[0].msSleep(period_ms);
+        for (uint32_t k = 0; k < nbus; k++) {
+            for (uint32_t i = 0; i < bus[k].count; i++) {
+                if (FLEET_READY == bus[k].fs[i].stage) {
+                    measure(&bus[k], i);
+                }
+            }
+        }
+    }
+    for (uint32_t k = 0; k < nbus; k++) {
+        bus[k].failed = bus[k].algo_ok = 0;
+        bus[k].algo_stabilizing = bus[k].algo_other = 0;
+    }
+}
+
+/* One bus on the common grid t0 + k * period; a cycle that starts later
+ * than one period after its grid point skips the missed points. */
+static void *serve(void *arg)
+{
+    vbus_t *b = arg;
+    uint64_t grid = t0_ms * 1000;
+
+    for (uint32_t k = 0; k < cycles + WARMUP_CYCLES;) {
+        uint64_t start;
+
+        sleep_until_us(grid);
+        start = now_us();
+        if (k >= WARMUP_CYCLES) {
+            b->late_ms[b->starts++] = (start - grid) / 1000.0F;
+        }
+        for (uint32_t i = 0; i < b->count; i++) {
+            if (FLEET_READY == b->fs[i].stage) {
+                fleet_select(&b->fs[i]);
+                b->failed += 0 != zmod4xxx_start_measurement(&b->fs[i].dev);
+            }
+        }
+        sleep_until_us(start + (seq_ms - ZMOD4510_WAIT_GUARD_TIME) * 1000ULL);
+        for (uint32_t i = 0; i < b->count; i++) {
+            if (FLEET_READY == b->fs[i].stage) {
+                measure(b, i);
+            }
+        }
+        k++;
+        grid += period_ms * 1000ULL;
+        while (now_us() > grid + period_ms * 1000ULL &&
+               k < cycles + WARMUP_CYCLES) {
+            grid += period_ms * 1000ULL;
+            if (k++ >= WARMUP_CYCLES) {
+                b->dropped++;
+            }
+        }
+    }
+    return NULL;
+}
+
+static int cmp_float(const void *a, const void *b)
+{
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+static int run(uint32_t n, uint32_t nbus, uint32_t bus_hz)
+{
+    sensor_t *sensors;
+    fleet_sensor_t *fs;
+    vbus_t *bus = calloc(nbus, sizeof(*bus));
+    uint32_t first = 0, failed = 0, dropped = 0, starts = 0, ready = 0;
+    uint32_t ok = 0, stabilizing = 0, other = 0;
+    uint32_t samples = n * (cycles + WARMUP_CYCLES);
+    uint64_t bits_max = 0;
+    long rss0 = rss_kb(), rss1;
+    double cpu0, cpu, sum = 0;
+    float *late;
+    int ret = -1;
+
+    sensors = calloc(n, sizeof(*sensors));
+    fs = calloc(n, sizeof(*fs));
+    late = calloc((size_t)nbus * cycles, sizeof(*late));
+    if (!bus || !sensors || !fs || !late) {
+        goto out;
+    }
+    for (uint32_t k = 0; k < nbus; k++) {
+        uint32_t count = n / nbus + (k < n % nbus);
+
+        if (vbus_open(&bus[k], &fs[first], &sensors[first], count,
+                      first + 1)) {
+            goto out;
+        }
+        first += count;
+    }
+
+    if (fleet_bring_up(fs, (int)n, MAX_PARALLEL, NULL, NULL) < 0) {
+        goto out;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (FLEET_READY == fs[i].stage) {
+            ready++;
+            init_no2_o3(&sensors[i].algo);
+        }
+    }
+    rss1 = rss_kb();
+    warm_up(bus, nbus);
+    SIM_SetRealtime(1);
+
+    for (uint32_t k = 0; k < nbus; k++) {
+        for (uint32_t c = 0; c < bus[k].count; c++) {
+            bus[k].dev[c].nBytes = bus[k].dev[c].nRead =
+                bus[k].dev[c].nWrite = 0;
+        }
+    }
+    t0_ms = now_us() / 1000 + 20;
+    cpu0 = cpu_s();
+    for (uint32_t k = 0; k < nbus; k++) {
+        pthread_create(&bus[k].thread, NULL, serve, &bus[k]);
+    }
+    for (uint32_t k = 0; k < nbus; k++) {
+        pthread_join(bus[k].thread, NULL);
+    }
+    cpu = cpu_s() - cpu0;
+    SIM_SetRealtime(0);
+
+    for (uint32_t k = 0; k < nbus; k++) {
+        uint64_t bits = vbus_bits(&bus[k]);
+
+        failed += bus[k].failed;
+        dropped += bus[k].dropped;
+        memcpy(late + starts, bus[k].late_ms, bus[k].starts * sizeof(*late));
+        starts += bus[k].starts;
+        ok += bus[k].algo_ok;
+        stabilizing += bus[k].algo_stabilizing;
+        other += bus[k].algo_other;
+        bits_max = bits > bits_max ? bits : bits_max;
+    }
+    qsort(late, starts, sizeof(*late), cmp_float);
+    for (uint32_t i = 0; i < starts; i++) {
+        sum += late[i];
+    }
+
+    printf("bench=fleet sensors=%u buses=%u ready=%u cycles=%u failed=%u "
+           "cpu_us_per_sample=%.1f cpu_pct_per_sensor=%.5f "
+           "kb_per_sensor=%.1f bytes_per_sensor=%zu "
+           "jitter_ms_avg=%.2f jitter_ms_p99=%.2f jitter_ms_max=%.2f "
+           "dropped_cycles=%u bus_load=%.3f algo_ok=%u algo_stabilizing=%u "
+           "algo_other=%u\n",
+           n, nbus, ready, cycles, failed, cpu * 1e6 / samples,
+           /* share of one core per sensor at the real cycle length */
+           cpu * 1e5 / samples / ZMOD4510_NO2_O3_SAMPLE_TIME,
+           (double)(rss1 - rss0) / n,
+           sizeof(fleet_sensor_t) + sizeof(sensor_t),
+           starts ? sum / starts : 0,
+           starts ? late[(starts - 1) * 99 / 100] : 0,
+           starts ? late[starts - 1] : 0, dropped,
+           bits_max / ((double)bus_hz * (cycles + WARMUP_CYCLES)) /
+               (SLACK_MS / 1000.0),
+           ok, stabilizing, other);
+    ret = 0;
+
+out:
+    for (uint32_t k = 0; k < nbus; k++) {
+        vbus_close(&bus[k]);
+    }
+    free(late);
+    free(fs);
+    free(sensors);
+    free(bus);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    static const uint32_t sizes[] = { 1, 10, 100, 250, 500, 1000, 2000, 5000 };
+    uint32_t max_sensors = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 1000;
+    uint32_t buses = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) : 4;
+    uint32_t bus_hz = argc > 6 ? (uint32_t)strtoul(argv[6], NULL, 0) : 400000;
+
+    cycles = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 0) : 5;
+    warmup = argc > 4 ? (uint32_t)strtoul(argv[4], NULL, 0) : 600;
+    seq_ms = argc > 5 ? (uint32_t)strtoul(argv[5], NULL, 0) : 600;
+    period_ms = seq_ms + SLACK_MS;
+    if (!buses || !cycles || seq_ms <= ZMOD4510_WAIT_GUARD_TIME) {
+        fprintf(stderr, "invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (sizes[i] > max_sensors) {
+            break;
+        }
+        if (run(sizes[i], sizes[i] < buses ? sizes[i] : buses, bus_hz)) {
+            fprintf(stderr, "run with %u sensors failed\n", sizes[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
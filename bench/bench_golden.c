@@ -0,0 +1,732 @@
+/**
+ * @file    bench_golden.c
+ * @brief   Bit-exact replay of the golden corpus through every code path
+ *
+ * The corpus (golden/corpus.txt) holds device parameters, ADC frames and
+ * result streams together with the outputs of the reference scalar code
+ * they were recorded with. Replaying it runs every implementation of the
+ * same computation and compares its outputs bit for bit with the recorded
+ * ones:
+ *   - ADC to resistance: zmod4xxx_calc_rmox() (the reference),
+ *     zmod4510_calc_rmox() and zmod4510_calc_rmox_lut() with a full table,
+ *     the non-clamped span, a 4K window and no table
+ *   - heater set points: zmod4xxx_calc_factor() for both configurations
+ *   - deadband: deadband_check() (the reference) result by result and
+ *     deadband_filter() cycle by cycle
+ * A line per path reports the mismatches next to the throughput, so a
+ * faster path is only accepted with mismatches=0. The exit status is
+ * nonzero on any mismatch.
+ *
+ * Recording (-r) writes a new corpus from the reference code: the simulated
+ * sensor after bring-up with its own measurement cycles, and synthetic
+ * devices covering the edges of the conversion (degenerate mox_lr/mox_er,
+ * words around both limits). Only record anew when the reference itself is
+ * meant to change.
+ *
+ * Usage: bench_golden corpus [repeats]
+ *        bench_golden -r corpus
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "zmod4xxx.h"
+#include "zmod4xxx_hal.h"
+#include "zmod4510.h"
+#include "deadband.h"
+#include "hal/sim/sim.h"
+
+#define MAX_DEVS      (64)
+#define MAX_LANES     (256)
+#define LINE_LEN      (512)
+#define INIT_HSP_LEN  (2)
+#define MEAS_HSP_LEN  (8)
+
+/* recorded corpus */
+#define REC_FRAMES    (30)  /* random or simulated frames per device */
+#define REC_LANES     (6)
+#define REC_CYCLES    (200)
+#define REC_CYCLE_MS  (6000)
+
+typedef struct {
+    zmod4xxx_dev_t dev;
+    uint8_t hsp_init[INIT_HSP_LEN];
+    uint8_t hsp_meas[MEAS_HSP_LEN];
+    uint32_t first;  /* first frame */
+    uint32_t frames;
+} golden_dev_t;
+
+typedef struct {
+    uint8_t adc[ZMOD4510_ADC_DATA_LEN];
+    uint32_t rmox[ZMOD4510_RMOX_COUNT]; /* bit patterns */
+} golden_frame_t;
+
+typedef struct {
+    int64_t t_ms;
+    uint32_t lane;
+    sensor_results_t r;
+    uint8_t emit;
+} golden_result_t;
+
+typedef struct {
+    golden_dev_t devs[MAX_DEVS];
+    uint32_t n_devs;
+    golden_frame_t *frames;
+    uint32_t n_frames;
+    uint32_t lanes;
+    golden_result_t *results;
+    uint32_t n_results;
+} corpus_t;
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t float_bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static float bits_float(uint32_t u)
+{
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static void put_hex(FILE *fp, const uint8_t *p, int len)
+{
+    for (int i = 0; i < len; i++) {
+        fprintf(fp, "%02x", p[i]);
+    }
+}
+
+static int get_hex(const char *s, uint8_t *p, int len)
+{
+    for (int i = 0; i < len; i++) {
+        unsigned v;
+        if (sscanf(s + 2 * i, "%2x", &v) != 1) {
+            return -1;
+        }
+        p[i] = (uint8_t)v;
+    }
+    return 0;
+}
+
+/* ---- ADC to resistance paths ---- */
+
+typedef struct {
+    zmod4xxx_dev_t *dev;
+    zmod4510_rmox_lut_t lut;
+} rmox_ctx_t;
+
+typedef struct {
+    const char *name;
+    void (*convert)(rmox_ctx_t *c, uint8_t *adc, float *rmox);
+    int table;  /* 0 none, 1 full, 2 span, 3 window */
+} rmox_path_t;
+
+static void rmox_generic(rmox_ctx_t *c, uint8_t *adc, float *rmox)
+{
+    zmod4xxx_calc_rmox(c->dev, adc, rmox);
+}
+
+static void rmox_4510(rmox_ctx_t *c, uint8_t *adc, float *rmox)
+{
+    zmod4510_calc_rmox(c->dev, adc, rmox);
+}
+
+static void rmox_lut(rmox_ctx_t *c, uint8_t *adc, float *rmox)
+{
+    zmod4510_calc_rmox_lut(&c->lut, adc, rmox);
+}
+
+static const rmox_path_t rmox_paths[] = {
+    { "generic", rmox_generic, 0 },
+    { "4510", rmox_4510, 0 },
+    { "lut_full", rmox_lut, 1 },
+    { "lut_span", rmox_lut, 2 },
+    { "lut_window", rmox_lut, 3 },
+    { "lut_none", rmox_lut, 0 },
+};
+
+static void lut_for(rmox_ctx_t *c, int table)
+{
+    static float storage[ZMOD4510_RMOX_LUT_FULL];
+    uint16_t first;
+    uint32_t span = zmod4510_rmox_lut_span(c->dev, &first);
+
+    switch (table) {
+    case 1:
+        zmod4510_rmox_lut_init(&c->lut, c->dev, storage, 0,
+                               ZMOD4510_RMOX_LUT_FULL);
+        break;
+    case 2:
+        zmod4510_rmox_lut_init(&c->lut, c->dev, storage, first, span);
+        break;
+    case 3:
+        zmod4510_rmox_lut_init(&c->lut, c->dev, storage,
+                               first + (span > 4096 ? (span - 4096) / 2 : 0),
+                               4096);
+        break;
+    default:
+        zmod4510_rmox_lut_init(&c->lut, c->dev, NULL, 0, 0);
+        break;
+    }
+}
+
+static uint32_t replay_rmox(corpus_t *cp, const rmox_path_t *p,
+                            uint32_t repeats)
+{
+    float rmox[ZMOD4510_RMOX_COUNT];
+    volatile float sink = 0;
+    uint32_t bad = 0, first_bad = UINT32_MAX;
+    double t = 0, t0;
+
+    for (uint32_t d = 0; d < cp->n_devs; d++) {
+        golden_dev_t *g = &cp->devs[d];
+        rmox_ctx_t c = { .dev = &g->dev };
+
+        lut_for(&c, p->table);
+        for (uint32_t i = 0; i < g->frames; i++) {
+            golden_frame_t *f = &cp->frames[g->first + i];
+
+            p->convert(&c, f->adc, rmox);
+            for (int k = 0; k < ZMOD4510_RMOX_COUNT; k++) {
+                if (float_bits(rmox[k]) != f->rmox[k]) {
+                    first_bad = bad++ ? first_bad : g->first + i;
+                }
+            }
+        }
+        t0 = seconds();
+        for (uint32_t r = 0; r < repeats; r++) {
+            for (uint32_t i = 0; i < g->frames; i++) {
+                p->convert(&c, cp->frames[g->first + i].adc, rmox);
+                sink += rmox[i & 15];
+            }
+        }
+        t += seconds() - t0;
+    }
+    printf("bench=golden op=calc_rmox path=%s frames=%u values=%u "
+           "mismatches=%u ns_per_frame=%.1f\n",
+           p->name, cp->n_frames, cp->n_frames * ZMOD4510_RMOX_COUNT, bad,
+           t * 1e9 / ((double)cp->n_frames * repeats));
+    if (bad) {
+        fprintf(stderr, "calc_rmox %s: first mismatch in frame %u\n", p->name,
+                first_bad);
+    }
+    (void)sink;
+    return bad;
+}
+
+/* ---- heater set points ---- */
+
+static uint32_t replay_factor(corpus_t *cp, uint32_t repeats)
+{
+    uint8_t hsp[HSP_MAX * 2];
+    volatile uint8_t sink = 0;
+    uint32_t bad = 0;
+    double t0, t;
+
+    for (uint32_t d = 0; d < cp->n_devs; d++) {
+        golden_dev_t *g = &cp->devs[d];
+
+        zmod4xxx_calc_factor(g->dev.init_conf, hsp, g->dev.config);
+        bad += memcmp(hsp, g->hsp_init, INIT_HSP_LEN) != 0;
+        zmod4xxx_calc_factor(g->dev.meas_conf, hsp, g->dev.config);
+        bad += memcmp(hsp, g->hsp_meas, MEAS_HSP_LEN) != 0;
+    }
+    t0 = seconds();
+    for (uint32_t r = 0; r < repeats; r++) {
+        for (uint32_t d = 0; d < cp->n_devs; d++) {
+            zmod4xxx_dev_t *dev = &cp->devs[d].dev;
+            zmod4xxx_calc_factor(dev->meas_conf, hsp, dev->config);
+            sink += hsp[r & 7];
+        }
+    }
+    t = seconds() - t0;
+    printf("bench=golden op=calc_factor path=generic devices=%u "
+           "mismatches=%u ns_per_call=%.1f\n",
+           cp->n_devs, bad, t * 1e9 / ((double)cp->n_devs * repeats));
+    (void)sink;
+    return bad;
+}
+
+/* ---- deadband ---- */
+
+typedef struct {
+    float o3[MAX_LANES], no2[MAX_LANES];
+    int32_t fast[MAX_LANES], epa[MAX_LANES], status[MAX_LANES];
+    uint8_t emit[MAX_LANES];
+} lanes_t;
+
+/* Runs the stream once; decisions go to out, one per result */
+static void deadband_pass(corpus_t *cp, int batched, uint8_t *out)
+{
+    static lanes_t l;
+    deadband_batch_t in = { l.o3, l.no2, l.fast, l.epa, l.status };
+    deadband_t f;
+
+    deadband_init(&f, cp->lanes, NULL);
+    for (uint32_t i = 0; i < cp->n_results;) {
+        int64_t t = cp->results[i].t_ms;
+        uint32_t j = i;
+
+        if (!batched) {
+            golden_result_t *g = &cp->results[i];
+            out[i++] = (uint8_t)(deadband_check(&f, g->lane, &g->r, t) != 0);
+            continue;
+        }
+        memset(l.emit, 0, cp->lanes);
+        for (; j < cp->n_results && cp->results[j].t_ms == t; j++) {
+            golden_result_t *g = &cp->results[j];
+            l.o3[g->lane] = g->r.o3_ppb;
+            l.no2[g->lane] = g->r.no2_ppb;
+            l.fast[g->lane] = g->r.fast_aqi;
+            l.epa[g->lane] = g->r.epa_aqi;
+            l.status[g->lane] = g->r.status;
+            l.emit[g->lane] = 1;
+        }
+        deadband_filter(&f, 0, cp->lanes, &in, t, l.emit);
+        for (; i < j; i++) {
+            out[i] = l.emit[cp->results[i].lane] != 0;
+        }
+    }
+    deadband_free(&f);
+}
+
+static uint32_t replay_deadband(corpus_t *cp, int batched, uint32_t repeats)
+{
+    uint8_t *out = malloc(cp->n_results ? cp->n_results : 1);
+    uint32_t bad = 0, passed = 0;
+    double t0, t;
+
+    if (!out) {
+        return 1;
+    }
+    deadband_pass(cp, batched, out);
+    for (uint32_t i = 0; i < cp->n_results; i++) {
+        bad += out[i] != cp->results[i].emit;
+        passed += out[i];
+    }
+    t0 = seconds();
+    for (uint32_t r = 0; r < repeats; r++) {
+        deadband_pass(cp, batched, out);
+    }
+    t = seconds() - t0;
+    printf("bench=golden op=deadband path=%s results=%u passed=%u "
+           "mismatches=%u ns_per_result=%.1f\n",
+           batched ? "filter" : "check", cp->n_results, passed, bad,
+           t * 1e9 / ((double)(cp->n_results ? cp->n_results : 1) * repeats));
+    free(out);
+    return bad;
+}
+
+/* ---- corpus file ---- */
+
+static void dev_defaults(zmod4xxx_dev_t *dev)
+{
+    dev->i2c_addr = ZMOD4510_I2C_ADDR;
+    dev->pid = ZMOD4510_PID;
+    dev->init_conf = &zmod_no2_o3_sensor_cfg[INIT];
+    dev->meas_conf = &zmod_no2_o3_sensor_cfg[MEASUREMENT];
+}
+
+static int load(const char *path, corpus_t *cp)
+{
+    FILE *fp = fopen(path, "r");
+    char line[LINE_LEN], hex[LINE_LEN];
+    uint32_t cap_f = 0, cap_r = 0, n = 0;
+
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    memset(cp, 0, sizeof(*cp));
+    while (fgets(line, sizeof(line), fp)) {
+        n++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if (!strncmp(line, "dev ", 4)) {
+            golden_dev_t *g = &cp->devs[cp->n_devs];
+            char init[16], meas[32];
+            unsigned lr, er;
+
+            if (cp->n_devs == MAX_DEVS ||
+                sscanf(line, "dev %12s %u %u %4s %16s", hex, &lr, &er, init,
+                       meas) != 5 ||
+                get_hex(hex, g->dev.config, 6) ||
+                get_hex(init, g->hsp_init, INIT_HSP_LEN) ||
+                get_hex(meas, g->hsp_meas, MEAS_HSP_LEN)) {
+                goto bad;
+            }
+            dev_defaults(&g->dev);
+            g->dev.mox_lr = (uint16_t)lr;
+            g->dev.mox_er = (uint16_t)er;
+            g->first = cp->n_frames;
+            cp->n_devs++;
+        } else if (!strncmp(line, "frame ", 6)) {
+            golden_frame_t *f;
+            const char *p = line + 6;
+
+            if (!cp->n_devs) {
+                goto bad;
+            }
+            if (cp->n_frames == cap_f) {
+                cap_f = cap_f ? 2 * cap_f : 256;
+                f = realloc(cp->frames, cap_f * sizeof(*f));
+                if (!f) {
+                    goto bad;
+                }
+                cp->frames = f;
+            }
+            f = &cp->frames[cp->n_frames];
+            if (get_hex(p, f->adc, ZMOD4510_ADC_DATA_LEN)) {
+                goto bad;
+            }
+            p += 2 * ZMOD4510_ADC_DATA_LEN;
+            for (int k = 0; k < ZMOD4510_RMOX_COUNT; k++) {
+                unsigned v;
+                if (sscanf(p, " %8x", &v) != 1) {
+                    goto bad;
+                }
+                f->rmox[k] = v;
+                p += 9;
+            }
+            cp->devs[cp->n_devs - 1].frames++;
+            cp->n_frames++;
+        } else if (!strncmp(line, "deadband ", 9)) {
+            if (sscanf(line, "deadband %u", &cp->lanes) != 1 ||
+                cp->lanes == 0 || cp->lanes > MAX_LANES) {
+                goto bad;
+            }
+        } else if (!strncmp(line, "result ", 7)) {
+            golden_result_t *g;
+            long long t;
+            unsigned lane, o3, no2, emit;
+            int fast, epa, status;
+
+            if (cp->n_results == cap_r) {
+                cap_r = cap_r ? 2 * cap_r : 1024;
+                g = realloc(cp->results, cap_r * sizeof(*g));
+                if (!g) {
+                    goto bad;
+                }
+                cp->results = g;
+            }
+            g = &cp->results[cp->n_results];
+            if (sscanf(line, "result %lld %u %x %x %d %d %d %u", &t, &lane,
+                       &o3, &no2, &fast, &epa, &status, &emit) != 8 ||
+                lane >= cp->lanes) {
+                goto bad;
+            }
+            memset(g, 0, sizeof(*g));
+            g->t_ms = t;
+            g->lane = lane;
+            g->r.o3_ppb = bits_float(o3);
+            g->r.no2_ppb = bits_float(no2);
+            g->r.fast_aqi = fast;
+            g->r.epa_aqi = epa;
+            g->r.status = status;
+            g->emit = (uint8_t)emit;
+            cp->n_results++;
+        } else {
+            goto bad;
+        }
+    }
+    fclose(fp);
+    return 0;
+
+bad:
+    fprintf(stderr, "%s:%u: malformed or too many entries\n", path, n);
+    fclose(fp);
+    return -1;
+}
+
+static void put_dev(FILE *fp, zmod4xxx_dev_t *dev)
+{
+    uint8_t hsp[HSP_MAX * 2];
+
+    fprintf(fp, "dev ");
+    put_hex(fp, dev->config, 6);
+    fprintf(fp, " %u %u ", dev->mox_lr, dev->mox_er);
+    zmod4xxx_calc_factor(dev->init_conf, hsp, dev->config);
+    put_hex(fp, hsp, INIT_HSP_LEN);
+    fprintf(fp, " ");
+    zmod4xxx_calc_factor(dev->meas_conf, hsp, dev->config);
+    put_hex(fp, hsp, MEAS_HSP_LEN);
+    fprintf(fp, "\n");
+}
+
+static void put_frame(FILE *fp, zmod4xxx_dev_t *dev, uint8_t *adc)
+{
+    float rmox[ZMOD4510_RMOX_COUNT];
+
+    zmod4xxx_calc_rmox(dev, adc, rmox);
+    fprintf(fp, "frame ");
+    put_hex(fp, adc, ZMOD4510_ADC_DATA_LEN);
+    for (int k = 0; k < ZMOD4510_RMOX_COUNT; k++) {
+        fprintf(fp, " %08x", float_bits(rmox[k]));
+    }
+    fprintf(fp, "\n");
+}
+
+static uint32_t lcg(uint32_t *state)
+{
+    *state = *state * 1664525U + 1013904223U;
+    return *state >> 8;
+}
+
+static void set_word(uint8_t *adc, int i, int32_t w)
+{
+    w = w < 0 ? 0 : w > 0xFFFF ? 0xFFFF : w;
+    adc[2 * i] = (uint8_t)(w >> 8);
+    adc[2 * i + 1] = (uint8_t)w;
+}
+
+/* Two frames with the words at and around both limits of a device */
+static void put_edges(FILE *fp, zmod4xxx_dev_t *dev)
+{
+    static const int32_t around[] = { -2, -1, 0, 1, 2 };
+    int32_t lr = dev->mox_lr, er = dev->mox_er, mid = (lr + er) / 2;
+    int32_t words[2 * ZMOD4510_RMOX_COUNT] = { 0, 1, 0xFFFE, 0xFFFF, mid - 1,
+                                               mid, mid + 1, 0x8000 };
+    uint8_t adc[ZMOD4510_ADC_DATA_LEN];
+    int n = 8;
+
+    for (size_t i = 0; i < sizeof(around) / sizeof(around[0]); i++) {
+        words[n++] = lr + around[i];
+        words[n++] = er + around[i];
+    }
+    while (n < 2 * ZMOD4510_RMOX_COUNT) {
+        words[n] = er - 1 - n;
+        n++;
+    }
+    for (int f = 0; f < 2; f++) {
+        for (int i = 0; i < ZMOD4510_RMOX_COUNT; i++) {
+            set_word(adc, i, words[f * ZMOD4510_RMOX_COUNT + i]);
+        }
+        put_frame(fp, dev, adc);
+    }
+}
+
+/* The simulated sensor after bring-up and its measurement cycles */
+static int record_sim(FILE *fp)
+{
+    static uint8_t prod_data[ZMOD4510_PROD_DATA_LEN];
+    uint8_t adc[ZMOD4510_ADC_DATA_LEN];
+    SimConfig_t cfg = SIM_DefaultConfig;
+    zmod4xxx_dev_t dev = { 0 };
+    Interface_t hal;
+    SimDevice_t sim;
+    int ret;
+
+    cfg.drift = 0.05F;
+    cfg.noise = 0.02F;
+    cfg.eventRate = 100;
+    cfg.eventDepth = 0.3F;
+    SIM_Init(&hal, &sim, &cfg);
+    dev_defaults(&dev);
+    dev.prod_data = prod_data;
+    ret = zmod4xxx_init(&dev, &hal);
+    if (!ret) {
+        ret = zmod4xxx_read_sensor_info(&dev);
+    }
+    if (!ret) {
+        ret = zmod4xxx_prepare_sensor(&dev);
+    }
+    if (ret) {
+        fprintf(stderr, "simulated bring-up failed: %d\n", ret);
+        return -1;
+    }
+    fprintf(fp, "# simulated sensor, %d measurement cycles\n", REC_FRAMES);
+    put_dev(fp, &dev);
+    put_edges(fp, &dev);
+    for (int i = 0; i < REC_FRAMES; i++) {
+        ret = zmod4xxx_start_measurement(&dev);
+        dev.delay_ms(cfg.seqTime);
+        ret |= zmod4xxx_wait_measurement(&dev, ZMOD4510_WAIT_POLL_TIME,
+                                         ZMOD4510_WAIT_TIMEOUT, NULL);
+        ret |= zmod4510_read_adc_result(&dev, adc);
+        if (ret) {
+            fprintf(stderr, "simulated cycle failed: %d\n", ret);
+            return -1;
+        }
+        put_frame(fp, &dev, adc);
+    }
+    return 0;
+}
+
+/* Synthetic devices: typical, widest, narrowest and degenerate limits */
+static void record_synthetic(FILE *fp, uint32_t *seed)
+{
+    static const struct {
+        const char *what;
+        int config0;  /* -1 for random */
+        uint16_t lr, er;
+    } cases[] = {
+        { "typical limits", -1, 1200, 61000 },
+        { "widest limits", -1, 0, 0xFFFF },
+        { "adjacent limits", -1, 30000, 30001 },
+        { "crossed limits", -1, 40000, 20000 },
+        { "both limits at the top", -1, 0xFFFF, 0xFFFF },
+        { "largest scale", 255, 500, 65000 },
+        { "zero scale", 0, 500, 65000 },
+    };
+    uint8_t adc[ZMOD4510_ADC_DATA_LEN];
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        zmod4xxx_dev_t dev = { 0 };
+        int32_t lr = cases[c].lr, er = cases[c].er;
+        uint32_t span = er > lr ? (uint32_t)(er - lr) : 1;
+
+        dev_defaults(&dev);
+        for (int i = 0; i < 6; i++) {
+            dev.config[i] = (uint8_t)lcg(seed);
+        }
+        if (cases[c].config0 >= 0) {
+            dev.config[0] = (uint8_t)cases[c].config0;
+        }
+        dev.mox_lr = cases[c].lr;
+        dev.mox_er = cases[c].er;
+        fprintf(fp, "# %s\n", cases[c].what);
+        put_dev(fp, &dev);
+        put_edges(fp, &dev);
+        for (int f = 0; f < REC_FRAMES; f++) {
+            for (int i = 0; i < ZMOD4510_RMOX_COUNT; i++) {
+                /* mostly inside the limits, some anywhere */
+                int32_t w = lcg(seed) % 8
+                                ? lr + (int32_t)(lcg(seed) % span)
+                                : (int32_t)(lcg(seed) & 0xFFFF);
+                set_word(adc, i, w);
+            }
+            put_frame(fp, &dev, adc);
+        }
+    }
+}
+
+/* uniform in [-1, 1) */
+static float noise(uint32_t *state)
+{
+    return (float)lcg(state) / (float)(1U << 23) - 1.0F;
+}
+
+/* Drifting, noisy results with events, failed and skipped cycles */
+static void record_results(FILE *fp, uint32_t *seed)
+{
+    float level[REC_LANES];
+    deadband_t f;
+
+    deadband_init(&f, REC_LANES, NULL);
+    fprintf(fp, "# results of %d sensors over %d cycles, default limits\n"
+                "deadband %d\n",
+            REC_LANES, REC_CYCLES, REC_LANES);
+    for (int i = 0; i < REC_LANES; i++) {
+        level[i] = 10.0F + 10.0F * i;
+    }
+    for (int c = 0; c < REC_CYCLES; c++) {
+        int64_t t = (int64_t)c * REC_CYCLE_MS;
+
+        for (uint32_t i = 0; i < REC_LANES; i++) {
+            sensor_results_t r = { 0 };
+            uint32_t roll = lcg(seed) % 100;
+
+            level[i] += 0.05F * level[i] * noise(seed);
+            if (roll == 0) {
+                level[i] += 25.0F;
+            }
+            level[i] -= (level[i] - 10.0F - 10.0F * i) * 0.02F;
+            if (roll == 1) {
+                continue;  /* no result this cycle */
+            }
+            if (roll == 2) {
+                r.o3_ppb = NAN;
+                r.no2_ppb = NAN;
+                r.status = ERROR_I2C;
+            } else {
+                r.o3_ppb = level[i] + 0.4F * noise(seed);
+                r.no2_ppb = 0.5F * level[i] + 0.4F * noise(seed);
+                r.fast_aqi = (int32_t)(r.o3_ppb * 1.5F);
+                r.epa_aqi = (int32_t)(level[i] * 1.5F);
+                r.status = roll == 3 ? NO2_O3_STABILIZATION : 0;
+            }
+            fprintf(fp, "result %lld %u %08x %08x %d %d %d %d\n", (long long)t,
+                    i, float_bits(r.o3_ppb), float_bits(r.no2_ppb),
+                    (int)r.fast_aqi, (int)r.epa_aqi, (int)r.status,
+                    deadband_check(&f, i, &r, t) != 0);
+        }
+    }
+    deadband_free(&f);
+}
+
+static int record(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    uint32_t seed = 47;
+    int ret;
+
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    fprintf(fp,
+            "# Golden corpus of the ZMOD4510 NO2/O3 conversions, written by\n"
+            "# bench_golden -r from the reference code. Replay with\n"
+            "# bench_golden; every path has to reproduce it bit for bit.\n"
+            "#\n"
+            "# dev <config> <mox_lr> <mox_er> <init hsp> <measurement hsp>\n"
+            "# frame <adc words> <rmox as IEEE 754 bits, one per word>\n"
+            "# deadband <sensors>\n"
+            "# result <ms> <sensor> <o3 bits> <no2 bits> <fast aqi> <epa aqi>"
+            " <status> <passed>\n");
+    ret = record_sim(fp);
+    if (!ret) {
+        record_synthetic(fp, &seed);
+        record_results(fp, &seed);
+    }
+    if (fclose(fp)) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t repeats;
+    uint32_t bad = 0;
+    corpus_t cp;
+
+    if (argc == 3 && !strcmp(argv[1], "-r")) {
+        return record(argv[2]) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    if (argc < 2 || argv[1][0] == '-') {
+        fprintf(stderr, "usage: %s corpus [repeats]\n"
+                        "       %s -r corpus\n",
+                argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+    repeats = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) : 2000;
+    if (!repeats || load(argv[1], &cp)) {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t p = 0; p < sizeof(rmox_paths) / sizeof(rmox_paths[0]); p++) {
+        bad += replay_rmox(&cp, &rmox_paths[p], repeats);
+    }
+    bad += replay_factor(&cp, repeats * 100);
+    if (cp.n_results) {
+        bad += replay_deadband(&cp, 0, repeats / 10 + 1);
+        bad += replay_deadband(&cp, 1, repeats / 10 + 1);
+    }
+    free(cp.frames);
+    free(cp.results);
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
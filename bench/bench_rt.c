@@ -0,0 +1,296 @@
+/**
+ * @file    bench_rt.c
+ * @brief   Wake-to-read latency of the acquisition loop under load, before
+ *          and after entering real-time mode
+ *
+ * A simulated sensor, brought up in virtual time, is then measured in real
+ * time with the sequence shortened to seq_ms, the way zmodd does it: start,
+ * sleep until just before the sequence ends, wait for it, then read, check
+ * and evaluate the results. Meanwhile load_threads threads spin at normal
+ * priority.
+ *
+ * mode=before sleeps as sensor_step did before the HAL could sleep until a
+ * deadline: the remaining whole ms by the ms clock, with the normal
+ * policy. mode=after first calls zrt_enter() and then sleeps with
+ * msSleepUntil. Reported per mode, over the cycles after the warm-up:
+ *   - wake_us p50/p99/max: how late the thread ran after the deadline
+ *   - read_us p50/p99/max: from the deadline to the evaluated result;
+ *     jitter_us is its max - min
+ *   - overruns: cycles whose result came later than the cycle end
+ *   - allocs, faults, logs: heap allocations, page faults and log messages
+ *     of the acquisition thread
+ *   - rt_failed: zrt_step_t bits of the settings that were not permitted
+ * The exit status is nonzero if mode=after allocated, faulted or logged.
+ *
+ * Usage: bench_rt [cycles] [seq_ms] [load_threads] [cpu]
+ */
+
+#define _GNU_SOURCE /* RUSAGE_THREAD */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "fleet.h"
+#include "no2_o3.h"
+#include "zmod4xxx.h"
+#include "zmod4510.h"
+#include "hal/sim/sim.h"
+#include "util/zlog.h"
+#include "util/zrt.h"
+
+#define WARMUP_CYCLES (3)
+/* time left after the sequence for reading and evaluating, as in zmodd */
+#define SLACK_MS      (ZMOD4510_NO2_O3_SAMPLE_TIME - 5600U)
+
+/* Heap allocations of the thread while armed. The bench interposes the
+ * allocator for the whole process, including the library and libc. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static __thread int armed;
+static uint32_t allocs;
+static uint32_t logs;
+
+void *malloc(size_t size)
+{
+    if (armed) {
+        __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    if (armed) {
+        __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    }
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    if (armed) {
+        __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    }
+    return __libc_realloc(p, size);
+}
+
+static Interface_t sim_hal;
+static SimDevice_t sim;
+static fleet_bus_t bus;
+static fleet_sensor_t sensor;
+static uint8_t prod_data[ZMOD4510_PROD_DATA_LEN];
+static no2_o3_handle_t algo;
+static volatile int loading;
+static uint32_t seq_ms, period_ms;
+
+static void count_log(void *ctx, int level, uint64_t timestamp_ms,
+                      const char *msg)
+{
+    (void)ctx;
+    (void)timestamp_ms;
+    __atomic_fetch_add(&logs, 1, __ATOMIC_RELAXED);
+    fprintf(stderr, "[%d] %s\n", level, msg);
+}
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* Offset of the simulator clock to CLOCK_MONOTONIC in whole ms */
+static int64_t sim_offset_ms(void)
+{
+    for (;;) {
+        uint64_t before = mono_ns() / 1000000;
+        int64_t off = (int64_t)(SIM_Clock() - before);
+
+        if (mono_ns() / 1000000 == before) {
+            return off;
+        }
+    }
+}
+
+static void *spin(void *arg)
+{
+    volatile uint64_t x = (uintptr_t)arg;
+
+    while (loading) {
+        x = x * 6364136223846793005ULL + 1;
+    }
+    return NULL;
+}
+
+/* The sleep of sensor_step before msSleepUntil */
+static void sleep_relative(uint64_t deadline_ms)
+{
+    uint64_t now = sensor.hal.msClock();
+
+    if (deadline_ms > now) {
+        sensor.hal.msSleep((uint32_t)(deadline_ms - now));
+    }
+}
+
+static void sleep_absolute(uint64_t deadline_ms)
+{
+    sensor.hal.msSleepUntil(deadline_ms);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void run(const char *mode, uint32_t cycles, int after,
+                const zrt_config_t *rt)
+{
+    void (*sleep_until)(uint64_t) = after ? sleep_absolute : sleep_relative;
+    uint32_t *wake = calloc(cycles, sizeof(*wake));
+    uint32_t *read = calloc(cycles, sizeof(*read));
+    uint32_t n = 0, overruns = 0, allocs0 = 0, logs0 = 0;
+    uint64_t faults0 = 0, next;
+    int64_t off;
+    int rt_failed = 0;
+
+    if (!wake || !read) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (after) {
+        rt_failed = zrt_enter(rt);
+        zlog_flush();
+    }
+    off = sim_offset_ms();
+    next = sensor.hal.msClock() + period_ms;
+    for (uint32_t c = 0; c < WARMUP_CYCLES + cycles; c++) {
+        zmod4xxx_dev_t *dev = &sensor.dev;
+        uint8_t adc[ZMOD4510_ADC_DATA_LEN];
+        no2_o3_inputs_t in = { adc, 50, -300 };
+        no2_o3_results_t r;
+        uint64_t start, deadline, deadline_ns, woke, done;
+        uint32_t waited;
+        int ret;
+
+        if (WARMUP_CYCLES == c) {
+            allocs0 = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+            logs0 = __atomic_load_n(&logs, __ATOMIC_RELAXED);
+            faults0 = zrt_page_faults();
+            armed = 1;
+        }
+        sleep_until(next);
+        start = next;
+        next += period_ms;
+        ret = zmod4xxx_start_measurement(dev);
+        deadline = start + seq_ms - ZMOD4510_WAIT_GUARD_TIME;
+        deadline_ns = (uint64_t)((int64_t)deadline - off) * 1000000;
+        sleep_until(deadline);
+        woke = mono_ns();
+        if (!ret) {
+            ret = zmod4xxx_wait_measurement(dev, ZMOD4510_WAIT_POLL_TIME,
+                                            ZMOD4510_WAIT_TIMEOUT, &waited);
+        }
+        if (!ret) {
+            ret = zmod4510_read_adc_result(dev, adc);
+        }
+        if (!ret) {
+            ret = zmod4xxx_check_error_event(dev);
+        }
+        if (!ret) {
+            calc_no2_o3(&algo, dev, &in, &r);
+        } else {
+            fleet_recover(&sensor, ret);
+        }
+        done = mono_ns();
+        if (c < WARMUP_CYCLES) {
+            continue;
+        }
+        wake[n] = woke > deadline_ns ? (uint32_t)((woke - deadline_ns) / 1000)
+                                     : 0;
+        read[n] = done > deadline_ns ? (uint32_t)((done - deadline_ns) / 1000)
+                                     : 0;
+        overruns += done >= (uint64_t)((int64_t)next - off) * 1000000;
+        n++;
+    }
+    armed = 0;
+    faults0 = zrt_page_faults() - faults0;
+    allocs0 = __atomic_load_n(&allocs, __ATOMIC_RELAXED) - allocs0;
+    zlog_flush();
+    logs0 = __atomic_load_n(&logs, __ATOMIC_RELAXED) - logs0;
+
+    qsort(wake, n, sizeof(*wake), cmp_u32);
+    qsort(read, n, sizeof(*read), cmp_u32);
+    printf("bench=rt mode=%s cycles=%u wake_us_p50=%u wake_us_p99=%u "
+           "wake_us_max=%u read_us_p50=%u read_us_p99=%u read_us_max=%u "
+           "jitter_us=%u overruns=%u allocs=%u faults=%llu logs=%u "
+           "rt_failed=%d\n",
+           mode, n, wake[n / 2], wake[n * 99 / 100], wake[n - 1], read[n / 2],
+           read[n * 99 / 100], read[n - 1], read[n - 1] - read[0], overruns,
+           allocs0, (unsigned long long)faults0, logs0, rt_failed);
+    free(wake);
+    free(read);
+    if (after && (allocs0 || faults0 || logs0)) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t cycles = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 100;
+    uint32_t load = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 0)
+                             : (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+    zrt_config_t rt = zrt_default_config;
+    SimConfig_t cfg = SIM_DefaultConfig;
+    zmod4xxx_dev_t *dev = &sensor.dev;
+    pthread_t *threads;
+
+    seq_ms = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) : 40;
+    period_ms = seq_ms + SLACK_MS / 10;
+    rt.cpu = argc > 4 ? atoi(argv[4]) : -1;
+    if (!cycles || seq_ms <= ZMOD4510_WAIT_GUARD_TIME) {
+        fprintf(stderr, "invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+    zlog_set_sink(count_log, NULL);
+
+    cfg.seqTime = seq_ms;
+    cfg.period = period_ms;
+    SIM_Init(&sim_hal, &sim, &cfg);
+    fleet_bus_init(&bus, &sim_hal, NULL, NULL);
+    fleet_sensor_init(&sensor, &bus, -1);
+    dev->i2c_addr = ZMOD4510_I2C_ADDR;
+    dev->pid = ZMOD4510_PID;
+    dev->init_conf = &zmod_no2_o3_sensor_cfg[INIT];
+    dev->meas_conf = &zmod_no2_o3_sensor_cfg[MEASUREMENT];
+    dev->prod_data = prod_data;
+    if (fleet_bring_up(&sensor, 1, 1, NULL, NULL)) {
+        fprintf(stderr, "bring-up failed: %d\n", sensor.error);
+        return EXIT_FAILURE;
+    }
+    fleet_select(&sensor);
+    init_no2_o3(&algo);
+    SIM_SetRealtime(1);
+
+    threads = calloc(load ? load : 1, sizeof(*threads));
+    if (!threads) {
+        return EXIT_FAILURE;
+    }
+    loading = 1;
+    for (uint32_t i = 0; i < load; i++) {
+        pthread_create(&threads[i], NULL, spin, (void *)(uintptr_t)i);
+    }
+    run("before", cycles, 0, &rt);
+    run("after", cycles, 1, &rt);
+    loading = 0;
+    for (uint32_t i = 0; i < load; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    fleet_bus_destroy(&bus);
+    return EXIT_SUCCESS;
+}
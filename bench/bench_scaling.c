@@ -0,0 +1,180 @@
+/**
+ * @file    bench_scaling.c
+ * @brief   Host cost of serving many sensors, by sensor and thread count
+ *
+ * Each sensor is a separate simulated ZMOD4510. A thread serves its share of
+ * the sensors the way a gateway would: start all of them, sleep once until
+ * the sequences end, then poll, read and convert each sensor's results. Time
+ * is virtual, so the numbers are the host cost per sample and per cycle.
+ *
+ * Usage: bench_scaling [max_sensors] [max_threads] [cycles]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "zmod4xxx.h"
+#include "zmod4510.h"
+#include "hal/sim/sim.h"
+
+typedef struct {
+    zmod4xxx_dev_t dev;
+    Interface_t hal;
+    SimDevice_t sim;
+    uint8_t prod_data[ZMOD4510_PROD_DATA_LEN];
+} sensor_t;
+
+typedef struct {
+    sensor_t *sensors;
+    uint32_t count;
+    uint32_t cycles;
+    uint32_t failed;
+    pthread_t thread;
+} worker_t;
+
+/* The legacy API passes no context to read/write, so each thread selects
+ * the interface of the sensor it is talking to. */
+static __thread Interface_t *current;
+
+static int8_t bench_read(uint8_t addr, uint8_t reg, uint8_t *data, uint8_t len)
+{
+    return current->i2cRead(current->handle, addr, &reg, 1, data, len);
+}
+
+static int8_t bench_write(uint8_t addr, uint8_t reg, uint8_t *data,
+                          uint8_t len)
+{
+    return current->i2cWrite(current->handle, addr, &reg, 1, data, len);
+}
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int setup(sensor_t *s, uint32_t seed)
+{
+    SimConfig_t cfg = SIM_DefaultConfig;
+
+    cfg.seed = seed;
+    SIM_Init(&s->hal, &s->sim, &cfg);
+    s->dev.i2c_addr = ZMOD4510_I2C_ADDR;
+    s->dev.pid = ZMOD4510_PID;
+    s->dev.init_conf = &zmod_no2_o3_sensor_cfg[INIT];
+    s->dev.meas_conf = &zmod_no2_o3_sensor_cfg[MEASUREMENT];
+    s->dev.prod_data = s->prod_data;
+    s->dev.read = bench_read;
+    s->dev.write = bench_write;
+    s->dev.delay_ms = s->hal.msSleep;
+
+    current = &s->hal;
+    if (zmod4xxx_read_sensor_info(&s->dev)) {
+        return -1;
+    }
+    return zmod4xxx_prepare_sensor(&s->dev);
+}
+
+static void *serve(void *arg)
+{
+    worker_t *w = arg;
+    uint8_t adc[ZMOD4510_ADC_DATA_LEN];
+    float rmox[ZMOD4510_RMOX_COUNT];
+
+    for (uint32_t c = 0; c < w->cycles; c++) {
+        for (uint32_t i = 0; i < w->count; i++) {
+            current = &w->sensors[i].hal;
+            w->failed += 0 != zmod4xxx_start_measurement(&w->sensors[i].dev);
+        }
+        w->sensors[0].dev.delay_ms(SIM_DefaultConfig.seqTime);
+        for (uint32_t i = 0; i < w->count; i++) {
+            zmod4xxx_dev_t *dev = &w->sensors[i].dev;
+
+            current = &w->sensors[i].hal;
+            if (zmod4xxx_wait_measurement(dev, ZMOD4510_WAIT_POLL_TIME,
+                                          ZMOD4510_WAIT_TIMEOUT, NULL) ||
+                zmod4510_read_adc_result(dev, adc) ||
+                zmod4xxx_check_error_event(dev)) {
+                w->failed++;
+                continue;
+            }
+            zmod4510_calc_rmox(dev, adc, rmox);
+        }
+    }
+    return NULL;
+}
+
+static int run(uint32_t sensors, uint32_t threads, uint32_t cycles)
+{
+    sensor_t *s = calloc(sensors, sizeof(*s));
+    worker_t *w = calloc(threads, sizeof(*w));
+    uint32_t failed = 0, first = 0;
+    uint64_t reads = 0, writes = 0; /* counted from the end of setup */
+    double t0, t;
+
+    if (!s || !w) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < sensors; i++) {
+        if (setup(&s[i], i + 1)) {
+            fprintf(stderr, "setup of sensor %u failed\n", i);
+            return -1;
+        }
+        reads -= s[i].sim.nRead;
+        writes -= s[i].sim.nWrite;
+    }
+    for (uint32_t k = 0; k < threads; k++) {
+        uint32_t count = sensors / threads + (k < sensors % threads);
+
+        w[k].sensors = &s[first];
+        w[k].count = count;
+        w[k].cycles = cycles;
+        first += count;
+    }
+
+    t0 = seconds();
+    for (uint32_t k = 0; k < threads; k++) {
+        pthread_create(&w[k].thread, NULL, serve, &w[k]);
+    }
+    for (uint32_t k = 0; k < threads; k++) {
+        pthread_join(w[k].thread, NULL);
+        failed += w[k].failed;
+    }
+    t = seconds() - t0;
+
+    for (uint32_t i = 0; i < sensors; i++) {
+        reads += s[i].sim.nRead;
+        writes += s[i].sim.nWrite;
+    }
+    printf("bench=scaling sensors=%u threads=%u cycles=%u failed=%u "
+           "us_per_cycle=%.2f us_per_sample=%.3f samples_per_s=%.0f "
+           "i2c_per_sample=%.2f\n",
+           sensors, threads, cycles, failed, t * 1e6 / cycles,
+           t * 1e6 / ((double)cycles * sensors),
+           (double)cycles * sensors / t,
+           (double)(reads + writes) / ((double)cycles * sensors));
+    free(w);
+    free(s);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t max_sensors = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 256;
+    uint32_t max_threads = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) : 8;
+    uint32_t cycles = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 0) : 200;
+
+    for (uint32_t n = 1; n <= max_sensors; n *= 2) {
+        if (run(n, 1, cycles)) {
+            return EXIT_FAILURE;
+        }
+    }
+    for (uint32_t k = 2; k <= max_threads && k <= max_sensors; k *= 2) {
+        if (run(max_sensors, k, cycles)) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
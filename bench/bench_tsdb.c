@@ -0,0 +1,87 @@
+/**
+ * @file    bench_tsdb.c
+ * @brief   Storage density and encode/decode throughput of the tsdb store
+ *
+ * Generates a synthetic series shaped like real ZMOD4510 output (6 s cadence
+ * with scheduling jitter, slowly drifting concentrations and resistances),
+ * appends it to a store and reads it back.
+ *
+ * Usage: bench_tsdb [samples] [path]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "tsdb.h"
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void synth(uint32_t i, sensor_results_t *r)
+{
+    double t = i / 600.0;
+
+    r->timestamp_ms = 1700000000000LL + i * 6000LL + (rand() % 5);
+    r->o3_ppb = (float)(30.0 + 20.0 * sin(t) + (rand() % 100) * 0.01);
+    r->no2_ppb = (float)(10.0 + 5.0 * cos(t / 3.0));
+    for (int k = 0; k < 4; k++) {
+        r->rmox[k] = (float)(1e5 * (k + 1) * (1.0 + 0.1 * sin(t + k)));
+    }
+    r->fast_aqi = (int32_t)(r->o3_ppb / 2);
+    r->epa_aqi = (int32_t)(r->o3_ppb / 3);
+    r->status = 0;
+}
+
+static int count_sample(void *ctx, const sensor_results_t *sample)
+{
+    (*(uint64_t *)ctx)++;
+    return sample->status;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t n = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 200000;
+    const char *path = argc > 2 ? argv[2] : "bench_tsdb.zts";
+    sensor_results_t r;
+    tsdb_t db;
+    uint64_t decoded = 0;
+    double t0, t_enc, t_dec;
+    off_t bytes;
+
+    unlink(path);
+    if (tsdb_open(&db, path)) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return EXIT_FAILURE;
+    }
+    srand(1);
+    t0 = seconds();
+    for (uint32_t i = 0; i < n; i++) {
+        synth(i, &r);
+        if (tsdb_append(&db, &r)) {
+            fprintf(stderr, "append failed at sample %u\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    tsdb_flush(&db);
+    t_enc = seconds() - t0;
+    bytes = lseek(db.fd, 0, SEEK_END);
+
+    t0 = seconds();
+    tsdb_query(&db, INT64_MIN, INT64_MAX, count_sample, &decoded);
+    t_dec = seconds() - t0;
+    tsdb_close(&db);
+    unlink(path);
+
+    printf("bench=tsdb samples=%u bytes=%lld bytes_per_sample=%.3f "
+           "raw_bytes_per_sample=%zu encode_samples_per_s=%.0f "
+           "decode_samples_per_s=%.0f decoded=%llu\n",
+           n, (long long)bytes, (double)bytes / n, sizeof(sensor_results_t),
+           n / t_enc, decoded / t_dec, (unsigned long long)decoded);
+    return decoded == n ? EXIT_SUCCESS : EXIT_FAILURE;
+}
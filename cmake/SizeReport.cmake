@@ -0,0 +1,27 @@
+# Size report of the minimal core library, run by the size_report target:
+#   cmake -DLIB=<archive> -DSIZE=<size> -DNM=<nm> -P SizeReport.cmake
+# Prints text/data/bss per object and in total, and fails if the archive
+# needs stdio, the heap or error strings from the C library.
+
+execute_process(COMMAND ${SIZE} -t ${LIB} RESULT_VARIABLE rc)
+if(rc)
+  message(FATAL_ERROR "${SIZE} failed on ${LIB}")
+endif()
+
+execute_process(COMMAND ${NM} -u ${LIB} OUTPUT_VARIABLE undefined
+                RESULT_VARIABLE rc)
+if(rc)
+  message(FATAL_ERROR "${NM} failed on ${LIB}")
+endif()
+
+set(forbidden "")
+foreach(sym printf fprintf sprintf snprintf vsnprintf vfprintf puts fputs
+            fopen fwrite perror strerror malloc calloc realloc free)
+  if(undefined MATCHES "[ \t_](__)?${sym}(_chk)?(@[^\n]*)?\n")
+    list(APPEND forbidden ${sym})
+  endif()
+endforeach()
+if(forbidden)
+  message(FATAL_ERROR "Minimal core references: ${forbidden}")
+endif()
+message(STATUS "Minimal core: no stdio, heap or error strings referenced")
@@ -6,12 +6,14 @@ from enum import IntEnum
 from pathlib import Path
 import logging
 import os
+import sys
 
 
 class ZMODStatus(IntEnum):
     OK = 0
     STABILIZATION = 1
     DAMAGE = -102
+    TIMEOUT = -2
 
 # Define the Result Structure matching the C code
 class SensorResults(ctypes.Structure):
@@ -21,8 +23,26 @@ class SensorResults(ctypes.Structure):
         ("fast_aqi", ctypes.c_int32),
         ("epa_aqi", ctypes.c_int32),
         ("status", ctypes.c_int32),
+        ("rmox", ctypes.c_float * 4),
+        ("timestamp_ms", ctypes.c_int64),
+        ("o3_1min_ppb", ctypes.c_float),
+        ("o3_1h_ppb", ctypes.c_float),
+        ("o3_8h_ppb", ctypes.c_float),
+        ("no2_1min_ppb", ctypes.c_float),
+        ("no2_1h_ppb", ctypes.c_float),
+        ("temperature_degc", ctypes.c_float),
+        ("humidity_pct", ctypes.c_float),
     ]
 
+# Output formats of sensor_set_export (export_format_t in src/pipeline/export.h)
+EXPORT_FORMATS = {"csv": 0, "jsonl": 1, "line": 2, "arrow": 3}
+
+# Signature of the library's log sink, see src/util/zlog.h
+LogSink = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_int, ctypes.c_uint64, ctypes.c_char_p)
+
+# Library severities (zlog_level_t) mapped to Python logging levels
+_LOG_LEVELS = [logging.DEBUG, logging.INFO, logging.WARNING, logging.ERROR]
+
 class ZMOD4510:
     def __init__(self, logger=None, log_level=logging.INFO):
         self.logger = logger or logging.getLogger(__name__)
@@ -37,19 +57,57 @@ class ZMOD4510:
         
         # Define function signatures
         self._lib.sensor_init.restype = ctypes.c_int
+        self._lib.sensor_init_sim.restype = ctypes.c_int
+        self._lib.sensor_set_free_running.argtypes = [ctypes.c_int]
+        self._lib.sensor_set_free_running.restype = None
 
         self._lib.sensor_step.argtypes = [ctypes.c_float, ctypes.c_float, ctypes.POINTER(SensorResults)]
         self._lib.sensor_step.restype = ctypes.c_int
 
+        self._lib.sensor_th_present.restype = ctypes.c_int
+
         self._lib.sensor_close.restype = None
 
-    def start(self):
-        res = self._lib.sensor_init()
+        self._lib.sensor_set_export.argtypes = [ctypes.c_char_p, ctypes.c_int]
+        self._lib.sensor_set_export.restype = ctypes.c_int
+
+        self._lib.sensor_set_mqtt.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p,
+                                              ctypes.c_int, ctypes.c_char_p]
+        self._lib.sensor_set_mqtt.restype = ctypes.c_int
+
+        self._lib.sensor_set_realtime.argtypes = [ctypes.c_int, ctypes.c_int]
+        self._lib.sensor_set_realtime.restype = ctypes.c_int
+
+        self._lib.ztrace_export_json.argtypes = [ctypes.c_char_p]
+        self._lib.ztrace_export_json.restype = ctypes.c_int
+
+        # Route library messages to our logger instead of stderr
+        self._lib.zlog_set_sink.argtypes = [LogSink, ctypes.c_void_p]
+        self._lib.zlog_set_sink.restype = None
+        self._lib.zlog_set_level.argtypes = [ctypes.c_int]
+        self._lib.zlog_set_level.restype = None
+        self._log_sink = LogSink(self._on_log)
+        self._lib.zlog_set_sink(self._log_sink, None)
+        effective = self.logger.getEffectiveLevel()
+        self._lib.zlog_set_level(next((i for i, lvl in enumerate(_LOG_LEVELS) if lvl >= effective),
+                                      len(_LOG_LEVELS)))
+
+    def _on_log(self, ctx, level, timestamp_ms, msg):
+        self.logger.log(_LOG_LEVELS[level], msg.decode(errors="replace"))
+
+    def start(self, simulated=False, free_running=False):
+        res = self._lib.sensor_init_sim() if simulated else self._lib.sensor_init()
         if res != 0:
             self.logger.error(f"Sensor Init Failed with code {res}")
             return False
+        self._lib.sensor_set_free_running(int(free_running))
         return True
 
+    def has_th_sensor(self):
+        """True if an SHT4x was found; its readings then replace the
+        temperature and humidity passed to get_data()."""
+        return self._lib.sensor_th_present() != 0
+
     def get_data(self, temperature_celsius_deg = -300, relative_humidity_percent = 50):
         results = SensorResults()
         self._lib.sensor_step(temperature_celsius_deg, relative_humidity_percent, ctypes.byref(results))
@@ -58,14 +116,76 @@ class ZMOD4510:
     def stop(self):
         self._lib.sensor_close()
 
+    def export(self, path, fmt="csv"):
+        """Append every following result to a file ("csv", "jsonl", "line"
+        protocol or columnar "arrow", see read_arrow()), written in batches
+        and synced every 10 minutes; None stops exporting. Returns True on
+        success."""
+        if path is None:
+            return self._lib.sensor_set_export(None, 0) == 0
+        return self._lib.sensor_set_export(os.fsencode(path), EXPORT_FORMATS[fmt]) == 0
+
+    def publish_mqtt(self, host, port=1883, topic="zmod4510/results", interval_s=60, spool=None):
+        """Publish the following results to an MQTT broker, one JSON Lines
+        message per interval, from a background thread; while the broker is
+        down messages go to the spool file if one is given. None stops
+        publishing. Returns True on success."""
+        if host is None:
+            return self._lib.sensor_set_mqtt(None, 0, None, 0, None) == 0
+        return self._lib.sensor_set_mqtt(host.encode(), port, topic.encode(), interval_s,
+                                         os.fsencode(spool) if spool else None) == 0
+
+    def set_realtime(self, priority=50, cpu=None):
+        """Run the calling thread, which is to call get_data(), at a
+        SCHED_FIFO priority (0 keeps the normal policy), pinned to cpu if
+        given, with the process memory locked. Needs CAP_SYS_NICE and
+        CAP_IPC_LOCK or matching limits. Only the library side of a cycle is
+        free of allocations and page faults; the interpreter is not.
+        Returns True if every setting was applied."""
+        return self._lib.sensor_set_realtime(priority, -1 if cpu is None else cpu) == 0
+
+    def export_trace(self, path):
+        """Write the recorded trace events as Chrome trace JSON (library
+        built with -DZMOD4510_TRACE=ON)."""
+        return self._lib.ztrace_export_json(os.fsencode(path)) == 0
+
+
+def read_arrow(path):
+    """Load an Arrow export as a pyarrow Table; table.to_pandas() gives a
+    DataFrame. The file is memory-mapped and the columns are used in place.
+    The sensor name is in table.schema.metadata[b"sensor"]. A file whose
+    writer did not close it has no footer yet; its complete batches are
+    read as a stream instead."""
+    import pyarrow as pa
+
+    source = pa.memory_map(os.fspath(path))
+    try:
+        return pa.ipc.open_file(source).read_all()
+    except pa.ArrowInvalid:
+        source.seek(8)
+        reader = pa.ipc.open_stream(source)
+        batches = []
+        try:
+            for batch in reader:
+                batches.append(batch)
+        except (pa.ArrowInvalid, OSError):
+            pass  # a batch cut short at the end
+        return pa.Table.from_batches(batches, reader.schema)
+
 
 if __name__ == "__main__":
+    # Usage: zmod4510.py [export-file [csv|jsonl|line|arrow]]
     sensor = ZMOD4510()
+    export_path = sys.argv[1] if len(sys.argv) > 1 else None
     
     try:
         if not sensor.start():
             raise RuntimeError("Failed to start sensor.")
+        if export_path and not sensor.export(export_path, sys.argv[2] if len(sys.argv) > 2 else "csv"):
+            raise RuntimeError(f"Cannot export to {export_path}.")
         sensor.logger.info("Sensor started. Press Ctrl+C to stop.")
+        # Readings go to the export file if one is given, not to the log
+        reading_level = logging.DEBUG if export_path else logging.INFO
         
         while True:
             # Example: You could get real T/RH from another Python library here
@@ -76,11 +196,13 @@ if __name__ == "__main__":
                     sensor.logger.info("Warming up...")
 
                 case ZMODStatus.OK:
-                    sensor.logger.info(f"O3: {data.o3_ppb:.2f} ppb | NO2: {data.no2_ppb:.2f} ppb | "
+                    sensor.logger.log(reading_level, f"O3: {data.o3_ppb:.2f} ppb | NO2: {data.no2_ppb:.2f} ppb | "
                         f"Fast AQI: {data.fast_aqi} | EPA AQI: {data.epa_aqi}")
 
                 case ZMODStatus.DAMAGE:
                     sensor.logger.error("Damaged.")
+                case ZMODStatus.TIMEOUT:
+                    sensor.logger.warning("Measurement timed out, sample skipped.")
                 case _:
                     sensor.logger.error(f"Unknown status: {data.status}")
 
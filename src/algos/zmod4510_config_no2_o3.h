@@ -22,6 +22,7 @@
 
 #define INIT        0
 #define MEASUREMENT 1
+#define MEASUREMENT_FREE_RUNNING 2
 
 /**********************************/
 /* < Define product ID > */
@@ -42,52 +43,30 @@
 // time between samples
 #define ZMOD4510_NO2_O3_SAMPLE_TIME (6000U)
 
+// wake up this long before the expected end of the sequence and poll the
+// status every ZMOD4510_WAIT_POLL_TIME until it has completed, for at most
+// ZMOD4510_WAIT_TIMEOUT
+#define ZMOD4510_WAIT_GUARD_TIME (10U)
+#define ZMOD4510_WAIT_POLL_TIME  (2U)
+#define ZMOD4510_WAIT_TIMEOUT    ZMOD4510_NO2_O3_SAMPLE_TIME
+
 #define ZMOD4XXX_H_ADDR 0x40
 #define ZMOD4XXX_D_ADDR 0x50
 #define ZMOD4XXX_M_ADDR 0x60
 #define ZMOD4XXX_S_ADDR 0x68
 
-uint8_t data_set_4510_init[] = {
-                                0x00, 0x50,
-                                0x00, 0x28, 0xC3, 0xE3,
-                                0x00, 0x00, 0x80, 0x40};
-
-uint8_t data_set_4510_no2_o3[] = {
-                                0x00, 0x50, 0xFF, 0x06,
-                                0xFE, 0xA2, 0xFE, 0x3E,
-                                0x00, 0x10, 0x00, 0x52,
-                                0x3F, 0x66, 0x00, 0x42,
-                                0x23, 0x03,
-                                0x00, 0x00, 0x02, 0x41,
-                                0x00, 0x41, 0x00, 0x41,
-                                0x00, 0x49, 0x00, 0x50,
-                                0x02, 0x42, 0x00, 0x42,
-                                0x00, 0x42, 0x00, 0x4A,
-                                0x00, 0x50, 0x02, 0x43,
-                                0x00, 0x43, 0x00, 0x43,
-                                0x00, 0x43, 0x80, 0x5B,
-                                };
-
-zmod4xxx_conf zmod_no2_o3_sensor_cfg[] = {
-    [INIT] = {
-        .start = 0x80,
-        .h = { .addr = ZMOD4XXX_H_ADDR, .len = 2, .data_buf = &data_set_4510_init[0]},
-        .d = { .addr = ZMOD4XXX_D_ADDR, .len = 2, .data_buf = &data_set_4510_init[2]},
-        .m = { .addr = ZMOD4XXX_M_ADDR, .len = 2, .data_buf = &data_set_4510_init[4]},
-        .s = { .addr = ZMOD4XXX_S_ADDR, .len = 4, .data_buf = &data_set_4510_init[6]},
-        .r = { .addr = 0x97, .len = 4},
-    },
-
-    [MEASUREMENT] = {
-        .start = 0x80,
-        .h = {.addr = ZMOD4XXX_H_ADDR, .len = 8, .data_buf = &data_set_4510_no2_o3[0]},
-        .d = {.addr = ZMOD4XXX_D_ADDR, .len = 8, .data_buf = &data_set_4510_no2_o3[8]},
-        .m = {.addr = ZMOD4XXX_M_ADDR, .len = 2, .data_buf = &data_set_4510_no2_o3[16]},
-        .s = {.addr = ZMOD4XXX_S_ADDR, .len = 32, .data_buf = &data_set_4510_no2_o3[18]},
-        .r = {.addr = 0x97, .len = 32},
-        .prod_data_len = ZMOD4510_PROD_DATA_LEN,
-    },
-};
+/* Register addresses and lengths of the NO2/O3 configuration, as used by
+ * the ZMOD4510 specialized driver path (zmod4510.h). */
+#define ZMOD4510_RESULT_ADDR     0x97
+#define ZMOD4510_INIT_RESULT_LEN (4)
+#define ZMOD4510_RMOX_COUNT      (ZMOD4510_ADC_DATA_LEN / 2)
+#define ZMOD4510_INIT_SET_LEN    (10)
+#define ZMOD4510_NO2_O3_SET_LEN  (50)
+
+/* Read-only configuration tables, defined in zmod4510.c */
+extern const uint8_t data_set_4510_init[ZMOD4510_INIT_SET_LEN];
+extern const uint8_t data_set_4510_no2_o3[ZMOD4510_NO2_O3_SET_LEN];
+extern const zmod4xxx_conf zmod_no2_o3_sensor_cfg[3];
 
 #define RMOX3_OFFSET (15 * 2)
 
@@ -0,0 +1,54 @@
+/**
+ * @file    coro_example.cpp
+ * @brief   Several simulated sensors brought up and measured on one thread
+ *
+ * Usage: no2_o3-coro [sensors] [cycles]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include "zmod_coro.hpp"
+
+static zmod::task<void> run_sensor(zmod::executor &ex, zmod::sensor &s,
+                                   int index, int cycles)
+{
+    uint64_t t0 = ex.now();
+    int ret = co_await s.bring_up();
+
+    if (ret) {
+        printf("sensor %d: bring-up failed with %d\n", index, ret);
+        co_return;
+    }
+    printf("sensor %d: ready after %llu ms\n", index,
+           (unsigned long long)(ex.now() - t0));
+    for (int i = 0; i < cycles; i++) {
+        sensor_results_t r = co_await s.measure();
+
+        printf("sensor %d: t=%llu ms status %d O3 %.3f ppb NO2 %.3f ppb\n",
+               index, (unsigned long long)(ex.now() - t0), (int)r.status,
+               r.o3_ppb, r.no2_ppb);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 4;
+    int cycles = argc > 2 ? atoi(argv[2]) : 3;
+    std::vector<std::unique_ptr<zmod::sim_hal>> hals;
+    std::vector<std::unique_ptr<zmod::sensor>> sensors;
+    SimConfig_t cfg = SIM_DefaultConfig;
+
+    for (int i = 0; i < count; i++) {
+        cfg.seed = (uint32_t)i + 1;
+        hals.push_back(std::make_unique<zmod::sim_hal>(&cfg));
+    }
+    zmod::executor ex(hals[0]->hal());
+    for (int i = 0; i < count; i++) {
+        sensors.push_back(std::make_unique<zmod::sensor>(ex, hals[i]->hal()));
+        ex.spawn(run_sensor(ex, *sensors[i], i, cycles));
+    }
+    ex.run();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,644 @@
+/**
+ * @file    zmod_coro.hpp
+ * @brief   C++20 coroutine front-end over the ZMOD4510 driver
+ *
+ * Header-only. One thread interleaves the detection, cleaning, preparation
+ *  and measurement cycles of many sensors:
+ *
+ *      zmod::executor ex(hal);
+ *      zmod::sensor s(ex, hal);
+ *      ex.spawn([](zmod::sensor &s) -> zmod::task<void> {
+ *          if (co_await s.bring_up()) co_return;
+ *          for (;;) {
+ *              sensor_results_t r = co_await s.measure();
+ *              ...
+ *          }
+ *      }(s));
+ *      ex.run();
+ *
+ * The executor keeps its timers on the clock of an Interface_t (msClock,
+ *  falling back to CLOCK_MONOTONIC, and msSleep), as the C scheduler in
+ *  sensor_interface.c does, so simulated sensors run in virtual time.
+ *  Waits of the driver become awaits; the I2C transfers themselves are short
+ *  and complete within the await. The prebuilt cleaning library and the
+ *  sensor preparation wait internally, so they run on a helper thread while
+ *  the executor goes on with the other sensors.
+ *
+ * Errors are returned as codes (zmod4xxx_err), as in the C API. None of the
+ *  objects may be copied or moved: the driver keeps pointers into them.
+ */
+
+#ifndef ZMOD_CORO_HPP
+#define ZMOD_CORO_HPP
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <queue>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "hal/hal.h"
+#include "hal/raspi/rpi.h"
+#include "hal/sim/sim.h"
+#include "zmod4510_config_no2_o3.h"
+#include "sensor_interface.h"
+}
+#include "no2_o3.h"
+#include "zmod4xxx.h"
+#include "zmod4xxx_cleaning.h"
+#include "zmod4xxx_hal.h"
+#include "zmod4510.h"
+
+namespace zmod {
+
+class executor;
+
+/**
+ * @brief Lazily started coroutine returning T, resumed by its awaiter
+ */
+template <typename T = void>
+class task;
+
+namespace detail {
+
+template <typename T>
+struct promise_base {
+    std::coroutine_handle<> continuation;
+
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(
+            std::coroutine_handle<P> h) noexcept
+        {
+            auto next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { std::terminate(); }
+};
+
+template <typename T>
+struct promise : promise_base<T> {
+    T value{};
+
+    task<T> get_return_object() noexcept;
+    void return_value(T v) noexcept(std::is_nothrow_move_assignable_v<T>)
+    {
+        value = std::move(v);
+    }
+};
+
+template <>
+struct promise<void> : promise_base<void> {
+    task<void> get_return_object() noexcept;
+    void return_void() noexcept {}
+};
+
+/* Root of a spawned task: starts when the executor first resumes it and
+ * frees itself at the end. */
+struct detached {
+    struct promise_type {
+        detached get_return_object() noexcept
+        {
+            return { std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+/* Result of an I2C transfer that already completed */
+struct ready {
+    int value;
+
+    bool await_ready() const noexcept { return true; }
+    void await_suspend(std::coroutine_handle<>) const noexcept {}
+    int await_resume() const noexcept { return value; }
+};
+
+inline void no_delay(uint32_t) {}
+
+} // namespace detail
+
+template <typename T>
+class task {
+public:
+    using promise_type = detail::promise<T>;
+
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+    task(task &&other) noexcept : h_(std::exchange(other.h_, {})) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+    ~task()
+    {
+        if (h_) {
+            h_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        h_.promise().continuation = caller;
+        return h_;
+    }
+    T await_resume() noexcept
+    {
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(h_.promise().value);
+        }
+    }
+
+private:
+    std::coroutine_handle<promise_type> h_;
+};
+
+namespace detail {
+
+template <typename T>
+task<T> promise<T>::get_return_object() noexcept
+{
+    return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() noexcept
+{
+    return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+/**
+ * @brief Single-threaded executor with timers on the clock of a HAL
+ */
+class executor {
+public:
+    /**
+     * @param [in] clock interface whose msClock and msSleep pace the timers;
+     *                   all sensors of the executor must share this clock
+     */
+    explicit executor(Interface_t &clock) noexcept : clock_(clock) {}
+    executor(const executor &) = delete;
+    executor &operator=(const executor &) = delete;
+
+    /** Current time in ms */
+    uint64_t now() const noexcept
+    {
+        struct timespec ts;
+
+        if (clock_.msClock) {
+            return clock_.msClock();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    /** Awaitable resuming the caller at the given time */
+    auto sleep_until(uint64_t deadline_ms) noexcept
+    {
+        struct awaiter {
+            executor &ex;
+            uint64_t deadline;
+
+            bool await_ready() const noexcept { return deadline <= ex.now(); }
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                ex.timers_.push({ deadline, ex.seq_++, h });
+            }
+            void await_resume() const noexcept {}
+        };
+        return awaiter{ *this, deadline_ms };
+    }
+
+    /** Awaitable resuming the caller after ms */
+    auto sleep_for(uint32_t ms) noexcept { return sleep_until(now() + ms); }
+
+    /**
+     * @brief Run a blocking call on a helper thread and await its result
+     * @note  The executor goes on with other tasks meanwhile; fn must not
+     *        touch objects those tasks use.
+     */
+    template <typename F>
+    auto run_blocking(F fn)
+    {
+        using R = std::invoke_result_t<F>;
+        struct awaiter {
+            executor &ex;
+            F fn;
+            R result{};
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                ex.jobs_++;
+                std::thread([this, h] {
+                    result = fn();
+                    std::lock_guard<std::mutex> lock(ex.lock_);
+                    ex.done_.push_back(h);
+                    ex.wake_.notify_one();
+                }).detach();
+            }
+            R await_resume() noexcept { return std::move(result); }
+        };
+        return awaiter{ *this, std::move(fn) };
+    }
+
+    /** Start a task; it runs within run() */
+    void spawn(task<void> t)
+    {
+        live_++;
+        ready_.push_back(root(std::move(t)).handle);
+    }
+
+    /** Run until every spawned task has finished */
+    void run()
+    {
+        while (live_ > 0) {
+            {
+                std::unique_lock<std::mutex> lock(lock_);
+                for (auto h : done_) {
+                    jobs_--;
+                    ready_.push_back(h);
+                }
+                done_.clear();
+                if (ready_.empty() && timers_.empty() && jobs_ > 0) {
+                    wake_.wait(lock, [this] { return !done_.empty(); });
+                    continue;
+                }
+            }
+            if (!ready_.empty()) {
+                auto h = ready_.front();
+                ready_.pop_front();
+                h.resume();
+                continue;
+            }
+            if (timers_.empty()) {
+                break; /* tasks wait for something that never comes */
+            }
+            timer t = timers_.top();
+            uint64_t now = this->now();
+            if (t.deadline > now) {
+                idle(t.deadline - now);
+                continue;
+            }
+            timers_.pop();
+            t.handle.resume();
+        }
+    }
+
+private:
+    struct timer {
+        uint64_t deadline;
+        uint64_t seq; /* FIFO among equal deadlines */
+        std::coroutine_handle<> handle;
+
+        bool operator>(const timer &o) const noexcept
+        {
+            return deadline != o.deadline ? deadline > o.deadline : seq > o.seq;
+        }
+    };
+
+    detail::detached root(task<void> t)
+    {
+        co_await t;
+        live_--;
+    }
+
+    /* Wait for the next timer; while helper threads run, wake on their
+     * completion instead of sleeping through it. */
+    void idle(uint64_t ms)
+    {
+        if (jobs_ > 0) {
+            std::unique_lock<std::mutex> lock(lock_);
+            wake_.wait_for(lock, std::chrono::milliseconds(ms),
+                           [this] { return !done_.empty(); });
+        } else {
+            clock_.msSleep((uint32_t)ms);
+        }
+    }
+
+    Interface_t &clock_;
+    std::priority_queue<timer, std::vector<timer>, std::greater<timer>> timers_;
+    std::deque<std::coroutine_handle<>> ready_;
+    uint64_t seq_ = 0;
+    int live_ = 0;
+    int jobs_ = 0;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::vector<std::coroutine_handle<>> done_;
+};
+
+/**
+ * @brief Raspberry Pi I2C bus, closed on destruction
+ */
+class rpi_hal {
+public:
+    explicit rpi_hal(const char *device = "/dev/i2c-1")
+    {
+        error_ = RPI_OpenBus(&hal_, &bus_, device);
+    }
+    ~rpi_hal() { RPI_CloseBus(&bus_); }
+    rpi_hal(const rpi_hal &) = delete;
+    rpi_hal &operator=(const rpi_hal &) = delete;
+
+    /** 0 if the bus was opened */
+    int error() const noexcept { return error_; }
+    Interface_t &hal() noexcept { return hal_; }
+
+private:
+    RPiBus_t bus_{};
+    Interface_t hal_{};
+    int error_;
+};
+
+/**
+ * @brief Simulated sensor with its own interface, see hal/sim/sim.h
+ */
+class sim_hal {
+public:
+    explicit sim_hal(const SimConfig_t *cfg = nullptr)
+    {
+        SIM_Init(&hal_, &dev_, cfg);
+    }
+    sim_hal(const sim_hal &) = delete;
+    sim_hal &operator=(const sim_hal &) = delete;
+
+    Interface_t &hal() noexcept { return hal_; }
+    const SimDevice_t &device() const noexcept { return dev_; }
+
+private:
+    SimDevice_t dev_{};
+    Interface_t hal_{};
+};
+
+/**
+ * @brief Register access to one device on a bus
+ */
+class bus {
+public:
+    bus(Interface_t &hal, uint8_t i2c_addr) noexcept
+        : hal_(hal), addr_(i2c_addr) {}
+
+    /** Read data from register reg; awaits to 0 on success */
+    detail::ready read(uint8_t reg, std::span<uint8_t> data) noexcept
+    {
+        return { hal_.i2cRead(hal_.handle, addr_, &reg, 1, data.data(),
+                              (int)data.size()) };
+    }
+
+    /** Write data to register reg; awaits to 0 on success */
+    detail::ready write(uint8_t reg, std::span<const uint8_t> data) noexcept
+    {
+        return { hal_.i2cWrite(hal_.handle, addr_, &reg, 1,
+                               const_cast<uint8_t *>(data.data()),
+                               (int)data.size()) };
+    }
+
+private:
+    Interface_t &hal_;
+    uint8_t addr_;
+};
+
+/**
+ * @brief ZMOD4510 running the NO2/O3 configuration and algorithm
+ */
+class sensor {
+public:
+    sensor(executor &ex, Interface_t &hal,
+           uint8_t i2c_addr = ZMOD4510_I2C_ADDR) noexcept
+        : ex_(ex), hal_(hal), view_(hal), bus_(hal, i2c_addr)
+    {
+        /* waits in the driver return at once; the awaits below replace them */
+        view_.msSleep = detail::no_delay;
+        dev_.i2c_addr = i2c_addr;
+        dev_.pid = ZMOD4510_PID;
+        dev_.init_conf = &zmod_no2_o3_sensor_cfg[INIT];
+        dev_.meas_conf = &zmod_no2_o3_sensor_cfg[MEASUREMENT];
+        dev_.prod_data = prod_data_;
+        clock_base_ms_ = ex.now();
+        wall_base_ms_ = (int64_t)time(nullptr) * 1000;
+    }
+    ~sensor()
+    {
+        if (started_) {
+            select();
+            zmod4xxx_stop_measurement(&dev_);
+        }
+    }
+    sensor(const sensor &) = delete;
+    sensor &operator=(const sensor &) = delete;
+
+    zmod4xxx_dev_t &dev() noexcept { return dev_; }
+    zmod::bus &bus() noexcept { return bus_; }
+
+private:
+    /* The legacy API has no context; select this sensor's interface
+     * before every driver call. */
+    void select() noexcept { zmod4xxx_select(&view_); }
+
+    /* Run a driver call that waits internally on a helper thread, with
+     * the real delay of the HAL */
+    template <typename F>
+    auto blocking(F fn)
+    {
+        return ex_.run_blocking([this, fn] {
+            zmod4xxx_select(&view_);
+            dev_.delay_ms = hal_.msSleep;
+            int ret = fn();
+            dev_.delay_ms = detail::no_delay;
+            return ret;
+        });
+    }
+
+public:
+
+    /** Find the sensor and read its product data */
+    task<int> detect()
+    {
+        int ret;
+
+        co_await ex_.sleep_for(200); /* zmod4xxx_init would block for it */
+        select();
+        ret = zmod4xxx_init(&dev_, &view_);
+        if (ret) {
+            co_return ret;
+        }
+        /* zmod4xxx_read_sensor_info polls for an idle sequencer */
+        for (int i = 0;; i++) {
+            uint8_t cmd = ZMOD4XXX_CMD_STOP;
+            uint8_t status;
+
+            select();
+            if (dev_.write(dev_.i2c_addr, ZMOD4XXX_ADDR_CMD, &cmd, 1)) {
+                co_return ERROR_I2C;
+            }
+            ret = zmod4xxx_read_status(&dev_, &status);
+            if (ret) {
+                co_return ret;
+            }
+            if (!(status & STATUS_SEQUENCER_RUNNING_MASK)) {
+                break;
+            }
+            if (i == 1000) {
+                co_return ERROR_GAS_TIMEOUT;
+            }
+            co_await ex_.sleep_for(200);
+        }
+        select();
+        co_return zmod4xxx_read_sensor_info(&dev_);
+    }
+
+    /** Run the cleaning procedure; ERROR_CLEANING if it was done before */
+    task<int> clean()
+    {
+        int ret = co_await blocking([this] {
+            return (int)zmod4xxx_cleaning_run(&dev_);
+        });
+        zmod4xxx_invalidate_shadow(&dev_);
+        co_return ret;
+    }
+
+    /** Configure the measurement and initialize the algorithm */
+    task<int> prepare()
+    {
+        int ret = co_await blocking([this] {
+            int r = zmod4xxx_prepare_sensor(&dev_);
+            return r ? r : (int)zmod4xxx_verify_config(&dev_);
+        });
+        if (ret) {
+            co_return ret;
+        }
+        co_return init_no2_o3(&algo_);
+    }
+
+    /** detect(), clean() unless done before, prepare() */
+    task<int> bring_up()
+    {
+        int ret = co_await detect();
+
+        if (!ret) {
+            ret = co_await clean();
+            ret = ERROR_CLEANING == ret ? 0 : ret;
+        }
+        if (!ret) {
+            ret = co_await prepare();
+        }
+        co_return ret;
+    }
+
+    /**
+     * @brief Run one host-triggered cycle and the algorithm
+     * @note  Cycles start on a ZMOD4510_NO2_O3_SAMPLE_TIME grid, like
+     *        sensor_step(), which also documents temp and humidity.
+     */
+    task<sensor_results_t> measure(float temp = -300, float humidity = 50)
+    {
+        sensor_results_t out{};
+        uint32_t waited = 0;
+        uint64_t start;
+        uint8_t status;
+        int ret;
+
+        out.temperature_degc = NAN;
+        out.humidity_pct = NAN;
+        if (cycle_start_ms_) {
+            co_await ex_.sleep_until(cycle_start_ms_ + ZMOD4510_NO2_O3_SAMPLE_TIME);
+        }
+        select();
+        ret = zmod4xxx_start_measurement(&dev_);
+        start = ex_.now();
+        cycle_start_ms_ = start;
+        started_ = !ret;
+
+        co_await ex_.sleep_until(start + meas_time_ms_ - ZMOD4510_WAIT_GUARD_TIME);
+        while (!ret) {
+            select();
+            ret = zmod4xxx_read_status(&dev_, &status);
+            if (ret || !(status & STATUS_SEQUENCER_RUNNING_MASK)) {
+                break;
+            }
+            if (waited >= ZMOD4510_WAIT_TIMEOUT) {
+                ret = ERROR_GAS_TIMEOUT;
+                break;
+            }
+            co_await ex_.sleep_for(ZMOD4510_WAIT_POLL_TIME);
+            waited += ZMOD4510_WAIT_POLL_TIME;
+        }
+        if (!ret) {
+            select();
+            ret = zmod4510_read_adc_result(&dev_, adc_);
+        }
+        if (!ret) {
+            ret = zmod4xxx_check_error_event(&dev_);
+        }
+        if (ret) {
+            out.status = ERROR_GAS_TIMEOUT == ret ? ret : NO2_O3_DAMAGE;
+            co_return out;
+        }
+        /* learn the duration of the sequence, as sensor_step() does */
+        if (waited) {
+            meas_time_ms_ = (uint32_t)(ex_.now() - start);
+        } else if (meas_time_ms_ > 2 * ZMOD4510_WAIT_GUARD_TIME) {
+            meas_time_ms_ -= meas_time_ms_ / 16;
+        }
+        out.timestamp_ms = wall_base_ms_ + (int64_t)(ex_.now() - clock_base_ms_);
+
+        no2_o3_inputs_t in{};
+        no2_o3_results_t res{};
+        in.adc_result = adc_;
+        in.humidity_pct = humidity;
+        in.temperature_degc = temp;
+        out.status = calc_no2_o3(&algo_, &dev_, &in, &res);
+        out.o3_ppb = res.O3_conc_ppb;
+        out.no2_ppb = res.NO2_conc_ppb;
+        out.fast_aqi = res.FAST_AQI;
+        out.epa_aqi = res.EPA_AQI;
+        for (int i = 0; i < 4; i++) {
+            out.rmox[i] = res.rmox[i];
+        }
+        out.o3_1min_ppb = algo_.o3_1min_ppb;
+        out.o3_1h_ppb = algo_.o3_1h_ppb;
+        out.o3_8h_ppb = algo_.o3_8h_ppb;
+        out.no2_1min_ppb = algo_.no2_1min_ppb;
+        out.no2_1h_ppb = algo_.no2_1h_ppb;
+        co_return out;
+    }
+
+private:
+    executor &ex_;
+    Interface_t &hal_;
+    Interface_t view_;
+    zmod::bus bus_;
+    zmod4xxx_dev_t dev_{};
+    uint8_t prod_data_[ZMOD4510_PROD_DATA_LEN]{};
+    uint8_t adc_[ZMOD4510_ADC_DATA_LEN]{};
+    no2_o3_handle_t algo_{};
+    uint64_t cycle_start_ms_ = 0;
+    uint32_t meas_time_ms_ = ZMOD4510_NO2_O3_SAMPLE_TIME;
+    uint64_t clock_base_ms_;
+    int64_t wall_base_ms_;
+    bool started_ = false;
+};
+
+} // namespace zmod
+
+#endif /* ZMOD_CORO_HPP */
@@ -0,0 +1,1298 @@
+/**
+ * @file    zmodd.c
+ * @brief   Acquisition daemon serving a fleet of ZMOD4510 sensors
+ *
+ * The daemon owns every bus and sensor listed in its configuration file
+ *  (zmodd_conf.h), brings the sensors up with src/fleet and runs one
+ *  acquisition thread per bus. Readings are pushed to the clients of a Unix
+ *  stream socket that subscribed to the sensor (zmodd_proto.h), so any
+ *  number of applications can share the sensors. If configured, results
+ *  are also published to an MQTT broker in batches (mqtt_pub.h), and only
+ *  results that changed are passed on (deadband.h). The acquisition
+ *  threads can run in real-time mode (zrt.h).
+ *
+ * Sensors are added and removed while the daemon runs, on request of a
+ *  client or when SIGHUP makes it reread the configuration file. Only the
+ *  changed sensor is brought up or let go of; the acquisition threads pick
+ *  the change up between two cycles and keep their cadence.
+ *
+ * Usage: zmodd <config-file>
+ */
+
+#define _GNU_SOURCE /* ppoll, pipe2 */
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "zmodd_conf.h"
+#include "zmodd_proto.h"
+#include "deadband.h"
+#include "fleet.h"
+#include "mqtt_pub.h"
+#include "no2_o3.h"
+#include "zmod4xxx.h"
+#include "zmod4510.h"
+#include "hal/raspi/rpi.h"
+#include "hal/sim/sim.h"
+#include "util/zlog.h"
+#include "util/zrt.h"
+
+#define MAX_CLIENTS     (32)
+/* Bytes queued per client; samples that do not fit are dropped */
+#define CLIENT_OUT_SIZE (8192)
+#define SIM_CHANNELS    (8)
+
+/* Simulated sensors of a bus, one per multiplexer channel */
+typedef struct {
+    Interface_t chan[SIM_CHANNELS];
+    SimDevice_t dev[SIM_CHANNELS];
+    int current;
+} sim_mux_t;
+
+/* Where a sensor is, and which thread owns it. The server thread adds a
+ * sensor and starts its bring-up thread. A ready sensor is queued to join
+ * its bus, and the acquisition thread of the bus makes it a lane between
+ * two cycles. Removing a sensor queues it to leave the same way; once no
+ * thread uses it any more it is retired, and the supervisor frees it. */
+typedef enum {
+    SENSOR_BRINGUP,  /**< the bring-up thread owns it */
+    SENSOR_JOINING,  /**< ready, on the join queue of its bus */
+    SENSOR_ON_BUS,   /**< a lane of its bus */
+    SENSOR_LEAVING,  /**< removed, on the leave queue of its bus */
+    SENSOR_IDLE,     /**< bring-up failed, unused */
+    SENSOR_RETIRED   /**< on the retired queue, to be freed */
+} sensor_place_t;
+
+typedef struct sensor {
+    zmodd_sensor_conf_t conf;
+    int id;
+    fleet_sensor_t fleet;
+    no2_o3_handle_t algo;
+    uint8_t prod_data[ZMOD4510_PROD_DATA_LEN];
+    /* as last reported by the bring-up, guarded by state_lock */
+    int8_t stage;
+    int16_t error;
+    /* guarded by hotplug_lock */
+    sensor_place_t place;
+    int removed;
+    struct sensor *next;   /**< next on the queue of its place */
+    struct sensor *live_next; /**< next on the list of live sensors */
+} sensor_t;
+
+/* Results of one cycle of a bus, one lane per sensor of the bus in the
+ * order they joined; the arrays are the input of the deadband. */
+typedef struct {
+    float o3_ppb[ZMODD_MAX_SENSORS];
+    float no2_ppb[ZMODD_MAX_SENSORS];
+    int32_t fast_aqi[ZMODD_MAX_SENSORS];
+    int32_t epa_aqi[ZMODD_MAX_SENSORS];
+    int32_t status[ZMODD_MAX_SENSORS];
+    uint8_t started[ZMODD_MAX_SENSORS]; /**< lane's sequence was started */
+    uint8_t emit[ZMODD_MAX_SENSORS];   /**< lane has a result to pass on */
+    int64_t timestamp_ms[ZMODD_MAX_SENSORS];
+    no2_o3_results_t r[ZMODD_MAX_SENSORS];
+    uint8_t valid[ZMODD_MAX_SENSORS];  /**< r holds a result */
+} cycle_t;
+
+typedef struct {
+    const zmodd_bus_conf_t *conf;
+    Interface_t hal;
+    RPiBus_t rpi;
+    sim_mux_t *sim;
+    fleet_bus_t fleet;
+    pthread_t thread;
+    int started;
+    uint32_t meas_time_ms; /**< learned duration of the sequence */
+    int lanes;             /**< sensors acquired on the bus */
+    sensor_t *lane[ZMODD_MAX_SENSORS];
+    cycle_t cycle;
+    deadband_t deadband;   /**< one entry per lane */
+    /* changes to apply between two cycles, guarded by hotplug_lock */
+    sensor_t *join;
+    sensor_t *leave;
+    int changed;           /**< join or leave is not empty */
+} bus_t;
+
+typedef struct {
+    int fd;
+    uint64_t subscribed; /**< bit per sensor id */
+    int all;             /**< subscribed to all sensors, also new ones */
+    uint32_t dropped;
+    uint8_t in[sizeof(zmodd_hdr_t) + ZMODD_MAX_PAYLOAD];
+    size_t in_len;
+    uint8_t out[CLIENT_OUT_SIZE];
+    size_t out_len;
+} client_t;
+
+static const char *conf_path;
+static zmodd_conf_t conf;
+static bus_t buses[ZMODD_MAX_BUSES];
+static client_t clients[MAX_CLIENTS];
+
+/* Sensors by id, NULL if the id is free; only the server thread uses the
+ * table, the other threads are handed the sensor itself */
+static sensor_t *sensors[ZMODD_MAX_SENSORS];
+static int next_id;
+
+/* Samples travel from the acquisition threads to the server loop through a
+ * pipe; a record is smaller than PIPE_BUF, so writes never interleave. */
+static int sample_pipe[2] = { -1, -1 };
+static mqtt_pub_t mqtt;
+
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Places of the sensors; priority inheritance, as the acquisition threads
+ * take it to apply changes */
+static pthread_mutex_t hotplug_lock;
+static pthread_cond_t hotplug_cond;
+static sensor_t *retired;
+static sensor_t *live;   /**< every sensor not yet freed */
+static int bringing_up;  /**< bring-up threads running */
+static int closing;      /**< the supervisor is to exit */
+
+static pthread_t supervisor;
+static pthread_mutex_t stop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stop_cond;
+static int stopping;
+static volatile sig_atomic_t signalled;
+static volatile sig_atomic_t reload_requested;
+
+static uint64_t clock_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int64_t wall_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Sleep until a monotonic deadline; returns nonzero if the daemon stops */
+static int sleep_until(uint64_t deadline_ms)
+{
+    struct timespec ts = { (time_t)(deadline_ms / 1000),
+                           (long)(deadline_ms % 1000) * 1000000 };
+    int ret;
+
+    pthread_mutex_lock(&stop_lock);
+    while (!stopping && clock_ms() < deadline_ms) {
+        pthread_cond_timedwait(&stop_cond, &stop_lock, &ts);
+    }
+    ret = stopping;
+    pthread_mutex_unlock(&stop_lock);
+    return ret;
+}
+
+static void on_signal(int sig)
+{
+    if (SIGHUP == sig) {
+        reload_requested = 1;
+    } else {
+        signalled = 1;
+    }
+}
+
+/* ---- buses ---------------------------------------------------------- */
+
+static int sim_read(void *handle, uint8_t addr, uint8_t *wr, int wr_len,
+                    uint8_t *rd, int rd_len)
+{
+    sim_mux_t *m = handle;
+    Interface_t *c = &m->chan[m->current];
+    return c->i2cRead(c->handle, addr, wr, wr_len, rd, rd_len);
+}
+
+static int sim_write(void *handle, uint8_t addr, uint8_t *wr1, int len1,
+                     uint8_t *wr2, int len2)
+{
+    sim_mux_t *m = handle;
+    Interface_t *c = &m->chan[m->current];
+    return c->i2cWrite(c->handle, addr, wr1, len1, wr2, len2);
+}
+
+static int sim_select(void *ctx, Interface_t *hal, int channel)
+{
+    (void)hal;
+    ((bus_t *)ctx)->sim->current = channel;
+    return 0;
+}
+
+/* TCA9548A: the control register holds one enable bit per channel */
+static int mux_select(void *ctx, Interface_t *hal, int channel)
+{
+    uint8_t enable = (uint8_t)(1U << channel);
+    return hal->i2cWrite(hal->handle, (uint8_t)((bus_t *)ctx)->conf->mux_addr,
+                         &enable, 1, NULL, 0);
+}
+
+static int bus_open(bus_t *bus, const zmodd_bus_conf_t *bc, int index)
+{
+    SimConfig_t cfg = SIM_DefaultConfig;
+    fleet_mux_fn select = NULL;
+
+    bus->conf = bc;
+    bus->meas_time_ms = ZMOD4510_NO2_O3_SAMPLE_TIME;
+    if (bc->device[0]) {
+        if (RPI_OpenBus(&bus->hal, &bus->rpi, bc->device)) {
+            return -1;
+        }
+        select = bc->mux_addr >= 0 ? mux_select : NULL;
+    } else {
+        bus->sim = calloc(1, sizeof(*bus->sim));
+        if (!bus->sim) {
+            return -1;
+        }
+        cfg.realtime = 1;
+        for (int c = 0; c < SIM_CHANNELS; c++) {
+            cfg.seed = (uint32_t)(index * SIM_CHANNELS + c + 1);
+            SIM_Init(&bus->sim->chan[c], &bus->sim->dev[c], &cfg);
+        }
+        bus->hal = bus->sim->chan[0];
+        bus->hal.handle = bus->sim;
+        bus->hal.i2cRead = sim_read;
+        bus->hal.i2cWrite = sim_write;
+        bus->hal.i2cBatch = NULL;
+        select = bc->mux_addr >= 0 ? sim_select : NULL;
+    }
+    fleet_bus_init(&bus->fleet, &bus->hal, select, bus);
+    return 0;
+}
+
+static void bus_close(bus_t *bus)
+{
+    if (!bus->conf) {
+        return;
+    }
+    fleet_bus_destroy(&bus->fleet);
+    deadband_free(&bus->deadband);
+    if (bus->sim) {
+        free(bus->sim);
+        bus->sim = NULL;
+    } else {
+        RPI_CloseBus(&bus->rpi);
+    }
+}
+
+/* ---- acquisition ---------------------------------------------------- */
+
+static void publish(const sensor_t *sensor, int status, int64_t timestamp_ms,
+                    const no2_o3_results_t *r)
+{
+    zmodd_sample_t s = { 0 };
+
+    s.id = (uint16_t)sensor->id;
+    s.status = (int16_t)status;
+    s.timestamp_ms = timestamp_ms;
+    if (r) {
+        s.o3_ppb = r->O3_conc_ppb;
+        s.no2_ppb = r->NO2_conc_ppb;
+        s.fast_aqi = r->FAST_AQI;
+        s.epa_aqi = r->EPA_AQI;
+        memcpy(s.rmox, r->rmox, sizeof(s.rmox));
+    }
+    if (write(sample_pipe[1], &s, sizeof(s)) != sizeof(s)) {
+        zlog_warn("Sample of sensor %d dropped, server busy", sensor->id);
+    }
+    if (conf.mqtt_enabled) {
+        sensor_results_t res = { .status = status, .timestamp_ms = timestamp_ms,
+                                 .o3_ppb = NAN, .no2_ppb = NAN };
+
+        for (int i = 0; i < 4; i++) {
+            res.rmox[i] = NAN;
+        }
+        if (r) {
+            res.o3_ppb = s.o3_ppb;
+            res.no2_ppb = s.no2_ppb;
+            res.fast_aqi = s.fast_aqi;
+            res.epa_aqi = s.epa_aqi;
+            memcpy(res.rmox, s.rmox, sizeof(res.rmox));
+        }
+        mqtt_pub_add(&mqtt, sensor->conf.name, &res);
+    }
+}
+
+/* Wait for the sequence of a sensor to end, at the latest at end_ms. The
+ * driver counts poll intervals, not elapsed time, so it waits for half of
+ * what is left at a time and the clock decides when the time is up. */
+static int wait_until(zmod4xxx_dev_t *dev, uint64_t end_ms, uint32_t *waited)
+{
+    uint64_t now;
+    uint32_t left, part;
+    int ret;
+
+    *waited = 0;
+    do {
+        now = clock_ms();
+        left = now < end_ms ? (uint32_t)(end_ms - now) : 0;
+        ret = zmod4xxx_wait_measurement(dev, ZMOD4510_WAIT_POLL_TIME,
+                                        left / 2, &part);
+        *waited += part;
+    } while (ERROR_GAS_TIMEOUT == ret && left >= 2 * ZMOD4510_WAIT_POLL_TIME);
+    return ret;
+}
+
+/* Read, check and evaluate the results of one sensor into a lane, waiting
+ * until end_ms at the latest for its sequence to end */
+static int measure(sensor_t *s, cycle_t *c, int lane, uint64_t end_ms,
+                   uint32_t *waited)
+{
+    zmod4xxx_dev_t *dev = &s->fleet.dev;
+    uint8_t adc[ZMOD4510_ADC_DATA_LEN];
+    no2_o3_inputs_t in = { adc, conf.humidity, conf.temperature };
+    no2_o3_results_t *r = &c->r[lane];
+    int ret;
+
+    ret = wait_until(dev, end_ms, waited);
+    if (!ret) {
+        ret = zmod4510_read_adc_result(dev, adc);
+    }
+    if (!ret) {
+        ret = zmod4xxx_check_error_event(dev);
+    }
+    c->timestamp_ms[lane] = wall_ms();
+    c->emit[lane] = 1;
+    c->valid[lane] = !ret;
+    if (ret) {
+        if (fleet_recover(&s->fleet, ret)) {
+            zlog_warn("Sensor %s not recovered, retrying next cycle",
+                      s->conf.name);
+        }
+        c->status[lane] = ret;
+        c->o3_ppb[lane] = NAN;
+        c->no2_ppb[lane] = NAN;
+        c->fast_aqi[lane] = 0;
+        c->epa_aqi[lane] = 0;
+        return ret;
+    }
+    c->status[lane] = calc_no2_o3(&s->algo, dev, &in, r);
+    c->o3_ppb[lane] = r->O3_conc_ppb;
+    c->no2_ppb[lane] = r->NO2_conc_ppb;
+    c->fast_aqi[lane] = r->FAST_AQI;
+    c->epa_aqi[lane] = r->EPA_AQI;
+    return 0;
+}
+
+/* Pass on the results of a cycle that the deadband lets through */
+static void publish_cycle(bus_t *bus)
+{
+    cycle_t *c = &bus->cycle;
+    deadband_batch_t in = { c->o3_ppb, c->no2_ppb, c->fast_aqi, c->epa_aqi,
+                            c->status };
+
+    if (conf.deadband_enabled) {
+        deadband_filter(&bus->deadband, 0, (uint32_t)bus->lanes, &in,
+                        wall_ms(), c->emit);
+    }
+    for (int k = 0; k < bus->lanes; k++) {
+        if (c->emit[k]) {
+            publish(bus->lane[k], c->status[k], c->timestamp_ms[k],
+                    c->valid[k] ? &c->r[k] : NULL);
+        }
+    }
+}
+
+/* Hand a sensor no thread uses any more to the supervisor; called with
+ * hotplug_lock held */
+static void retire(sensor_t *s)
+{
+    s->place = SENSOR_RETIRED;
+    s->next = retired;
+    retired = s;
+    pthread_cond_broadcast(&hotplug_cond);
+}
+
+/* Queue a change for the acquisition thread of a bus; called with
+ * hotplug_lock held */
+static void bus_queue(bus_t *bus, sensor_t **queue, sensor_t *s,
+                      sensor_place_t place)
+{
+    s->place = place;
+    s->next = *queue;
+    *queue = s;
+    __atomic_store_n(&bus->changed, 1, __ATOMIC_RELAXED);
+}
+
+/* Let the queued sensors leave and join a bus, between two cycles. A
+ * leaving lane is replaced by the last one, whose started flag and
+ * deadband entry move with it, so the lanes stay contiguous; nothing is
+ * allocated or freed here. A joining lane has not started a sequence. */
+static void bus_apply(bus_t *bus)
+{
+    sensor_t *s;
+
+    pthread_mutex_lock(&hotplug_lock);
+    while ((s = bus->leave)) {
+        bus->leave = s->next;
+        for (int k = 0; k < bus->lanes; k++) {
+            if (bus->lane[k] == s) {
+                bus->lane[k] = bus->lane[--bus->lanes];
+                bus->cycle.started[k] = bus->cycle.started[bus->lanes];
+                if (conf.deadband_enabled) {
+                    deadband_move(&bus->deadband, (uint32_t)k,
+                                  (uint32_t)bus->lanes);
+                }
+                break;
+            }
+        }
+        retire(s);
+    }
+    /* leaving first keeps the lanes within ZMODD_MAX_SENSORS: every lane
+     * left holds an id */
+    while ((s = bus->join)) {
+        bus->join = s->next;
+        s->place = SENSOR_ON_BUS;
+        if (conf.deadband_enabled) {
+            deadband_reset(&bus->deadband, (uint32_t)bus->lanes);
+        }
+        bus->cycle.started[bus->lanes] = 0;
+        bus->lane[bus->lanes++] = s;
+    }
+    __atomic_store_n(&bus->changed, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&hotplug_lock);
+}
+
+/* Host-triggered cycles of all ready sensors of a bus on a common grid:
+ * start every sensor, sleep until just before the sequences end, collect
+ * the results one by one, then pass them on together. */
+static void *acquire(void *arg)
+{
+    bus_t *bus = arg;
+    uint64_t start, end;
+    uint32_t waited;
+
+    if (conf.rt_enabled) {
+        zrt_enter(&conf.rt);
+    }
+    for (;;) {
+        if (__atomic_load_n(&bus->changed, __ATOMIC_RELAXED)) {
+            bus_apply(bus);
+        }
+        start = clock_ms();
+        for (int k = 0; k < bus->lanes; k++) {
+            sensor_t *s = bus->lane[k];
+            int ret;
+
+            fleet_select(&s->fleet);
+            ret = zmod4xxx_start_measurement(&s->fleet.dev);
+            bus->cycle.started[k] = !ret;
+            if (ret) {
+                publish(s, ret, wall_ms(), NULL);
+                fleet_recover(&s->fleet, ret);
+            }
+        }
+        if (sleep_until(start + bus->meas_time_ms -
+                        ZMOD4510_WAIT_GUARD_TIME)) {
+            break;
+        }
+        memset(bus->cycle.emit, 0, sizeof(bus->cycle.emit));
+        /* a stuck sensor may only use up what is left of the cycle; the
+         * sequences of the others ended meanwhile and are still read */
+        end = start + ZMOD4510_NO2_O3_SAMPLE_TIME - ZMOD4510_WAIT_GUARD_TIME;
+        for (int k = 0, first = 1; k < bus->lanes; k++) {
+            sensor_t *s = bus->lane[k];
+
+            /* an idle sensor would return the last cycle's ADC words and
+             * pace the wake-up from a sequence that never ran; its error
+             * was published above */
+            if (!bus->cycle.started[k]) {
+                continue;
+            }
+            fleet_select(&s->fleet);
+            if (measure(s, &bus->cycle, k, end, &waited) || !first) {
+                continue;
+            }
+            /* the first started sensor of the bus paces the wake-up time */
+            first = 0;
+            if (waited) {
+                bus->meas_time_ms = (uint32_t)(clock_ms() - start);
+            } else if (bus->meas_time_ms > 2 * ZMOD4510_WAIT_GUARD_TIME) {
+                bus->meas_time_ms -= bus->meas_time_ms / 16;
+            }
+        }
+        publish_cycle(bus);
+        if (sleep_until(start + ZMOD4510_NO2_O3_SAMPLE_TIME)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void on_progress(void *ctx, int index, const fleet_sensor_t *sensor)
+{
+    sensor_t *s = ctx;
+
+    (void)index;
+    pthread_mutex_lock(&state_lock);
+    s->stage = (int8_t)sensor->stage;
+    s->error = (int16_t)sensor->error;
+    pthread_mutex_unlock(&state_lock);
+    zlog_info("Sensor %s: %s", s->conf.name,
+              fleet_stage_name(sensor->stage));
+}
+
+/* Bring one sensor up while the buses keep acquiring the others, then
+ * queue it to join its bus */
+static void *bring_up(void *arg)
+{
+    sensor_t *s = arg;
+    bus_t *bus = &buses[s->conf.bus];
+
+    if (!fleet_bring_up_one(&s->fleet, on_progress, s)) {
+        init_no2_o3(&s->algo);
+    }
+    pthread_mutex_lock(&hotplug_lock);
+    if (s->removed) {
+        retire(s);
+    } else if (FLEET_READY == s->fleet.stage) {
+        bus_queue(bus, &bus->join, s, SENSOR_JOINING);
+    } else {
+        s->place = SENSOR_IDLE;
+    }
+    bringing_up--;
+    pthread_cond_broadcast(&hotplug_cond);
+    pthread_mutex_unlock(&hotplug_lock);
+    return NULL;
+}
+
+/* Free the retired sensors until the daemon closes and no bring-up is
+ * left, so the acquisition threads never free memory */
+static void *supervise(void *arg)
+{
+    sensor_t *s;
+
+    (void)arg;
+    pthread_mutex_lock(&hotplug_lock);
+    for (;;) {
+        while ((s = retired)) {
+            retired = s->next;
+            for (sensor_t **p = &live; *p; p = &(*p)->live_next) {
+                if (*p == s) {
+                    *p = s->live_next;
+                    break;
+                }
+            }
+            pthread_mutex_unlock(&hotplug_lock);
+            free(s);
+            pthread_mutex_lock(&hotplug_lock);
+        }
+        if (closing && !bringing_up) {
+            break;
+        }
+        pthread_cond_wait(&hotplug_cond, &hotplug_lock);
+    }
+    pthread_mutex_unlock(&hotplug_lock);
+    return NULL;
+}
+
+/* ---- clients -------------------------------------------------------- */
+
+static void client_flush(client_t *c)
+{
+    ssize_t n;
+
+    while (c->out_len) {
+        n = send(c->fd, c->out, c->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n <= 0) {
+            break;
+        }
+        memmove(c->out, c->out + n, c->out_len - n);
+        c->out_len -= n;
+    }
+}
+
+/* Queue a frame; returns nonzero if it does not fit */
+static int client_send(client_t *c, uint8_t type, const void *payload,
+                       uint16_t length)
+{
+    zmodd_hdr_t hdr = { type, 0, length };
+
+    if (c->out_len + sizeof(hdr) + length > sizeof(c->out)) {
+        return -1;
+    }
+    memcpy(c->out + c->out_len, &hdr, sizeof(hdr));
+    memcpy(c->out + c->out_len + sizeof(hdr), payload, length);
+    c->out_len += sizeof(hdr) + length;
+    return 0;
+}
+
+static void client_error(client_t *c, uint8_t request, uint16_t code)
+{
+    zmodd_error_t e = { request, 0, code };
+    client_send(c, ZMODD_MSG_ERROR, &e, sizeof(e));
+}
+
+static void sensor_info(const sensor_t *s, zmodd_sensor_t *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->id = (uint16_t)s->id;
+    info->bus = (uint8_t)s->conf.bus;
+    info->channel = (int8_t)s->conf.channel;
+    info->i2c_addr = s->conf.i2c_addr;
+    pthread_mutex_lock(&state_lock);
+    info->stage = s->stage;
+    info->error = s->error;
+    pthread_mutex_unlock(&state_lock);
+    memcpy(info->name, s->conf.name, sizeof(info->name));
+}
+
+/* ---- adding and removing sensors ------------------------------------ */
+
+/* Tell every client of a sensor that was added or is being removed */
+static void announce(const sensor_t *s, int removed)
+{
+    zmodd_sensor_t info;
+    uint64_t bit = (uint64_t)1 << s->id;
+
+    sensor_info(s, &info);
+    if (removed) {
+        info.stage = ZMODD_STAGE_REMOVED;
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        client_t *c = &clients[i];
+
+        if (c->fd < 0) {
+            continue;
+        }
+        if (removed && !c->all) {
+            c->subscribed &= ~bit;
+        }
+        client_send(c, ZMODD_MSG_SENSOR, &info, sizeof(info));
+        client_flush(c);
+    }
+}
+
+static int sensor_find(const char *name)
+{
+    for (int i = 0; i < ZMODD_MAX_SENSORS; i++) {
+        if (sensors[i] && 0 == strcmp(sensors[i]->conf.name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Whether a sensor that may still access its chip is at the location:
+ * 0 if none, 1 if one with an id, 2 if one removed but not yet let go of
+ * by its bus or its bring-up */
+static int location_in_use(const zmodd_sensor_conf_t *sc)
+{
+    int used = 0;
+
+    pthread_mutex_lock(&hotplug_lock);
+    for (const sensor_t *s = live; s && !used; s = s->live_next) {
+        if (SENSOR_RETIRED != s->place && s->conf.bus == sc->bus &&
+            s->conf.channel == sc->channel &&
+            s->conf.i2c_addr == sc->i2c_addr) {
+            used = s->removed ? 2 : 1;
+        }
+    }
+    pthread_mutex_unlock(&hotplug_lock);
+    return used;
+}
+
+/* Add a sensor and start bringing it up; returns its id or a negative
+ * ZMODD_ERR_* */
+static int sensor_add(const zmodd_sensor_conf_t *sc)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    sensor_t *s;
+    zmod4xxx_dev_t *dev;
+    int id = -1, ret;
+
+    if (sc->bus < 0 || sc->bus >= conf.bus_count ||
+        (conf.buses[sc->bus].mux_addr < 0) != (sc->channel < 0) ||
+        sc->channel > 7 || sc->i2c_addr < 0x08 || sc->i2c_addr > 0x77 ||
+        !sc->name[0] || sensor_find(sc->name) >= 0 || location_in_use(sc)) {
+        return -ZMODD_ERR_BAD_SENSOR;
+    }
+    /* round robin, so samples still on their way from a removed sensor
+     * are not taken for those of a new one */
+    for (int k = 0; k < ZMODD_MAX_SENSORS && id < 0; k++) {
+        int i = (next_id + k) % ZMODD_MAX_SENSORS;
+
+        id = sensors[i] ? -1 : i;
+    }
+    s = id >= 0 ? calloc(1, sizeof(*s)) : NULL;
+    if (!s) {
+        return -ZMODD_ERR_NO_ROOM;
+    }
+    s->conf = *sc;
+    s->id = id;
+    s->stage = FLEET_PENDING;
+    s->place = SENSOR_BRINGUP;
+    fleet_sensor_init(&s->fleet, &buses[sc->bus].fleet, sc->channel);
+    dev = &s->fleet.dev;
+    dev->i2c_addr = sc->i2c_addr;
+    dev->pid = ZMOD4510_PID;
+    dev->init_conf = &zmod_no2_o3_sensor_cfg[INIT];
+    dev->meas_conf = &zmod_no2_o3_sensor_cfg[MEASUREMENT];
+    dev->prod_data = s->prod_data;
+
+    pthread_mutex_lock(&hotplug_lock);
+    bringing_up++;
+    s->live_next = live;
+    live = s;
+    pthread_mutex_unlock(&hotplug_lock);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, bring_up, s);
+    pthread_attr_destroy(&attr);
+    if (ret) {
+        pthread_mutex_lock(&hotplug_lock);
+        bringing_up--;
+        live = s->live_next;
+        pthread_mutex_unlock(&hotplug_lock);
+        free(s);
+        return -ZMODD_ERR_NO_ROOM;
+    }
+    sensors[id] = s;
+    next_id = id + 1;
+    zlog_info("Sensor %s added as %d", sc->name, id);
+    announce(s, 0);
+    return id;
+}
+
+/* Remove a sensor; its bus lets go of it between two cycles */
+static int sensor_remove(int id)
+{
+    sensor_t *s = id >= 0 && id < ZMODD_MAX_SENSORS ? sensors[id] : NULL;
+    bus_t *bus;
+
+    if (!s) {
+        return -ZMODD_ERR_UNKNOWN_SENSOR;
+    }
+    bus = &buses[s->conf.bus];
+    sensors[id] = NULL;
+    zlog_info("Sensor %s removed", s->conf.name);
+    announce(s, 1);
+
+    pthread_mutex_lock(&hotplug_lock);
+    s->removed = 1;
+    switch (s->place) {
+    case SENSOR_JOINING:
+        for (sensor_t **p = &bus->join; *p; p = &(*p)->next) {
+            if (*p == s) {
+                *p = s->next;
+                break;
+            }
+        }
+        retire(s);
+        break;
+    case SENSOR_ON_BUS:
+        bus_queue(bus, &bus->leave, s, SENSOR_LEAVING);
+        break;
+    case SENSOR_IDLE:
+        retire(s);
+        break;
+    default:
+        break; /* retired by its bring-up thread when done */
+    }
+    pthread_mutex_unlock(&hotplug_lock);
+    return 0;
+}
+
+/* Bus of the current configuration that a reread bus is, -1 if none */
+static int same_bus(const zmodd_bus_conf_t *bc)
+{
+    for (int b = 0; b < conf.bus_count; b++) {
+        if (0 == strcmp(conf.buses[b].name, bc->name) &&
+            0 == strcmp(conf.buses[b].device, bc->device) &&
+            conf.buses[b].mux_addr == bc->mux_addr) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+/* Reread the configuration file and apply its sensors: remove the ones
+ * that are gone or moved, add the new ones. The other directives, buses
+ * included, take effect at the next start. A new sensor at the location
+ * of a removed one, e.g. a renamed one, waits until the removed one is
+ * let go of; returns the number of such sensors. */
+static int reload(void)
+{
+    static zmodd_conf_t next;
+    int bus[ZMODD_MAX_BUSES], removed = 0, added = 0, waiting = 0;
+
+    if (zmodd_conf_load(&next, conf_path)) {
+        zlog_error("Reloading %s failed, sensors kept", conf_path);
+        return 0;
+    }
+    for (int b = 0; b < next.bus_count; b++) {
+        bus[b] = same_bus(&next.buses[b]);
+        if (bus[b] < 0) {
+            zlog_warn("Bus %s changed, takes effect at the next start",
+                      next.buses[b].name);
+        }
+    }
+    for (int id = 0; id < ZMODD_MAX_SENSORS; id++) {
+        const sensor_t *s = sensors[id];
+        int i = 0;
+
+        if (!s) {
+            continue;
+        }
+        while (i < next.sensor_count &&
+               strcmp(next.sensors[i].name, s->conf.name)) {
+            i++;
+        }
+        if (i == next.sensor_count || bus[next.sensors[i].bus] != s->conf.bus ||
+            next.sensors[i].channel != s->conf.channel ||
+            next.sensors[i].i2c_addr != s->conf.i2c_addr) {
+            removed += 0 == sensor_remove(id);
+        }
+    }
+    for (int i = 0; i < next.sensor_count; i++) {
+        zmodd_sensor_conf_t sc = next.sensors[i];
+
+        sc.bus = bus[sc.bus];
+        if (sc.bus >= 0 && sensor_find(sc.name) < 0) {
+            int ret;
+
+            if (2 == location_in_use(&sc)) {
+                waiting++;
+                continue;
+            }
+            ret = sensor_add(&sc);
+            if (ret < 0) {
+                zlog_error("Cannot add sensor %s: error %d", sc.name, -ret);
+            }
+            added += ret >= 0;
+        }
+    }
+    zlog_info("Reloaded %s: %d sensors removed, %d added, %d waiting",
+              conf_path, removed, added, waiting);
+    return waiting;
+}
+
+/* ---- client requests ------------------------------------------------ */
+
+static void client_list(client_t *c)
+{
+    zmodd_sensor_t info;
+
+    for (int i = 0; i < ZMODD_MAX_SENSORS; i++) {
+        if (sensors[i]) {
+            sensor_info(sensors[i], &info);
+            client_send(c, ZMODD_MSG_SENSOR, &info, sizeof(info));
+        }
+    }
+}
+
+static void client_subscribe(client_t *c, const zmodd_hdr_t *hdr,
+                             const uint8_t *payload)
+{
+    uint64_t mask = 0;
+    uint16_t id;
+    int all = 0;
+
+    if (hdr->length % sizeof(id)) {
+        client_error(c, hdr->type, ZMODD_ERR_BAD_LENGTH);
+        return;
+    }
+    for (int i = 0; i < hdr->length; i += sizeof(id)) {
+        memcpy(&id, payload + i, sizeof(id));
+        if (ZMODD_ALL_SENSORS == id) {
+            mask = ~(uint64_t)0;
+            all = 1;
+        } else if (id < ZMODD_MAX_SENSORS && sensors[id]) {
+            mask |= (uint64_t)1 << id;
+        } else {
+            client_error(c, hdr->type, ZMODD_ERR_UNKNOWN_SENSOR);
+            return;
+        }
+    }
+    if (ZMODD_MSG_SUBSCRIBE == hdr->type) {
+        c->subscribed |= mask;
+        c->all |= all;
+    } else {
+        c->subscribed &= ~mask;
+        c->all &= !all;
+    }
+}
+
+static void client_add(client_t *c, const zmodd_hdr_t *hdr,
+                       const uint8_t *payload)
+{
+    zmodd_add_t add;
+    zmodd_sensor_conf_t sc;
+    int ret;
+
+    if (hdr->length != sizeof(add)) {
+        client_error(c, hdr->type, ZMODD_ERR_BAD_LENGTH);
+        return;
+    }
+    memcpy(&add, payload, sizeof(add));
+    if (!memchr(add.name, 0, sizeof(add.name))) {
+        client_error(c, hdr->type, ZMODD_ERR_BAD_SENSOR);
+        return;
+    }
+    memcpy(sc.name, add.name, sizeof(sc.name));
+    sc.bus = add.bus;
+    sc.channel = add.channel;
+    sc.i2c_addr = add.i2c_addr;
+    ret = sensor_add(&sc);
+    if (ret < 0) {
+        client_error(c, hdr->type, (uint16_t)-ret);
+    }
+}
+
+static void client_remove(client_t *c, const zmodd_hdr_t *hdr,
+                          const uint8_t *payload)
+{
+    uint16_t id;
+
+    if (hdr->length % sizeof(id)) {
+        client_error(c, hdr->type, ZMODD_ERR_BAD_LENGTH);
+        return;
+    }
+    for (int i = 0; i < hdr->length; i += sizeof(id)) {
+        memcpy(&id, payload + i, sizeof(id));
+        if (sensor_remove(id)) {
+            client_error(c, hdr->type, ZMODD_ERR_UNKNOWN_SENSOR);
+        }
+    }
+}
+
+static void client_request(client_t *c, const zmodd_hdr_t *hdr,
+                           const uint8_t *payload)
+{
+    switch (hdr->type) {
+    case ZMODD_MSG_LIST:
+        client_list(c);
+        break;
+    case ZMODD_MSG_SUBSCRIBE:
+    case ZMODD_MSG_UNSUBSCRIBE:
+        client_subscribe(c, hdr, payload);
+        break;
+    case ZMODD_MSG_ADD:
+        client_add(c, hdr, payload);
+        break;
+    case ZMODD_MSG_REMOVE:
+        client_remove(c, hdr, payload);
+        break;
+    default:
+        client_error(c, hdr->type, ZMODD_ERR_UNKNOWN_MSG);
+        break;
+    }
+}
+
+static void client_close(client_t *c)
+{
+    close(c->fd);
+    c->fd = -1;
+}
+
+/* Read what the client sent and process every complete frame */
+static void client_input(client_t *c)
+{
+    zmodd_hdr_t hdr;
+    ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len,
+                     MSG_DONTWAIT);
+
+    if (n <= 0) {
+        if (0 == n || (EAGAIN != errno && EINTR != errno)) {
+            client_close(c);
+        }
+        return;
+    }
+    c->in_len += n;
+    while (c->in_len >= sizeof(hdr)) {
+        memcpy(&hdr, c->in, sizeof(hdr));
+        if (hdr.length > ZMODD_MAX_PAYLOAD) {
+            client_close(c);
+            return;
+        }
+        if (c->in_len < sizeof(hdr) + hdr.length) {
+            break;
+        }
+        client_request(c, &hdr, c->in + sizeof(hdr));
+        c->in_len -= sizeof(hdr) + hdr.length;
+        memmove(c->in, c->in + sizeof(hdr) + hdr.length, c->in_len);
+    }
+    client_flush(c);
+}
+
+static void client_accept(int listener)
+{
+    zmodd_hello_t hello = { ZMODD_PROTO_VERSION, 0 };
+    int fd = accept(listener, NULL, NULL);
+
+    if (fd < 0) {
+        return;
+    }
+    for (int i = 0; i < ZMODD_MAX_SENSORS; i++) {
+        if (sensors[i]) {
+            hello.sensor_count = (uint16_t)(i + 1);
+        }
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].fd < 0) {
+            memset(&clients[i], 0, sizeof(clients[i]));
+            clients[i].fd = fd;
+            client_send(&clients[i], ZMODD_MSG_HELLO, &hello, sizeof(hello));
+            client_flush(&clients[i]);
+            return;
+        }
+    }
+    zlog_warn("Client rejected, %d clients connected", MAX_CLIENTS);
+    close(fd);
+}
+
+/* Fan the queued samples out to the subscribed clients */
+static void dispatch_samples(void)
+{
+    zmodd_sample_t s;
+
+    while (read(sample_pipe[0], &s, sizeof(s)) == sizeof(s)) {
+        if (!sensors[s.id]) {
+            continue; /* the last cycle of a removed sensor */
+        }
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            client_t *c = &clients[i];
+
+            if (c->fd < 0 || !(c->subscribed >> s.id & 1)) {
+                continue;
+            }
+            s.dropped = c->dropped;
+            if (client_send(c, ZMODD_MSG_SAMPLE, &s, sizeof(s))) {
+                c->dropped++;
+            } else {
+                c->dropped = 0;
+            }
+        }
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) {
+            client_flush(&clients[i]);
+        }
+    }
+}
+
+static int listen_on(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        zlog_error("Socket path too long: %s", path);
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        zlog_error("Cannot create socket: %s", strerror(errno));
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(fd, MAX_CLIENTS)) {
+        zlog_error("Cannot listen on %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Serve until SIGINT or SIGTERM, reloading on SIGHUP; the signals are only
+ * unblocked while polling */
+static void serve(int listener, const sigset_t *poll_mask)
+{
+    struct pollfd pfd[2 + MAX_CLIENTS];
+    struct timespec timeout;
+    uint64_t retry_ms = 0; /**< when to repeat a reload, 0 never */
+    int map[MAX_CLIENTS];
+
+    while (!signalled) {
+        uint64_t now = clock_ms();
+        int n = 2;
+
+        /* a reload with waiting sensors is repeated once per cycle */
+        if (reload_requested || (retry_ms && now >= retry_ms)) {
+            reload_requested = 0;
+            retry_ms = reload() ? now + ZMOD4510_NO2_O3_SAMPLE_TIME : 0;
+        }
+        if (retry_ms) {
+            timeout.tv_sec = (time_t)((retry_ms - now) / 1000);
+            timeout.tv_nsec = (long)((retry_ms - now) % 1000) * 1000000;
+        }
+        pfd[0].fd = listener;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = sample_pipe[0];
+        pfd[1].events = POLLIN;
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (clients[i].fd >= 0) {
+                pfd[n].fd = clients[i].fd;
+                pfd[n].events = POLLIN | (clients[i].out_len ? POLLOUT : 0);
+                map[n - 2] = i;
+                n++;
+            }
+        }
+        if (ppoll(pfd, n, retry_ms ? &timeout : NULL, poll_mask) <= 0) {
+            continue; /* EINTR on a signal, or time to repeat the reload */
+        }
+        if (pfd[1].revents & POLLIN) {
+            dispatch_samples();
+        }
+        for (int k = 2; k < n; k++) {
+            client_t *c = &clients[map[k - 2]];
+
+            if (pfd[k].revents & POLLOUT) {
+                client_flush(c);
+            }
+            if (c->fd >= 0 && pfd[k].revents & (POLLIN | POLLHUP | POLLERR)) {
+                client_input(c);
+            }
+        }
+        if (pfd[0].revents & POLLIN) {
+            client_accept(listener);
+        }
+    }
+}
+
+/* ---- main ----------------------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigset_t block, poll_mask;
+    pthread_condattr_t attr;
+    pthread_mutexattr_t mattr;
+    sensor_t *s;
+    int listener, ret = EXIT_FAILURE;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <config-file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    conf_path = argv[1];
+    if (zmodd_conf_load(&conf, conf_path)) {
+        zlog_flush();
+        return EXIT_FAILURE;
+    }
+
+    /* blocked before any thread is created, so only ppoll receives them */
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &block, &poll_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&stop_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&hotplug_lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+    pthread_cond_init(&hotplug_cond, NULL);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    if (pipe2(sample_pipe, O_CLOEXEC | O_NONBLOCK)) {
+        goto out;
+    }
+    for (int b = 0; b < conf.bus_count; b++) {
+        if (bus_open(&buses[b], &conf.buses[b], b)) {
+            zlog_error("Cannot open bus %s", conf.buses[b].name);
+            goto out;
+        }
+    }
+    /* sized for every sensor, as sensors may be added to any bus */
+    for (int b = 0; b < conf.bus_count && conf.deadband_enabled; b++) {
+        if (deadband_init(&buses[b].deadband, ZMODD_MAX_SENSORS,
+                          &conf.deadband)) {
+            zlog_error("Cannot allocate the deadband of bus %s",
+                       conf.buses[b].name);
+            goto out;
+        }
+    }
+    if (conf.mqtt_enabled && mqtt_pub_start(&mqtt, &conf.mqtt)) {
+        zlog_error("Cannot start publishing to %s", conf.mqtt.host);
+        goto out;
+    }
+    listener = listen_on(conf.socket_path);
+    if (listener < 0) {
+        goto out;
+    }
+    zlog_info("Serving %d sensors on %s", conf.sensor_count, conf.socket_path);
+    if (0 == pthread_create(&supervisor, NULL, supervise, NULL)) {
+        /* the buses acquire from the start; each sensor joins its bus as
+         * soon as it is up */
+        for (int b = 0; b < conf.bus_count; b++) {
+            buses[b].started =
+                0 == pthread_create(&buses[b].thread, NULL, acquire, &buses[b]);
+        }
+        for (int i = 0; i < conf.sensor_count; i++) {
+            int err = sensor_add(&conf.sensors[i]);
+
+            if (err < 0) {
+                zlog_error("Cannot add sensor %s: error %d",
+                           conf.sensors[i].name, -err);
+            }
+        }
+        serve(listener, &poll_mask);
+        ret = EXIT_SUCCESS;
+
+        pthread_mutex_lock(&stop_lock);
+        stopping = 1;
+        pthread_cond_broadcast(&stop_cond);
+        pthread_mutex_unlock(&stop_lock);
+        for (int b = 0; b < conf.bus_count; b++) {
+            if (buses[b].started) {
+                pthread_join(buses[b].thread, NULL);
+            }
+        }
+        /* waits for the bring-ups still running */
+        pthread_mutex_lock(&hotplug_lock);
+        closing = 1;
+        pthread_cond_broadcast(&hotplug_cond);
+        pthread_mutex_unlock(&hotplug_lock);
+        pthread_join(supervisor, NULL);
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) {
+            client_close(&clients[i]);
+        }
+    }
+    close(listener);
+    unlink(conf.socket_path);
+
+out:
+    if (conf.mqtt_enabled) {
+        mqtt_pub_stop(&mqtt);
+    }
+    /* the sensors still in use: by id, or removed but not yet let go of */
+    for (int b = 0; b < conf.bus_count; b++) {
+        while ((s = buses[b].leave)) {
+            buses[b].leave = s->next;
+            free(s);
+        }
+        bus_close(&buses[b]);
+    }
+    for (int i = 0; i < ZMODD_MAX_SENSORS; i++) {
+        free(sensors[i]);
+    }
+    zlog_info("Exiting");
+    zlog_flush();
+    return ret;
+}
@@ -0,0 +1,298 @@
+/**
+ * @file    zmodd_conf.c
+ * @brief   Configuration file of the zmodd acquisition daemon
+ */
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zmodd_conf.h"
+#include "zmod4510_config_no2_o3.h"
+#include "util/zlog.h"
+
+#define MAX_TOKENS (14)
+
+static int parse_int(const char *s, long min, long max, long *value)
+{
+    char *end;
+
+    *value = strtol(s, &end, 0);
+    return !*s || *end || *value < min || *value > max;
+}
+
+static int parse_float(const char *s, float min, float max, float *value)
+{
+    char *end;
+    float v = strtof(s, &end);
+
+    if (!*s || *end || v < min || v > max) {
+        return -1;
+    }
+    *value = v;
+    return 0;
+}
+
+static int copy_name(char *dst, size_t size, const char *src)
+{
+    if (strlen(src) >= size) {
+        return -1;
+    }
+    strcpy(dst, src);
+    return 0;
+}
+
+static int find_bus(const zmodd_conf_t *conf, const char *name)
+{
+    for (int i = 0; i < conf->bus_count; i++) {
+        if (0 == strcmp(conf->buses[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* bus <name> <device|sim> [mux <addr>] */
+static int parse_bus(zmodd_conf_t *conf, char **tok, int n)
+{
+    zmodd_bus_conf_t *bus = &conf->buses[conf->bus_count];
+    long value;
+
+    if (n != 3 && n != 5) {
+        return -1;
+    }
+    if (conf->bus_count >= ZMODD_MAX_BUSES || find_bus(conf, tok[1]) >= 0 ||
+        copy_name(bus->name, sizeof(bus->name), tok[1])) {
+        return -1;
+    }
+    if (strcmp(tok[2], "sim")) {
+        if (copy_name(bus->device, sizeof(bus->device), tok[2])) {
+            return -1;
+        }
+    } else {
+        bus->device[0] = 0;
+    }
+    bus->mux_addr = -1;
+    if (5 == n) {
+        if (strcmp(tok[3], "mux") || parse_int(tok[4], 0x08, 0x77, &value)) {
+            return -1;
+        }
+        bus->mux_addr = (int)value;
+    }
+    conf->bus_count++;
+    return 0;
+}
+
+/* sensor <name> bus <bus> [channel <n>] [addr <addr>] */
+static int parse_sensor(zmodd_conf_t *conf, char **tok, int n)
+{
+    zmodd_sensor_conf_t *s = &conf->sensors[conf->sensor_count];
+    long value;
+
+    if (n < 4 || n % 2 || conf->sensor_count >= ZMODD_MAX_SENSORS ||
+        copy_name(s->name, sizeof(s->name), tok[1])) {
+        return -1;
+    }
+    s->bus = -1;
+    s->channel = -1;
+    s->i2c_addr = ZMOD4510_I2C_ADDR;
+    for (int i = 2; i < n; i += 2) {
+        if (0 == strcmp(tok[i], "bus")) {
+            s->bus = find_bus(conf, tok[i + 1]);
+        } else if (0 == strcmp(tok[i], "channel") &&
+                   !parse_int(tok[i + 1], 0, 7, &value)) {
+            s->channel = (int)value;
+        } else if (0 == strcmp(tok[i], "addr") &&
+                   !parse_int(tok[i + 1], 0x08, 0x77, &value)) {
+            s->i2c_addr = (uint8_t)value;
+        } else {
+            return -1;
+        }
+    }
+    /* a channel is required behind a multiplexer and meaningless without */
+    if (s->bus < 0 ||
+        (conf->buses[s->bus].mux_addr < 0) != (s->channel < 0)) {
+        return -1;
+    }
+    /* names identify sensors on reload, and a location holds one sensor */
+    for (int i = 0; i < conf->sensor_count; i++) {
+        const zmodd_sensor_conf_t *o = &conf->sensors[i];
+
+        if (0 == strcmp(o->name, s->name) ||
+            (o->bus == s->bus && o->channel == s->channel &&
+             o->i2c_addr == s->i2c_addr)) {
+            return -1;
+        }
+    }
+    conf->sensor_count++;
+    return 0;
+}
+
+/* mqtt <host> [port <n>] [topic <t>] [interval <s>] [format <f>] [spool <p>] */
+static int parse_mqtt(zmodd_conf_t *conf, char **tok, int n)
+{
+    mqtt_pub_config_t *m = &conf->mqtt;
+    long value;
+    int bad = n % 2 || conf->mqtt_enabled ||
+              copy_name(m->host, sizeof(m->host), tok[1]);
+
+    for (int i = 2; i < n && !bad; i += 2) {
+        const char *key = tok[i], *arg = tok[i + 1];
+
+        if (0 == strcmp(key, "port")) {
+            bad = parse_int(arg, 1, 65535, &value);
+            m->port = (uint16_t)value;
+        } else if (0 == strcmp(key, "topic")) {
+            bad = copy_name(m->topic, sizeof(m->topic), arg);
+        } else if (0 == strcmp(key, "interval")) {
+            bad = parse_int(arg, 1, 86400, &value);
+            m->interval_ms = (uint32_t)value * 1000;
+        } else if (0 == strcmp(key, "format")) {
+            bad = strcmp(arg, "jsonl") && strcmp(arg, "line");
+            m->format = strcmp(arg, "line") ? EXPORT_JSONL : EXPORT_LINE;
+        } else if (0 == strcmp(key, "spool")) {
+            bad = copy_name(m->spool_path, sizeof(m->spool_path), arg);
+        } else {
+            bad = 1;
+        }
+    }
+    conf->mqtt_enabled = !bad;
+    return bad ? -1 : 0;
+}
+
+/* deadband [o3 <ppb>] [no2 <ppb>] [rel <percent>] [heartbeat <s>] */
+static int parse_deadband(zmodd_conf_t *conf, char **tok, int n)
+{
+    deadband_config_t *d = &conf->deadband;
+    long value;
+    float rel = d->rel * 100;
+    int bad = !(n % 2) || conf->deadband_enabled;
+
+    for (int i = 1; i < n && !bad; i += 2) {
+        const char *key = tok[i], *arg = tok[i + 1];
+
+        if (0 == strcmp(key, "o3")) {
+            bad = parse_float(arg, 0, 10000, &d->o3_abs_ppb);
+        } else if (0 == strcmp(key, "no2")) {
+            bad = parse_float(arg, 0, 10000, &d->no2_abs_ppb);
+        } else if (0 == strcmp(key, "rel")) {
+            bad = parse_float(arg, 0, 100, &rel);
+            d->rel = rel / 100;
+        } else if (0 == strcmp(key, "heartbeat")) {
+            bad = parse_int(arg, 0, 86400, &value);
+            d->heartbeat_ms = (uint32_t)value * 1000;
+        } else {
+            bad = 1;
+        }
+    }
+    conf->deadband_enabled = !bad;
+    return bad ? -1 : 0;
+}
+
+/* realtime [priority <n>] [policy fifo|rr] [cpu <n>] */
+static int parse_realtime(zmodd_conf_t *conf, char **tok, int n)
+{
+    zrt_config_t *rt = &conf->rt;
+    long value;
+    int bad = !(n % 2) || conf->rt_enabled;
+
+    for (int i = 1; i < n && !bad; i += 2) {
+        const char *key = tok[i], *arg = tok[i + 1];
+
+        if (0 == strcmp(key, "priority")) {
+            bad = parse_int(arg, 1, 99, &value);
+            rt->priority = (int)value;
+        } else if (0 == strcmp(key, "policy")) {
+            bad = strcmp(arg, "fifo") && strcmp(arg, "rr");
+            rt->policy = strcmp(arg, "rr") ? SCHED_FIFO : SCHED_RR;
+        } else if (0 == strcmp(key, "cpu")) {
+            bad = parse_int(arg, 0, 1023, &value);
+            rt->cpu = (int)value;
+        } else {
+            bad = 1;
+        }
+    }
+    conf->rt_enabled = !bad;
+    return bad ? -1 : 0;
+}
+
+static int parse_line(zmodd_conf_t *conf, char *line)
+{
+    char *tok[MAX_TOKENS], *save = NULL;
+    int n = 0;
+
+    line[strcspn(line, "#\r\n")] = 0;
+    for (char *t = strtok_r(line, " \t", &save); t;
+         t = strtok_r(NULL, " \t", &save)) {
+        if (n == MAX_TOKENS) {
+            return -1;
+        }
+        tok[n++] = t;
+    }
+    if (0 == n) {
+        return 0;
+    }
+    if (0 == strcmp(tok[0], "bus")) {
+        return parse_bus(conf, tok, n);
+    }
+    if (0 == strcmp(tok[0], "sensor")) {
+        return parse_sensor(conf, tok, n);
+    }
+    if (0 == strcmp(tok[0], "mqtt")) {
+        return parse_mqtt(conf, tok, n);
+    }
+    if (0 == strcmp(tok[0], "deadband")) {
+        return parse_deadband(conf, tok, n);
+    }
+    if (0 == strcmp(tok[0], "realtime")) {
+        return parse_realtime(conf, tok, n);
+    }
+    if (2 != n) {
+        return -1;
+    }
+    if (0 == strcmp(tok[0], "socket")) {
+        return copy_name(conf->socket_path, sizeof(conf->socket_path), tok[1]);
+    }
+    if (0 == strcmp(tok[0], "temperature")) {
+        return parse_float(tok[1], -300, 100, &conf->temperature);
+    }
+    if (0 == strcmp(tok[0], "humidity")) {
+        return parse_float(tok[1], 0, 100, &conf->humidity);
+    }
+    return -1;
+}
+
+int zmodd_conf_load(zmodd_conf_t *conf, const char *path)
+{
+    char line[256];
+    int number = 0;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        zlog_error("Cannot open configuration %s", path);
+        return -1;
+    }
+    memset(conf, 0, sizeof(*conf));
+    strcpy(conf->socket_path, ZMODD_DEFAULT_SOCKET);
+    conf->temperature = -300;
+    conf->humidity = 50;
+    conf->mqtt = mqtt_pub_default_config;
+    strcpy(conf->mqtt.client_id, "zmodd");
+    conf->deadband = deadband_default_config;
+    conf->rt = zrt_default_config;
+
+    while (fgets(line, sizeof(line), f)) {
+        number++;
+        if (parse_line(conf, line)) {
+            zlog_error("%s:%d: invalid directive", path, number);
+            fclose(f);
+            return number;
+        }
+    }
+    fclose(f);
+    if (0 == conf->sensor_count) {
+        zlog_error("%s: no sensors configured", path);
+        return number + 1;
+    }
+    return 0;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file    zmodd_conf.h
+ * @brief   Configuration file of the zmodd acquisition daemon
+ *
+ * The file lists the buses and the sensors on them, one directive per line.
+ *  Text after '#' is a comment.
+ *
+ *     socket /run/zmodd.sock
+ *     temperature -300          # ambient inputs of the algorithm
+ *     humidity 50
+ *     bus main /dev/i2c-1 mux 0x70
+ *     bus lab sim
+ *     sensor intake bus main channel 0
+ *     sensor exhaust bus main channel 1 addr 0x33
+ *     sensor bench bus lab
+ *     mqtt broker.lan port 1883 topic site/air interval 60 spool /var/lib/zmodd.spool
+ *     deadband o3 1 no2 1 rel 5 heartbeat 300
+ *     realtime priority 50 cpu 3
+ *
+ * A bus is an I2C device or "sim" for simulated sensors, optionally behind
+ *  a TCA9548A-style multiplexer at the given address. A sensor names its
+ *  bus, its multiplexer channel if the bus has one, and its address
+ *  (default 0x33). Sensors are numbered in the order they are listed; no
+ *  two may share a name or a location (bus, channel and address).
+ *
+ * On SIGHUP the daemon rereads the file and applies its sensors: a sensor
+ *  no longer listed, or listed with another bus, channel or address, is
+ *  removed, and a newly listed one is added; the others keep acquiring.
+ *  Sensors are matched by name. A sensor at the location (bus, channel and
+ *  address) of a removed one, e.g. a renamed one, is added once the
+ *  removed one has left its bus, at the latest one cycle later. Changes to
+ *  the other directives, buses included, take effect at the next start.
+ *
+ * The optional mqtt directive also publishes every result to a broker
+ *  (mqtt_pub.h). After the host come optional settings: port, topic,
+ *  interval in seconds, format (jsonl or line) and spool file.
+ *
+ * The optional deadband directive passes a result on to the clients and the
+ *  broker only if it differs from the last one passed on (deadband.h): by
+ *  more than o3 or no2 ppb or rel percent, in its AQI category or status,
+ *  or if the last one is heartbeat seconds old. Omitted settings keep the
+ *  defaults of deadband_default_config.
+ *
+ * The optional realtime directive runs the acquisition threads in
+ *  real-time mode (zrt.h): with the given priority and policy (fifo or
+ *  rr), pinned to a CPU if one is given, and with the memory locked.
+ *  Omitted settings keep the defaults of zrt_default_config.
+ */
+
+#ifndef ZMODD_CONF_H
+#define ZMODD_CONF_H
+
+#include <stdint.h>
+#include "zmodd_proto.h"
+#include "mqtt_pub.h"
+#include "deadband.h"
+#include "util/zrt.h"
+
+#define ZMODD_MAX_BUSES   (8)
+#define ZMODD_MAX_SENSORS (64)
+#define ZMODD_PATH_LEN    (108)
+
+typedef struct {
+    char name[ZMODD_NAME_LEN];
+    char device[ZMODD_PATH_LEN]; /**< bus device, empty for simulated */
+    int mux_addr;                /**< multiplexer address, -1 if none */
+} zmodd_bus_conf_t;
+
+typedef struct {
+    char name[ZMODD_NAME_LEN];
+    int bus;                     /**< index into zmodd_conf_t::buses */
+    int channel;                 /**< multiplexer channel, -1 if none */
+    uint8_t i2c_addr;
+} zmodd_sensor_conf_t;
+
+typedef struct {
+    char socket_path[ZMODD_PATH_LEN];
+    float temperature;
+    float humidity;
+    int bus_count;
+    zmodd_bus_conf_t buses[ZMODD_MAX_BUSES];
+    int sensor_count;
+    zmodd_sensor_conf_t sensors[ZMODD_MAX_SENSORS];
+    int mqtt_enabled;
+    mqtt_pub_config_t mqtt;
+    int deadband_enabled;
+    deadband_config_t deadband;
+    int rt_enabled;
+    zrt_config_t rt;
+} zmodd_conf_t;
+
+/**
+ * @brief Read a configuration file
+ * @param [out] conf parsed configuration
+ * @param [in] path file to read
+ * @return 0 on success, otherwise the number of the first bad line, or -1
+ *         if the file cannot be read
+ */
+int zmodd_conf_load(zmodd_conf_t *conf, const char *path);
+
+#endif /* ZMODD_CONF_H */
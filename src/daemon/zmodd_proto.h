@@ -0,0 +1,113 @@
+/**
+ * @file    zmodd_proto.h
+ * @brief   Wire protocol of the zmodd acquisition daemon
+ *
+ * Clients connect to the daemon's Unix stream socket and exchange frames.
+ *  Every frame is a zmodd_hdr_t followed by `length` payload bytes. All
+ *  fields are in host byte order and the structures are packed; client and
+ *  daemon always run on the same machine.
+ *
+ * On connect the daemon sends ZMODD_MSG_HELLO. A client then sends
+ *  ZMODD_MSG_LIST to learn the sensors and ZMODD_MSG_SUBSCRIBE with the ids
+ *  it wants; from then on the daemon pushes a ZMODD_MSG_SAMPLE for every
+ *  completed measurement of a subscribed sensor. A client that does not
+ *  keep up loses samples, never the connection; the count of lost samples
+ *  is reported in the next sample it receives.
+ *
+ * Sensors can be added and removed while the daemon runs, by any client
+ *  with ZMODD_MSG_ADD and ZMODD_MSG_REMOVE or by reloading the
+ *  configuration file. Every client is told of each change with a
+ *  ZMODD_MSG_SENSOR: of the new sensor, or with ZMODD_STAGE_REMOVED. The
+ *  id of a removed sensor is not reused until the other ids have been. A
+ *  sensor cannot be added at the bus, channel and address of another one,
+ *  also not of a removed one until its bus has let go of it.
+ */
+
+#ifndef ZMODD_PROTO_H
+#define ZMODD_PROTO_H
+
+#include <stdint.h>
+
+#define ZMODD_PROTO_VERSION  (2)
+#define ZMODD_DEFAULT_SOCKET "/run/zmodd.sock"
+
+/** Sensor id that stands for all sensors in subscribe and unsubscribe */
+#define ZMODD_ALL_SENSORS    (0xFFFF)
+/** Maximum payload length of a frame */
+#define ZMODD_MAX_PAYLOAD    (512)
+/** Maximum length of a sensor name including the terminating zero */
+#define ZMODD_NAME_LEN       (24)
+/** Stage of a sensor that has been removed */
+#define ZMODD_STAGE_REMOVED  (-1)
+
+typedef enum {
+    /* daemon to client */
+    ZMODD_MSG_HELLO = 1,   /**< zmodd_hello_t */
+    ZMODD_MSG_SENSOR,      /**< zmodd_sensor_t, one per sensor after LIST,
+                                and one per sensor added or removed */
+    ZMODD_MSG_SAMPLE,      /**< zmodd_sample_t */
+    ZMODD_MSG_ERROR,       /**< zmodd_error_t, reply to a bad request */
+    /* client to daemon */
+    ZMODD_MSG_LIST = 0x40, /**< no payload */
+    ZMODD_MSG_SUBSCRIBE,   /**< array of uint16_t sensor ids */
+    ZMODD_MSG_UNSUBSCRIBE, /**< array of uint16_t sensor ids */
+    ZMODD_MSG_ADD,         /**< zmodd_add_t */
+    ZMODD_MSG_REMOVE       /**< array of uint16_t sensor ids */
+} zmodd_msg_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;    /**< zmodd_msg_t */
+    uint8_t flags;   /**< reserved, 0 */
+    uint16_t length; /**< payload bytes following the header */
+} zmodd_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t version;      /**< ZMODD_PROTO_VERSION */
+    uint16_t sensor_count; /**< sensor ids are below sensor_count, LIST
+                                tells which are in use */
+} zmodd_hello_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t id;
+    uint8_t bus;                 /**< index of the bus in the config file */
+    int8_t channel;              /**< multiplexer channel, -1 if none */
+    uint8_t i2c_addr;
+    int8_t stage;                /**< fleet_stage_t or ZMODD_STAGE_REMOVED */
+    int16_t error;               /**< zmod4xxx_err if the stage is failed */
+    char name[ZMODD_NAME_LEN];   /**< zero terminated */
+} zmodd_sensor_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t id;
+    int16_t status;       /**< NO2_O3_OK, NO2_O3_STABILIZATION or an error */
+    uint32_t dropped;     /**< samples lost for this client since the last */
+    int64_t timestamp_ms; /**< wall-clock time the ADC result was read */
+    float o3_ppb;
+    float no2_ppb;
+    uint16_t fast_aqi;
+    uint16_t epa_aqi;
+    float rmox[4];
+} zmodd_sample_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bus;                 /**< index of the bus in the config file */
+    int8_t channel;              /**< multiplexer channel, -1 if none */
+    uint8_t i2c_addr;
+    uint8_t reserved;            /**< 0 */
+    char name[ZMODD_NAME_LEN];   /**< zero terminated, unique */
+} zmodd_add_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t request; /**< type of the rejected frame */
+    uint8_t reserved;
+    uint16_t code;   /**< ZMODD_ERR_* */
+} zmodd_error_t;
+
+#define ZMODD_ERR_UNKNOWN_MSG    (1)
+#define ZMODD_ERR_BAD_LENGTH     (2)
+#define ZMODD_ERR_UNKNOWN_SENSOR (3)
+#define ZMODD_ERR_BAD_SENSOR     (4) /**< invalid, or name or location
+                                          in use */
+#define ZMODD_ERR_NO_ROOM        (5) /**< no sensor id is free */
+
+#endif /* ZMODD_PROTO_H */
@@ -0,0 +1,183 @@
+/**
+ * @file    zmodd_sub.c
+ * @brief   Command line client of the zmodd acquisition daemon
+ *
+ * Lists the daemon's sensors, subscribes to the given ones (all if none is
+ *  given) and prints every pushed sample as one line of key=value pairs.
+ *  With -a it adds a sensor to the running daemon instead, with -r it
+ *  removes sensors, and prints the daemon's replies.
+ *
+ * Usage: zmodd-sub [-s socket] [sensor-id ...]
+ *        zmodd-sub [-s socket] -a <name> <bus-index> [channel [addr]]
+ *        zmodd-sub [-s socket] -r <sensor-id> ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "zmodd_proto.h"
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int send_frame(int fd, uint8_t type, const void *payload,
+                      uint16_t length)
+{
+    uint8_t buf[sizeof(zmodd_hdr_t) + ZMODD_MAX_PAYLOAD];
+    zmodd_hdr_t hdr = { type, 0, length };
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), payload, length);
+    return write(fd, buf, sizeof(hdr) + length) ==
+                   (ssize_t)(sizeof(hdr) + length)
+               ? 0
+               : -1;
+}
+
+static void print_frame(const zmodd_hdr_t *hdr, const uint8_t *payload)
+{
+    zmodd_hello_t hello;
+    zmodd_sensor_t sensor;
+    zmodd_sample_t s;
+    zmodd_error_t e;
+
+    switch (hdr->type) {
+    case ZMODD_MSG_HELLO:
+        memcpy(&hello, payload, sizeof(hello));
+        printf("version=%u sensors=%u\n", hello.version, hello.sensor_count);
+        break;
+    case ZMODD_MSG_SENSOR:
+        memcpy(&sensor, payload, sizeof(sensor));
+        printf("sensor=%u name=%.*s bus=%u channel=%d addr=0x%02X stage=%d "
+               "error=%d\n",
+               sensor.id, ZMODD_NAME_LEN, sensor.name, sensor.bus,
+               sensor.channel, sensor.i2c_addr, sensor.stage, sensor.error);
+        break;
+    case ZMODD_MSG_SAMPLE:
+        memcpy(&s, payload, sizeof(s));
+        printf("sample=%u ts=%lld status=%d o3_ppb=%.3f no2_ppb=%.3f "
+               "fast_aqi=%u epa_aqi=%u dropped=%u\n",
+               s.id, (long long)s.timestamp_ms, s.status, s.o3_ppb,
+               s.no2_ppb, s.fast_aqi, s.epa_aqi, s.dropped);
+        break;
+    case ZMODD_MSG_ERROR:
+        memcpy(&e, payload, sizeof(e));
+        printf("error=%u request=0x%02X\n", e.code, e.request);
+        break;
+    }
+    fflush(stdout);
+}
+
+/* Print frames until replies answers to a request came; returns nonzero
+ * if the daemon rejected one */
+static int await_replies(int fd, int replies)
+{
+    uint8_t payload[ZMODD_MAX_PAYLOAD];
+    zmodd_hdr_t hdr;
+    int rejected = 0;
+
+    while (replies > 0 && 0 == read_full(fd, &hdr, sizeof(hdr)) &&
+           hdr.length <= sizeof(payload) &&
+           0 == read_full(fd, payload, hdr.length)) {
+        print_frame(&hdr, payload);
+        replies -= ZMODD_MSG_SENSOR == hdr.type || ZMODD_MSG_ERROR == hdr.type;
+        rejected |= ZMODD_MSG_ERROR == hdr.type;
+    }
+    return rejected || replies > 0;
+}
+
+static int add_sensor(int fd, int argc, char **argv)
+{
+    zmodd_add_t add = { 0 };
+
+    if (argc < 2 || strlen(argv[0]) >= sizeof(add.name)) {
+        fprintf(stderr, "-a <name> <bus-index> [channel [addr]]\n");
+        return EXIT_FAILURE;
+    }
+    strcpy(add.name, argv[0]);
+    add.bus = (uint8_t)strtoul(argv[1], NULL, 0);
+    add.channel = (int8_t)(argc > 2 ? strtol(argv[2], NULL, 0) : -1);
+    add.i2c_addr = (uint8_t)(argc > 3 ? strtoul(argv[3], NULL, 0) : 0x33);
+    if (send_frame(fd, ZMODD_MSG_ADD, &add, sizeof(add))) {
+        perror("send");
+        return EXIT_FAILURE;
+    }
+    return await_replies(fd, 1) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int remove_sensors(int fd, int argc, char **argv)
+{
+    uint16_t ids[ZMODD_MAX_PAYLOAD / sizeof(uint16_t)];
+    int n = 0;
+
+    for (; n < argc && n < (int)(sizeof(ids) / sizeof(ids[0])); n++) {
+        ids[n] = (uint16_t)strtoul(argv[n], NULL, 0);
+    }
+    if (0 == n || send_frame(fd, ZMODD_MSG_REMOVE, ids, n * sizeof(ids[0]))) {
+        fprintf(stderr, "-r <sensor-id> ...\n");
+        return EXIT_FAILURE;
+    }
+    return await_replies(fd, n) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    const char *path = ZMODD_DEFAULT_SOCKET;
+    uint16_t ids[ZMODD_MAX_PAYLOAD / sizeof(uint16_t)];
+    uint16_t n = 0;
+    uint8_t payload[ZMODD_MAX_PAYLOAD];
+    zmodd_hdr_t hdr;
+    int fd, i = 1;
+
+    if (argc > 2 && 0 == strcmp(argv[1], "-s")) {
+        path = argv[2];
+        i = 3;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    if (i < argc && 0 == strcmp(argv[i], "-a")) {
+        return add_sensor(fd, argc - i - 1, argv + i + 1);
+    }
+    if (i < argc && 0 == strcmp(argv[i], "-r")) {
+        return remove_sensors(fd, argc - i - 1, argv + i + 1);
+    }
+
+    for (; i < argc && n < sizeof(ids) / sizeof(ids[0]); i++) {
+        ids[n++] = (uint16_t)strtoul(argv[i], NULL, 0);
+    }
+    if (0 == n) {
+        ids[n++] = ZMODD_ALL_SENSORS;
+    }
+    if (send_frame(fd, ZMODD_MSG_LIST, NULL, 0) ||
+        send_frame(fd, ZMODD_MSG_SUBSCRIBE, ids, n * sizeof(ids[0]))) {
+        perror("send");
+        return EXIT_FAILURE;
+    }
+    while (0 == read_full(fd, &hdr, sizeof(hdr)) &&
+           hdr.length <= sizeof(payload) &&
+           0 == read_full(fd, payload, hdr.length)) {
+        print_frame(&hdr, payload);
+    }
+    close(fd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,293 @@
+/**
+ * @file    fleet.c
+ * @brief   Concurrent bring-up of many ZMOD4510 sensors
+ */
+
+#include <stdlib.h>
+#include "fleet.h"
+#include "zmod4xxx.h"
+#include "zmod4xxx_hal.h"
+#include "zmod4xxx_cleaning.h"
+#include "util/zlog.h"
+#include "util/ztrace.h"
+
+typedef struct {
+    fleet_sensor_t *sensors;
+    int count;
+    int next;
+    fleet_progress_fn progress;
+    void *ctx;
+    pthread_mutex_t lock;
+} fleet_run_t;
+
+static const char *const stage_names[] = {
+    "pending", "detect", "cleaning", "prepare", "ready", "failed"
+};
+
+/* Wait for the bus in FIFO order and switch the multiplexer to the
+ * sensor's channel. Returns with the bus held, also on error. */
+static int bus_acquire(fleet_sensor_t *s)
+{
+    fleet_bus_t *bus = s->bus;
+    uint32_t ticket;
+    int ret = 0;
+
+    pthread_mutex_lock(&bus->lock);
+    ticket = bus->next_ticket++;
+    while (ticket != bus->serving) {
+        pthread_cond_wait(&bus->turn, &bus->lock);
+    }
+    pthread_mutex_unlock(&bus->lock);
+
+    if (s->channel >= 0 && s->channel != bus->channel) {
+        ret = bus->select(bus->select_ctx, bus->hal, s->channel);
+        bus->channel = ret ? -1 : s->channel;
+    }
+    return ret;
+}
+
+static void bus_release(fleet_bus_t *bus)
+{
+    pthread_mutex_lock(&bus->lock);
+    bus->transactions++;
+    bus->serving++;
+    pthread_cond_broadcast(&bus->turn);
+    pthread_mutex_unlock(&bus->lock);
+}
+
+static int sched_read(void *handle, uint8_t addr, uint8_t *wr, int wr_len,
+                      uint8_t *rd, int rd_len)
+{
+    fleet_sensor_t *s = handle;
+    Interface_t *hal = s->bus->hal;
+    int ret = bus_acquire(s);
+
+    if (!ret) {
+        ret = hal->i2cRead(hal->handle, addr, wr, wr_len, rd, rd_len);
+    }
+    bus_release(s->bus);
+    return ret ? ecHALError : ecSuccess;
+}
+
+static int sched_write(void *handle, uint8_t addr, uint8_t *wr1, int len1,
+                       uint8_t *wr2, int len2)
+{
+    fleet_sensor_t *s = handle;
+    Interface_t *hal = s->bus->hal;
+    int ret = bus_acquire(s);
+
+    if (!ret) {
+        ret = hal->i2cWrite(hal->handle, addr, wr1, len1, wr2, len2);
+    }
+    bus_release(s->bus);
+    return ret ? ecHALError : ecSuccess;
+}
+
+static int sched_batch(void *handle, I2CSegment_t *seg, int count)
+{
+    fleet_sensor_t *s = handle;
+    Interface_t *hal = s->bus->hal;
+    int ret = bus_acquire(s);
+
+    if (!ret) {
+        ret = hal->i2cBatch(hal->handle, seg, count);
+    }
+    bus_release(s->bus);
+    return ret ? ecHALError : ecSuccess;
+}
+
+static int sched_reset(void *handle)
+{
+    fleet_sensor_t *s = handle;
+    Interface_t *hal = s->bus->hal;
+    int ret = bus_acquire(s);
+
+    if (!ret) {
+        ret = hal->reset(hal->handle);
+    }
+    bus_release(s->bus);
+    return ret;
+}
+
+void fleet_bus_init(fleet_bus_t *bus, Interface_t *hal, fleet_mux_fn select,
+                    void *ctx)
+{
+    bus->hal = hal;
+    bus->select = select;
+    bus->select_ctx = ctx;
+    pthread_mutex_init(&bus->lock, NULL);
+    pthread_cond_init(&bus->turn, NULL);
+    bus->next_ticket = 0;
+    bus->serving = 0;
+    bus->channel = -1;
+    bus->transactions = 0;
+}
+
+void fleet_bus_destroy(fleet_bus_t *bus)
+{
+    pthread_cond_destroy(&bus->turn);
+    pthread_mutex_destroy(&bus->lock);
+}
+
+void fleet_sensor_init(fleet_sensor_t *sensor, fleet_bus_t *bus, int channel)
+{
+    sensor->bus = bus;
+    sensor->channel = bus->select ? channel : -1;
+    sensor->hal.handle = sensor;
+    sensor->hal.i2cRead = sched_read;
+    sensor->hal.i2cWrite = sched_write;
+    sensor->hal.msSleep = bus->hal->msSleep;
+    sensor->hal.reset = bus->hal->reset ? sched_reset : NULL;
+    sensor->hal.msClock = bus->hal->msClock;
+    sensor->hal.i2cBatch = bus->hal->i2cBatch ? sched_batch : NULL;
+    sensor->hal.msSleepUntil = bus->hal->msSleepUntil;
+    sensor->stage = FLEET_PENDING;
+    sensor->error = 0;
+}
+
+void fleet_select(fleet_sensor_t *sensor)
+{
+    zmod4xxx_select(&sensor->hal);
+}
+
+int fleet_recover(fleet_sensor_t *sensor, int error)
+{
+    int ret;
+
+    switch (error) {
+    case ERROR_POR_EVENT:
+    case ERROR_CONFIG_MISMATCH:
+        ZTRACE_INSTANT("recover", sensor->dev.i2c_addr, error);
+        zmod4xxx_invalidate_shadow(&sensor->dev);
+        ret = zmod4xxx_prepare_sensor(&sensor->dev);
+        if (!ret) {
+            ret = zmod4xxx_verify_config(&sensor->dev);
+        }
+        return ret;
+    case ERROR_GAS_TIMEOUT:
+        return zmod4xxx_stop_measurement(&sensor->dev);
+    default:
+        return 0;
+    }
+}
+
+const char *fleet_stage_name(fleet_stage_t stage)
+{
+    return stage <= FLEET_FAILED ? stage_names[stage] : "unknown";
+}
+
+static void set_stage(fleet_run_t *run, int index, fleet_stage_t stage)
+{
+    fleet_sensor_t *s = &run->sensors[index];
+
+    pthread_mutex_lock(&run->lock);
+    s->stage = stage;
+    if (run->progress) {
+        run->progress(run->ctx, index, s);
+    }
+    pthread_mutex_unlock(&run->lock);
+}
+
+static int bring_up(fleet_run_t *run, int index)
+{
+    fleet_sensor_t *s = &run->sensors[index];
+    int ret;
+
+    set_stage(run, index, FLEET_DETECT);
+    ret = zmod4xxx_init(&s->dev, &s->hal);
+    if (!ret) {
+        ret = zmod4xxx_read_sensor_info(&s->dev);
+    }
+    if (ret) {
+        return ret;
+    }
+
+    set_stage(run, index, FLEET_CLEANING);
+    ret = zmod4xxx_cleaning_run(&s->dev);
+    zmod4xxx_invalidate_shadow(&s->dev);
+    if (ret && ERROR_CLEANING != ret) {
+        return ret;
+    }
+
+    set_stage(run, index, FLEET_PREPARE);
+    ret = zmod4xxx_prepare_sensor(&s->dev);
+    if (!ret) {
+        ret = zmod4xxx_verify_config(&s->dev);
+    }
+    return ret;
+}
+
+static void *worker(void *arg)
+{
+    fleet_run_t *run = arg;
+    int index;
+
+    for (;;) {
+        pthread_mutex_lock(&run->lock);
+        index = run->next < run->count ? run->next++ : -1;
+        pthread_mutex_unlock(&run->lock);
+        if (index < 0) {
+            break;
+        }
+
+        run->sensors[index].error = bring_up(run, index);
+        if (run->sensors[index].error) {
+            zlog_error("Sensor %d: %s failed with error %d", index,
+                       fleet_stage_name(run->sensors[index].stage),
+                       run->sensors[index].error);
+            set_stage(run, index, FLEET_FAILED);
+        } else {
+            set_stage(run, index, FLEET_READY);
+        }
+    }
+    return NULL;
+}
+
+int fleet_bring_up(fleet_sensor_t *sensors, int count, int max_parallel,
+                   fleet_progress_fn progress, void *ctx)
+{
+    fleet_run_t run = { .sensors = sensors, .count = count,
+                        .progress = progress, .ctx = ctx };
+    pthread_t *threads;
+    int started = 0, failed = 0;
+
+    if (max_parallel <= 0 || max_parallel > count) {
+        max_parallel = count;
+    }
+    threads = calloc(max_parallel > 0 ? max_parallel : 1, sizeof(*threads));
+    if (!threads) {
+        return -1;
+    }
+    pthread_mutex_init(&run.lock, NULL);
+    while (started < max_parallel &&
+           0 == pthread_create(&threads[started], NULL, worker, &run)) {
+        started++;
+    }
+    if (0 == started && count > 0) {
+        free(threads);
+        pthread_mutex_destroy(&run.lock);
+        return -1;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&run.lock);
+
+    for (int i = 0; i < count; i++) {
+        failed += FLEET_READY != sensors[i].stage;
+    }
+    return failed;
+}
+
+int fleet_bring_up_one(fleet_sensor_t *sensor, fleet_progress_fn progress,
+                       void *ctx)
+{
+    fleet_run_t run = { .sensors = sensor, .count = 1,
+                        .progress = progress, .ctx = ctx };
+
+    pthread_mutex_init(&run.lock, NULL);
+    worker(&run);
+    pthread_mutex_destroy(&run.lock);
+    return sensor->error;
+}
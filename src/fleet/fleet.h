@@ -0,0 +1,172 @@
+/**
+ * @file    fleet.h
+ * @brief   Concurrent bring-up of many ZMOD4510 sensors
+ *
+ * Detection, cleaning and preparation of a sensor are dominated by waits on
+ *  the sensor (the first-time cleaning alone takes about a minute), so the
+ *  sensors of a fleet are brought up concurrently, each on its own worker
+ *  thread.
+ *
+ * Sensors sharing a bus are serialized per I2C transaction, not per sensor:
+ *  every transaction takes the bus in FIFO order, switches the multiplexer
+ *  to the sensor's channel if needed, and releases the bus again, so one
+ *  sensor's transfers never interleave with another's while all of them wait
+ *  on their sequencers in parallel.
+ */
+
+#ifndef FLEET_H
+#define FLEET_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "hal/hal.h"
+#include "zmod4xxx_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Switch a bus multiplexer to a channel
+ * @param [in] ctx user pointer of the bus
+ * @param [in] hal transport of the bus
+ * @param [in] channel channel to select
+ * @return 0 on success
+ */
+typedef int (*fleet_mux_fn)(void *ctx, Interface_t *hal, int channel);
+
+/**
+ * @brief One physical I2C bus
+ */
+typedef struct {
+    Interface_t *hal;      /**< transport, e.g. from HAL_Init or SIM_Init */
+    fleet_mux_fn select;   /**< multiplexer control, NULL if none */
+    void *select_ctx;      /**< user pointer passed to select */
+    /* scheduler state, set up by fleet_bus_init */
+    pthread_mutex_t lock;
+    pthread_cond_t turn;
+    uint32_t next_ticket;
+    uint32_t serving;
+    int channel;           /**< currently selected channel, -1 unknown */
+    uint32_t transactions; /**< I2C transactions performed on the bus */
+} fleet_bus_t;
+
+/**
+ * @brief Bring-up stages reported to the progress callback
+ */
+typedef enum {
+    FLEET_PENDING = 0,
+    FLEET_DETECT,
+    FLEET_CLEANING,
+    FLEET_PREPARE,
+    FLEET_READY,
+    FLEET_FAILED
+} fleet_stage_t;
+
+/**
+ * @brief One sensor of the fleet
+ */
+typedef struct {
+    fleet_bus_t *bus;      /**< bus the sensor is connected to */
+    int channel;           /**< multiplexer channel, -1 if none */
+    zmod4xxx_dev_t dev;    /**< sensor object, usable after FLEET_READY */
+    Interface_t hal;       /**< view of the bus scheduled for this sensor */
+    fleet_stage_t stage;
+    int error;             /**< zmod4xxx_err of the failing step */
+} fleet_sensor_t;
+
+/**
+ * @brief Progress callback, called on every stage change of a sensor
+ * @note  Calls are serialized; they come from the worker threads.
+ */
+typedef void (*fleet_progress_fn)(void *ctx, int index,
+                                  const fleet_sensor_t *sensor);
+
+/**
+ * @brief Initialize a bus
+ * @param [out] bus bus object
+ * @param [in] hal transport of the bus
+ * @param [in] select multiplexer control, NULL if none
+ * @param [in] ctx user pointer passed to select
+ */
+void fleet_bus_init(fleet_bus_t *bus, Interface_t *hal, fleet_mux_fn select,
+                    void *ctx);
+
+/**
+ * @brief Release the resources of a bus
+ */
+void fleet_bus_destroy(fleet_bus_t *bus);
+
+/**
+ * @brief Attach a sensor to a bus
+ *
+ * The caller then sets up sensor->dev as for zmod4xxx_init: i2c_addr, pid,
+ *  init_conf, meas_conf and the prod_data buffer.
+ *
+ * @param [out] sensor sensor object
+ * @param [in] bus bus the sensor is connected to
+ * @param [in] channel multiplexer channel, -1 if none
+ */
+void fleet_sensor_init(fleet_sensor_t *sensor, fleet_bus_t *bus, int channel);
+
+/**
+ * @brief Detect, clean (if not yet done) and prepare all sensors
+ * @param [in,out] sensors sensors to bring up
+ * @param [in] count number of sensors
+ * @param [in] max_parallel maximum number of concurrent bring-ups, 0 for all
+ * @param [in] progress progress callback, may be NULL
+ * @param [in] ctx user pointer passed to progress
+ * @return number of sensors that failed, -1 if no worker could be started
+ */
+int fleet_bring_up(fleet_sensor_t *sensors, int count, int max_parallel,
+                   fleet_progress_fn progress, void *ctx);
+
+/**
+ * @brief Detect, clean (if not yet done) and prepare one sensor on the
+ *        calling thread
+ *
+ * For a sensor added to a fleet that is already acquiring: only this
+ *  sensor is brought up, while the bus keeps serving the others per
+ *  transaction.
+ *
+ * @param [in,out] sensor sensor to bring up
+ * @param [in] progress progress callback, may be NULL; the index is 0
+ * @param [in] ctx user pointer passed to progress
+ * @return 0 if the sensor is ready, otherwise the zmod4xxx_err of the
+ *         failing stage
+ */
+int fleet_bring_up_one(fleet_sensor_t *sensor, fleet_progress_fn progress,
+                       void *ctx);
+
+/**
+ * @brief Select a ready sensor for the legacy API on the calling thread
+ * @note  Required before zmod4xxx_* calls on a sensor of the fleet.
+ */
+void fleet_select(fleet_sensor_t *sensor);
+
+/**
+ * @brief Bring a ready sensor back after a failed measurement cycle
+ *
+ * After a power-on reset the configuration is rewritten and verified; a
+ *  sequence that did not end in time is stopped so that the next start
+ *  begins a fresh one. Other errors, e.g. a NACK or an access conflict,
+ *  only cost the sample and need nothing.
+ *
+ * @note  The caller selects the sensor (fleet_select) first.
+ * @param [in,out] sensor sensor of the failed cycle
+ * @param [in] error zmod4xxx_err of the cycle
+ * @return 0 if the sensor can start the next cycle, otherwise the error of
+ *         the recovery, which is worth another attempt in the next cycle
+ */
+int fleet_recover(fleet_sensor_t *sensor, int error);
+
+/**
+ * @brief Name of a stage
+ */
+const char *fleet_stage_name(fleet_stage_t stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FLEET_H */
@@ -0,0 +1,214 @@
+/**
+ * @addtogroup fault_hal
+ * @{
+ * @file    fault.c
+ * @brief   Fault injecting HAL decorator
+ */
+
+#include <string.h>
+#include "hal/fault/fault.h"
+
+#define FAULT_REG_STATUS  0x94
+#define FAULT_REG_ERROR   0xB7
+#define FAULT_RUNNING     0x80
+#define FAULT_POR         0x80
+#define FAULT_CONFLICT    0x40
+#define FAULT_RATE_SCALE  100000U
+
+const FaultConfig_t  FAULT_DefaultConfig = {
+  .seed      = 1,
+  .timeoutMs = 25,
+  .delayMs   = 2000,
+  .addr      = 0x33,
+};
+
+static char const* const  _names [ fcCount ] = {
+  "nack", "timeout", "por", "conflict", "delay"
+};
+
+static uint32_t
+_Random ( FaultInjector_t*  fi ) {
+  uint32_t  x = fi -> rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  fi -> rng = x;
+  return x;
+}
+
+/* The fault of this transaction: a forced or the next scripted one if due,
+   else one drawn at random; -1 if none. */
+static int
+_Draw ( FaultInjector_t*  fi, uint64_t  now ) {
+  FaultConfig_t const*  cfg = &fi -> cfg;
+  uint32_t  x, sum = 0;
+  int  fault = fi -> forced;
+
+  if ( fault >= 0 && fi -> forcedAt <= now ) {
+    fi -> forced = -1;
+    return fault;
+  }
+  if ( fi -> next < cfg -> scriptLen &&
+       cfg -> script [ fi -> next ] . atMs <= now )
+    return cfg -> script [ fi -> next++ ] . fault;
+
+  x = _Random ( fi ) % FAULT_RATE_SCALE;
+  for ( int f = 0; f < fcCount; f++ ) {
+    sum += cfg -> rate [ f ];
+    if ( x < sum )
+      return f;
+  }
+  return -1;
+}
+
+/* Start a transaction: returns an error if it is to fail, otherwise sets up
+   what the sensor will report. */
+static int
+_Begin ( FaultInjector_t*  fi ) {
+  uint64_t  now = fi -> inner . msClock ( );
+  int  fault;
+
+  fi -> transactions++;
+  fault = _Draw ( fi, now );
+  if ( fault < 0 )
+    return ecSuccess;
+  fi -> injected [ fault ]++;
+  fi -> lastMs [ fault ] = now;
+
+  switch ( fault ) {
+  case fcNack:
+    return ecHALError;
+  case fcTimeout:
+    fi -> inner . msSleep ( fi -> cfg . timeoutMs );
+    return ecHALError;
+  case fcPor:
+    if ( fi -> inner . reset )
+      fi -> inner . reset ( fi -> inner . handle );
+    fi -> errorBits |= FAULT_POR;
+    break;
+  case fcConflict:
+    fi -> errorBits |= FAULT_CONFLICT;
+    break;
+  case fcDelay:
+    fi -> delayPending = 1;
+    break;
+  }
+  return ecSuccess;
+}
+
+/* Change what a register read of the disturbed sensor returns */
+static void
+_Patch ( FaultInjector_t*  fi, uint8_t  slAddr, uint8_t  reg, uint8_t*  data,
+         int  len ) {
+  int  status = FAULT_REG_STATUS - reg;
+  int  error  = FAULT_REG_ERROR - reg;
+
+  if ( slAddr != fi -> cfg . addr )
+    return;
+  if ( status >= 0 && status < len ) {
+    uint64_t  now = fi -> inner . msClock ( );
+
+    /* a pending delay starts when the sequence actually ends */
+    if ( fi -> delayPending && ! ( data [ status ] & FAULT_RUNNING ) ) {
+      fi -> busyUntil    = now + fi -> cfg . delayMs;
+      fi -> delayPending = 0;
+    }
+    if ( now < fi -> busyUntil )
+      data [ status ] |= FAULT_RUNNING;
+  }
+  if ( error >= 0 && error < len ) {
+    data [ error ] |= fi -> errorBits;
+    fi -> errorBits = 0;
+  }
+}
+
+static int
+_I2CRead ( void*  handle, uint8_t  slAddr, uint8_t*  wrData, int  wrLen,
+           uint8_t*  rdData, int  rdLen ) {
+  FaultInjector_t*  fi = ( FaultInjector_t* ) handle;
+  int  ret = _Begin ( fi );
+
+  if ( ret )
+    return ret;
+  ret = fi -> inner . i2cRead ( fi -> inner . handle, slAddr, wrData, wrLen,
+                                rdData, rdLen );
+  if ( ! ret && wrLen > 0 )
+    _Patch ( fi, slAddr, wrData [ 0 ], rdData, rdLen );
+  return ret;
+}
+
+static int
+_I2CWrite ( void*  handle, uint8_t  slAddr, uint8_t*  wrData1, int  wrLen1,
+            uint8_t*  wrData2, int  wrLen2 ) {
+  FaultInjector_t*  fi = ( FaultInjector_t* ) handle;
+  int  ret = _Begin ( fi );
+
+  if ( ret )
+    return ret;
+  return fi -> inner . i2cWrite ( fi -> inner . handle, slAddr, wrData1, wrLen1,
+                                  wrData2, wrLen2 );
+}
+
+/* One fault per combined transfer, as it is one bus transaction */
+static int
+_I2CBatch ( void*  handle, I2CSegment_t*  seg, int  count ) {
+  FaultInjector_t*  fi = ( FaultInjector_t* ) handle;
+  int  ret = _Begin ( fi );
+
+  if ( ret )
+    return ret;
+  ret = fi -> inner . i2cBatch ( fi -> inner . handle, seg, count );
+  if ( ret )
+    return ret;
+  for ( int i = 0; i + 1 < count; i++ ) {
+    if ( ! seg [ i ] . read && seg [ i ] . len > 0 && seg [ i + 1 ] . read &&
+         seg [ i + 1 ] . addr == seg [ i ] . addr )
+      _Patch ( fi, seg [ i ] . addr, seg [ i ] . data [ 0 ],
+               seg [ i + 1 ] . data, seg [ i + 1 ] . len );
+  }
+  return ecSuccess;
+}
+
+static int
+_Reset ( void*  handle ) {
+  FaultInjector_t*  fi = ( FaultInjector_t* ) handle;
+  return fi -> inner . reset ( fi -> inner . handle );
+}
+
+int
+FAULT_Init ( Interface_t*  hal, FaultInjector_t*  fi,
+             Interface_t const*  inner, FaultConfig_t const*  cfg ) {
+  if ( ! inner -> msClock )
+    return heNotImplemented;
+
+  memset ( fi, 0, sizeof ( *fi ) );
+  fi -> cfg    = cfg ? *cfg : FAULT_DefaultConfig;
+  fi -> inner  = *inner;
+  fi -> forced = -1;
+  fi -> rng    = fi -> cfg . seed ? fi -> cfg . seed : 1;
+  if ( ! fi -> cfg . script )
+    fi -> cfg . scriptLen = 0;
+
+  hal -> handle   = fi;
+  hal -> i2cRead  = _I2CRead;
+  hal -> i2cWrite = _I2CWrite;
+  hal -> msSleep  = inner -> msSleep;
+  hal -> reset    = inner -> reset ? _Reset : NULL;
+  hal -> msClock  = inner -> msClock;
+  hal -> i2cBatch = inner -> i2cBatch ? _I2CBatch : NULL;
+  hal -> msSleepUntil = inner -> msSleepUntil;
+  return ecSuccess;
+}
+
+void
+FAULT_Inject ( FaultInjector_t*  fi, FaultClass_t  fault, uint64_t  atMs ) {
+  fi -> forcedAt = atMs;
+  fi -> forced   = fault;
+}
+
+char const*
+FAULT_Name ( FaultClass_t  fault ) {
+  return fault < fcCount ? _names [ fault ] : "unknown";
+}
+
+/** @} */
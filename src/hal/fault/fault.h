@@ -0,0 +1,122 @@
+/**
+ * @addtogroup fault_hal
+ * @{
+ * @file    fault.h
+ * @brief   Fault injecting HAL decorator
+ *
+ * The decorator implements ::Interface_t on top of another one, real or
+ *  simulated, and injects the faults the error paths of the driver have to
+ *  handle:
+ *  - a transaction that is not acknowledged,
+ *  - a transaction that hangs until the bus times out,
+ *  - a power-on reset: the sensor is reset through Interface_t::reset if
+ *    the backend has one, and the POR bit is set in register 0xB7,
+ *  - an access conflict, the conflict bit in register 0xB7,
+ *  - a late end of the sequence: the status register reports the sequencer
+ *    running for a while after it has finished.
+ *
+ * Faults fire on a script of absolute times, on the clock of the backend,
+ *  or at random with a rate per class. Each class counts its injections and
+ *  remembers when it fired last, from which a harness derives the time to
+ *  recover.
+ */
+
+#ifndef FAULT_H
+#define FAULT_H
+
+#include <stdint.h>
+#include "hal/hal.h"
+
+/**
+ * @brief Fault classes
+ */
+typedef enum {
+  fcNack = 0,   /**< transaction not acknowledged */
+  fcTimeout,    /**< transaction fails after FaultConfig_t::timeoutMs */
+  fcPor,        /**< power-on reset of the sensor */
+  fcConflict,   /**< access conflict flagged in 0xB7 */
+  fcDelay,      /**< sequence ends FaultConfig_t::delayMs late */
+  fcCount
+} FaultClass_t;
+
+/**
+ * @brief One scripted fault
+ */
+typedef struct {
+  uint64_t      atMs;   /**< fires with the first transaction from then on */
+  FaultClass_t  fault;
+} FaultEvent_t;
+
+/**
+ * @brief Schedule and shape of the faults
+ */
+typedef struct {
+  FaultEvent_t const*  script;    /**< ordered by atMs, NULL for none */
+  int       scriptLen;
+  uint32_t  rate [ fcCount ];     /**< random faults per 100000 transactions */
+  uint32_t  seed;                 /**< seed of the random schedule */
+  uint32_t  timeoutMs;            /**< duration of a hanging transaction */
+  uint32_t  delayMs;              /**< extra duration of a late sequence */
+  uint8_t   addr;                 /**< address of the sensor to disturb */
+} FaultConfig_t;
+
+/**
+ * @brief State of a decorator
+ */
+typedef struct {
+  FaultConfig_t  cfg;
+  Interface_t    inner;           /**< copy of the decorated interface */
+  int            next;            /**< next scripted fault */
+  int            forced;          /**< class of FAULT_Inject, -1 if none */
+  uint64_t       forcedAt;        /**< when the forced fault is due */
+  uint32_t       rng;
+  uint8_t        errorBits;       /**< set in the next read of 0xB7 */
+  int            delayPending;    /**< stretch the next end of a sequence */
+  uint64_t       busyUntil;       /**< sequencer reported running until */
+  uint32_t       transactions;
+  uint32_t       injected [ fcCount ];
+  uint64_t       lastMs [ fcCount ]; /**< time the class fired last */
+} FaultInjector_t;
+
+/**
+ * @brief Defaults: no faults, 25 ms bus timeout, 2 s late sequence,
+ *        sensor at 0x33
+ */
+extern const FaultConfig_t  FAULT_DefaultConfig;
+
+/**
+ * @brief Wrap an interface and populate ::Interface_t object
+ *
+ * The optional functions of the result are present exactly if they are in
+ *  inner. The backend's clock (Interface_t::msClock) is required.
+ *
+ * @param hal   pointer to ::Interface_t object to be initialized
+ * @param fi    storage for the decorator, referenced by hal->handle
+ * @param inner interface to decorate, copied
+ * @param cfg   schedule, NULL for ::FAULT_DefaultConfig
+ * @return      error code
+ * @retval  0   on success
+ * @retval  heNotImplemented if inner has no clock
+ */
+int  FAULT_Init ( Interface_t*  hal, FaultInjector_t*  fi,
+                  Interface_t const*  inner, FaultConfig_t const*  cfg );
+
+/**
+ * @brief Inject a fault with the first transaction from a given time on
+ *
+ * Replaces a fault injected before that has not fired yet.
+ *
+ * @param fi    decorator
+ * @param fault class of the fault
+ * @param atMs  time on the clock of the backend, 0 for the next transaction
+ */
+void  FAULT_Inject ( FaultInjector_t*  fi, FaultClass_t  fault, uint64_t  atMs );
+
+/**
+ * @brief Name of a fault class
+ */
+char const*  FAULT_Name ( FaultClass_t  fault );
+
+#endif /* FAULT_H */
+
+/** @} */
@@ -16,7 +16,10 @@
  * @author  Renesas Electronics Corporation
  */
 
+#include <stddef.h>
+#ifndef ZMOD4510_MINIMAL
 #include <stdio.h>
+#endif
 #include "hal/hal.h"
 
 static struct {
@@ -41,6 +44,12 @@ char const*
 HAL_GetErrorInfo ( int*  error, int*  scope, char*  str, int  bufLen ) {
   *error = lastError . error;
   *scope = lastError . scope;
+#ifdef ZMOD4510_MINIMAL
+  /* no text in the minimal build, error and scope identify the failure */
+  ( void ) str;
+  ( void ) bufLen;
+  return NULL;
+#else
   if ( str && bufLen ) {
     if ( lastError . errStrFn )
       lastError . errStrFn ( lastError . error, lastError . scope, str, bufLen );
@@ -50,9 +59,11 @@ HAL_GetErrorInfo ( int*  error, int*  scope, char*  str, int  bufLen ) {
   }
   else
     return NULL;
+#endif
 }
 
 
+#ifndef ZMOD4510_MINIMAL
 char const*
 HAL_GetErrorString ( int  error, int scope, char*  str, int  bufLen ) {
   char buf [ 100 ];
@@ -83,3 +94,13 @@ HAL_GetErrorString ( int  error, int scope, char*  str, int  bufLen ) {
   snprintf ( str, bufLen, "HAL Error: %s", msg );
   return str;
 }
+#else
+char const*
+HAL_GetErrorString ( int  error, int scope, char*  str, int  bufLen ) {
+  ( void ) error;
+  ( void ) scope;
+  ( void ) str;
+  ( void ) bufLen;
+  return NULL;
+}
+#endif
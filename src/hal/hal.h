@@ -72,6 +72,17 @@ typedef enum {
 typedef int ( *I2CImpl_t ) ( void*, uint8_t, uint8_t*, int, uint8_t*, int );
 
 
+/**
+ * @brief One part of a combined I2C transfer, see Interface_t::i2cBatch
+ */
+typedef struct {
+  uint8_t   addr;   /**< slave address */
+  uint8_t   read;   /**< 1 to read into data, 0 to write data */
+  uint16_t  len;    /**< number of bytes */
+  uint8_t*  data;
+} I2CSegment_t;
+
+
 /**
  * @brief A structure of pointers to hardware specific functions
  */
@@ -123,6 +134,33 @@ typedef struct {
    * Implementation must pulse the reset pin
    */
   int  ( *reset ) ( void*  handle );
+
+  /** Pointer to monotonic clock function
+   *
+   * Optional. An implementation must return a monotonic time stamp in `ms`
+   *  that is consistent with the delays produced by msSleep. It is used to
+   *  schedule sensor accesses against absolute deadlines.
+   */
+  uint64_t  ( *msClock ) ( void );
+
+  /** Pointer to combined transfer function
+   *
+   * Optional. Performs all segments as one bus transaction: a start
+   *  condition, the segments joined by repeated start conditions, and a
+   *  stop condition at the end. Segments may address different devices,
+   *  so results of several sensors are collected in one transaction.
+   * Returns 0 if every segment was acknowledged.
+   */
+  int  ( *i2cBatch ) ( void*  handle, I2CSegment_t*  seg, int  count );
+
+  /** Pointer to absolute delay function
+   *
+   * Optional. An implementation must delay execution until msClock returns
+   *  at least `ms`. Unlike a delay computed from the clock and passed to
+   *  msSleep, the deadline is not moved by rounding to whole ms or by the
+   *  time between reading the clock and going to sleep.
+   */
+  void  ( *msSleepUntil ) ( uint64_t  ms );
 } Interface_t;
 
 
@@ -217,7 +255,8 @@ int HAL_SetError ( int  error, int  scope,
  *  @param str      Pointer to string buffer, where error message is written.
  *                  If no string information is required, pass NULL pointer.
  *  @param bufSize  Size of the string buffer, pass 0 if not used
- *  @return         Value passed in str
+ *  @return         Value passed in str; NULL in the minimal build
+ *                  (ZMOD4510_MINIMAL), which keeps no error texts
  */
 char const*  HAL_GetErrorInfo ( int*  error, int*  scope, char*  str, int  bufSize );
 
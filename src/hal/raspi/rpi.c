@@ -21,23 +21,46 @@
 #include <string.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <linux/i2c-dev.h>
 #include <linux/i2c.h>
+#include <errno.h>
 #include "hal/raspi/rpi.h"
 #include "hal/hal.h"
+#include "util/zlog.h"
+#include "util/ztrace.h"
 
 
 #define I2C_BUS_FILE "/dev/i2c-1"
 #define I2C_ADDRESS 0x33
+#define RPI_MAX_SEGMENTS 8
+/* register address and the longest block the drivers write (uint8_t len) */
+#define RPI_MAX_WRITE 256
+/* ZMOD4xxx error event register, cleared by reading it */
+#define RPI_REG_CLEAR_ON_READ 0xB7
 
-static int i2c_file_descriptor = -1;
+// bus opened by HAL_Init
+static RPiBus_t  _bus = { .fd = -1 };
 
 // remember hal object for deinitialization
 static Interface_t*   _hal = NULL;
 
+// set by the SIGINT handler, acted on by the next sleep
+static volatile sig_atomic_t  _terminate = 0;
+
+static RPiRetryConfig_t  _retry = {
+  .maxRetries  = 3,
+  .baseDelayUs = 100,
+  .maxDelayUs  = 2000,
+};
+static RPiI2CStats_t  _stats;
+
+#ifdef ZMOD4510_MINIMAL
+#define _GetErrorString NULL
+#else
 static char const*
 _GetErrorString(int error, int scope, char* str, int bufLen) {
     if (scope == resI2C) {
@@ -51,31 +74,189 @@ _GetErrorString(int error, int scope, char* str, int bufLen) {
     }
     return str;
 }
+#endif
+
+/* Leave the program if Ctrl-C was pressed. Logging and closing the bus are
+ * not async-signal-safe, so the handler only sets the flag and this runs
+ * from the sleeps every measurement cycle passes through. */
+static void
+_CheckTerminate ( void ) {
+  if ( _terminate ) {
+    zlog_info ( "Termination requested by user" );
+    HAL_HandleError ( ecSuccess, NULL );
+  }
+}
+
+/* Sleep until an absolute monotonic time; a signal does not cut the sleep
+ * short unless it requests termination, and under SCHED_FIFO the wake-up is
+ * not delayed by timer slack. */
+static void
+_SleepUntil ( struct timespec const*  ts ) {
+  _CheckTerminate ( );
+  while ( clock_nanosleep ( CLOCK_MONOTONIC, TIMER_ABSTIME, ts, NULL ) == EINTR )
+    _CheckTerminate ( );
+}
 
 static void
 _SleepMS ( uint32_t  ms ) {
-  usleep ( ms * 1000 );
+  struct timespec  ts;
+
+  ZTRACE_BEGIN ( "sleep", 0, ms );
+  clock_gettime ( CLOCK_MONOTONIC, &ts );
+  ts . tv_sec  += ms / 1000;
+  ts . tv_nsec += ( long ) ( ms % 1000 ) * 1000000;
+  if ( ts . tv_nsec >= 1000000000 ) {
+    ts . tv_sec++;
+    ts . tv_nsec -= 1000000000;
+  }
+  _SleepUntil ( &ts );
+  ZTRACE_END ( "sleep", 0, ms );
+}
+
+static void
+_SleepUntilMS ( uint64_t  ms ) {
+  struct timespec  ts = { ( time_t ) ( ms / 1000 ),
+                          ( long ) ( ms % 1000 ) * 1000000 };
+  _SleepUntil ( &ts );
+}
+
+static uint64_t
+_ClockMS ( void ) {
+  struct timespec  ts;
+  clock_gettime ( CLOCK_MONOTONIC, &ts );
+  return ( uint64_t ) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+_Count ( uint32_t*  counter ) {
+  __atomic_fetch_add ( counter, 1, __ATOMIC_RELAXED );
+}
+
+/* Delay before retry number `attempt` (1 based): the first retry after a
+ * NACK is immediate, later ones back off exponentially with the delay drawn
+ * uniformly from its upper half so that competing masters de-synchronize. */
+static uint32_t
+_BackoffUs ( RPiRetryConfig_t const*  cfg, uint32_t  attempt, int  nack ) {
+  static __thread uint32_t  seed;
+  uint32_t  shift, delay;
+
+  if ( nack && attempt == 1 )
+    return 0;
+  if ( ! seed )
+    seed = ( ( uint32_t ) ( uintptr_t ) &seed ^ ( uint32_t ) time ( NULL ) ) | 1;
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+
+  shift = attempt - ( nack ? 2 : 1 );
+  shift = shift < 16 ? shift : 16;
+  delay = cfg -> baseDelayUs << shift;
+  if ( delay > cfg -> maxDelayUs || delay < cfg -> baseDelayUs )
+    delay = cfg -> maxDelayUs;
+  return delay / 2 + seed % ( delay / 2 + 1 );
 }
 
+/* Whether the transaction reads a register that is cleared by reading it */
 static int
-_Connect ( ) {
+_ClearsOnRead ( struct i2c_rdwr_ioctl_data const*  msgset ) {
+  for ( uint32_t i = 0; i + 1 < msgset -> nmsgs; i++ ) {
+    struct i2c_msg const*  m = &msgset -> msgs [ i ];
+
+    if ( ! ( m -> flags & I2C_M_RD ) && m -> len == 1 &&
+         m -> buf [ 0 ] == RPI_REG_CLEAR_ON_READ &&
+         ( m [ 1 ] . flags & I2C_M_RD ) && m [ 1 ] . addr == m -> addr )
+      return 1;
+  }
+  return 0;
+}
+
+/* Run one I2C_RDWR transaction with bounded retries. A timeout or bus error
+ * may hit after the data was read, so a read of a clear-on-read register is
+ * retried after a NACK only; a repeated read would return the cleared value.
+ * Returns 0 on success, otherwise the errno of the last attempt. */
+static int
+_Transfer ( int  fd, struct i2c_rdwr_ioctl_data*  msgset ) {
+  RPiRetryConfig_t  cfg = _retry;
+  uint32_t  attempt = 0;
+  int  once = _ClearsOnRead ( msgset );
+  int  err;
+
+  _Count ( &_stats . transactions );
+  for ( ;; ) {
+    if ( ioctl ( fd, I2C_RDWR, msgset ) >= 0 ) {
+      if ( attempt )
+        _Count ( &_stats . recovered );
+      return 0;
+    }
+    err = errno;
+
+    int  nack = err == EREMOTEIO || err == ENXIO || err == EAGAIN;
+    if ( nack )
+      _Count ( &_stats . nack );
+    else if ( err == ETIMEDOUT )
+      _Count ( &_stats . timeout );
+    else if ( err == EIO )
+      _Count ( &_stats . io );
+    else
+      _Count ( &_stats . other );
+
+    if ( attempt >= cfg . maxRetries ||
+         ! ( nack || ( ! once && ( err == ETIMEDOUT || err == EIO ) ) ) ) {
+      _Count ( &_stats . failed );
+      return err;
+    }
+    attempt++;
+    _Count ( &_stats . retries );
+    ZTRACE_INSTANT ( "i2c_retry", msgset -> msgs [ 0 ] . addr, err );
+
+    uint32_t  us = _BackoffUs ( &cfg, attempt, nack );
+    if ( us )
+      usleep ( us );
+  }
+}
+
+void
+RPI_SetRetryConfig ( RPiRetryConfig_t const*  cfg ) {
+  _retry = *cfg;
+  if ( _retry . baseDelayUs == 0 )
+    _retry . baseDelayUs = 1;
+  if ( _retry . maxDelayUs < _retry . baseDelayUs )
+    _retry . maxDelayUs = _retry . baseDelayUs;
+}
+
+void
+RPI_GetI2CStats ( RPiI2CStats_t*  stats ) {
+  stats -> transactions = __atomic_load_n ( &_stats . transactions, __ATOMIC_RELAXED );
+  stats -> retries      = __atomic_load_n ( &_stats . retries, __ATOMIC_RELAXED );
+  stats -> recovered    = __atomic_load_n ( &_stats . recovered, __ATOMIC_RELAXED );
+  stats -> failed       = __atomic_load_n ( &_stats . failed, __ATOMIC_RELAXED );
+  stats -> nack         = __atomic_load_n ( &_stats . nack, __ATOMIC_RELAXED );
+  stats -> timeout      = __atomic_load_n ( &_stats . timeout, __ATOMIC_RELAXED );
+  stats -> io           = __atomic_load_n ( &_stats . io, __ATOMIC_RELAXED );
+  stats -> other        = __atomic_load_n ( &_stats . other, __ATOMIC_RELAXED );
+}
+
+static int
+_Connect ( RPiBus_t*  bus, char const*  device ) {
   // Close existing file descriptor if open
-  if (i2c_file_descriptor >= 0) {
-    close(i2c_file_descriptor);
+  if (bus->fd >= 0) {
+    close(bus->fd);
   }
 
   // Open the I2C device file
-  i2c_file_descriptor = open(I2C_BUS_FILE, O_RDWR);
-  if (i2c_file_descriptor < 0) {
-    perror("Failed to open the I2C bus file");
+  bus->fd = open(device, O_RDWR);
+  if (bus->fd < 0) {
+    zlog_error("Failed to open the I2C bus file %s: %s", device,
+               strerror(errno));
     return ecHALError;
   }
 
   // Set the I2C slave address
-  if (ioctl(i2c_file_descriptor, I2C_SLAVE, I2C_ADDRESS) < 0) {
-    perror("Failed to acquire I2C bus access and/or set slave address");
-    close(i2c_file_descriptor);
-    i2c_file_descriptor = -1;
+  if (ioctl(bus->fd, I2C_SLAVE, I2C_ADDRESS) < 0) {
+    zlog_error("Failed to acquire I2C bus access and/or set slave address: %s",
+               strerror(errno));
+    close(bus->fd);
+    bus->fd = -1;
     return ecHALError;
   }
 
@@ -85,9 +266,10 @@ _Connect ( ) {
 static int
 _I2CRead(void *handle, uint8_t slAddr, uint8_t *wrData, int wrLen, uint8_t *rdData, int rdLen)
 {
-  if (i2c_file_descriptor < 0)
+  RPiBus_t *bus = handle;
+  if (!bus || bus->fd < 0)
   {
-    fprintf(stderr, "I2C bus not initialized or open.\n");
+    zlog_error("I2C bus not initialized or open.");
     return ecHALError;
   }
 
@@ -114,8 +296,11 @@ _I2CRead(void *handle, uint8_t slAddr, uint8_t *wrData, int wrLen, uint8_t *rdDa
   msgset.msgs = msgs;
   msgset.nmsgs = num_msgs;
 
-  if (ioctl(i2c_file_descriptor, I2C_RDWR, &msgset) < 0) {
-    perror("Failed to read from the I2C device");
+  ZTRACE_BEGIN("i2c_read", slAddr, wrLen + rdLen);
+  int err = _Transfer(bus->fd, &msgset);
+  ZTRACE_END("i2c_read", slAddr, -err);
+  if (err) {
+    zlog_error("Failed to read from the I2C device: %s", strerror(err));
     return ecHALError;
   }
 
@@ -125,15 +310,24 @@ _I2CRead(void *handle, uint8_t slAddr, uint8_t *wrData, int wrLen, uint8_t *rdDa
 static int
 _I2CWrite(void *handle, uint8_t slAddr, uint8_t *wrData1, int wrLen1, uint8_t *wrData2, int wrLen2)
 {
-  if (i2c_file_descriptor < 0)
+  RPiBus_t *bus = handle;
+  if (!bus || bus->fd < 0)
   {
-    fprintf(stderr, "I2C bus not initialized or open.\n");
+    zlog_error("I2C bus not initialized or open.");
     return ecHALError;
   }
 
-  uint8_t buf[wrLen1 + wrLen2];
+  if (wrLen1 < 0 || wrLen2 < 0 || wrLen1 + wrLen2 > RPI_MAX_WRITE)
+  {
+    zlog_error("I2C write of %d bytes exceeds %d", wrLen1 + wrLen2,
+               RPI_MAX_WRITE);
+    return HAL_SetError(recI2CLenMismatch, resI2C, _GetErrorString);
+  }
+
+  uint8_t buf[RPI_MAX_WRITE];
   memcpy(buf, wrData1, wrLen1);
-  memcpy(buf + wrLen1, wrData2, wrLen2);
+  if (wrLen2 > 0)
+    memcpy(buf + wrLen1, wrData2, wrLen2);
 
   struct i2c_msg msg;
   struct i2c_rdwr_ioctl_data msgset;
@@ -146,14 +340,46 @@ _I2CWrite(void *handle, uint8_t slAddr, uint8_t *wrData1, int wrLen1, uint8_t *w
   msgset.msgs = &msg;
   msgset.nmsgs = 1;
 
-  if (ioctl(i2c_file_descriptor, I2C_RDWR, &msgset) < 0) {
-    perror("Failed to write to the I2C device");
+  ZTRACE_BEGIN("i2c_write", slAddr, wrLen1 + wrLen2);
+  int err = _Transfer(bus->fd, &msgset);
+  ZTRACE_END("i2c_write", slAddr, -err);
+  if (err) {
+    zlog_error("Failed to write to the I2C device: %s", strerror(err));
     return ecHALError;
   }
 
   return ecSuccess;
 }
 
+/* All segments in one I2C_RDWR ioctl: the adapter joins the messages with
+ * repeated starts and stops only after the last one. */
+static int
+_I2CBatch ( void*  handle, I2CSegment_t*  seg, int  count ) {
+  RPiBus_t*  bus = handle;
+  struct i2c_msg  msgs [ RPI_MAX_SEGMENTS ];
+  struct i2c_rdwr_ioctl_data  msgset = { msgs, ( uint32_t ) count };
+
+  if ( ! bus || bus -> fd < 0 || count < 1 || count > RPI_MAX_SEGMENTS ) {
+    zlog_error ( "Invalid combined I2C transfer" );
+    return ecHALError;
+  }
+  for ( int i = 0; i < count; i++ ) {
+    msgs [ i ] . addr  = seg [ i ] . addr;
+    msgs [ i ] . flags = seg [ i ] . read ? I2C_M_RD : 0;
+    msgs [ i ] . len   = seg [ i ] . len;
+    msgs [ i ] . buf   = seg [ i ] . data;
+  }
+
+  ZTRACE_BEGIN ( "i2c_batch", seg [ 0 ] . addr, count );
+  int  err = _Transfer ( bus -> fd, &msgset );
+  ZTRACE_END ( "i2c_batch", seg [ 0 ] . addr, -err );
+  if ( err ) {
+    zlog_error ( "Combined I2C transfer failed: %s", strerror ( err ) );
+    return ecHALError;
+  }
+  return ecSuccess;
+}
+
 static int
 _Reset ( ) {
   //TODO
@@ -162,30 +388,34 @@ _Reset ( ) {
 
 void
 _Terminate ( int  sig ) {
-  printf ( "Termination requested by user\n" );
-  HAL_HandleError ( ecSuccess, NULL );
+  ( void ) sig;
+  _terminate = 1;
 }
 
 int
 HAL_Init ( Interface_t*  hal ) {
 
-  printf ( "Initializing Raspberry Pi HAL\n\n" );
-  printf ( "This application can be be terminated at any "
-           "time by pressing Ctrl-C\n\n" );
+  zlog_info ( "Initializing Raspberry Pi HAL" );
+  zlog_info ( "This application can be be terminated at any "
+              "time by pressing Ctrl-C" );
 
   _hal = hal;
 
-  int errorCode = _Connect ( );
+  int errorCode = _Connect ( &_bus, I2C_BUS_FILE );
 
   // register signal handler for Ctlr-C
   // this needs to be called after gpioInitialize (called from _Connect)
   signal ( SIGINT, _Terminate );
 
   if ( ! errorCode ) {
+    hal -> handle         = &_bus;
     hal -> msSleep        = _SleepMS;
     hal -> i2cRead        = _I2CRead;
     hal -> i2cWrite       = _I2CWrite;
     hal -> reset          = _Reset;
+    hal -> msClock        = _ClockMS;
+    hal -> i2cBatch       = _I2CBatch;
+    hal -> msSleepUntil   = _SleepUntilMS;
   }
   return errorCode;
 }
@@ -193,34 +423,68 @@ HAL_Init ( Interface_t*  hal ) {
 
 int
 HAL_Deinit ( Interface_t*  hal ) {
+  ( void ) hal;
+  return RPI_CloseBus ( &_bus );
+}
+
+
+int
+RPI_OpenBus ( Interface_t*  hal, RPiBus_t*  bus, char const*  device ) {
+  bus -> fd = -1;
+  int  errorCode = _Connect ( bus, device );
+
+  if ( ! errorCode ) {
+    hal -> handle         = bus;
+    hal -> msSleep        = _SleepMS;
+    hal -> i2cRead        = _I2CRead;
+    hal -> i2cWrite       = _I2CWrite;
+    hal -> reset          = _Reset;
+    hal -> msClock        = _ClockMS;
+    hal -> i2cBatch       = _I2CBatch;
+    hal -> msSleepUntil   = _SleepUntilMS;
+  }
+  return errorCode;
+}
+
+
+int
+RPI_CloseBus ( RPiBus_t*  bus ) {
   int  errorCode = 0;
-  if ( i2c_file_descriptor > -1 ) {
-    errorCode = close ( i2c_file_descriptor );
-    i2c_file_descriptor = -1;
+  if ( bus -> fd > -1 ) {
+    errorCode = close ( bus -> fd );
+    bus -> fd = -1;
   }
   if ( errorCode )
-    return HAL_SetError ( errorCode, resPiGPIO, _GetErrorString );
+    return HAL_SetError ( errno, resPiGPIO, _GetErrorString );
   return ecSuccess;
 }
 
 
 void
 HAL_HandleError ( int  errorCode, void const*  contextV ) {
+#ifdef ZMOD4510_MINIMAL
+  /* the exit status is the only report, so keep the incoming error */
+  ( void ) contextV;
+  int  deinit = HAL_Deinit ( _hal );
+  exit ( errorCode ? errorCode : deinit );
+#else
   char const*  context = ( char const* ) contextV;
   int  error, scope;
   char  msg [ 200 ];
   if ( errorCode ) {
-    printf ( "ERROR code %i received during %s\n", errorCode, context );
-    printf ( "  %s\n", HAL_GetErrorInfo ( &error, &scope, msg, 200 ) );
+    zlog_error ( "ERROR code %i received during %s", errorCode, context );
+    zlog_error ( "  %s", HAL_GetErrorInfo ( &error, &scope, msg, 200 ) );
   }
   errorCode = HAL_Deinit ( _hal );
   if ( errorCode ) {
-    printf ( "ERROR code %i received during interface deinitialization\n", 
-             errorCode );
-    printf ( "  %s\n", HAL_GetErrorInfo ( &error, &scope, msg, 200 ) );
+    zlog_error ( "ERROR code %i received during interface deinitialization",
+                 errorCode );
+    zlog_error ( "  %s", HAL_GetErrorInfo ( &error, &scope, msg, 200 ) );
   }
+#endif
 
-  printf ( "\nExiting\n" );
+  zlog_info ( "Exiting" );
+  zlog_flush ( );
   exit ( errorCode );
 }
 
@@ -20,6 +20,7 @@
 #define RPI_H
 
 #include <stdint.h>
+#include "hal/hal.h"
 
 typedef enum {
   resPiGPIO         = 0x310000,
@@ -27,6 +28,75 @@ typedef enum {
   recI2CLenMismatch = 0x320001
 } RPiErrorDefs_t;
 
+/**
+ * @brief Retry policy of the I2C transport
+ *
+ * A failed transaction is retried if the error is transient: a NACK
+ *  (EREMOTEIO, ENXIO, EAGAIN), a bus timeout (ETIMEDOUT) or a generic bus
+ *  error (EIO). A NACK is retried at once first; every further attempt waits
+ *  an exponentially growing, randomly jittered delay. Other errors, e.g. a
+ *  closed or missing bus device, fail immediately. A read of the error
+ *  event register 0xB7, which the sensor clears when it is read, is
+ *  retried after a NACK only: after a timeout or bus error the data may
+ *  have been read already.
+ */
+typedef struct {
+  uint32_t  maxRetries;   /**< retries after the first attempt, 0 disables */
+  uint32_t  baseDelayUs;  /**< first backoff delay */
+  uint32_t  maxDelayUs;   /**< upper bound of the delay */
+} RPiRetryConfig_t;
+
+/**
+ * @brief I2C transport counters
+ */
+typedef struct {
+  uint32_t  transactions; /**< transactions requested */
+  uint32_t  retries;      /**< retry attempts */
+  uint32_t  recovered;    /**< transactions that succeeded after a retry */
+  uint32_t  failed;       /**< transactions that failed in the end */
+  uint32_t  nack;         /**< attempts failed with a NACK */
+  uint32_t  timeout;      /**< attempts failed with ETIMEDOUT */
+  uint32_t  io;           /**< attempts failed with EIO */
+  uint32_t  other;        /**< attempts failed with any other error */
+} RPiI2CStats_t;
+
+/**
+ * @brief One opened I2C bus device, referenced by Interface_t::handle
+ */
+typedef struct {
+  int  fd;
+} RPiBus_t;
+
+/**
+ * @brief Open an I2C bus device and populate ::Interface_t object
+ *
+ * Unlike HAL_Init(), which opens /dev/i2c-1, any number of buses may be
+ *  opened this way, each with its own ::Interface_t. No signal handler is
+ *  installed.
+ *
+ * @param hal     pointer to ::Interface_t object to be initialized
+ * @param bus     storage for the bus, referenced by hal->handle
+ * @param device  bus device, e.g. "/dev/i2c-1"
+ * @return        error code
+ * @retval  0     on success
+ */
+int  RPI_OpenBus ( Interface_t*  hal, RPiBus_t*  bus, char const*  device );
+
+/**
+ * @brief Close a bus opened with RPI_OpenBus()
+ */
+int  RPI_CloseBus ( RPiBus_t*  bus );
+
+/**
+ * @brief Set the retry policy (default: 3 retries, 100 us to 2 ms)
+ */
+void  RPI_SetRetryConfig ( RPiRetryConfig_t const*  cfg );
+
+/**
+ * @brief Read the transport counters
+ */
+void  RPI_GetI2CStats ( RPiI2CStats_t*  stats );
+
 #endif /* RPI_H */
 
 /** @} */
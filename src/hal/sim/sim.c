@@ -0,0 +1,404 @@
+/**
+ * @addtogroup sim_hal
+ * @{
+ * @file    sim.c
+ * @brief   Simulated ZMOD4510 HAL function definitions
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hal/sim/sim.h"
+
+#define SIM_I2C_ADDR     0x33
+#define SIM_REG_PID      0x00
+#define SIM_REG_CONF     0x20
+#define SIM_REG_PROD     0x26
+#define SIM_REG_TRACKING 0x3A
+#define SIM_REG_SEQ      0x68
+#define SIM_REG_CMD      0x93
+#define SIM_REG_STATUS   0x94
+#define SIM_REG_RESULT   0x97
+#define SIM_REG_ERROR    0xB7
+#define SIM_INIT_TIME    100U
+#define SIM_MOX_LR       0x0240
+#define SIM_MOX_ER       0xF8C0
+#define SIM_EVENT_LEN    50U
+#define SIM_TH_ADDR      0x44
+
+const SimConfig_t  SIM_DefaultConfig = {
+  .seqTime  = 5600,
+  .period   = 6000,
+  .realtime = 0,
+  .seed     = 1,
+  .thSensor = 1,
+};
+
+static const uint8_t  _conf [ 6 ]  = { 0x2D, 0x01, 0x0A, 0x9C, 0x8A, 0x9D };
+static const uint8_t  _prod [ 10 ] = { 0x05, 0x12, 0x30, 0x41, 0x00,
+                                       0x7E, 0x88, 0x19, 0x02, 0x60 };
+static const uint8_t  _track [ 6 ] = { 0x00, 0x01, 0x5A, 0x3C, 0x11, 0x07 };
+
+/* One clock and one time mode for all simulated sensors: the ::Interface_t
+   clock and sleep functions do not receive the handle of a sensor. */
+static uint64_t  _virtualMS = 0;
+static int       _realtime = 0;
+static int       _modeSet = 0;
+static int64_t   _realOffsetMS = 0;
+
+static uint64_t
+_MonotonicMS ( void ) {
+  struct timespec  ts;
+  clock_gettime ( CLOCK_MONOTONIC, &ts );
+  return ( uint64_t ) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t
+SIM_Clock ( void ) {
+  if ( _realtime )
+    return _MonotonicMS ( ) + _realOffsetMS;
+  return __atomic_load_n ( &_virtualMS, __ATOMIC_RELAXED );
+}
+
+void
+SIM_SetRealtime ( int  enable ) {
+  uint64_t  now = SIM_Clock ( );
+
+  if ( enable )
+    _realOffsetMS = ( int64_t ) ( now - _MonotonicMS ( ) );
+  else
+    _virtualMS = now;
+  _realtime = enable;
+  _modeSet  = 1;
+}
+
+static void
+_SleepMS ( uint32_t  ms ) {
+  if ( _realtime )
+    usleep ( ms * 1000 );
+  else
+    __atomic_fetch_add ( &_virtualMS, ms, __ATOMIC_RELAXED );
+}
+
+static void
+_SleepUntilMS ( uint64_t  ms ) {
+  uint64_t  now = SIM_Clock ( );
+
+  if ( ms <= now )
+    return;
+  if ( _realtime ) {
+    uint64_t  real = ms - _realOffsetMS;
+    struct timespec  ts = { ( time_t ) ( real / 1000 ),
+                            ( long ) ( real % 1000 ) * 1000000 };
+
+    while ( clock_nanosleep ( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL ) ==
+            EINTR )
+      ;
+  } else {
+    __atomic_fetch_add ( &_virtualMS, ms - now, __ATOMIC_RELAXED );
+  }
+}
+
+static uint32_t
+_Noise ( uint32_t  x ) {
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+/* Reading of sequence step i in the given cycle as a fraction of the ADC
+   range. Stateless, so any cycle can be reproduced from the seed. */
+static float
+_Waveform ( SimConfig_t const*  cfg, uint32_t  cycle, int  i ) {
+  uint32_t  n = _Noise ( cfg -> seed * 2654435761U + cycle * 16 + i + 1 );
+  float  f = 0.45F + 0.1F * sinf ( cycle * 0.01F + i ) +
+             ( ( n & 0xFFFF ) / 65535.0F - 0.5F ) * 0.01F;
+
+  if ( cfg -> drift != 0 )
+    /* about one period per day of 6 s cycles, phase set by the seed */
+    f += cfg -> drift * sinf ( cycle * 4.4e-4F + cfg -> seed );
+  if ( cfg -> noise != 0 )
+    f += ( ( n >> 16 ) / 65535.0F - 0.5F ) * cfg -> noise;
+  if ( cfg -> eventRate != 0 ) {
+    /* an event fills a block of cycles: a fast rise, then a slow decay */
+    uint32_t  h   = _Noise ( cfg -> seed * 40503U + cycle / SIM_EVENT_LEN + 1 );
+    uint32_t  pos = cycle % SIM_EVENT_LEN;
+
+    if ( h % 1000 < cfg -> eventRate * SIM_EVENT_LEN ) {
+      float  shape = pos < SIM_EVENT_LEN / 5
+                       ? pos / ( SIM_EVENT_LEN / 5.0F )
+                       : ( SIM_EVENT_LEN - pos ) / ( SIM_EVENT_LEN * 0.8F );
+      /* O3 shows mostly in the first half of the steps, NO2 in the second */
+      int  o3 = ( h >> 16 ) & 1;
+      f += cfg -> eventDepth * shape * ( ( i < 8 ) == o3 ? 1.0F : 0.25F );
+    }
+  }
+  return f < 0.01F ? 0.01F : f > 0.99F ? 0.99F : f;
+}
+
+/* Copy the results of the given cycle to the result registers. */
+static void
+_Latch ( SimDevice_t*  dev, uint32_t  cycle ) {
+  uint8_t*  r = &dev -> reg [ SIM_REG_RESULT ];
+
+  if ( dev -> seqLen == 4 ) {
+    r [ 0 ] = SIM_MOX_LR >> 8;
+    r [ 1 ] = SIM_MOX_LR & 0xFF;
+    r [ 2 ] = SIM_MOX_ER >> 8;
+    r [ 3 ] = SIM_MOX_ER & 0xFF;
+    return;
+  }
+  for ( int i = 0; i < 16; i++ ) {
+    float  f = _Waveform ( &dev -> cfg, cycle, i );
+    uint16_t  adc = ( uint16_t ) ( SIM_MOX_LR + f * ( SIM_MOX_ER - SIM_MOX_LR ) );
+    r [ 2 * i ]     = adc >> 8;
+    r [ 2 * i + 1 ] = adc & 0xFF;
+  }
+}
+
+/* Bring sequencer state and result registers up to the current time. */
+static void
+_Update ( SimDevice_t*  dev ) {
+  uint64_t  elapsed;
+  uint32_t  seqTime, cycle, phase, completed, steps, step;
+  int  running;
+
+  if ( ! ( dev -> cmd & 0x80 ) ) {
+    dev -> reg [ SIM_REG_STATUS ] = 0;
+    return;
+  }
+  seqTime = dev -> seqLen == 4 ? SIM_INIT_TIME : dev -> cfg . seqTime;
+  elapsed = SIM_Clock ( ) - dev -> tStart;
+  if ( dev -> cmd & 0x40 ) {
+    cycle = ( uint32_t ) ( elapsed / dev -> cfg . period );
+    phase = ( uint32_t ) ( elapsed % dev -> cfg . period );
+  } else {
+    cycle = 0;
+    phase = elapsed < seqTime ? ( uint32_t ) elapsed : seqTime;
+  }
+  running   = phase < seqTime;
+  completed = running ? cycle : cycle + 1;
+  steps     = dev -> seqLen > 1 ? dev -> seqLen / 2 : 1;
+  step      = running ? phase * steps / seqTime : steps - 1;
+
+  dev -> reg [ SIM_REG_STATUS ] = ( running ? 0x80 : 0 ) |
+                                  ( dev -> cmd & 0x40 ) | ( step & 0x1F );
+  if ( completed > dev -> latched ) {
+    dev -> cycles += completed - dev -> latched;
+    dev -> latched = completed;
+    _Latch ( dev, dev -> cycles - 1 );
+  }
+}
+
+/* CRC-8 of the SHT4x, polynomial 0x31, initial value 0xFF */
+static uint8_t
+_ThCrc ( uint8_t const*  data ) {
+  uint8_t  crc = 0xFF;
+
+  for ( int i = 0; i < 2; i++ ) {
+    crc ^= data [ i ];
+    for ( int b = 0; b < 8; b++ )
+      crc = crc & 0x80 ? ( uint8_t ) ( crc << 1 ) ^ 0x31 : ( uint8_t ) ( crc << 1 );
+  }
+  return crc;
+}
+
+/* Conversion time of an SHT4x command in ms, 0 if unknown */
+static uint32_t
+_ThTime ( uint8_t  cmd ) {
+  switch ( cmd ) {
+  case 0xFD: return 9;    /* high precision */
+  case 0xF6: return 5;    /* medium precision */
+  case 0xE0: return 2;    /* low precision */
+  case 0x89: return 1;    /* serial number */
+  default:   return 0;
+  }
+}
+
+static int
+_ThWrite ( SimDevice_t*  dev, uint8_t const*  data, int  len ) {
+  if ( len != 1 )
+    return ecHALError;
+  if ( data [ 0 ] == 0x94 ) {
+    dev -> thCmd = 0;
+    return ecSuccess;
+  }
+  if ( ! _ThTime ( data [ 0 ] ) )
+    return ecHALError;
+  dev -> thCmd   = data [ 0 ];
+  dev -> thStart = SIM_Clock ( );
+  return ecSuccess;
+}
+
+/* A day-long swing of temperature with the opposite swing of humidity */
+static int
+_ThRead ( SimDevice_t*  dev, uint8_t*  data, int  len ) {
+  uint16_t  word [ 2 ];
+
+  if ( len != 6 || ! dev -> thCmd ||
+       SIM_Clock ( ) - dev -> thStart < _ThTime ( dev -> thCmd ) )
+    return ecHALError;
+  if ( dev -> thCmd == 0x89 ) {
+    word [ 0 ] = ( uint16_t ) ( _track [ 2 ] << 8 | _track [ 3 ] );
+    word [ 1 ] = ( uint16_t ) ( _track [ 4 ] << 8 | _track [ 5 ] );
+  } else {
+    float  day = dev -> thStart * 7.27e-8F + dev -> cfg . seed;
+    float  t   = 21.0F + 3.0F * sinf ( day );
+    float  rh  = 45.0F - 10.0F * sinf ( day );
+    word [ 0 ] = ( uint16_t ) ( ( t + 45.0F ) * 65535.0F / 175.0F );
+    word [ 1 ] = ( uint16_t ) ( ( rh + 6.0F ) * 65535.0F / 125.0F );
+    dev -> thCount++;
+  }
+  for ( int i = 0; i < 2; i++ ) {
+    data [ 3 * i ]     = word [ i ] >> 8;
+    data [ 3 * i + 1 ] = word [ i ] & 0xFF;
+    data [ 3 * i + 2 ] = _ThCrc ( &data [ 3 * i ] );
+  }
+  dev -> thCmd = 0;
+  return ecSuccess;
+}
+
+static int
+_I2CRead ( void*  handle, uint8_t  slAddr, uint8_t*  wrData, int  wrLen,
+           uint8_t*  rdData, int  rdLen ) {
+  SimDevice_t*  dev = ( SimDevice_t* ) handle;
+  uint8_t  addr = wrLen > 0 ? wrData [ 0 ] : 0;
+
+  if ( slAddr == SIM_TH_ADDR && dev -> cfg . thSensor ) {
+    dev -> nRead++;
+    dev -> nBytes += wrLen + rdLen;
+    if ( wrLen > 0 && _ThWrite ( dev, wrData, wrLen ) )
+      return ecHALError;
+    return _ThRead ( dev, rdData, rdLen );
+  }
+  if ( slAddr != SIM_I2C_ADDR )
+    return ecHALError;
+  _Update ( dev );
+  dev -> nRead++;
+  dev -> nBytes += wrLen + rdLen;
+
+  if ( ( dev -> reg [ SIM_REG_STATUS ] & 0x80 ) &&
+       addr < SIM_REG_ERROR && addr + rdLen > SIM_REG_RESULT )
+    dev -> reg [ SIM_REG_ERROR ] |= 0x40;
+
+  for ( int i = 0; i < rdLen; i++ )
+    rdData [ i ] = dev -> reg [ ( uint8_t ) ( addr + i ) ];
+
+  /* the error register is cleared on read */
+  if ( addr <= SIM_REG_ERROR && addr + rdLen > SIM_REG_ERROR )
+    dev -> reg [ SIM_REG_ERROR ] = 0;
+  return ecSuccess;
+}
+
+static int
+_I2CWrite ( void*  handle, uint8_t  slAddr, uint8_t*  wrData1, int  wrLen1,
+            uint8_t*  wrData2, int  wrLen2 ) {
+  SimDevice_t*  dev = ( SimDevice_t* ) handle;
+  uint8_t  addr;
+
+  if ( slAddr == SIM_TH_ADDR && dev -> cfg . thSensor ) {
+    uint8_t  cmd [ 2 ];
+    int  len = 0;
+
+    dev -> nWrite++;
+    dev -> nBytes += wrLen1 + wrLen2;
+    for ( int i = 0; i < wrLen1 && len < 2; i++ )
+      cmd [ len++ ] = wrData1 [ i ];
+    for ( int i = 0; i < wrLen2 && len < 2; i++ )
+      cmd [ len++ ] = wrData2 [ i ];
+    return wrLen1 + wrLen2 == 1 ? _ThWrite ( dev, cmd, 1 ) : ecHALError;
+  }
+  if ( slAddr != SIM_I2C_ADDR )
+    return ecHALError;
+  dev -> nWrite++;
+  dev -> nBytes += wrLen1 + wrLen2;
+  if ( wrLen1 == 0 )
+    return ecSuccess;
+
+  _Update ( dev );
+  addr = wrData1 [ 0 ];
+  if ( addr == SIM_REG_CMD && wrLen2 > 0 ) {
+    dev -> cmd = wrData2 [ 0 ];
+    if ( dev -> cmd & 0x80 ) {
+      dev -> tStart  = SIM_Clock ( );
+      dev -> latched = 0;
+    }
+    _Update ( dev );
+    return ecSuccess;
+  }
+  if ( addr == SIM_REG_SEQ )
+    dev -> seqLen = ( uint8_t ) wrLen2;
+  for ( int i = 0; i < wrLen2; i++ )
+    dev -> reg [ ( uint8_t ) ( addr + i ) ] = wrData2 [ i ];
+  return ecSuccess;
+}
+
+/* A write followed by a read of the same device is a register read; any
+   other segment is a transfer of its own. Stops at the first failure. */
+static int
+_I2CBatch ( void*  handle, I2CSegment_t*  seg, int  count ) {
+  for ( int i = 0; i < count; i++ ) {
+    int  ret;
+
+    if ( ! seg [ i ] . read && i + 1 < count && seg [ i + 1 ] . read &&
+         seg [ i + 1 ] . addr == seg [ i ] . addr ) {
+      ret = _I2CRead ( handle, seg [ i ] . addr, seg [ i ] . data,
+                       seg [ i ] . len, seg [ i + 1 ] . data, seg [ i + 1 ] . len );
+      i++;
+    } else if ( seg [ i ] . read ) {
+      ret = _I2CRead ( handle, seg [ i ] . addr, NULL, 0, seg [ i ] . data,
+                       seg [ i ] . len );
+    } else {
+      ret = _I2CWrite ( handle, seg [ i ] . addr, seg [ i ] . data,
+                        seg [ i ] . len > 0, seg [ i ] . data + 1,
+                        seg [ i ] . len - 1 );
+    }
+    if ( ret )
+      return ret;
+  }
+  return ecSuccess;
+}
+
+static int
+_Reset ( void*  handle ) {
+  SimDevice_t*  dev = ( SimDevice_t* ) handle;
+  dev -> cmd = 0;
+  dev -> reg [ SIM_REG_STATUS ] = 0;
+  dev -> reg [ SIM_REG_ERROR ]  = 0x80;
+  return ecSuccess;
+}
+
+int
+SIM_Init ( Interface_t*  hal, SimDevice_t*  dev, SimConfig_t const*  cfg ) {
+  if ( ! cfg )
+    cfg = &SIM_DefaultConfig;
+  /* switching the mode here would change the time of the other sensors */
+  if ( _modeSet && ( ! cfg -> realtime ) != ( ! _realtime ) )
+    return ecHALError;
+
+  memset ( dev, 0, sizeof ( *dev ) );
+  dev -> cfg = *cfg;
+  _realtime  = cfg -> realtime;
+  _modeSet   = 1;
+
+  dev -> reg [ SIM_REG_PID ]     = 0x63;
+  dev -> reg [ SIM_REG_PID + 1 ] = 0x20;
+  memcpy ( &dev -> reg [ SIM_REG_CONF ], _conf, sizeof ( _conf ) );
+  memcpy ( &dev -> reg [ SIM_REG_PROD ], _prod, sizeof ( _prod ) );
+  memcpy ( &dev -> reg [ SIM_REG_TRACKING ], _track, sizeof ( _track ) );
+
+  hal -> handle   = dev;
+  hal -> msSleep  = _SleepMS;
+  hal -> i2cRead  = _I2CRead;
+  hal -> i2cWrite = _I2CWrite;
+  hal -> reset    = _Reset;
+  hal -> msClock  = SIM_Clock;
+  hal -> i2cBatch = _I2CBatch;
+  hal -> msSleepUntil = _SleepUntilMS;
+  return ecSuccess;
+}
+
+/** @} */
@@ -0,0 +1,110 @@
+/**
+ * @addtogroup sim_hal
+ * @{
+ * @file    sim.h
+ * @brief   Simulated ZMOD4510 HAL type and function declarations
+ *
+ * The simulator implements the ::Interface_t functions on top of a register
+ *  model of the ZMOD4510. It answers the identification, configuration and
+ *  status registers, runs the sequencer in single-shot or sleep-timer
+ *  (free-running) mode and produces ADC results for every completed cycle.
+ *  Reading results while the sequencer is running sets the access conflict
+ *  flag in register 0xB7, as the real sensor does.
+ *
+ * By default time is virtual: msSleep advances a process-wide clock instead
+ *  of blocking, so hours of operation can be simulated in milliseconds. The
+ *  clock may be advanced from several threads, each driving its own sensors;
+ *  every sleep then moves the time of all sensors, so a thread sees the sum
+ *  of all sleeps, not its own. The clock and its mode, virtual or real time,
+ *  are shared because the ::Interface_t time functions receive no sensor
+ *  handle. The first SIM_Init() fixes the mode and only SIM_SetRealtime()
+ *  changes it.
+ *
+ * The ADC results follow a slow sine per sequence step with a little noise.
+ *  For load tests the waveform can be made livelier: a baseline drift, more
+ *  noise, and gas events that raise the readings of the O3 or the NO2 half
+ *  of the sequence for a few minutes. These are off by default.
+ *
+ * A companion SHT4x temperature and humidity sensor answers at address 0x44
+ *  on the same interface: it accepts the measurement, serial number and
+ *  soft reset commands and, like the real part, does not acknowledge a read
+ *  until the conversion time has passed.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include "hal/hal.h"
+
+/**
+ * @brief Simulator parameters
+ */
+typedef struct {
+  uint32_t  seqTime;    /**< duration of a measurement sequence in ms */
+  uint32_t  period;     /**< sleep-timer cycle length in ms */
+  int       realtime;   /**< if != 0, sleep for real instead of virtually */
+  uint32_t  seed;       /**< seed of the ADC noise */
+  float     drift;      /**< baseline drift amplitude, fraction of the range */
+  float     noise;      /**< extra noise amplitude, fraction of the range */
+  uint32_t  eventRate;  /**< gas events per 1000 cycles, 0 for none */
+  float     eventDepth; /**< peak change of an event, fraction of the range */
+  int       thSensor;   /**< if != 0, simulate an SHT4x at address 0x44 */
+} SimConfig_t;
+
+/**
+ * @brief State of one simulated sensor
+ */
+typedef struct {
+  SimConfig_t  cfg;
+  uint8_t      reg [ 256 ];   /**< register file */
+  uint8_t      seqLen;        /**< length of the last sequencer table */
+  uint8_t      cmd;           /**< last command written to 0x93 */
+  uint64_t     tStart;        /**< time the sequencer was started */
+  uint32_t     latched;       /**< cycles since start copied to 0x97 */
+  uint32_t     cycles;        /**< cycles completed since initialization */
+  uint32_t     nRead;         /**< number of read transactions */
+  uint32_t     nWrite;        /**< number of write transactions */
+  uint32_t     nBytes;        /**< payload bytes transferred */
+  uint8_t      thCmd;         /**< pending SHT4x command, 0 if none */
+  uint64_t     thStart;       /**< time the SHT4x command was written */
+  uint32_t     thCount;       /**< SHT4x measurements completed */
+} SimDevice_t;
+
+/**
+ * @brief Default parameters matching the ZMOD4510 NO2/O3 configuration
+ */
+extern const SimConfig_t  SIM_DefaultConfig;
+
+/**
+ * @brief Initialize a simulated sensor and populate ::Interface_t object
+ *
+ * @param hal   pointer to ::Interface_t object to be initialized
+ * @param dev   storage for the simulated sensor, referenced by hal->handle
+ * @param cfg   simulator parameters, NULL for ::SIM_DefaultConfig
+ * @return      error code
+ * @retval  0   on success
+ * @retval  ecHALError if cfg->realtime differs from the mode of the sensors
+ *              initialized before, see SIM_SetRealtime()
+ */
+int  SIM_Init ( Interface_t*  hal, SimDevice_t*  dev, SimConfig_t const*  cfg );
+
+/**
+ * @brief Current simulated time in ms
+ */
+uint64_t  SIM_Clock ( void );
+
+/**
+ * @brief Switch all simulated sensors between virtual and real time
+ *
+ * The clock continues from its current value, so sensors can be brought up
+ *  and warmed up in virtual time and then run in real time, e.g. for a load
+ *  test. Must not be called while another thread uses the simulator.
+ *
+ * @param enable  if != 0, sleep for real from now on
+ */
+void  SIM_SetRealtime ( int  enable );
+
+#endif /* SIM_H */
+
+/** @} */
@@ -19,20 +19,42 @@
 #include "hal/hal.h"
 #include "hal/zmod4xxx_hal.h"
 #include "sensors/zmod4xxx_types.h"
+#include "util/ztrace.h"
 
+/* The legacy API passes no interface to read/write. The interface of the
+ *  last zmod4xxx_init is used, unless the calling thread selected its own. */
 static Interface_t* _hal;
+static __thread Interface_t* _threadHal;
+
+static Interface_t*
+_Current ( void ) {
+  return _threadHal ? _threadHal : __atomic_load_n ( &_hal, __ATOMIC_ACQUIRE );
+}
 
 /* wrapper function, mapping register read api to generic I2C API */
 static int8_t
 _i2c_read_reg ( uint8_t  slaveAddr, uint8_t  addr, uint8_t*  data, uint8_t  len ) {
-  return _hal -> i2cRead ( _hal -> handle, slaveAddr, &addr, 1, data, len );
+  Interface_t*  hal = _Current ( );
+  int  ret;
+
+  ZTRACE_BEGIN ( "i2c_read_reg", slaveAddr, addr );
+  ret = hal -> i2cRead ( hal -> handle, slaveAddr, &addr, 1, data, len );
+  ZTRACE_END ( "i2c_read_reg", slaveAddr, ret );
+  /* HAL errors such as ecHALError do not fit the int8_t of the legacy API */
+  return ret ? ERROR_I2C : ZMOD4XXX_OK;
 }
 
 
 /* wrapper function, mapping register write api to generic I2C API */
 static int8_t
 _i2c_write_reg ( uint8_t  slaveAddr, uint8_t  addr, uint8_t*  data, uint8_t  len ) {
-  return _hal -> i2cWrite ( _hal -> handle, slaveAddr, &addr, 1, data, len );
+  Interface_t*  hal = _Current ( );
+  int  ret;
+
+  ZTRACE_BEGIN ( "i2c_write_reg", slaveAddr, addr );
+  ret = hal -> i2cWrite ( hal -> handle, slaveAddr, &addr, 1, data, len );
+  ZTRACE_END ( "i2c_write_reg", slaveAddr, ret );
+  return ret ? ERROR_I2C : ZMOD4XXX_OK;
 }
 
 
@@ -64,7 +86,8 @@ zmod4xxx_init ( zmod4xxx_dev_t*  dev, Interface_t*  hal ) {
   
   dev -> delay_ms ( 200 );
   
-  _hal = hal;
+  __atomic_store_n ( &_hal, hal, __ATOMIC_RELEASE );
+  _threadHal = hal;
 
   /* verify there is a sensor connected */
   if ( hal -> i2cWrite ( hal -> handle, dev ->i2c_addr, dummy, 0, NULL, 0 ) ) {
@@ -73,3 +96,9 @@ zmod4xxx_init ( zmod4xxx_dev_t*  dev, Interface_t*  hal ) {
 
   return ZMOD4XXX_OK;
 }
+
+
+void
+zmod4xxx_select ( Interface_t*  hal ) {
+  _threadHal = hal;
+}
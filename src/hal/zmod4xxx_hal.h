@@ -47,6 +47,19 @@ extern "C" {
  */
 int  zmod4xxx_init ( zmod4xxx_dev_t*  dev, Interface_t*  hal );
 
+/**
+ * Select the interface used by the calling thread
+ *
+ * The legacy API does not pass the interface to zmod4xxx_dev_t#read and
+ *  zmod4xxx_dev_t#write. zmod4xxx_init selects \a hal for the calling thread
+ *  and makes it the default of all other threads. A thread operating sensors
+ *  on several interfaces must select the interface of the sensor before
+ *  each API call; NULL reverts to the default.
+ *
+ * \param    [in] hal   pointer to the hal interface object
+ */
+void zmod4xxx_select ( Interface_t*  hal );
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,13 +1,33 @@
 #include "sensor_interface.h"
+#include "tsdb.h"
+#include "rollup.h"
 #include <stdio.h>
 #include <stdlib.h>
 
-int main() {    
+/* Number of results after which the partially filled store block is
+ * persisted (100 samples = 10 min). */
+#define STORE_FLUSH_INTERVAL 100
+
+/* Usage: no2_o3-example [store-file]
+ * If a store file is given, every result is appended to it. */
+int main(int argc, char** argv) {
+    tsdb_t store;
+    int use_store = argc > 1;
+    unsigned stored = 0;
+    static rollup_t rollup;
+    rollup_stats_t o3_1h;
+
     int ret = sensor_init();
     if (ret) {
         return EXIT_FAILURE;
     }
 
+    if (use_store && tsdb_open(&store, argv[1])) {
+        printf("Cannot open result store %s\n", argv[1]);
+        sensor_close();
+        return EXIT_FAILURE;
+    }
+
     /* Set default values for temperature and humidity: These values will be used
      * if no sensor is detected or if reading the sensor fails. 
      * The temperature value of -300°C causes the algo to use the on-chip temperature
@@ -15,12 +35,28 @@ int main() {
      * sensor provides better accuracy and is the preferred input source. */
     float default_temperature = -300;
     float default_humidity    =  50;
-    printf("Using on-chip temperature sensor and 50%% relative humidity!\n\n");
+    if (sensor_th_present()) {
+        printf("Using the SHT4x temperature and humidity sensor!\n\n");
+    } else {
+        printf("Using on-chip temperature sensor and 50%% relative humidity!\n\n");
+    }
+
+    rollup_init(&rollup);
 
-    sensor_results_t results;
+    sensor_results_t results = { 0 };
     while ( 1 ) {
         sensor_step(default_temperature, default_humidity, &results);
-    
+        if (use_store) {
+            tsdb_err err = tsdb_append(&store, &results);
+            if (err) {
+                printf("Cannot append to result store: error %d\n", err);
+            } else if (++stored % STORE_FLUSH_INTERVAL == 0 &&
+                       (err = tsdb_flush(&store))) {
+                printf("Cannot flush result store: error %d\n", err);
+            }
+        }
+        rollup_update(&rollup, &results);
+
         /* Check validity of the algorithm results. */
         switch (results.status) {
         case NO2_O3_STABILIZATION:
@@ -34,6 +70,10 @@ int main() {
             printf("  NO2_conc    = %8.3f ppb\n", results.no2_ppb);
             printf("  Fast AQI    = %8i\n", results.fast_aqi);
             printf("  EPA AQI     = %8i\n", results.epa_aqi);
+            rollup_get(&rollup, ROLLUP_O3, ROLLUP_1H, &o3_1h);
+            printf("  O3 1h       = mean %.3f, min %.3f, max %.3f, "
+                   "p95 %.3f ppb\n", o3_1h.mean, o3_1h.min, o3_1h.max,
+                   rollup_quantile(&rollup, ROLLUP_O3, ROLLUP_1H, 0.95F));
             break;
         /* Notification from Sensor self-check. For more information, read the
          * Datasheet, section "Conditioning, Sensor Self-Check Status, and 
@@ -41,9 +81,16 @@ int main() {
         case NO2_O3_DAMAGE:
             printf("Error: Sensor probably damaged. Algorithm results may be incorrect.\n");
             break;
+        /* The sequencer did not complete within one sample period. */
+        case ERROR_GAS_TIMEOUT:
+            printf("Warning: Measurement did not complete in time, sample skipped.\n");
+            break;
         /* Exit program due to unexpected error. */
         default:
             printf("Unexpected status.\n");
+            if (use_store) {
+                tsdb_close(&store);
+            }
             sensor_close();
             return EXIT_FAILURE;
         }
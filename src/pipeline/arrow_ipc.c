@@ -0,0 +1,612 @@
+/**
+ * @file    arrow_ipc.c
+ * @brief   Columnar export of sensor results to Apache Arrow IPC files
+ *
+ * The metadata of the format are FlatBuffers. Their layout is fixed here, so
+ * they are encoded directly, front to back: a table is preceded by its vtable
+ * and followed by the objects it references, which keeps every reference a
+ * positive offset as FlatBuffers require.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "arrow_ipc.h"
+
+/* File magic, padded to 8 bytes at the start of the file */
+#define MAGIC         "ARROW1"
+#define MAGIC_LEN     (6)
+/* Upper bound of the schema and record batch metadata */
+#define META_MAX      (4096)
+#define CONTINUATION  (0xFFFFFFFFU)
+
+/* Schema.fbs and Message.fbs */
+#define METADATA_V5         (4)
+#define HEADER_SCHEMA       (1)
+#define HEADER_RECORD_BATCH (3)
+#define TYPE_INT            (2)
+#define TYPE_FLOATING_POINT (3)
+#define TYPE_TIMESTAMP      (10)
+#define PRECISION_SINGLE    (1)
+#define UNIT_MILLISECOND    (1)
+#define BLOCK_SIZE          (24)
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define ENDIANNESS (1)
+#else
+#define ENDIANNESS (0)
+#endif
+
+const arrow_config_t arrow_default_config = {
+    .batch_rows = 1024,
+    .tag = "zmod4510",
+};
+
+typedef struct {
+    const char *name;
+    uint8_t type;
+    uint8_t size;
+    uint16_t offset; /* in sensor_results_t */
+} column_t;
+
+#define TS(f)  { #f, TYPE_TIMESTAMP, 8, offsetof(sensor_results_t, f) }
+#define I32(f) { #f, TYPE_INT, 4, offsetof(sensor_results_t, f) }
+#define F32(f) { #f, TYPE_FLOATING_POINT, 4, offsetof(sensor_results_t, f) }
+#define RMOX(i) \
+    { "rmox" #i, TYPE_FLOATING_POINT, 4, offsetof(sensor_results_t, rmox[i]) }
+
+static const column_t columns[ARROW_COLUMNS] = {
+    TS(timestamp_ms), I32(status), F32(o3_ppb), F32(no2_ppb),
+    I32(fast_aqi), I32(epa_aqi), RMOX(0), RMOX(1), RMOX(2), RMOX(3),
+    F32(o3_1min_ppb), F32(o3_1h_ppb), F32(o3_8h_ppb), F32(no2_1min_ppb),
+    F32(no2_1h_ppb), F32(temperature_degc), F32(humidity_pct),
+};
+
+static uint32_t pad8(uint32_t n)
+{
+    return (n + 7) & ~7U;
+}
+
+static void put_le(uint8_t *p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, int n)
+{
+    uint64_t v = 0;
+
+    for (int i = n - 1; i >= 0; i--) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+/* ---- FlatBuffers, built front to back ---- */
+
+typedef struct {
+    uint8_t *buf;
+    uint32_t len;
+    uint32_t cap;
+    int overflow;
+} fb_t;
+
+/* Reserve size bytes at the given alignment, zeroed. On overflow the
+ * object lands at 0 and the buffer is discarded by the caller. */
+static uint32_t fb_alloc(fb_t *b, uint32_t size, uint32_t align)
+{
+    uint32_t pos = (b->len + align - 1) & ~(align - 1);
+
+    if (pos + size > b->cap) {
+        b->overflow = 1;
+        return 0;
+    }
+    memset(b->buf + b->len, 0, pos + size - b->len);
+    b->len = pos + size;
+    return pos;
+}
+
+static void fb_put(fb_t *b, uint32_t pos, uint64_t v, int n)
+{
+    put_le(b->buf + pos, v, n);
+}
+
+/* Store at slot the offset of target, which lies behind it */
+static void fb_ref(fb_t *b, uint32_t slot, uint32_t target)
+{
+    put_le(b->buf + slot, target - slot, 4);
+}
+
+/* A table of n fields (at most 8) with the given sizes, 0 for absent. The
+ * position of each field is returned in slot. */
+static uint32_t fb_table(fb_t *b, int n, const uint8_t *size, uint32_t *slot)
+{
+    uint32_t vt = fb_alloc(b, 4 + 2 * n, 2);
+    uint32_t align = 4, end = 4, t;
+    uint16_t at[8];
+
+    for (int i = 0; i < n; i++) {
+        at[i] = 0;
+        if (size[i]) {
+            end = (end + size[i] - 1) & ~(uint32_t)(size[i] - 1);
+            at[i] = (uint16_t)end;
+            end += size[i];
+            align = size[i] > align ? size[i] : align;
+        }
+    }
+    t = fb_alloc(b, end, align);
+    fb_put(b, vt, 4 + 2 * n, 2);
+    fb_put(b, vt + 2, end, 2);
+    for (int i = 0; i < n; i++) {
+        fb_put(b, vt + 4 + 2 * i, at[i], 2);
+        slot[i] = t + at[i];
+    }
+    fb_put(b, t, t - vt, 4);
+    return t;
+}
+
+static uint32_t fb_string(fb_t *b, const char *s)
+{
+    uint32_t len = (uint32_t)strlen(s);
+    uint32_t pos = fb_alloc(b, 4 + len + 1, 4);
+
+    fb_put(b, pos, len, 4);
+    memcpy(b->buf + pos + 4, s, len);
+    return pos;
+}
+
+/* A vector of count elements; returns the position of its length, the
+ * elements follow at the given alignment */
+static uint32_t fb_vector(fb_t *b, uint32_t count, uint32_t elem,
+                          uint32_t align)
+{
+    uint32_t pos;
+
+    while ((b->len + 4) % align && b->len < b->cap) {
+        b->buf[b->len++] = 0;
+    }
+    pos = fb_alloc(b, 4 + count * elem, 4);
+    fb_put(b, pos, count, 4);
+    return pos;
+}
+
+/* Position of field k of a table in a buffer read back, 0 if absent */
+static uint32_t fb_field(const uint8_t *buf, uint32_t len, uint32_t table,
+                         int k)
+{
+    uint32_t vt, vlen, at;
+
+    if (table + 4 > len) {
+        return 0;
+    }
+    vt = table - (uint32_t)get_le(buf + table, 4);
+    if (vt + 4 > len) {
+        return 0;
+    }
+    vlen = (uint32_t)get_le(buf + vt, 2);
+    if (4 + 2 * (uint32_t)k + 2 > vlen || vt + vlen > len) {
+        return 0;
+    }
+    at = (uint32_t)get_le(buf + vt + 4 + 2 * k, 2);
+    return at && table + at < len ? table + at : 0;
+}
+
+/* ---- Arrow metadata ---- */
+
+static uint32_t put_type(fb_t *b, const column_t *c)
+{
+    static const uint8_t ts[2] = { 2, 4 }, in[2] = { 4, 1 }, fp[1] = { 2 };
+    uint32_t slot[2], t;
+
+    switch (c->type) {
+    case TYPE_TIMESTAMP:
+        t = fb_table(b, 2, ts, slot);
+        fb_put(b, slot[0], UNIT_MILLISECOND, 2);
+        fb_ref(b, slot[1], fb_string(b, "UTC"));
+        break;
+    case TYPE_INT:
+        t = fb_table(b, 2, in, slot);
+        fb_put(b, slot[0], 32, 4);
+        fb_put(b, slot[1], 1, 1);
+        break;
+    default:
+        t = fb_table(b, 1, fp, slot);
+        fb_put(b, slot[0], PRECISION_SINGLE, 2);
+        break;
+    }
+    return t;
+}
+
+static uint32_t put_schema(fb_t *b, const char *tag)
+{
+    /* endianness, fields, custom_metadata */
+    static const uint8_t schema[3] = { 2, 4, 4 };
+    /* name, nullable, type_type, type, dictionary, children */
+    static const uint8_t field[6] = { 4, 1, 1, 4, 0, 4 };
+    /* key, value */
+    static const uint8_t kv[2] = { 4, 4 };
+    uint32_t s[3], f[6], k[2], t, fields, meta, pair;
+
+    t = fb_table(b, 3, schema, s);
+    fb_put(b, s[0], ENDIANNESS, 2);
+    fields = fb_vector(b, ARROW_COLUMNS, 4, 4);
+    fb_ref(b, s[1], fields);
+    for (int i = 0; i < ARROW_COLUMNS; i++) {
+        uint32_t pos = fb_table(b, 6, field, f);
+
+        fb_ref(b, fields + 4 + 4 * i, pos);
+        fb_ref(b, f[0], fb_string(b, columns[i].name));
+        fb_put(b, f[2], columns[i].type, 1);
+        fb_ref(b, f[3], put_type(b, &columns[i]));
+        fb_ref(b, f[5], fb_vector(b, 0, 4, 4));
+    }
+    meta = fb_vector(b, 1, 4, 4);
+    fb_ref(b, s[2], meta);
+    pair = fb_table(b, 2, kv, k);
+    fb_ref(b, meta + 4, pair);
+    fb_ref(b, k[0], fb_string(b, "sensor"));
+    fb_ref(b, k[1], fb_string(b, tag));
+    return t;
+}
+
+/* Message with room for its header; returns the slot of the header */
+static uint32_t put_message(fb_t *b, uint8_t header_type, int64_t body_len)
+{
+    /* version, header_type, header, bodyLength */
+    static const uint8_t message[4] = { 2, 1, 4, 8 };
+    uint32_t root = fb_alloc(b, 4, 4), s[4];
+
+    fb_ref(b, root, fb_table(b, 4, message, s));
+    fb_put(b, s[0], METADATA_V5, 2);
+    fb_put(b, s[1], header_type, 1);
+    fb_put(b, s[3], (uint64_t)body_len, 8);
+    return s[2];
+}
+
+static int64_t body_len(uint32_t rows)
+{
+    int64_t len = 0;
+
+    for (int i = 0; i < ARROW_COLUMNS; i++) {
+        len += pad8(rows * columns[i].size);
+    }
+    return len;
+}
+
+static void put_record_batch(fb_t *b, uint32_t slot, uint32_t rows)
+{
+    /* length, nodes, buffers */
+    static const uint8_t batch[3] = { 8, 4, 4 };
+    uint32_t s[3], nodes, buffers;
+    uint64_t off = 0;
+
+    fb_ref(b, slot, fb_table(b, 3, batch, s));
+    fb_put(b, s[0], rows, 8);
+    nodes = fb_vector(b, ARROW_COLUMNS, 16, 8);
+    fb_ref(b, s[1], nodes);
+    buffers = fb_vector(b, 2 * ARROW_COLUMNS, 16, 8);
+    fb_ref(b, s[2], buffers);
+    for (int i = 0; i < ARROW_COLUMNS; i++) {
+        uint32_t len = rows * columns[i].size;
+        uint32_t node = nodes + 4 + 16 * i, buf = buffers + 4 + 32 * i;
+
+        fb_put(b, node, rows, 8);      /* length, no nulls */
+        fb_put(b, buf, off, 8);        /* no validity bitmap */
+        fb_put(b, buf + 16, off, 8);   /* values */
+        fb_put(b, buf + 24, len, 8);
+        off += pad8(len);
+    }
+}
+
+/* Frame the metadata built at out + 8 as an encapsulated message; returns
+ * its length, a multiple of 8 */
+static uint32_t frame(uint8_t *out, fb_t *b)
+{
+    uint32_t len = pad8(b->len);
+
+    memset(b->buf + b->len, 0, len - b->len);
+    put_le(out, CONTINUATION, 4);
+    put_le(out + 4, len, 4);
+    return 8 + len;
+}
+
+static uint32_t schema_message(uint8_t *out, const char *tag)
+{
+    fb_t b = { out + 8, 0, META_MAX - 8, 0 };
+    uint32_t slot = put_message(&b, HEADER_SCHEMA, 0);
+
+    fb_ref(&b, slot, put_schema(&b, tag));
+    return b.overflow ? 0 : frame(out, &b);
+}
+
+static uint32_t record_batch_message(uint8_t *out, uint32_t rows)
+{
+    fb_t b = { out + 8, 0, META_MAX - 8, 0 };
+
+    put_record_batch(&b, put_message(&b, HEADER_RECORD_BATCH, body_len(rows)),
+                     rows);
+    return b.overflow ? 0 : frame(out, &b);
+}
+
+/* ---- file ---- */
+
+static int write_all(int fd, struct iovec *iov, int n, off_t at)
+{
+    while (n > 0) {
+        ssize_t done = pwritev(fd, iov, n, at);
+        if (done < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        at += done;
+        while (n > 0 && (size_t)done >= iov->iov_len) {
+            done -= (ssize_t)iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + done;
+            iov->iov_len -= (size_t)done;
+        }
+    }
+    return 0;
+}
+
+static int pread_all(int fd, void *buf, size_t len, off_t at)
+{
+    return pread(fd, buf, len, at) == (ssize_t)len ? 0 : -1;
+}
+
+static arrow_err add_block(arrow_writer_t *w, int64_t offset, int32_t meta,
+                           int64_t body)
+{
+    if (w->n_blocks == w->cap_blocks) {
+        uint32_t cap = w->cap_blocks ? 2 * w->cap_blocks : 64;
+        arrow_block_t *b = realloc(w->blocks, cap * sizeof(*b));
+
+        if (!b) {
+            return ARROW_ERR_NOMEM;
+        }
+        w->blocks = b;
+        w->cap_blocks = cap;
+    }
+    w->blocks[w->n_blocks].offset = offset;
+    w->blocks[w->n_blocks].meta_len = meta;
+    w->blocks[w->n_blocks].body_len = body;
+    w->n_blocks++;
+    return ARROW_OK;
+}
+
+/* Check that an existing file starts like ours, collect its complete record
+ * batches and cut off the footer and anything incomplete behind them */
+static arrow_err resume(arrow_writer_t *w, int64_t size, const uint8_t *schema,
+                        uint32_t schema_len)
+{
+    uint64_t buf[META_MAX / 8];
+    uint8_t *meta = (uint8_t *)buf;
+    int64_t pos = 8 + schema_len;
+
+    if (size < pos || pread_all(w->fd, meta, 8, 0) ||
+        memcmp(meta, MAGIC, MAGIC_LEN) ||
+        pread_all(w->fd, meta, schema_len, 8) ||
+        memcmp(meta, schema, schema_len)) {
+        return ARROW_ERR_FORMAT;
+    }
+    for (;;) {
+        uint32_t len, root, type, body;
+        int64_t body_bytes;
+
+        if (pos + 8 > size || pread_all(w->fd, meta, 8, pos) ||
+            get_le(meta, 4) != CONTINUATION) {
+            break;
+        }
+        len = (uint32_t)get_le(meta + 4, 4);
+        if (len < 8 || len > META_MAX || pos + 8 + len > size ||
+            pread_all(w->fd, meta, len, pos + 8)) {
+            break;
+        }
+        root = (uint32_t)get_le(meta, 4);
+        type = fb_field(meta, len, root, 1);
+        body = fb_field(meta, len, root, 3);
+        if (!type || meta[type] != HEADER_RECORD_BATCH || !body ||
+            body + 8 > len) {
+            break;
+        }
+        body_bytes = (int64_t)get_le(meta + body, 8);
+        if (body_bytes < 0 || pos + 8 + len + body_bytes > size) {
+            break;
+        }
+        if (add_block(w, pos, (int32_t)(8 + len), body_bytes)) {
+            return ARROW_ERR_NOMEM;
+        }
+        pos += 8 + len + body_bytes;
+    }
+    w->end = pos;
+    return ftruncate(w->fd, pos) ? ARROW_ERR_IO : ARROW_OK;
+}
+
+arrow_err arrow_open(arrow_writer_t *w, const char *path,
+                     const arrow_config_t *cfg)
+{
+    uint64_t buf[(8 + META_MAX) / 8];
+    uint8_t *head = (uint8_t *)buf;
+    uint32_t off = 0, schema_len;
+    int64_t size;
+    arrow_err ret;
+
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    w->cfg = cfg ? *cfg : arrow_default_config;
+    w->cfg.tag[ARROW_TAG_LEN - 1] = 0;
+    if (!w->cfg.batch_rows) {
+        w->cfg.batch_rows = 1;
+    } else if (w->cfg.batch_rows > ARROW_MAX_ROWS) {
+        w->cfg.batch_rows = ARROW_MAX_ROWS;
+    }
+    for (int i = 0; i < ARROW_COLUMNS; i++) {
+        w->col_off[i] = off;
+        off += pad8(w->cfg.batch_rows * columns[i].size);
+    }
+    w->body = malloc(off);
+    schema_len = schema_message(head + 8, w->cfg.tag);
+    if (!w->body || !schema_len) {
+        free(w->body);
+        w->body = NULL;
+        return ARROW_ERR_NOMEM;
+    }
+
+    w->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    size = w->fd < 0 ? -1 : lseek(w->fd, 0, SEEK_END);
+    if (size < 0) {
+        ret = ARROW_ERR_IO;
+    } else if (size) {
+        ret = resume(w, size, head + 8, schema_len);
+    } else {
+        memset(head, 0, 8);
+        memcpy(head, MAGIC, MAGIC_LEN);
+        ret = pwrite(w->fd, head, 8 + schema_len, 0) ==
+                      (ssize_t)(8 + schema_len)
+                  ? ARROW_OK
+                  : ARROW_ERR_IO;
+        w->end = 8 + schema_len;
+    }
+    if (ret) {
+        if (w->fd >= 0) {
+            close(w->fd);
+        }
+        w->fd = -1;
+        free(w->body);
+        free(w->blocks);
+        w->body = NULL;
+        w->blocks = NULL;
+        return ret;
+    }
+    return ARROW_OK;
+}
+
+arrow_err arrow_write_batch(arrow_writer_t *w)
+{
+    static const uint8_t zeros[8];
+    uint64_t meta[META_MAX / 8];
+    struct iovec iov[1 + 2 * ARROW_COLUMNS];
+    uint32_t meta_len;
+    int64_t body = body_len(w->rows);
+    int n = 0;
+
+    if (!w->rows) {
+        return ARROW_OK;
+    }
+    /* the block is recorded first, so a written batch is never missing
+     * from the footer */
+    if (add_block(w, w->end, 0, body)) {
+        return ARROW_ERR_NOMEM;
+    }
+    meta_len = record_batch_message((uint8_t *)meta, w->rows);
+    iov[n].iov_base = meta;
+    iov[n++].iov_len = meta_len;
+    for (int i = 0; i < ARROW_COLUMNS; i++) {
+        uint32_t len = w->rows * columns[i].size;
+
+        iov[n].iov_base = w->body + w->col_off[i];
+        iov[n++].iov_len = len;
+        if (pad8(len) != len) {
+            iov[n].iov_base = (void *)zeros;
+            iov[n++].iov_len = pad8(len) - len;
+        }
+    }
+    if (!meta_len || write_all(w->fd, iov, n, w->end)) {
+        /* the retry overwrites what was written of the batch */
+        w->n_blocks--;
+        return ARROW_ERR_IO;
+    }
+    w->blocks[w->n_blocks - 1].meta_len = (int32_t)meta_len;
+    w->end += meta_len + body;
+    w->rows = 0;
+    return ARROW_OK;
+}
+
+void arrow_append(arrow_writer_t *w, const sensor_results_t *r)
+{
+    const uint8_t *src = (const uint8_t *)r;
+
+    for (int i = 0; i < ARROW_COLUMNS; i++) {
+        uint8_t *dst = w->body + w->col_off[i] + w->rows * columns[i].size;
+
+        if (8 == columns[i].size) {
+            memcpy(dst, src + columns[i].offset, 8);
+        } else {
+            memcpy(dst, src + columns[i].offset, 4);
+        }
+    }
+    w->rows++;
+}
+
+/* End-of-stream marker, footer, its length and the closing magic */
+arrow_err arrow_write_footer(arrow_writer_t *w)
+{
+    /* version, schema, dictionaries, recordBatches */
+    static const uint8_t footer[4] = { 2, 4, 4, 4 };
+    uint32_t cap = 8 + META_MAX + BLOCK_SIZE * w->n_blocks + 16;
+    uint8_t *out = malloc(cap);
+    fb_t b;
+    uint32_t root, s[4], batches, len;
+    arrow_err ret = ARROW_OK;
+
+    if (!out) {
+        return ARROW_ERR_NOMEM;
+    }
+    put_le(out, CONTINUATION, 4);
+    put_le(out + 4, 0, 4);
+    b = (fb_t){ out + 8, 0, cap - 8 - 10, 0 };
+    root = fb_alloc(&b, 4, 4);
+    fb_ref(&b, root, fb_table(&b, 4, footer, s));
+    fb_put(&b, s[0], METADATA_V5, 2);
+    fb_ref(&b, s[1], put_schema(&b, w->cfg.tag));
+    fb_ref(&b, s[2], fb_vector(&b, 0, BLOCK_SIZE, 8));
+    batches = fb_vector(&b, w->n_blocks, BLOCK_SIZE, 8);
+    fb_ref(&b, s[3], batches);
+    for (uint32_t i = 0; i < w->n_blocks; i++) {
+        uint32_t at = batches + 4 + BLOCK_SIZE * i;
+
+        fb_put(&b, at, (uint64_t)w->blocks[i].offset, 8);
+        fb_put(&b, at + 8, (uint32_t)w->blocks[i].meta_len, 4);
+        fb_put(&b, at + 16, (uint64_t)w->blocks[i].body_len, 8);
+    }
+    len = b.len;
+    put_le(out + 8 + len, len, 4);
+    memcpy(out + 8 + len + 4, MAGIC, MAGIC_LEN);
+    len += 8 + 4 + MAGIC_LEN;
+    /* a failed batch may have left bytes behind the footer */
+    if (b.overflow || pwrite(w->fd, out, len, w->end) != (ssize_t)len ||
+        ftruncate(w->fd, w->end + len)) {
+        ret = ARROW_ERR_IO;
+    }
+    free(out);
+    return ret;
+}
+
+arrow_err arrow_close(arrow_writer_t *w)
+{
+    arrow_err ret = ARROW_OK;
+
+    if (w->fd < 0) {
+        return ARROW_OK;
+    }
+    if (close(w->fd)) {
+        ret = ARROW_ERR_IO;
+    }
+    free(w->body);
+    free(w->blocks);
+    w->body = NULL;
+    w->blocks = NULL;
+    w->fd = -1;
+    return ret;
+}
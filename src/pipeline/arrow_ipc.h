@@ -0,0 +1,133 @@
+/**
+ * @file    arrow_ipc.h
+ * @brief   Columnar export of sensor results to Apache Arrow IPC files
+ *
+ * Every field of a result is stored straight into its column of the next
+ *  record batch, so a batch is written with a single writev() of its
+ *  metadata and column buffers, without converting rows. The writer only
+ *  buffers rows and writes batches of up to batch_rows results; when to
+ *  write and sync is decided by the caller, export.h.
+ *
+ * Files are in the Arrow IPC file format (Feather V2): pyarrow and pandas
+ *  memory-map them and use the columns in place. The footer indexing the
+ *  batches is written on close; opening an existing file removes it and
+ *  appends, provided the file has the same columns and sensor name. A file
+ *  that was not closed lacks the footer but its complete batches can still
+ *  be read as an IPC stream, which read_arrow() in zmod4510.py falls back to.
+ *
+ * Columns: timestamp_ms (timestamp[ms, UTC]), status, o3_ppb, no2_ppb,
+ *  fast_aqi, epa_aqi, rmox0..3, the running averages, temperature_degc and
+ *  humidity_pct, as int32 and float32 in host byte order; NaN stays NaN.
+ *  The sensor name is stored in the schema metadata as "sensor".
+ */
+
+#ifndef ARROW_IPC_H
+#define ARROW_IPC_H
+
+#include <stdint.h>
+#include "sensor_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of columns */
+#define ARROW_COLUMNS   (17)
+/** Column bytes of one row */
+#define ARROW_ROW_BYTES (72)
+/** Upper bound of rows per record batch */
+#define ARROW_MAX_ROWS  (65536)
+/** Maximum length of the sensor name including the terminating zero. */
+#define ARROW_TAG_LEN   (32)
+
+/**
+ * @brief Error codes, the same values as export_err
+ */
+typedef enum {
+    ARROW_OK = 0,
+    ARROW_ERR_IO = -1,     /**< Opening, writing or syncing the file failed. */
+    ARROW_ERR_NOMEM = -2,  /**< The batch could not be allocated. */
+    ARROW_ERR_FORMAT = -3, /**< The file exists with other contents. */
+} arrow_err;
+
+/**
+ * @brief File layout
+ */
+typedef struct {
+    uint32_t batch_rows;      /**< maximum rows per record batch */
+    char tag[ARROW_TAG_LEN];  /**< sensor name, stored in the schema */
+} arrow_config_t;
+
+/**
+ * @brief Default layout: 1024 rows per batch
+ */
+extern const arrow_config_t arrow_default_config;
+
+/**
+ * @brief Position of a record batch in the file, listed in the footer
+ */
+typedef struct {
+    int64_t offset;
+    int32_t meta_len;   /**< including the message prefix */
+    int64_t body_len;
+} arrow_block_t;
+
+/**
+ * @brief Writer handle
+ */
+typedef struct {
+    int fd;
+    arrow_config_t cfg;
+    uint8_t *body;                    /**< column buffers of one batch */
+    uint32_t col_off[ARROW_COLUMNS];  /**< offset of each column in body */
+    uint32_t rows;                    /**< results buffered */
+    int64_t end;                      /**< file offset after the last batch */
+    arrow_block_t *blocks;            /**< batches in the file */
+    uint32_t n_blocks;
+    uint32_t cap_blocks;
+} arrow_writer_t;
+
+/**
+ * @brief Create a file, or open one written before and append to it
+ * @param [out] w writer handle
+ * @param [in] path output file
+ * @param [in] cfg layout, NULL for arrow_default_config
+ * @return error code
+ */
+arrow_err arrow_open(arrow_writer_t *w, const char *path,
+                     const arrow_config_t *cfg);
+
+/**
+ * @brief Add one result to the buffered batch
+ * @param [in] w writer handle, with fewer than cfg.batch_rows rows buffered
+ * @param [in] r result of sensor_step()
+ */
+void arrow_append(arrow_writer_t *w, const sensor_results_t *r);
+
+/**
+ * @brief Write the buffered results as one record batch
+ * @param [in] w writer handle
+ * @return error code; on failure the batch is kept for the next call
+ */
+arrow_err arrow_write_batch(arrow_writer_t *w);
+
+/**
+ * @brief Write the footer indexing the batches written so far
+ * @note  Write the buffered results first; the file is not synced.
+ * @param [in] w writer handle
+ * @return error code
+ */
+arrow_err arrow_write_footer(arrow_writer_t *w);
+
+/**
+ * @brief Close the file and free the buffers, without writing
+ * @param [in] w writer handle
+ * @return error code
+ */
+arrow_err arrow_close(arrow_writer_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ARROW_IPC_H */
@@ -0,0 +1,181 @@
+/**
+ * @file    deadband.c
+ * @brief   Change detection on the results of many sensors
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "deadband.h"
+
+/* status of a sensor that has not passed on any result yet */
+#define NO_STATUS INT32_MIN
+
+const deadband_config_t deadband_default_config = {
+    .o3_abs_ppb = 1.0F,
+    .no2_abs_ppb = 1.0F,
+    .rel = 0.05F,
+    .heartbeat_ms = 300000,
+};
+
+/* EPA category: 0 good, 1 moderate, ... 5 hazardous */
+static inline int32_t category(int32_t aqi)
+{
+    return (aqi > 50) + (aqi > 100) + (aqi > 150) + (aqi > 200) + (aqi > 300);
+}
+
+/* Moved beyond the band, or became or ceased to be a number. Written with
+ * selects only so that the loop over the sensors vectorizes; fmaxf() would
+ * not, as it has to order NaN. */
+static inline int moved(float last, float now, float abs_band, float rel)
+{
+    float band = rel * fabsf(last);
+
+    band = band > abs_band ? band : abs_band;
+    return (fabsf(now - last) > band) | (isnan(now) != isnan(last));
+}
+
+/* Select by mask, keep is all ones or zero. A ?: between the old and the
+ * new value of a state array becomes a conditional store, which does not
+ * vectorize. */
+static inline float select_f(int32_t keep, float old, float now)
+{
+    uint32_t a, b;
+
+    memcpy(&a, &old, sizeof(a));
+    memcpy(&b, &now, sizeof(b));
+    a = (a & (uint32_t)keep) | (b & ~(uint32_t)keep);
+    memcpy(&old, &a, sizeof(old));
+    return old;
+}
+
+deadband_err deadband_init(deadband_t *f, uint32_t count,
+                           const deadband_config_t *cfg)
+{
+    memset(f, 0, sizeof(*f));
+    f->cfg = cfg ? *cfg : deadband_default_config;
+    f->count = count;
+    f->o3 = calloc(count ? count : 1, sizeof(*f->o3));
+    f->no2 = calloc(count ? count : 1, sizeof(*f->no2));
+    f->fast_cat = calloc(count ? count : 1, sizeof(*f->fast_cat));
+    f->epa_cat = calloc(count ? count : 1, sizeof(*f->epa_cat));
+    f->status = malloc((count ? count : 1) * sizeof(*f->status));
+    f->sent_ms = calloc(count ? count : 1, sizeof(*f->sent_ms));
+    if (!f->o3 || !f->no2 || !f->fast_cat || !f->epa_cat || !f->status ||
+        !f->sent_ms) {
+        deadband_free(f);
+        return DEADBAND_ERR_NOMEM;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        f->status[i] = NO_STATUS;
+    }
+    return DEADBAND_OK;
+}
+
+/* The loop over the lanes of a batch. The arrays are parameters because
+ * restrict is only honoured there; without it the vectorizer gives up on
+ * the number of run-time alias checks. */
+static uint32_t filter_lanes(const deadband_config_t *cfg, uint32_t n,
+                             int64_t now_ms, float *restrict o3,
+                             float *restrict no2, int32_t *restrict fast_cat,
+                             int32_t *restrict epa_cat,
+                             int32_t *restrict status,
+                             uint32_t *restrict sent_ms,
+                             const float *restrict in_o3,
+                             const float *restrict in_no2,
+                             const int32_t *restrict in_fast,
+                             const int32_t *restrict in_epa,
+                             const int32_t *restrict in_status,
+                             uint8_t *restrict emit)
+{
+    const float o3_abs = cfg->o3_abs_ppb;
+    const float no2_abs = cfg->no2_abs_ppb;
+    const float rel = cfg->rel;
+    const int32_t hb = cfg->heartbeat_ms && cfg->heartbeat_ms < INT32_MAX ?
+                       (int32_t)cfg->heartbeat_ms : INT32_MAX;
+    const uint32_t now = (uint32_t)now_ms;
+    uint32_t passed = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        float o = o3[i], v = no2[i];
+        int32_t fc = category(in_fast[i]), ec = category(in_epa[i]);
+        int32_t fl = fast_cat[i], el = epa_cat[i], st = status[i];
+        uint32_t t = sent_ms[i];
+        int32_t pass = moved(o, in_o3[i], o3_abs, rel) |
+                       moved(v, in_no2[i], no2_abs, rel) |
+                       (fc != fl) | (ec != el) | (in_status[i] != st) |
+                       ((int32_t)(now - t) >= hb);
+        int32_t keep;
+
+        pass &= emit[i] != 0;
+        keep = pass - 1;
+        o3[i] = select_f(keep, o, in_o3[i]);
+        no2[i] = select_f(keep, v, in_no2[i]);
+        fast_cat[i] = (fl & keep) | (fc & ~keep);
+        epa_cat[i] = (el & keep) | (ec & ~keep);
+        status[i] = (st & keep) | (in_status[i] & ~keep);
+        sent_ms[i] = (t & (uint32_t)keep) | (now & ~(uint32_t)keep);
+        emit[i] = (uint8_t)pass;
+        passed += (uint32_t)pass;
+    }
+    return passed;
+}
+
+uint32_t deadband_filter(deadband_t *f, uint32_t first, uint32_t n,
+                         const deadband_batch_t *in, int64_t now_ms,
+                         uint8_t *emit)
+{
+    uint32_t passed;
+
+    for (uint32_t i = 0; i < n; i++) {
+        f->results += emit[i] != 0;
+    }
+    passed = filter_lanes(&f->cfg, n, now_ms, f->o3 + first, f->no2 + first,
+                          f->fast_cat + first, f->epa_cat + first,
+                          f->status + first, f->sent_ms + first, in->o3_ppb,
+                          in->no2_ppb, in->fast_aqi, in->epa_aqi, in->status,
+                          emit);
+    f->passed += passed;
+    return passed;
+}
+
+int deadband_check(deadband_t *f, uint32_t index, const sensor_results_t *r,
+                   int64_t now_ms)
+{
+    deadband_batch_t in = { &r->o3_ppb, &r->no2_ppb, &r->fast_aqi,
+                            &r->epa_aqi, &r->status };
+    uint8_t emit = 1;
+
+    return (int)deadband_filter(f, index, 1, &in, now_ms, &emit);
+}
+
+void deadband_reset(deadband_t *f, uint32_t index)
+{
+    f->o3[index] = 0;
+    f->no2[index] = 0;
+    f->fast_cat[index] = 0;
+    f->epa_cat[index] = 0;
+    f->status[index] = NO_STATUS;
+    f->sent_ms[index] = 0;
+}
+
+void deadband_move(deadband_t *f, uint32_t to, uint32_t from)
+{
+    f->o3[to] = f->o3[from];
+    f->no2[to] = f->no2[from];
+    f->fast_cat[to] = f->fast_cat[from];
+    f->epa_cat[to] = f->epa_cat[from];
+    f->status[to] = f->status[from];
+    f->sent_ms[to] = f->sent_ms[from];
+}
+
+void deadband_free(deadband_t *f)
+{
+    free(f->o3);
+    free(f->no2);
+    free(f->fast_cat);
+    free(f->epa_cat);
+    free(f->status);
+    free(f->sent_ms);
+    memset(f, 0, sizeof(*f));
+}
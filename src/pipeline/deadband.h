@@ -0,0 +1,141 @@
+/**
+ * @file    deadband.h
+ * @brief   Change detection on the results of many sensors
+ *
+ * Consecutive results of a sensor rarely differ much. The filter passes a
+ *  result on only if
+ *  - O3 or NO2 moved by more than the deadband from the last result passed
+ *    on; the band is the larger of an absolute and a relative limit, so the
+ *    absolute one governs low concentrations and the relative one high
+ *    ones,
+ *  - the EPA category (good, moderate, ...) of fast_aqi or epa_aqi changed,
+ *  - the status changed, or
+ *  - nothing was passed on for heartbeat_ms.
+ *
+ * The state is kept as one array per field across sensors and a batch of
+ *  results is evaluated lane by lane without branches, so the compiler
+ *  vectorizes the loop over the sensors of a cycle.
+ */
+
+#ifndef DEADBAND_H
+#define DEADBAND_H
+
+#include <stdint.h>
+#include "sensor_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Error codes
+ */
+typedef enum {
+    DEADBAND_OK = 0,
+    DEADBAND_ERR_NOMEM = -1, /**< The state could not be allocated. */
+} deadband_err;
+
+/**
+ * @brief Limits; a limit of 0 passes on every change of that kind
+ */
+typedef struct {
+    float o3_abs_ppb;      /**< absolute band of O3 */
+    float no2_abs_ppb;     /**< absolute band of NO2 */
+    float rel;             /**< relative band of both, e.g. 0.05 for 5 % */
+    uint32_t heartbeat_ms; /**< pass on at least this often, 0 never;
+                                at most 24 days */
+} deadband_config_t;
+
+/**
+ * @brief Defaults: 1 ppb or 5 %, a heartbeat every 5 min
+ */
+extern const deadband_config_t deadband_default_config;
+
+/**
+ * @brief Results of a batch, one array per field with an entry per sensor
+ */
+typedef struct {
+    const float *o3_ppb;
+    const float *no2_ppb;
+    const int32_t *fast_aqi;
+    const int32_t *epa_aqi;
+    const int32_t *status;
+} deadband_batch_t;
+
+/**
+ * @brief Filter state
+ */
+typedef struct {
+    deadband_config_t cfg;
+    uint32_t count;        /**< sensors */
+    /* last result passed on, per sensor */
+    float *o3;
+    float *no2;
+    int32_t *fast_cat;
+    int32_t *epa_cat;
+    int32_t *status;
+    uint32_t *sent_ms;     /**< low 32 bit of the time, wraps */
+    uint64_t results;      /**< results evaluated */
+    uint64_t passed;       /**< results passed on */
+} deadband_t;
+
+/**
+ * @brief Allocate the state of count sensors
+ * @param [out] f filter
+ * @param [in] count number of sensors
+ * @param [in] cfg limits, NULL for deadband_default_config
+ * @return error code
+ */
+deadband_err deadband_init(deadband_t *f, uint32_t count,
+                           const deadband_config_t *cfg);
+
+/**
+ * @brief Decide which results of a batch to pass on
+ * @note  The first result of a sensor is always passed on.
+ * @param [in,out] f filter
+ * @param [in] first index of the first sensor of the batch
+ * @param [in] n sensors in the batch
+ * @param [in] in results, entries 0 to n - 1 of each field
+ * @param [in] now_ms time of the batch, paces the heartbeat
+ * @param [in,out] emit per sensor: nonzero if it has a result in the batch;
+ *                 on return nonzero if that result is to be passed on
+ * @return number of results to pass on
+ */
+uint32_t deadband_filter(deadband_t *f, uint32_t first, uint32_t n,
+                         const deadband_batch_t *in, int64_t now_ms,
+                         uint8_t *emit);
+
+/**
+ * @brief Filter one result
+ * @return nonzero if it is to be passed on
+ */
+int deadband_check(deadband_t *f, uint32_t index, const sensor_results_t *r,
+                   int64_t now_ms);
+
+/**
+ * @brief Forget the last result of a sensor, e.g. of a new one taking the
+ *        index; its next result is passed on
+ * @param [in,out] f filter
+ * @param [in] index sensor
+ */
+void deadband_reset(deadband_t *f, uint32_t index);
+
+/**
+ * @brief Move the state of a sensor to another index, e.g. to keep the
+ *        sensors of a batch contiguous when one in between is removed
+ * @param [in,out] f filter
+ * @param [in] to new index
+ * @param [in] from index of the sensor
+ */
+void deadband_move(deadband_t *f, uint32_t to, uint32_t from);
+
+/**
+ * @brief Release the state
+ */
+void deadband_free(deadband_t *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEADBAND_H */
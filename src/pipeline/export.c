@@ -0,0 +1,348 @@
+/**
+ * @file    export.c
+ * @brief   Batched export of sensor results to CSV, JSON Lines, line protocol
+ *          or Arrow IPC
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "export.h"
+
+const export_config_t export_default_config = {
+    .format = EXPORT_CSV,
+    .flush_bytes = 4096,
+    .flush_ms = 60000,
+    .sync_ms = 600000,
+    .tag = "zmod4510",
+};
+
+const export_config_t export_arrow_config = {
+    .format = EXPORT_ARROW,
+    .flush_bytes = 65536,
+    .flush_ms = 0,
+    .sync_ms = 600000,
+    .tag = "zmod4510",
+};
+
+static const char csv_header[] =
+    "timestamp_ms,sensor,status,o3_ppb,no2_ppb,fast_aqi,epa_aqi,"
+    "rmox0,rmox1,rmox2,rmox3\n";
+
+/* Append to the record being formatted; the caller guarantees that
+ * EXPORT_MAX_RECORD bytes are free, which bounds every record. */
+typedef struct {
+    char *p;
+    char *end;
+} out_t;
+
+static void put(out_t *o, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void put(out_t *o, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(o->p, o->end - o->p, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        o->p += n < o->end - o->p ? n : o->end - o->p - 1;
+    }
+}
+
+/* Floats are printed with %.6g, at most 13 characters; values that are not
+ * finite have no representation in JSON and line protocol. */
+static void put_float(out_t *o, const char *name, float v,
+                      export_format_t format)
+{
+    int finite = isfinite(v);
+
+    switch (format) {
+    case EXPORT_CSV:
+        if (finite) {
+            put(o, ",%.6g", v);
+        } else {
+            put(o, ",");
+        }
+        break;
+    case EXPORT_JSONL:
+        if (finite) {
+            put(o, ",\"%s\":%.6g", name, v);
+        } else {
+            put(o, ",\"%s\":null", name);
+        }
+        break;
+    case EXPORT_LINE:
+        /* the first field is always the integer status, so every float
+         * follows a field and an omitted one leaves no dangling comma */
+        if (finite) {
+            put(o, ",%s=%.6g", name, v);
+        }
+        break;
+    case EXPORT_ARROW:
+        break;
+    }
+}
+
+uint32_t export_format_record(char *buf, export_format_t f, const char *tag,
+                              const sensor_results_t *r)
+{
+    static const char *const rmox_names[] = { "rmox0", "rmox1", "rmox2",
+                                              "rmox3" };
+    out_t o = { buf, buf + EXPORT_MAX_RECORD };
+
+    switch (f) {
+    case EXPORT_CSV:
+        put(&o, "%lld,%s,%d", (long long)r->timestamp_ms, tag, (int)r->status);
+        break;
+    case EXPORT_JSONL:
+        put(&o, "{\"timestamp_ms\":%lld,\"sensor\":\"%s\",\"status\":%d",
+            (long long)r->timestamp_ms, tag, (int)r->status);
+        break;
+    case EXPORT_LINE:
+        put(&o, "zmod4510,sensor=%s status=%di", tag, (int)r->status);
+        break;
+    case EXPORT_ARROW:
+        return 0;
+    }
+    put_float(&o, "o3_ppb", r->o3_ppb, f);
+    put_float(&o, "no2_ppb", r->no2_ppb, f);
+    switch (f) {
+    case EXPORT_CSV:
+        put(&o, ",%d,%d", (int)r->fast_aqi, (int)r->epa_aqi);
+        break;
+    case EXPORT_JSONL:
+        put(&o, ",\"fast_aqi\":%d,\"epa_aqi\":%d", (int)r->fast_aqi,
+            (int)r->epa_aqi);
+        break;
+    case EXPORT_LINE:
+        put(&o, ",fast_aqi=%di,epa_aqi=%di", (int)r->fast_aqi,
+            (int)r->epa_aqi);
+        break;
+    case EXPORT_ARROW:
+        break;
+    }
+    for (int i = 0; i < 4; i++) {
+        put_float(&o, rmox_names[i], r->rmox[i], f);
+    }
+    switch (f) {
+    case EXPORT_CSV:
+        put(&o, "\n");
+        break;
+    case EXPORT_JSONL:
+        put(&o, "}\n");
+        break;
+    case EXPORT_LINE:
+        put(&o, " %lld000000\n", (long long)r->timestamp_ms);
+        break;
+    case EXPORT_ARROW:
+        break;
+    }
+    return (uint32_t)(o.p - buf);
+}
+
+/* Room for one more result in the buffer or the Arrow batch */
+static int batch_full(const exporter_t *x)
+{
+    if (EXPORT_ARROW == x->cfg.format) {
+        return x->arrow.rows >= x->arrow.cfg.batch_rows;
+    }
+    return x->len >= x->cfg.flush_bytes;
+}
+
+/* Write the whole buffer with as few write() calls as the kernel allows,
+ * or the Arrow batch with one writev() */
+static export_err write_batch(exporter_t *x)
+{
+    uint32_t done = 0;
+
+    if (EXPORT_ARROW == x->cfg.format) {
+        export_err ret;
+
+        if (!x->arrow.rows) {
+            return EXPORT_OK;
+        }
+        ret = (export_err)arrow_write_batch(&x->arrow);
+        if (ret) {
+            return ret;
+        }
+        x->writes++;
+    }
+    while (done < x->len) {
+        ssize_t n = write(x->fd, x->buf + done, x->len - done);
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            /* keep what was not written for the next attempt */
+            memmove(x->buf, x->buf + done, x->len - done);
+            x->len -= done;
+            return EXPORT_ERR_IO;
+        }
+        done += (uint32_t)n;
+        x->writes++;
+    }
+    x->len = 0;
+    x->t_first = INT64_MIN;
+    x->dirty = 1;
+    return EXPORT_OK;
+}
+
+static export_err sync_file(exporter_t *x)
+{
+    if (x->dirty) {
+        if (fdatasync(x->fd)) {
+            return EXPORT_ERR_IO;
+        }
+        x->syncs++;
+        x->dirty = 0;
+    }
+    return EXPORT_OK;
+}
+
+/* the tag is written unquoted in CSV and line protocol */
+void export_sanitize_tag(char *tag)
+{
+    for (char *c = tag; *c; c++) {
+        if (strchr(" ,=\"\\\n", *c)) {
+            *c = '_';
+        }
+    }
+}
+
+static export_err open_arrow(exporter_t *x, const char *path)
+{
+    arrow_config_t cfg = arrow_default_config;
+    arrow_err ret;
+
+    cfg.batch_rows = x->cfg.flush_bytes / ARROW_ROW_BYTES;
+    memcpy(cfg.tag, x->cfg.tag, EXPORT_TAG_LEN);
+    ret = arrow_open(&x->arrow, path, &cfg);
+    x->fd = x->arrow.fd;
+    /* the schema was written or a footer cut off */
+    x->dirty = 1;
+    x->t_first = INT64_MIN;
+    x->t_synced = INT64_MIN;
+    return (export_err)ret;
+}
+
+export_err export_open(exporter_t *x, const char *path,
+                       const export_config_t *cfg)
+{
+    memset(x, 0, sizeof(*x));
+    x->fd = -1;
+    x->arrow.fd = -1;
+    x->cfg = cfg ? *cfg : export_default_config;
+    x->cfg.tag[EXPORT_TAG_LEN - 1] = 0;
+    export_sanitize_tag(x->cfg.tag);
+    if (EXPORT_ARROW == x->cfg.format) {
+        return open_arrow(x, path);
+    }
+    x->buf = malloc(x->cfg.flush_bytes + EXPORT_MAX_RECORD);
+    if (!x->buf) {
+        return EXPORT_ERR_NOMEM;
+    }
+    x->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (x->fd < 0) {
+        free(x->buf);
+        x->buf = NULL;
+        return EXPORT_ERR_IO;
+    }
+    if (EXPORT_CSV == x->cfg.format && 0 == lseek(x->fd, 0, SEEK_END)) {
+        memcpy(x->buf, csv_header, sizeof(csv_header) - 1);
+        x->len = sizeof(csv_header) - 1;
+    }
+    x->t_first = INT64_MIN;
+    x->t_synced = INT64_MIN;
+    return EXPORT_OK;
+}
+
+export_err export_append(exporter_t *x, const sensor_results_t *r)
+{
+    export_err ret = EXPORT_OK;
+
+    if (batch_full(x)) {
+        /* a failed write left a full buffer; retry before adding more */
+        ret = write_batch(x);
+        if (ret) {
+            return ret;
+        }
+    }
+    if (INT64_MIN == x->t_first) {
+        x->t_first = r->timestamp_ms;
+    }
+    if (INT64_MIN == x->t_synced) {
+        x->t_synced = r->timestamp_ms;
+    }
+    if (EXPORT_ARROW == x->cfg.format) {
+        arrow_append(&x->arrow, r);
+    } else {
+        x->len += export_format_record(x->buf + x->len, x->cfg.format,
+                                       x->cfg.tag, r);
+    }
+    x->records++;
+
+    if (batch_full(x) ||
+        (x->cfg.flush_ms && r->timestamp_ms - x->t_first >= x->cfg.flush_ms)) {
+        ret = write_batch(x);
+    }
+    if (!ret && x->cfg.sync_ms &&
+        r->timestamp_ms - x->t_synced >= x->cfg.sync_ms) {
+        /* buffered results are written first so the sync covers them */
+        ret = write_batch(x);
+        if (!ret) {
+            ret = sync_file(x);
+        }
+        x->t_synced = r->timestamp_ms;
+    }
+    return ret;
+}
+
+export_err export_flush(exporter_t *x, int sync)
+{
+    export_err ret = write_batch(x);
+
+    if (!ret && sync) {
+        ret = sync_file(x);
+    }
+    return ret;
+}
+
+export_err export_close(exporter_t *x)
+{
+    export_err ret;
+
+    if (x->fd < 0) {
+        return EXPORT_OK;
+    }
+    if (EXPORT_ARROW == x->cfg.format) {
+        /* the footer indexing the batches is synced together with them */
+        ret = write_batch(x);
+        if (!ret) {
+            ret = (export_err)arrow_write_footer(&x->arrow);
+            x->dirty = 1;
+        }
+        if (!ret) {
+            ret = sync_file(x);
+        }
+        if (arrow_close(&x->arrow) && !ret) {
+            ret = EXPORT_ERR_IO;
+        }
+    } else {
+        ret = export_flush(x, 1);
+        if (close(x->fd) && !ret) {
+            ret = EXPORT_ERR_IO;
+        }
+    }
+    free(x->buf);
+    x->buf = NULL;
+    x->fd = -1;
+    return ret;
+}
@@ -0,0 +1,157 @@
+/**
+ * @file    export.h
+ * @brief   Batched export of sensor results to CSV, JSON Lines, line protocol
+ *          or Arrow IPC
+ *
+ * Results are formatted into a buffer allocated once at open and written
+ *  with a single write() per batch, when the buffer reaches flush_bytes or
+ *  the oldest buffered result is flush_ms older than the newest. Durability
+ *  is grouped too: fdatasync() runs at most once per sync_ms, covering all
+ *  batches written since the last sync, instead of once per record.
+ *
+ * Like the rollups, thresholds advance with the timestamps of the results,
+ *  so an exporter behaves the same in simulated and real time. At most
+ *  sync_ms of results (plus what is still buffered) are lost on power
+ *  failure; export_close() writes and syncs everything.
+ *
+ * EXPORT_ARROW hands the results to the columnar writer of arrow_ipc.h with
+ *  the same policy; flush_bytes then counts column bytes, ARROW_ROW_BYTES
+ *  per result.
+ */
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdint.h>
+#include "sensor_interface.h"
+#include "arrow_ipc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Upper bound of one formatted record, including the tag. */
+#define EXPORT_MAX_RECORD (384)
+/** Maximum length of the tag including the terminating zero. */
+#define EXPORT_TAG_LEN    (32)
+
+/**
+ * @brief Error codes
+ */
+typedef enum {
+    EXPORT_OK = 0,
+    EXPORT_ERR_IO = -1,    /**< Opening, writing or syncing the file failed. */
+    EXPORT_ERR_NOMEM = -2, /**< The batch buffer could not be allocated. */
+    EXPORT_ERR_FORMAT = -3, /**< An existing Arrow file has other columns. */
+} export_err;
+
+/**
+ * @brief Output formats
+ */
+typedef enum {
+    EXPORT_CSV = 0, /**< header line, then one row per result */
+    EXPORT_JSONL,   /**< one JSON object per line */
+    EXPORT_LINE,    /**< InfluxDB line protocol, ns timestamps */
+    EXPORT_ARROW    /**< Arrow IPC file, columnar (arrow_ipc.h) */
+} export_format_t;
+
+/**
+ * @brief Batching and sync policy
+ */
+typedef struct {
+    export_format_t format;
+    uint32_t flush_bytes; /**< write once this many bytes are buffered */
+    uint32_t flush_ms;    /**< write once the buffer spans this long, 0 off */
+    uint32_t sync_ms;     /**< fdatasync at most this often, 0 never */
+    char tag[EXPORT_TAG_LEN]; /**< sensor name; CSV/JSONL field, line tag */
+} export_config_t;
+
+/**
+ * @brief Default policy: CSV, 4 KiB or 1 min per write, sync every 10 min
+ */
+extern const export_config_t export_default_config;
+
+/**
+ * @brief Arrow policy: 64 KiB batches (910 results), sync every 10 min
+ * @note  The sync writes what is buffered, so at one result per 6 s a batch
+ *        holds 100 results.
+ */
+extern const export_config_t export_arrow_config;
+
+/**
+ * @brief Exporter handle
+ */
+typedef struct {
+    int fd;
+    export_config_t cfg;
+    char *buf;            /**< flush_bytes + EXPORT_MAX_RECORD bytes */
+    uint32_t len;         /**< bytes buffered */
+    int64_t t_first;      /**< timestamp of the oldest buffered result */
+    int64_t t_synced;     /**< timestamp of the last sync */
+    int dirty;            /**< written but not yet synced */
+    uint64_t records;     /**< results exported */
+    uint32_t writes;      /**< write() calls issued */
+    uint32_t syncs;       /**< fdatasync() calls issued */
+    arrow_writer_t arrow; /**< writer of EXPORT_ARROW */
+} exporter_t;
+
+/**
+ * @brief Open or create a file and append to it
+ * @note  A CSV header is written if the file is empty. An Arrow file must
+ *        have been written with the same tag.
+ * @param [out] x exporter handle
+ * @param [in] path output file
+ * @param [in] cfg policy, NULL for export_default_config
+ * @return error code
+ */
+export_err export_open(exporter_t *x, const char *path,
+                       const export_config_t *cfg);
+
+/**
+ * @brief Add one result; writes and syncs when a threshold is reached
+ * @param [in] x exporter handle
+ * @param [in] r result of sensor_step()
+ * @return error code; on EXPORT_ERR_IO the batch is kept for the next call
+ */
+export_err export_append(exporter_t *x, const sensor_results_t *r);
+
+/**
+ * @brief Write the buffered results now
+ * @param [in] x exporter handle
+ * @param [in] sync if != 0, also sync the file
+ * @return error code
+ */
+export_err export_flush(exporter_t *x, int sync);
+
+/**
+ * @brief Format one result as a line of the given format
+ * @note  Used by other stages sharing the formats, e.g. mqtt_pub.h. The tag
+ *        is written as given; pass it through export_sanitize_tag() first.
+ * @param [out] buf at least EXPORT_MAX_RECORD bytes
+ * @param [in] format output format
+ * @param [in] tag sensor name, shorter than EXPORT_TAG_LEN
+ * @param [in] r result
+ * @return length of the line including the newline, without a terminator;
+ *         0 for EXPORT_ARROW, which is not line based
+ */
+uint32_t export_format_record(char *buf, export_format_t format,
+                              const char *tag, const sensor_results_t *r);
+
+/**
+ * @brief Replace the characters a tag cannot contain (space, comma, equal
+ *        sign, quote, backslash, newline) with '_'
+ */
+void export_sanitize_tag(char *tag);
+
+/**
+ * @brief Flush, sync and close
+ * @param [in] x exporter handle
+ * @return error code
+ */
+export_err export_close(exporter_t *x);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXPORT_H */
@@ -0,0 +1,667 @@
+/**
+ * @file    mqtt_pub.c
+ * @brief   Batched publication of sensor results to an MQTT broker
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "mqtt_pub.h"
+#include "util/zlog.h"
+
+#define IO_TIMEOUT_MS    (5000)
+#define BACKOFF_MIN_MS   (1000)
+#define BACKOFF_MAX_MS   (60000)
+/* failed publishes of a spooled message before it is dropped as lost */
+#define MAX_ATTEMPTS     (5)
+
+/* MQTT 3.1.1 control packet types (upper nibble of the first byte) */
+#define MQTT_CONNECT     (0x10)
+#define MQTT_CONNACK     (0x20)
+#define MQTT_PUBLISH_Q1  (0x32)
+#define MQTT_PUBACK      (0x40)
+#define MQTT_PINGREQ     (0xC0)
+#define MQTT_DISCONNECT  (0xE0)
+
+/* Spool file: a header holding the offset of the oldest message, then
+ * messages as a 32 bit length followed by the payload. */
+#define SPOOL_MAGIC      (0x4C50535AU) /* "ZSPL" */
+#define SPOOL_HEADER     (16)
+
+const mqtt_pub_config_t mqtt_pub_default_config = {
+    .host = "localhost",
+    .port = 1883,
+    .keepalive_s = 60,
+    .client_id = "zmod4510",
+    .topic = "zmod4510/results",
+    .format = EXPORT_JSONL,
+    .interval_ms = 60000,
+    .batch_len = 1024,
+    .spool_path = "",
+    .spool_max_bytes = 16 * 1024 * 1024,
+};
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void count(uint32_t *counter, uint32_t n)
+{
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+/* ---- MQTT client ---------------------------------------------------- */
+
+static int write_all(int fd, const struct iovec *iov, int n)
+{
+    struct iovec v[5];
+    ssize_t done;
+
+    memcpy(v, iov, n * sizeof(*v));
+    while (n > 0) {
+        done = writev(fd, v, n);
+        if (done < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        while (n > 0 && (size_t)done >= v[0].iov_len) {
+            done -= v[0].iov_len;
+            memmove(v, v + 1, --n * sizeof(*v));
+        }
+        if (n > 0) {
+            v[0].iov_base = (char *)v[0].iov_base + done;
+            v[0].iov_len -= done;
+        }
+    }
+    return 0;
+}
+
+static int read_all(int fd, uint8_t *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Remaining length, 7 bits per byte, least significant first */
+static int put_length(uint8_t *buf, uint32_t len)
+{
+    int n = 0;
+
+    do {
+        buf[n] = len & 0x7F;
+        len >>= 7;
+        buf[n++] |= len ? 0x80 : 0;
+    } while (len);
+    return n;
+}
+
+/* Read one packet; the body is returned if it fits into 4 bytes, as all
+ * packets the publisher waits for do, and skipped otherwise. */
+static int read_packet(int fd, uint8_t *type, uint8_t body[4], uint32_t *len)
+{
+    uint8_t b, skip[64];
+    uint32_t n = 0;
+
+    if (read_all(fd, type, 1)) {
+        return -1;
+    }
+    for (int shift = 0; shift < 28; shift += 7) {
+        if (read_all(fd, &b, 1)) {
+            return -1;
+        }
+        n |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    *len = n;
+    if (n <= 4) {
+        return read_all(fd, body, n);
+    }
+    while (n) {
+        uint32_t k = n < sizeof(skip) ? n : sizeof(skip);
+        if (read_all(fd, skip, k)) {
+            return -1;
+        }
+        n -= k;
+    }
+    return 0;
+}
+
+static void disconnect(mqtt_pub_t *p, int graceful)
+{
+    uint8_t pkt[2] = { MQTT_DISCONNECT, 0 };
+    struct iovec v = { pkt, sizeof(pkt) };
+
+    if (p->sock < 0) {
+        return;
+    }
+    if (graceful) {
+        write_all(p->sock, &v, 1);
+    }
+    close(p->sock);
+    p->sock = -1;
+}
+
+static int open_socket(const mqtt_pub_config_t *cfg)
+{
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM }, *ai, *a;
+    struct timeval tv = { IO_TIMEOUT_MS / 1000, 0 };
+    char port[8];
+    int fd = -1, one = 1;
+
+    snprintf(port, sizeof(port), "%u", cfg->port);
+    if (getaddrinfo(cfg->host, port, &hints, &ai)) {
+        return -1;
+    }
+    for (a = ai; a && fd < 0; a = a->ai_next) {
+        struct pollfd pfd;
+        int err = 0;
+        socklen_t len = sizeof(err);
+
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            continue;
+        }
+        /* connect with a timeout, then switch to blocking I/O with one */
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        if (connect(fd, a->ai_addr, a->ai_addrlen) && EINPROGRESS != errno) {
+            err = errno;
+        } else {
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            if (poll(&pfd, 1, IO_TIMEOUT_MS) != 1 ||
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len)) {
+                err = ETIMEDOUT;
+            }
+        }
+        if (err) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(ai);
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, 0);
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        /* every packet is written whole and then waited for */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+static int mqtt_connect(mqtt_pub_t *p)
+{
+    uint16_t id_len = (uint16_t)strlen(p->cfg.client_id);
+    uint8_t pkt[16 + sizeof(p->cfg.client_id)], type, body[4];
+    uint32_t len;
+    int n = 0;
+
+    p->sock = open_socket(&p->cfg);
+    if (p->sock < 0) {
+        return -1;
+    }
+    pkt[n++] = MQTT_CONNECT;
+    n += put_length(pkt + n, 12 + id_len);
+    memcpy(pkt + n, "\0\4MQTT\4\2", 8); /* protocol, level 4, clean session */
+    n += 8;
+    pkt[n++] = (uint8_t)(p->cfg.keepalive_s >> 8);
+    pkt[n++] = (uint8_t)p->cfg.keepalive_s;
+    pkt[n++] = (uint8_t)(id_len >> 8);
+    pkt[n++] = (uint8_t)id_len;
+    memcpy(pkt + n, p->cfg.client_id, id_len);
+    n += id_len;
+
+    struct iovec v = { pkt, (size_t)n };
+    if (write_all(p->sock, &v, 1) || read_packet(p->sock, &type, body, &len) ||
+        MQTT_CONNACK != type || len != 2 || body[1] != 0) {
+        zlog_warn("MQTT broker %s:%u refused the connection", p->cfg.host,
+                  p->cfg.port);
+        disconnect(p, 0);
+        return -1;
+    }
+    p->last_tx_ms = now_ms();
+    return 0;
+}
+
+/* Publish with QoS 1 and wait for the acknowledgement */
+static int mqtt_publish(mqtt_pub_t *p, const char *payload, uint32_t len)
+{
+    uint16_t topic_len = (uint16_t)strlen(p->cfg.topic);
+    uint16_t id;
+    uint8_t hdr[8], ids[2];
+    uint8_t tl[2] = { (uint8_t)(topic_len >> 8), (uint8_t)topic_len };
+    uint8_t type, body[4];
+    uint32_t n;
+    int h = 0;
+
+    /* 0 is not a valid packet id */
+    p->packet_id = (uint16_t)(p->packet_id + 1);
+    if (!p->packet_id) {
+        p->packet_id = 1;
+    }
+    id = p->packet_id;
+    ids[0] = (uint8_t)(id >> 8);
+    ids[1] = (uint8_t)id;
+    hdr[h++] = MQTT_PUBLISH_Q1;
+    h += put_length(hdr + h, 2 + topic_len + 2 + len);
+
+    struct iovec v[5] = { { hdr, (size_t)h },
+                          { tl, 2 },
+                          { p->cfg.topic, topic_len },
+                          { ids, 2 },
+                          { (void *)payload, len } };
+    if (write_all(p->sock, v, 5)) {
+        return -1;
+    }
+    p->last_tx_ms = now_ms();
+    for (;;) {
+        if (read_packet(p->sock, &type, body, &n)) {
+            return -1;
+        }
+        if ((type & 0xF0) == MQTT_PUBACK && 2 == n &&
+            id == (uint16_t)(body[0] << 8 | body[1])) {
+            return 0;
+        }
+        /* PINGRESP or an acknowledgement of an earlier attempt */
+    }
+}
+
+static void mqtt_ping(mqtt_pub_t *p)
+{
+    uint8_t pkt[2] = { MQTT_PINGREQ, 0 };
+    struct iovec v = { pkt, sizeof(pkt) };
+
+    if (write_all(p->sock, &v, 1)) {
+        disconnect(p, 0);
+        return;
+    }
+    p->last_tx_ms = now_ms();
+}
+
+/* Wait longer before the next connection attempt */
+static void back_off(mqtt_pub_t *p)
+{
+    p->backoff_ms = p->backoff_ms ? p->backoff_ms * 2 : BACKOFF_MIN_MS;
+    if (p->backoff_ms > BACKOFF_MAX_MS) {
+        p->backoff_ms = BACKOFF_MAX_MS;
+    }
+    p->retry_ms = now_ms() + p->backoff_ms;
+}
+
+/* Drop the connection after a failed publish and back off as after a
+ * failed connect; a broker that accepts the connection but not the message
+ * is not hammered. The backoff is reset by the next successful publish. */
+static void publish_failed(mqtt_pub_t *p)
+{
+    disconnect(p, 0);
+    back_off(p);
+}
+
+static void published(mqtt_pub_t *p)
+{
+    count(&p->stats.published, 1);
+    p->backoff_ms = 0;
+}
+
+/* Connect unless down and still backing off; returns nonzero if down */
+static int ensure_connected(mqtt_pub_t *p)
+{
+    if (p->sock >= 0) {
+        return 0;
+    }
+    if (now_ms() < p->retry_ms) {
+        return -1;
+    }
+    if (mqtt_connect(p)) {
+        back_off(p);
+        return -1;
+    }
+    zlog_info("Connected to MQTT broker %s:%u", p->cfg.host, p->cfg.port);
+    count(&p->stats.connects, 1);
+    return 0;
+}
+
+/* ---- spool ---------------------------------------------------------- */
+
+static void spool_set_head(mqtt_pub_t *p, uint64_t head)
+{
+    p->spool_head = head;
+    p->spool_attempts = 0;
+    if (p->spool_head == p->spool_end) {
+        /* drained: start over instead of growing the file forever */
+        p->spool_head = p->spool_end = SPOOL_HEADER;
+        if (ftruncate(p->spool, SPOOL_HEADER)) {
+            zlog_warn("Cannot truncate the MQTT spool");
+        }
+    }
+    if (pwrite(p->spool, &p->spool_head, 8, 8) != 8) {
+        zlog_warn("Cannot update the MQTT spool header");
+    }
+    __atomic_store_n(&p->stats.spool_bytes,
+                     (uint32_t)(p->spool_end - p->spool_head),
+                     __ATOMIC_RELAXED);
+}
+
+static int spool_open(mqtt_pub_t *p)
+{
+    uint32_t hdr[2] = { SPOOL_MAGIC, 0 };
+    uint64_t head;
+    off_t size;
+
+    p->spool = open(p->cfg.spool_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (p->spool < 0) {
+        return -1;
+    }
+    size = lseek(p->spool, 0, SEEK_END);
+    if (size >= SPOOL_HEADER && pread(p->spool, hdr, 8, 0) == 8 &&
+        SPOOL_MAGIC == hdr[0] && pread(p->spool, &head, 8, 8) == 8 &&
+        head >= SPOOL_HEADER && head <= (uint64_t)size) {
+        p->spool_end = (uint64_t)size;
+        spool_set_head(p, head);
+        if (p->spool_head != p->spool_end) {
+            zlog_info("MQTT spool holds %llu bytes to send",
+                      (unsigned long long)(p->spool_end - p->spool_head));
+        }
+        return 0;
+    }
+    /* new or unusable: start empty */
+    hdr[0] = SPOOL_MAGIC;
+    if (ftruncate(p->spool, 0) || pwrite(p->spool, hdr, 8, 0) != 8) {
+        close(p->spool);
+        p->spool = -1;
+        return -1;
+    }
+    p->spool_end = SPOOL_HEADER;
+    spool_set_head(p, SPOOL_HEADER);
+    return 0;
+}
+
+static int spool_append(mqtt_pub_t *p, const char *payload, uint32_t len)
+{
+    struct iovec v[2] = { { &len, 4 }, { (void *)payload, len } };
+
+    if (p->spool < 0 ||
+        p->spool_end - p->spool_head + 4 + len > p->cfg.spool_max_bytes) {
+        return -1;
+    }
+    if (lseek(p->spool, (off_t)p->spool_end, SEEK_SET) < 0 ||
+        write_all(p->spool, v, 2) || fdatasync(p->spool)) {
+        /* cut off a partial message so the spool stays readable */
+        if (ftruncate(p->spool, (off_t)p->spool_end)) {
+            zlog_warn("Cannot truncate the MQTT spool");
+        }
+        return -1;
+    }
+    p->spool_end += 4 + len;
+    __atomic_store_n(&p->stats.spool_bytes,
+                     (uint32_t)(p->spool_end - p->spool_head),
+                     __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Send the spooled messages, oldest first, while the broker takes them;
+ * stops at the deadline so the next batch is collected in time. A message
+ * the broker rejected MAX_ATTEMPTS times is dropped, so it cannot block
+ * the spool for good. */
+static void spool_drain(mqtt_pub_t *p, uint64_t deadline)
+{
+    uint32_t cap = p->cfg.batch_len * EXPORT_MAX_RECORD, len;
+
+    while (p->spool >= 0 && p->spool_head < p->spool_end && p->sock >= 0 &&
+           now_ms() < deadline) {
+        if (pread(p->spool, &len, 4, (off_t)p->spool_head) != 4 ||
+            p->spool_head + 4 + len > p->spool_end) {
+            zlog_error("MQTT spool is corrupt, discarding it");
+            spool_set_head(p, p->spool_end);
+            return;
+        }
+        if (len > cap ||
+            pread(p->spool, p->payload, len, (off_t)p->spool_head + 4) !=
+                (ssize_t)len) {
+            count(&p->stats.lost, 1);
+        } else if (mqtt_publish(p, p->payload, len)) {
+            publish_failed(p);
+            if (++p->spool_attempts < MAX_ATTEMPTS) {
+                return;
+            }
+            zlog_warn("MQTT spooled message failed %d times, dropped",
+                      MAX_ATTEMPTS);
+            count(&p->stats.lost, 1);
+        } else {
+            published(p);
+        }
+        spool_set_head(p, p->spool_head + 4 + len);
+    }
+}
+
+/* ---- publisher thread ----------------------------------------------- */
+
+static uint32_t encode(mqtt_pub_t *p, const mqtt_pub_entry_t *e, uint32_t n)
+{
+    uint32_t len = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        len += export_format_record(p->payload + len, p->cfg.format, e[i].tag,
+                                    &e[i].r);
+    }
+    return len;
+}
+
+static void deliver(mqtt_pub_t *p, uint32_t len)
+{
+    /* spooled messages go first to keep the order */
+    if (p->spool_head == p->spool_end && !ensure_connected(p)) {
+        if (!mqtt_publish(p, p->payload, len)) {
+            published(p);
+            return;
+        }
+        zlog_warn("MQTT publish failed, reconnecting");
+        publish_failed(p);
+    }
+    if (spool_append(p, p->payload, len)) {
+        count(&p->stats.lost, 1);
+    } else {
+        count(&p->stats.spooled, 1);
+    }
+}
+
+static void *run(void *arg)
+{
+    mqtt_pub_t *p = arg;
+    uint64_t next = now_ms() + p->cfg.interval_ms;
+    uint64_t ka = (uint64_t)p->cfg.keepalive_s * 500; /* ping at half */
+    mqtt_pub_entry_t *batch;
+    uint32_t n;
+    int stop;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        uint64_t now = now_ms(), wake = next;
+
+        if (p->sock >= 0 && ka && p->last_tx_ms + ka < wake) {
+            wake = p->last_tx_ms + ka;
+        }
+        if (p->spool_head != p->spool_end && p->retry_ms < wake) {
+            wake = p->retry_ms > now ? p->retry_ms : now;
+        }
+        if (!p->stop && now < wake) {
+            struct timespec ts = { (time_t)(wake / 1000),
+                                   (long)(wake % 1000) * 1000000 };
+            pthread_cond_timedwait(&p->wake, &p->lock, &ts);
+            continue;
+        }
+
+        stop = p->stop;
+        n = 0;
+        if (stop || now >= next) {
+            batch = p->batch[0];
+            p->batch[0] = p->batch[1];
+            p->batch[1] = batch;
+            n = p->fill;
+            p->fill = 0;
+            next += p->cfg.interval_ms;
+            if (next <= now) {
+                next = now + p->cfg.interval_ms;
+            }
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        /* the spool goes out before any new message */
+        if (p->spool_head != p->spool_end && !ensure_connected(p)) {
+            spool_drain(p, next);
+        }
+        if (n) {
+            deliver(p, encode(p, p->batch[1], n));
+        }
+        if (p->sock >= 0 && ka && now_ms() >= p->last_tx_ms + ka) {
+            mqtt_ping(p);
+        }
+
+        pthread_mutex_lock(&p->lock);
+        if (stop) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    disconnect(p, 1);
+    return NULL;
+}
+
+int mqtt_pub_start(mqtt_pub_t *p, const mqtt_pub_config_t *cfg)
+{
+    pthread_condattr_t attr;
+    pthread_mutexattr_t mattr;
+
+    memset(p, 0, sizeof(*p));
+    p->cfg = cfg ? *cfg : mqtt_pub_default_config;
+    p->cfg.host[sizeof(p->cfg.host) - 1] = 0;
+    p->cfg.client_id[sizeof(p->cfg.client_id) - 1] = 0;
+    p->cfg.topic[sizeof(p->cfg.topic) - 1] = 0;
+    p->cfg.spool_path[sizeof(p->cfg.spool_path) - 1] = 0;
+    if (!p->cfg.batch_len || !p->cfg.interval_ms) {
+        return -1;
+    }
+    p->sock = -1;
+    p->spool = -1;
+    p->spool_head = p->spool_end = SPOOL_HEADER;
+    p->batch[0] = calloc(p->cfg.batch_len, sizeof(mqtt_pub_entry_t));
+    p->batch[1] = calloc(p->cfg.batch_len, sizeof(mqtt_pub_entry_t));
+    p->payload = malloc((size_t)p->cfg.batch_len * EXPORT_MAX_RECORD);
+    if (!p->batch[0] || !p->batch[1] || !p->payload ||
+        (p->cfg.spool_path[0] && spool_open(p))) {
+        goto fail;
+    }
+
+    /* a real-time thread adding a result waits for the publisher at most as
+     * long as it holds the lock, not until it is scheduled again */
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&p->lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&p->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    if (0 == pthread_create(&p->thread, NULL, run, p)) {
+        return 0;
+    }
+    pthread_cond_destroy(&p->wake);
+    pthread_mutex_destroy(&p->lock);
+
+fail:
+    if (p->spool >= 0) {
+        close(p->spool);
+    }
+    free(p->batch[0]);
+    free(p->batch[1]);
+    free(p->payload);
+    p->batch[0] = p->batch[1] = NULL;
+    p->payload = NULL;
+    return -1;
+}
+
+int mqtt_pub_add(mqtt_pub_t *p, const char *tag, const sensor_results_t *r)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&p->lock);
+    if (p->fill < p->cfg.batch_len) {
+        mqtt_pub_entry_t *e = &p->batch[0][p->fill++];
+
+        strncpy(e->tag, tag, sizeof(e->tag) - 1);
+        e->tag[sizeof(e->tag) - 1] = 0;
+        export_sanitize_tag(e->tag);
+        e->r = *r;
+        p->stats.added++;
+        ret = 0;
+    } else {
+        p->stats.dropped++;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return ret;
+}
+
+void mqtt_pub_get_stats(mqtt_pub_t *p, mqtt_pub_stats_t *stats)
+{
+    pthread_mutex_lock(&p->lock);
+    stats->added = p->stats.added;
+    stats->dropped = p->stats.dropped;
+    pthread_mutex_unlock(&p->lock);
+    stats->published = __atomic_load_n(&p->stats.published, __ATOMIC_RELAXED);
+    stats->spooled = __atomic_load_n(&p->stats.spooled, __ATOMIC_RELAXED);
+    stats->lost = __atomic_load_n(&p->stats.lost, __ATOMIC_RELAXED);
+    stats->connects = __atomic_load_n(&p->stats.connects, __ATOMIC_RELAXED);
+    stats->spool_bytes =
+        __atomic_load_n(&p->stats.spool_bytes, __ATOMIC_RELAXED);
+}
+
+void mqtt_pub_stop(mqtt_pub_t *p)
+{
+    if (!p->payload) {
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+
+    pthread_cond_destroy(&p->wake);
+    pthread_mutex_destroy(&p->lock);
+    if (p->spool >= 0) {
+        close(p->spool);
+        p->spool = -1;
+    }
+    free(p->batch[0]);
+    free(p->batch[1]);
+    free(p->payload);
+    p->batch[0] = p->batch[1] = NULL;
+    p->payload = NULL;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file    mqtt_pub.h
+ * @brief   Batched publication of sensor results to an MQTT broker
+ *
+ * mqtt_pub_add() only copies a result into the batch being collected and
+ *  never waits for the network; if the batch is full the result is dropped
+ *  and counted. A publisher thread closes the batch every interval_ms,
+ *  formats it as one message (JSON Lines or line protocol, one line per
+ *  result, see export.h) and publishes it with QoS 1 over a minimal
+ *  MQTT 3.1.1 client.
+ *
+ * While the broker is unreachable, messages are appended to a disk spool;
+ *  once the connection is back the spool is drained oldest first before any
+ *  new message is sent, so the broker sees the batches in order. A message
+ *  leaves the spool only after the broker acknowledged it, or after the
+ *  fifth failed attempt to publish it. Without a spool file, messages that
+ *  cannot be sent are dropped. After a failed connect or publish the next
+ *  connection is attempted with exponential backoff.
+ */
+
+#ifndef MQTT_PUB_H
+#define MQTT_PUB_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "sensor_interface.h"
+#include "export.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Broker, batching and spool settings
+ */
+typedef struct {
+    char host[64];
+    uint16_t port;
+    uint16_t keepalive_s;     /**< MQTT keep alive, 0 disables */
+    char client_id[24];
+    char topic[96];
+    export_format_t format;   /**< EXPORT_JSONL or EXPORT_LINE */
+    uint32_t interval_ms;     /**< one message per interval */
+    uint32_t batch_len;       /**< results per message, more are dropped */
+    char spool_path[108];     /**< disk spool, empty for none */
+    uint32_t spool_max_bytes; /**< messages beyond this are dropped */
+} mqtt_pub_config_t;
+
+/**
+ * @brief Defaults: localhost:1883, topic zmod4510/results, JSON Lines,
+ *        one message per minute of up to 1024 results, no spool
+ */
+extern const mqtt_pub_config_t mqtt_pub_default_config;
+
+/**
+ * @brief Counters
+ */
+typedef struct {
+    uint64_t added;      /**< results accepted by mqtt_pub_add() */
+    uint64_t dropped;    /**< results rejected because the batch was full */
+    uint32_t published;  /**< messages acknowledged by the broker */
+    uint32_t spooled;    /**< messages written to the spool */
+    uint32_t lost;       /**< messages neither sent nor spooled, or
+                              dropped from the spool after repeated
+                              failed publishes */
+    uint32_t connects;   /**< successful connections */
+    uint32_t spool_bytes; /**< bytes waiting in the spool */
+} mqtt_pub_stats_t;
+
+/**
+ * @brief One result waiting in a batch
+ */
+typedef struct {
+    char tag[EXPORT_TAG_LEN];
+    sensor_results_t r;
+} mqtt_pub_entry_t;
+
+/**
+ * @brief Publisher handle
+ */
+typedef struct {
+    mqtt_pub_config_t cfg;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int stop;
+    mqtt_pub_entry_t *batch[2]; /**< collected and being sent */
+    uint32_t fill;              /**< entries in batch[0] */
+    char *payload;              /**< batch_len * EXPORT_MAX_RECORD bytes */
+    int sock;                   /**< broker connection, -1 if down */
+    uint16_t packet_id;
+    uint64_t last_tx_ms;
+    uint64_t retry_ms;          /**< earliest next connection attempt */
+    uint32_t backoff_ms;
+    int spool;                  /**< spool file, -1 if none */
+    uint64_t spool_head;        /**< offset of the oldest spooled message */
+    uint64_t spool_end;
+    uint32_t spool_attempts;    /**< failed publishes of the oldest */
+    mqtt_pub_stats_t stats;
+} mqtt_pub_t;
+
+/**
+ * @brief Open the spool and start the publisher thread
+ * @note  The broker need not be reachable; connecting is retried with
+ *        backoff from the publisher thread.
+ * @param [out] p publisher handle
+ * @param [in] cfg settings, NULL for mqtt_pub_default_config
+ * @return 0 on success, -1 if memory, the spool or the thread failed
+ */
+int mqtt_pub_start(mqtt_pub_t *p, const mqtt_pub_config_t *cfg);
+
+/**
+ * @brief Queue a result for the next message; never blocks on I/O
+ * @param [in] p publisher handle
+ * @param [in] tag sensor name
+ * @param [in] r result
+ * @return 0, or -1 if the batch is full and the result was dropped
+ */
+int mqtt_pub_add(mqtt_pub_t *p, const char *tag, const sensor_results_t *r);
+
+/**
+ * @brief Read the counters
+ */
+void mqtt_pub_get_stats(mqtt_pub_t *p, mqtt_pub_stats_t *stats);
+
+/**
+ * @brief Send or spool the last batch, disconnect and stop the thread
+ */
+void mqtt_pub_stop(mqtt_pub_t *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_PUB_H */
@@ -0,0 +1,197 @@
+/**
+ * @file    rollup.c
+ * @brief   Incremental sliding-window rollups of sensor results
+ */
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include "rollup.h"
+
+/* Pane width of each window in ms (window length / ROLLUP_PANES). */
+static const int64_t pane_width_ms[ROLLUP_NUM_WINDOWS] = {
+    [ROLLUP_1MIN] = 60LL * 1000 / ROLLUP_PANES,
+    [ROLLUP_1H] = 3600LL * 1000 / ROLLUP_PANES,
+    [ROLLUP_8H] = 8 * 3600LL * 1000 / ROLLUP_PANES,
+    [ROLLUP_24H] = 24 * 3600LL * 1000 / ROLLUP_PANES,
+};
+
+static void reset_window(rollup_win_t *w)
+{
+    memset(w, 0, sizeof(*w));
+    w->pane_id = INT64_MIN;
+    w->closed_min = FLT_MAX;
+    w->closed_max = -FLT_MAX;
+}
+
+static void update_closed(rollup_win_t *w)
+{
+    w->closed_min = FLT_MAX;
+    w->closed_max = -FLT_MAX;
+    for (int i = 0; i < ROLLUP_PANES; i++) {
+        const rollup_pane_t *p = &w->pane[i];
+        if (i == w->head || !p->count) {
+            continue;
+        }
+        if (p->min < w->closed_min) {
+            w->closed_min = p->min;
+        }
+        if (p->max > w->closed_max) {
+            w->closed_max = p->max;
+        }
+    }
+}
+
+/* Move the current pane forward to pane id, expiring the panes that drop
+ * out of the window. */
+static void advance(rollup_win_t *w, int64_t id)
+{
+    int64_t steps;
+
+    if (INT64_MIN == w->pane_id) {
+        w->pane_id = id;
+        return;
+    }
+    steps = id - w->pane_id;
+    if (steps <= 0) {
+        return;
+    }
+    if (steps >= ROLLUP_PANES) {
+        reset_window(w);
+        w->pane_id = id;
+        return;
+    }
+    while (steps--) {
+        rollup_pane_t *p;
+
+        w->head = (uint8_t)((w->head + 1) % ROLLUP_PANES);
+        p = &w->pane[w->head];
+        if (p->count) {
+            w->count -= p->count;
+            w->sum -= p->sum;
+            for (int b = 0; b < ROLLUP_BINS; b++) {
+                w->hist[b] -= p->hist[b];
+            }
+            memset(p, 0, sizeof(*p));
+        }
+    }
+    if (!w->count) {
+        w->sum = 0;
+    }
+    w->pane_id = id;
+    update_closed(w);
+}
+
+static void add_sample(rollup_win_t *w, float v, int bin)
+{
+    rollup_pane_t *p = &w->pane[w->head];
+
+    if (!p->count || v < p->min) {
+        p->min = v;
+    }
+    if (!p->count || v > p->max) {
+        p->max = v;
+    }
+    p->count++;
+    p->sum += v;
+    p->hist[bin]++;
+    w->count++;
+    w->sum += v;
+    w->hist[bin]++;
+}
+
+static int bin_of(float v)
+{
+    int b;
+
+    if (!(v >= 1.0F)) {
+        return 0;
+    }
+    b = 1 + (int)(log2f(v) * ROLLUP_BINS_PER_OCTAVE);
+    return b < ROLLUP_BINS ? b : ROLLUP_BINS - 1;
+}
+
+void rollup_init(rollup_t *r)
+{
+    for (int c = 0; c < ROLLUP_NUM_CHANNELS; c++) {
+        for (int w = 0; w < ROLLUP_NUM_WINDOWS; w++) {
+            reset_window(&r->win[c][w]);
+        }
+    }
+}
+
+void rollup_update(rollup_t *r, const sensor_results_t *res)
+{
+    float v[ROLLUP_NUM_CHANNELS];
+
+    if (NO2_O3_OK != res->status) {
+        return;
+    }
+    v[ROLLUP_O3] = res->o3_ppb;
+    v[ROLLUP_NO2] = res->no2_ppb;
+    for (int c = 0; c < ROLLUP_NUM_CHANNELS; c++) {
+        int bin = bin_of(v[c]);
+        for (int w = 0; w < ROLLUP_NUM_WINDOWS; w++) {
+            advance(&r->win[c][w], res->timestamp_ms / pane_width_ms[w]);
+            add_sample(&r->win[c][w], v[c], bin);
+        }
+    }
+}
+
+void rollup_get(const rollup_t *r, rollup_channel_t ch, rollup_window_t w,
+                rollup_stats_t *stats)
+{
+    const rollup_win_t *win = &r->win[ch][w];
+    const rollup_pane_t *head = &win->pane[win->head];
+
+    memset(stats, 0, sizeof(*stats));
+    if (!win->count) {
+        return;
+    }
+    stats->count = win->count;
+    stats->mean = (float)(win->sum / win->count);
+    stats->min = win->closed_min;
+    stats->max = win->closed_max;
+    if (head->count && head->min < stats->min) {
+        stats->min = head->min;
+    }
+    if (head->count && head->max > stats->max) {
+        stats->max = head->max;
+    }
+}
+
+float rollup_quantile(const rollup_t *r, rollup_channel_t ch,
+                      rollup_window_t w, float q)
+{
+    const rollup_win_t *win = &r->win[ch][w];
+    rollup_stats_t stats;
+    float rank, cum = 0, v = 0;
+    int b;
+
+    if (!win->count) {
+        return 0;
+    }
+    rank = q < 0 ? 0 : (q > 1 ? 1 : q) * win->count;
+    for (b = 0; b < ROLLUP_BINS - 1; b++) {
+        if (cum + win->hist[b] >= rank && win->hist[b]) {
+            break;
+        }
+        cum += win->hist[b];
+    }
+    if (win->hist[b]) {
+        float frac = (rank - cum) / win->hist[b];
+        if (0 == b) {
+            v = frac;
+        } else {
+            float lo = exp2f((float)(b - 1) / ROLLUP_BINS_PER_OCTAVE);
+            v = lo * exp2f(frac / ROLLUP_BINS_PER_OCTAVE);
+        }
+    }
+    rollup_get(r, ch, w, &stats);
+    if (v < stats.min) {
+        v = stats.min;
+    } else if (v > stats.max) {
+        v = stats.max;
+    }
+    return v;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file    rollup.h
+ * @brief   Incremental sliding-window rollups of sensor results
+ *
+ * For each concentration channel the module maintains 1 min, 1 h, 8 h and
+ *  24 h sliding windows with count, mean, minimum, maximum and a log-binned
+ *  histogram used to estimate quantiles. Each window is split into
+ *  ROLLUP_PANES panes; a sample updates only the current pane and the window
+ *  totals, and a pane leaving the window is subtracted in one step. The work
+ *  per sample and per query is therefore independent of the window length.
+ *
+ * Windows advance with the timestamps of the samples fed to rollup_update().
+ *  A window covers the current pane and the preceding ROLLUP_PANES - 1
+ *  panes, i.e. its length varies between 59/60 and 60/60 of the nominal
+ *  duration.
+ */
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stdint.h>
+#include "sensor_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of panes each window is split into. */
+#define ROLLUP_PANES (60)
+/** Number of histogram bins used for quantile estimation. */
+#define ROLLUP_BINS  (64)
+/** Histogram bins per octave; bin edges are 2^(k / ROLLUP_BINS_PER_OCTAVE). */
+#define ROLLUP_BINS_PER_OCTAVE (6)
+
+/**
+ * @brief Window lengths
+ */
+typedef enum {
+    ROLLUP_1MIN = 0,
+    ROLLUP_1H,
+    ROLLUP_8H,
+    ROLLUP_24H,
+    ROLLUP_NUM_WINDOWS
+} rollup_window_t;
+
+/**
+ * @brief Aggregated channels
+ */
+typedef enum {
+    ROLLUP_O3 = 0,
+    ROLLUP_NO2,
+    ROLLUP_NUM_CHANNELS
+} rollup_channel_t;
+
+/**
+ * @brief Aggregates of one pane
+ */
+typedef struct {
+    uint16_t count;
+    float sum;
+    float min;
+    float max;
+    uint16_t hist[ROLLUP_BINS];
+} rollup_pane_t;
+
+/**
+ * @brief State of one sliding window
+ */
+typedef struct {
+    rollup_pane_t pane[ROLLUP_PANES];
+    int64_t pane_id;  /**< timestamp / pane width of the current pane */
+    uint8_t head;     /**< index of the current pane */
+    uint32_t count;
+    double sum;
+    float closed_min; /**< minimum over the panes preceding the current one */
+    float closed_max; /**< maximum over the panes preceding the current one */
+    uint32_t hist[ROLLUP_BINS];
+} rollup_win_t;
+
+/**
+ * @brief Rollup state of one sensor
+ */
+typedef struct {
+    rollup_win_t win[ROLLUP_NUM_CHANNELS][ROLLUP_NUM_WINDOWS];
+} rollup_t;
+
+/**
+ * @brief Snapshot of a window
+ */
+typedef struct {
+    uint32_t count; /**< number of samples in the window */
+    float mean;
+    float min;
+    float max;
+} rollup_stats_t;
+
+/**
+ * @brief Reset all windows
+ * @param [out] r rollup state
+ */
+void rollup_init(rollup_t *r);
+
+/**
+ * @brief Feed one result into all windows
+ * @note  Results whose status is not NO2_O3_OK are ignored.
+ * @param [in,out] r rollup state
+ * @param [in] res result of sensor_step()
+ */
+void rollup_update(rollup_t *r, const sensor_results_t *res);
+
+/**
+ * @brief Read count, mean, min and max of a window
+ * @param [in] r rollup state
+ * @param [in] ch channel
+ * @param [in] w window
+ * @param [out] stats window aggregates, all zero if the window is empty
+ */
+void rollup_get(const rollup_t *r, rollup_channel_t ch, rollup_window_t w,
+                rollup_stats_t *stats);
+
+/**
+ * @brief Estimate a quantile of a window
+ * @param [in] r rollup state
+ * @param [in] ch channel
+ * @param [in] w window
+ * @param [in] q quantile in [0, 1], e.g. 0.95
+ * @return estimated value; relative error is bounded by the bin width
+ *         (about 12 %), 0 if the window is empty
+ */
+float rollup_quantile(const rollup_t *r, rollup_channel_t ch,
+                      rollup_window_t w, float q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ROLLUP_H */
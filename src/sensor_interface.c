@@ -1,25 +1,107 @@
+#include <math.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
 #include "sensor_interface.h"
 #include "zmod4xxx.h"
 #include "zmod4xxx_hal.h"
 #include "zmod4xxx_cleaning.h"
-#include "zmod4510_config_no2_o3.h"
+#include "zmod4510.h"
+#include "sht4x.h"
+#ifndef ZMOD4510_MINIMAL
+#include "export.h"
+#include "mqtt_pub.h"
+#include "util/zrt.h"
+#endif
+#include "hal/sim/sim.h"
+#include "util/zlog.h"
+#include "util/ztrace.h"
 
 /* Internal variables */
 static int          ret;
 static Interface_t  hal;
+static SimDevice_t  sim;
 static char const*  errContext;
 
+/* Timing related declarations */
+static int      free_running;
+static int      free_running_started;
+static uint64_t next_end_ms;
+static uint64_t last_end_ms;    /* last observed end in free-running mode */
+static uint32_t timer_period_ms = ZMOD4510_NO2_O3_SAMPLE_TIME;
+static uint64_t cycle_start_ms;
+static uint32_t meas_time_ms = ZMOD4510_NO2_O3_SAMPLE_TIME;
+static uint64_t clock_base_ms;
+static int64_t  wall_base_ms;
+
 /* Gas sensor related declarations */
 static zmod4xxx_dev_t dev;
 static uint8_t zmod4xxx_status;
 static uint8_t adc_result[ZMOD4510_ADC_DATA_LEN];
 static uint8_t prod_data[ZMOD4510_PROD_DATA_LEN];
 
+/* Temperature and humidity sensor related declarations */
+static sht4x_dev_t th;
+static int         th_present;
+static int         th_pending;
+static float       th_temperature;
+static float       th_humidity;
+static int         th_valid;
+
+#ifndef ZMOD4510_MINIMAL
+/* Export related declarations */
+static exporter_t exporter = { .fd = -1 };
+static mqtt_pub_t   mqtt;
+static int          mqtt_started;
+#endif
+
 /* Algorithm related declarations */
 static no2_o3_handle_t  algo_handle;
 static no2_o3_results_t algo_results;
 static no2_o3_inputs_t  algo_input;
 
+/* Everything kept per sensor is allocated statically above; keep it within
+ * the budget promised in sensor_interface.h. */
+_Static_assert(sizeof(hal) + sizeof(dev) + sizeof(adc_result) +
+               sizeof(prod_data) + sizeof(th) + sizeof(algo_handle) +
+               sizeof(algo_results) + sizeof(algo_input) <=
+               SENSOR_STATE_BUDGET, "per-sensor state exceeds its budget");
+
+/* Monotonic time in milliseconds, taken from the HAL if it provides a
+ * clock so that simulated time is honoured. */
+static
+uint64_t clock_ms(void) {
+    struct timespec ts;
+    if (hal.msClock) {
+        return hal.msClock();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Wall-clock timestamp in milliseconds, used to tag each result. It is
+ * derived from the monotonic clock so that timestamps never go back. */
+static
+int64_t now_ms(void) {
+    return wall_base_ms + (int64_t)(clock_ms() - clock_base_ms);
+}
+
+/* Sleep until the given monotonic time, on the deadline itself if the HAL
+ * can sleep until an absolute time. */
+static
+void sleep_until(uint64_t deadline_ms) {
+    uint64_t now = clock_ms();
+    if (deadline_ms > now) {
+        ZTRACE_BEGIN("sleep_until", dev.i2c_addr, deadline_ms - now);
+        if (hal.msSleepUntil) {
+            hal.msSleepUntil(deadline_ms);
+        } else {
+            dev.delay_ms((uint32_t)(deadline_ms - now));
+        }
+        ZTRACE_END("sleep_until", dev.i2c_addr, 0);
+    }
+}
+
 /* This function is used to detect and configure a gas sensor.
  * In addition, the cleaning procedure is executed if required (this is 
  * just required once in sensor lifetime) */
@@ -48,24 +130,35 @@ int detect_and_configure(zmod4xxx_dev_t* sensor, int pd_len, char const** errCon
         *errContext = "Reading tracking number";
         return ret;
     }
-    printf("Sensor tracking number: x0000");
-    for (int i = 0; i < sizeof(track_number); i++) {
-        printf("%02X", track_number[i]);
-    }
-    printf("\n");
-    printf("Sensor trimming data:");
-    for (int i = 0; i < pd_len; i++) {
-        printf(" %i", prod_data[i]);
+#ifndef ZMOD4510_MINIMAL
+    {
+        char line[64];
+        int  len = 0;
+
+        for (int i = 0; i < (int)sizeof(track_number); i++) {
+            len += snprintf(line + len, sizeof(line) - len, "%02X",
+                            track_number[i]);
+        }
+        zlog_info("Sensor tracking number: x0000%s", line);
+        len = 0;
+        for (int i = 0; i < pd_len; i++) {
+            len += snprintf(line + len, sizeof(line) - len, " %i",
+                            prod_data[i]);
+        }
+        zlog_info("Sensor trimming data:%s", line);
     }
-    printf("\n");
+#else
+    (void)pd_len;
+#endif
 
     /* Start the cleaning procedure. Check the Datasheet on indications
      * of usage. IMPORTANT NOTE: The cleaning procedure can be run only once
      * during the modules lifetime and takes 1 minute (blocking). */
-    printf("Starting cleaning procedure. This might take up to 1 min ...\n");;
+    zlog_info("Starting cleaning procedure. This might take up to 1 min ...");
     ret = zmod4xxx_cleaning_run(sensor);
+    zmod4xxx_invalidate_shadow(sensor);
     if (ERROR_CLEANING == ret) {
-        printf("Skipping cleaning procedure. It has already been performed\n");;
+        zlog_info("Skipping cleaning procedure. It has already been performed");
     } else if (ret) {
         *errContext = "sensor cleaning";
         return ret;
@@ -76,12 +169,60 @@ int detect_and_configure(zmod4xxx_dev_t* sensor, int pd_len, char const** errCon
         *errContext = "sensor preparation";
         return ret;
     }
+    /* Confirm the sensor holds the configuration just written. */
+    ret = zmod4xxx_verify_config(sensor);
+    if (ret) {
+        *errContext = "configuration readback";
+        return ret;
+    }
     return 0;
 }
 
+/* Start a T/RH conversion; it ends long before the gas measurement and is
+ * read together with the ADC results. */
+static
+void th_trigger(void) {
+    if (th_present && !th_pending) {
+        th_pending = !sht4x_start_measurement(&th);
+    }
+}
+
+/* Read the ADC results and, if a conversion is pending, the T/RH result in
+ * one combined transfer. Without HAL support or if the combined transfer
+ * fails, both are read separately. */
+static
+int read_adc_and_th(zmod4xxx_dev_t* sensor, uint8_t* result) {
+    uint8_t      reg = ZMOD4510_RESULT_ADDR;
+    uint8_t      raw[SHT4X_RAW_LEN];
+    I2CSegment_t seg[3] = {
+        { sensor->i2c_addr, 0, 1, &reg },
+        { sensor->i2c_addr, 1, ZMOD4510_ADC_DATA_LEN, result },
+    };
+
+    th_valid = 0;
+    if (!th_pending) {
+        return zmod4510_read_adc_result(sensor, result);
+    }
+    th_pending = 0;
+    sht4x_read_segment(&th, &seg[2], raw);
+    if (hal.i2cBatch && !hal.i2cBatch(hal.handle, seg, 3)) {
+        th_valid = !sht4x_convert(raw, &th_temperature, &th_humidity);
+    } else {
+        ret = zmod4510_read_adc_result(sensor, result);
+        if (ret) {
+            return ret;
+        }
+        th_valid = !sht4x_read(&th, &th_temperature, &th_humidity);
+    }
+    if (!th_valid) {
+        zlog_warn("Reading temperature and humidity failed");
+    }
+    return ZMOD4XXX_OK;
+}
+
 /* This function read the gas sensor results and checks for result validity. */
 static
-void read_and_verify(zmod4xxx_dev_t* sensor, uint8_t* result, char const* id) {
+void read_and_verify(zmod4xxx_dev_t* sensor, uint8_t* result) {
     /* Verify completion of measurement sequence. */
     ret = zmod4xxx_read_status(sensor, &zmod4xxx_status);
     if (ret) {
@@ -105,7 +246,7 @@ void read_and_verify(zmod4xxx_dev_t* sensor, uint8_t* result, char const* id) {
         }
     }
     /* Read sensor ADC output. */
-    ret = zmod4xxx_read_adc_result(sensor, result);
+    ret = read_adc_and_th(sensor, result);
     if (ret) {
         HAL_HandleError(ret, "Reading ADC results");
     }
@@ -118,10 +259,138 @@ void read_and_verify(zmod4xxx_dev_t* sensor, uint8_t* result, char const* id) {
     }
 }
 
-/* Initialize the hardware and algorithm */
-int sensor_init() {
-    ret = HAL_Init(&hal);
-    if (ret) return ret;
+/* Wait in free-running mode until the sensor has completed the current
+ * cycle. The host wakes shortly before the expected end and polls the status
+ * until the sequencer is idle; the observed end anchors the next cycle, so
+ * the cadence follows the sensor's sleep timer rather than the host.
+ *
+ * The period of the sleep timer is learned from successive observed ends
+ * rather than assumed. A sequencer that is already idle on waking has
+ * either ended early, or not started yet because the timer period is
+ * longer than expected. Unchanged ADC words tell the second case, and the
+ * host then waits for the next sequence instead of reading the old result
+ * again. Observed ends more than one period apart are reported as missed
+ * cycles. */
+static
+int wait_free_running(void) {
+    uint8_t  adc[ZMOD4510_ADC_DATA_LEN];
+    uint32_t waited, interval, periods;
+    uint64_t now;
+    int      sleeping = 0;
+
+    if (!free_running_started) {
+        dev.meas_conf = &zmod_no2_o3_sensor_cfg[MEASUREMENT_FREE_RUNNING];
+        ret = zmod4xxx_start_measurement(&dev);
+        if (ret) {
+            return ret;
+        }
+        next_end_ms = clock_ms() + timer_period_ms;
+        last_end_ms = 0;
+        free_running_started = 1;
+    }
+    th_trigger();
+
+    sleep_until(next_end_ms - ZMOD4510_WAIT_GUARD_TIME);
+    ret = zmod4xxx_wait_measurement(&dev, ZMOD4510_WAIT_POLL_TIME,
+                                    ZMOD4510_WAIT_TIMEOUT, &waited);
+    if (!ret && !waited) {
+        ret = zmod4510_read_adc_result(&dev, adc);
+        sleeping = !ret && !memcmp(adc, adc_result, sizeof(adc));
+    }
+    if (!ret && sleeping) {
+        /* wait for the timer to start the next sequence; a coarse poll
+         * suffices, the sequence takes seconds */
+        waited = 0;
+        while (!(ret = zmod4xxx_read_status(&dev, &zmod4xxx_status)) &&
+               !(zmod4xxx_status & STATUS_SEQUENCER_RUNNING_MASK)) {
+            if (waited >= 2 * ZMOD4510_NO2_O3_SAMPLE_TIME) {
+                return ERROR_GAS_TIMEOUT;
+            }
+            dev.delay_ms(ZMOD4510_WAIT_GUARD_TIME);
+            waited += ZMOD4510_WAIT_GUARD_TIME;
+        }
+        if (!ret) {
+            ret = zmod4xxx_wait_measurement(&dev, ZMOD4510_WAIT_POLL_TIME,
+                                            ZMOD4510_WAIT_TIMEOUT, &waited);
+        }
+    }
+    if (ret) {
+        return ret;
+    }
+    now = clock_ms();
+    if (!waited) {
+        /* ended unobserved: assume a shorter period and wake sooner; the
+         * next two observed ends correct the period either way */
+        if (timer_period_ms > 2 * ZMOD4510_WAIT_GUARD_TIME) {
+            timer_period_ms -= timer_period_ms / 16;
+        }
+        last_end_ms = 0;
+        next_end_ms = now + timer_period_ms;
+        return 0;
+    }
+    if (last_end_ms) {
+        interval = (uint32_t)(now - last_end_ms);
+        periods = sleeping ? 1 : (interval + timer_period_ms / 2) /
+                                 timer_period_ms;
+        if (1 == periods) {
+            timer_period_ms = interval;
+        } else if (periods > 1) {
+            zlog_warn("Free-running sensor: %u cycles missed",
+                      (unsigned)(periods - 1));
+        }
+    }
+    last_end_ms = now;
+    next_end_ms = now + timer_period_ms;
+    return 0;
+}
+
+/* Run one host-triggered cycle. Cycles start on a fixed
+ * ZMOD4510_NO2_O3_SAMPLE_TIME grid; within a cycle the host sleeps until just
+ * before the expected end of the sequence and polls for completion, so the
+ * results are available as soon as the sensor has produced them. The
+ * expected duration is learned from the observed completion times. */
+static
+int wait_host_triggered(void) {
+    uint64_t start;
+    uint32_t waited;
+
+    if (cycle_start_ms) {
+        sleep_until(cycle_start_ms + ZMOD4510_NO2_O3_SAMPLE_TIME);
+    }
+    ret = zmod4xxx_start_measurement(&dev);
+    if (ret) {
+        return ret;
+    }
+    start = clock_ms();
+    cycle_start_ms = start;
+    th_trigger();
+
+    sleep_until(start + meas_time_ms - ZMOD4510_WAIT_GUARD_TIME);
+    ret = zmod4xxx_wait_measurement(&dev, ZMOD4510_WAIT_POLL_TIME,
+                                    ZMOD4510_WAIT_TIMEOUT, &waited);
+    if (ret) {
+        return ret;
+    }
+    if (waited) {
+        meas_time_ms = (uint32_t)(clock_ms() - start);
+    } else if (meas_time_ms > 2 * ZMOD4510_WAIT_GUARD_TIME) {
+        /* Already idle: the end was earlier than expected, wake sooner. */
+        meas_time_ms -= meas_time_ms / 16;
+    }
+    return 0;
+}
+
+/* Configure the sensor and algorithm on an initialized HAL */
+static
+int sensor_setup(void) {
+    clock_base_ms = clock_ms();
+    wall_base_ms = (int64_t)time(NULL) * 1000;
+    /* nothing learned from an earlier run carries over to this sensor */
+    free_running_started = 0;
+    next_end_ms = 0;
+    cycle_start_ms = 0;
+    meas_time_ms = ZMOD4510_NO2_O3_SAMPLE_TIME;
+    timer_period_ms = ZMOD4510_NO2_O3_SAMPLE_TIME;
 
     dev.i2c_addr = ZMOD4510_I2C_ADDR;
     dev.pid = ZMOD4510_PID;
@@ -132,34 +401,209 @@ int sensor_init() {
     ret = detect_and_configure(&dev, ZMOD4510_PROD_DATA_LEN, &errContext);
     if (ret) return ret;
 
+    th_pending = 0;
+    th_present = !sht4x_init(&th, &hal, SHT4X_I2C_ADDR);
+    if (th_present) {
+        zlog_info("SHT4x temperature and humidity sensor found, serial %08X",
+                  (unsigned)th.serial);
+    } else {
+        zlog_info("No SHT4x temperature and humidity sensor found");
+    }
+
     return init_no2_o3(&algo_handle);
 }
 
+/* Initialize the hardware and algorithm */
+int sensor_init() {
+    ret = HAL_Init(&hal);
+    if (ret) return ret;
+
+    return sensor_setup();
+}
+
+/* Initialize the simulated sensor and algorithm */
+int sensor_init_sim() {
+    ret = SIM_Init(&hal, &sim, NULL);
+    if (ret) return ret;
+
+    return sensor_setup();
+}
+
+/* Select free-running mode, effective from the next measurement cycle */
+void sensor_set_free_running(int enable) {
+    if (free_running_started && !enable) {
+        zmod4xxx_stop_measurement(&dev);
+        dev.meas_conf = &zmod_no2_o3_sensor_cfg[MEASUREMENT];
+        free_running_started = 0;
+    }
+    free_running = enable;
+}
+
 /* Perform one single measurement cycle */
 void sensor_step(float temp, float humidity, sensor_results_t* out) {
-    ret = zmod4xxx_start_measurement(&dev);
+    ZTRACE_BEGIN("sensor_step", dev.i2c_addr, free_running);
+    if (free_running) {
+        ret = wait_free_running();
+    } else {
+        ret = wait_host_triggered();
+    }
     if (ret) {
-        out->status = NO2_O3_DAMAGE;
+        ZTRACE_INSTANT("error", dev.i2c_addr, ret);
+        /* the T/RH result of this cycle is dropped; the next cycle starts a
+         * fresh conversion instead of reading this one a cycle late */
+        th_pending = 0;
+        out->timestamp_ms = now_ms();
+        out->o3_ppb = NAN;
+        out->no2_ppb = NAN;
+        out->fast_aqi = 0;
+        out->epa_aqi = 0;
+        for (int i = 0; i < 4; i++) {
+            out->rmox[i] = NAN;
+        }
+        out->o3_1min_ppb = NAN;
+        out->o3_1h_ppb = NAN;
+        out->o3_8h_ppb = NAN;
+        out->no2_1min_ppb = NAN;
+        out->no2_1h_ppb = NAN;
+        out->temperature_degc = NAN;
+        out->humidity_pct = NAN;
+        out->status = ERROR_GAS_TIMEOUT == ret ? ret : NO2_O3_DAMAGE;
+        ZTRACE_END("sensor_step", dev.i2c_addr, out->status);
         return;
     }
 
-    dev.delay_ms(ZMOD4510_NO2_O3_SAMPLE_TIME);
-
-    read_and_verify(&dev, adc_result, "ZMOD4510");
+    ZTRACE_BEGIN("read_and_verify", dev.i2c_addr, 0);
+    read_and_verify(&dev, adc_result);
+    ZTRACE_END("read_and_verify", dev.i2c_addr, 0);
+    out->timestamp_ms = now_ms();
 
     algo_input.adc_result = adc_result;
-    algo_input.humidity_pct = humidity;
-    algo_input.temperature_degc = temp;
+    algo_input.humidity_pct = th_valid ? th_humidity : humidity;
+    algo_input.temperature_degc = th_valid ? th_temperature : temp;
+    out->temperature_degc = th_valid ? th_temperature : NAN;
+    out->humidity_pct = th_valid ? th_humidity : NAN;
 
+    ZTRACE_BEGIN("calc_no2_o3", dev.i2c_addr, 0);
     ret = calc_no2_o3(&algo_handle, &dev, &algo_input, &algo_results);
+    ZTRACE_END("calc_no2_o3", dev.i2c_addr, ret);
 
     out->o3_ppb = algo_results.O3_conc_ppb;
     out->no2_ppb = algo_results.NO2_conc_ppb;
     out->fast_aqi = algo_results.FAST_AQI;
     out->epa_aqi = algo_results.EPA_AQI;
+    for (int i = 0; i < 4; i++) {
+        out->rmox[i] = algo_results.rmox[i];
+    }
+    out->o3_1min_ppb = algo_handle.o3_1min_ppb;
+    out->o3_1h_ppb = algo_handle.o3_1h_ppb;
+    out->o3_8h_ppb = algo_handle.o3_8h_ppb;
+    out->no2_1min_ppb = algo_handle.no2_1min_ppb;
+    out->no2_1h_ppb = algo_handle.no2_1h_ppb;
     out->status = ret;
+#ifndef ZMOD4510_MINIMAL
+    if (exporter.fd >= 0 && export_append(&exporter, out)) {
+        zlog_warn("Export of the result failed, retrying with the next");
+    }
+    if (mqtt_started) {
+        mqtt_pub_add(&mqtt, "zmod4510", out);
+    }
+#endif
+    ZTRACE_END("sensor_step", dev.i2c_addr, ret);
+}
+
+#ifdef ZMOD4510_MINIMAL
+/* Exporting and publishing need stdio, threads and the heap; the minimal
+ * build only accepts turning them off. */
+int sensor_set_export(const char* path, int format) {
+    (void)format;
+    return path ? -1 : 0;
+}
+
+int sensor_set_mqtt(const char* host, int port, const char* topic,
+                    int interval_s, const char* spool_path) {
+    (void)port;
+    (void)topic;
+    (void)interval_s;
+    (void)spool_path;
+    return host ? -1 : 0;
+}
+
+int sensor_set_realtime(int priority, int cpu) {
+    (void)priority;
+    (void)cpu;
+    return -1;
+}
+#else
+/* Export every following result, or stop exporting if path is NULL */
+int sensor_set_export(const char* path, int format) {
+    export_config_t cfg = EXPORT_ARROW == format ? export_arrow_config
+                                                 : export_default_config;
+
+    /* reject an unknown format before stopping the running export */
+    if (path && (format < EXPORT_CSV || format > EXPORT_ARROW)) {
+        return -1;
+    }
+    if (export_close(&exporter)) {
+        zlog_error("Closing the export file failed");
+    }
+    if (!path) {
+        return 0;
+    }
+    cfg.format = (export_format_t)format;
+    return export_open(&exporter, path, &cfg);
+}
+
+/* Publish every following result to a broker, or stop if host is NULL */
+int sensor_set_mqtt(const char* host, int port, const char* topic,
+                    int interval_s, const char* spool_path) {
+    mqtt_pub_config_t cfg = mqtt_pub_default_config;
+
+    if (mqtt_started) {
+        mqtt_pub_stop(&mqtt);
+        mqtt_started = 0;
+    }
+    if (!host) {
+        return 0;
+    }
+    strncpy(cfg.host, host, sizeof(cfg.host) - 1);
+    cfg.port = (uint16_t)port;
+    if (topic) {
+        strncpy(cfg.topic, topic, sizeof(cfg.topic) - 1);
+    }
+    cfg.interval_ms = (uint32_t)interval_s * 1000;
+    if (spool_path) {
+        strncpy(cfg.spool_path, spool_path, sizeof(cfg.spool_path) - 1);
+    }
+    if (mqtt_pub_start(&mqtt, &cfg)) {
+        return -1;
+    }
+    mqtt_started = 1;
+    return 0;
+}
+
+/* Real-time mode for the calling thread, which is to run sensor_step. Returns
+ * the zrt_step_t bits of the settings that could not be applied. */
+int sensor_set_realtime(int priority, int cpu) {
+    zrt_config_t cfg = zrt_default_config;
+
+    cfg.policy = priority > 0 ? SCHED_FIFO : SCHED_OTHER;
+    cfg.priority = priority;
+    cfg.cpu = cpu;
+    return zrt_enter(&cfg);
+}
+#endif
+
+/* Report whether the T/RH sensor was found by the last initialization */
+int sensor_th_present() {
+    return th_present;
 }
 
 void sensor_close() {
+    sensor_set_export(NULL, 0);
+    sensor_set_mqtt(NULL, 0, NULL, 0, NULL);
+    if (free_running_started) {
+        zmod4xxx_stop_measurement(&dev);
+        free_running_started = 0;
+    }
     HAL_Deinit(&hal);
 }
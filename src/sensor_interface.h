@@ -3,16 +3,37 @@
 
 #include "no2_o3.h"
 
+// Upper bound of the statically allocated state of the sensor, in bytes.
+// No heap is used by the core; the minimal build (ZMOD4510_MINIMAL) also
+// leaves out stdio and reports failures by error codes only.
+#define SENSOR_STATE_BUDGET (512)
+
 typedef struct {
     float o3_ppb;
     float no2_ppb;
     int32_t fast_aqi;
     int32_t epa_aqi;
     int32_t status; // To return NO2_O3_OK, etc.
+    float rmox[4]; // MOx resistances reported by the algorithm
+    int64_t timestamp_ms; // Wall-clock time the ADC result was read, or the cycle failed
+    float o3_1min_ppb; // Running averages maintained by the algorithm
+    float o3_1h_ppb;
+    float o3_8h_ppb;
+    float no2_1min_ppb;
+    float no2_1h_ppb;
+    float temperature_degc; // Measured by the SHT4x, NaN if none was read
+    float humidity_pct;
 } sensor_results_t;
 
 int sensor_init();
-void sensor_step(float temp, float humidity, sensor_results_t* out);
+int sensor_init_sim(); // Run against the simulated sensor in src/hal/sim
+void sensor_set_free_running(int enable); // Let the sensor's sleep timer pace cycles
+void sensor_step(float temp, float humidity, sensor_results_t* out); // temp/humidity are used if no SHT4x result is available
+int sensor_th_present(); // An SHT4x was found next to the ZMOD4510
+int sensor_set_realtime(int priority, int cpu); // Real-time mode of the thread calling sensor_step (zrt.h), 0 keeps the policy
+int sensor_set_export(const char* path, int format); // Batch every result to a file (export.h), NULL to stop; -1 for an unknown format
+int sensor_set_mqtt(const char* host, int port, const char* topic, int interval_s,
+                    const char* spool_path); // Publish results to a broker (mqtt_pub.h), NULL host to stop
 void sensor_close();
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,123 @@
+/**
+ * @file    sht4x.c
+ * @brief   Driver of the Sensirion SHT4x temperature and humidity sensor
+ */
+
+#include <stddef.h>
+#include "sht4x.h"
+
+/* CRC-8 over one word, polynomial 0x31, initial value 0xFF */
+static uint8_t crc8(const uint8_t *data)
+{
+    uint8_t crc = 0xFF;
+
+    for (int i = 0; i < 2; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = crc & 0x80 ? (uint8_t)(crc << 1) ^ 0x31 : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static sht4x_err command(sht4x_dev_t *dev, uint8_t cmd)
+{
+    if (dev->hal->i2cWrite(dev->hal->handle, dev->i2c_addr, &cmd, 1, NULL, 0)) {
+        return SHT4X_ERR_I2C;
+    }
+    return SHT4X_OK;
+}
+
+static sht4x_err read_raw(sht4x_dev_t *dev, uint8_t raw[SHT4X_RAW_LEN])
+{
+    if (dev->hal->i2cRead(dev->hal->handle, dev->i2c_addr, NULL, 0, raw,
+                          SHT4X_RAW_LEN)) {
+        return SHT4X_ERR_I2C;
+    }
+    return SHT4X_OK;
+}
+
+sht4x_err sht4x_init(sht4x_dev_t *dev, Interface_t *hal, uint8_t i2c_addr)
+{
+    uint8_t raw[SHT4X_RAW_LEN];
+    sht4x_err ret;
+
+    dev->hal = hal;
+    dev->i2c_addr = i2c_addr;
+    dev->cmd = SHT4X_CMD_MEASURE_HIGH;
+    dev->serial = 0;
+
+    ret = command(dev, SHT4X_CMD_SOFT_RESET);
+    if (ret) {
+        return ret;
+    }
+    hal->msSleep(1);
+    ret = command(dev, SHT4X_CMD_SERIAL);
+    if (ret) {
+        return ret;
+    }
+    hal->msSleep(1);
+    ret = read_raw(dev, raw);
+    if (ret) {
+        return ret;
+    }
+    if (crc8(raw) != raw[2] || crc8(raw + 3) != raw[5]) {
+        return SHT4X_ERR_CRC;
+    }
+    dev->serial = (uint32_t)raw[0] << 24 | (uint32_t)raw[1] << 16 |
+                  (uint32_t)raw[3] << 8 | raw[4];
+    return SHT4X_OK;
+}
+
+sht4x_err sht4x_start_measurement(sht4x_dev_t *dev)
+{
+    return command(dev, dev->cmd);
+}
+
+/* maximum conversion times of the datasheet, rounded up */
+uint32_t sht4x_measurement_time(const sht4x_dev_t *dev)
+{
+    switch (dev->cmd) {
+    case SHT4X_CMD_MEASURE_LOW:
+        return 2;
+    case SHT4X_CMD_MEASURE_MEDIUM:
+        return 5;
+    default:
+        return 9;
+    }
+}
+
+void sht4x_read_segment(const sht4x_dev_t *dev, I2CSegment_t *seg,
+                        uint8_t raw[SHT4X_RAW_LEN])
+{
+    seg->addr = dev->i2c_addr;
+    seg->read = 1;
+    seg->len = SHT4X_RAW_LEN;
+    seg->data = raw;
+}
+
+sht4x_err sht4x_convert(const uint8_t raw[SHT4X_RAW_LEN],
+                        float *temperature_degc, float *humidity_pct)
+{
+    float rh;
+
+    if (crc8(raw) != raw[2] || crc8(raw + 3) != raw[5]) {
+        return SHT4X_ERR_CRC;
+    }
+    *temperature_degc = -45.0F + 175.0F * (raw[0] << 8 | raw[1]) / 65535.0F;
+    rh = -6.0F + 125.0F * (raw[3] << 8 | raw[4]) / 65535.0F;
+    *humidity_pct = rh < 0.0F ? 0.0F : rh > 100.0F ? 100.0F : rh;
+    return SHT4X_OK;
+}
+
+sht4x_err sht4x_read(sht4x_dev_t *dev, float *temperature_degc,
+                     float *humidity_pct)
+{
+    uint8_t raw[SHT4X_RAW_LEN];
+    sht4x_err ret = read_raw(dev, raw);
+
+    if (ret) {
+        return ret;
+    }
+    return sht4x_convert(raw, temperature_degc, humidity_pct);
+}
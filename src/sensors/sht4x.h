@@ -0,0 +1,105 @@
+/**
+ * @addtogroup zmod_api
+ * @{
+ * @file    sht4x.h
+ * @brief   Driver of the Sensirion SHT4x temperature and humidity sensor
+ *
+ * The NO2/O3 algorithm compensates its results for ambient temperature and
+ *  humidity. An SHT4x on the same bus provides them: a conversion is started
+ *  together with the gas measurement and, since it ends long before the
+ *  ZMOD4510 sequence, its result is read in the same transaction as the ADC
+ *  results (see Interface_t::i2cBatch), at no extra bus turnaround.
+ */
+
+#ifndef _SHT4X_H
+#define _SHT4X_H
+
+#include <stdint.h>
+#include "hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHT4X_I2C_ADDR (0x44) /**< SHT40/41/45 -A variants */
+#define SHT4X_RAW_LEN  (6)    /**< T word, CRC, RH word, CRC */
+
+#define SHT4X_CMD_MEASURE_HIGH   (0xFD) /**< high precision, 8.3 ms */
+#define SHT4X_CMD_MEASURE_MEDIUM (0xF6) /**< medium precision, 4.5 ms */
+#define SHT4X_CMD_MEASURE_LOW    (0xE0) /**< low precision, 1.6 ms */
+#define SHT4X_CMD_SERIAL         (0x89)
+#define SHT4X_CMD_SOFT_RESET     (0x94)
+
+/**
+ * @brief Error codes
+ */
+typedef enum {
+    SHT4X_OK = 0,
+    SHT4X_ERR_I2C = -1, /**< The sensor did not acknowledge. */
+    SHT4X_ERR_CRC = -2, /**< A word failed its checksum. */
+} sht4x_err;
+
+/**
+ * @brief Device
+ */
+typedef struct {
+    Interface_t *hal;
+    uint8_t i2c_addr;
+    uint8_t cmd;      /**< measurement command, SHT4X_CMD_MEASURE_HIGH */
+    uint32_t serial;  /**< read by sht4x_init() */
+} sht4x_dev_t;
+
+/**
+ * @brief   Reset the sensor and read its serial number.
+ * @param   [out] dev device
+ * @param   [in] hal interface of the bus the sensor is on
+ * @param   [in] i2c_addr usually SHT4X_I2C_ADDR
+ * @return  error code; SHT4X_ERR_I2C if no sensor answers
+ */
+sht4x_err sht4x_init(sht4x_dev_t *dev, Interface_t *hal, uint8_t i2c_addr);
+
+/**
+ * @brief   Start a conversion with dev->cmd.
+ * @return  error code
+ */
+sht4x_err sht4x_start_measurement(sht4x_dev_t *dev);
+
+/**
+ * @brief   Time from sht4x_start_measurement() to the result, in ms.
+ */
+uint32_t sht4x_measurement_time(const sht4x_dev_t *dev);
+
+/**
+ * @brief   Describe the result read as one segment of a combined transfer.
+ * @param   [in] dev device
+ * @param   [out] seg segment to fill
+ * @param   [out] raw SHT4X_RAW_LEN bytes, to pass to sht4x_convert()
+ */
+void sht4x_read_segment(const sht4x_dev_t *dev, I2CSegment_t *seg,
+                        uint8_t raw[SHT4X_RAW_LEN]);
+
+/**
+ * @brief   Check and convert a raw result.
+ * @param   [in] raw result bytes
+ * @param   [out] temperature_degc temperature in degree Celsius
+ * @param   [out] humidity_pct relative humidity in %, clamped to 0..100
+ * @return  error code
+ */
+sht4x_err sht4x_convert(const uint8_t raw[SHT4X_RAW_LEN],
+                        float *temperature_degc, float *humidity_pct);
+
+/**
+ * @brief   Read and convert the result of the last conversion.
+ * @note    The sensor does not acknowledge before the conversion ended.
+ * @return  error code
+ */
+sht4x_err sht4x_read(sht4x_dev_t *dev, float *temperature_degc,
+                     float *humidity_pct);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
+
+#endif /* _SHT4X_H */
@@ -0,0 +1,152 @@
+/*****************************************************************************
+ * Copyright (c) 2024 Renesas Electronics Corporation
+ * All Rights Reserved.
+ * 
+ * This code is proprietary to Renesas, and is license pursuant to the terms and
+ * conditions that may be accessed at:
+ * https://www.renesas.com/eu/en/document/msc/renesas-software-license-terms-gas-sensor-software
+ *****************************************************************************/
+
+/**
+ * @file    zmod4510.c
+ * @brief   ZMOD4510 NO2/O3 configuration tables and specialized driver path
+ */
+
+#include "zmod4510.h"
+
+const uint8_t data_set_4510_init[ZMOD4510_INIT_SET_LEN] = {
+                                0x00, 0x50,
+                                0x00, 0x28, 0xC3, 0xE3,
+                                0x00, 0x00, 0x80, 0x40};
+
+const uint8_t data_set_4510_no2_o3[ZMOD4510_NO2_O3_SET_LEN] = {
+                                0x00, 0x50, 0xFF, 0x06,
+                                0xFE, 0xA2, 0xFE, 0x3E,
+                                0x00, 0x10, 0x00, 0x52,
+                                0x3F, 0x66, 0x00, 0x42,
+                                0x23, 0x03,
+                                0x00, 0x00, 0x02, 0x41,
+                                0x00, 0x41, 0x00, 0x41,
+                                0x00, 0x49, 0x00, 0x50,
+                                0x02, 0x42, 0x00, 0x42,
+                                0x00, 0x42, 0x00, 0x4A,
+                                0x00, 0x50, 0x02, 0x43,
+                                0x00, 0x43, 0x00, 0x43,
+                                0x00, 0x43, 0x80, 0x5B,
+                                };
+
+const zmod4xxx_conf zmod_no2_o3_sensor_cfg[3] = {
+    [INIT] = {
+        .start = 0x80,
+        .h = { .addr = ZMOD4XXX_H_ADDR, .len = 2, .data_buf = &data_set_4510_init[0]},
+        .d = { .addr = ZMOD4XXX_D_ADDR, .len = 2, .data_buf = &data_set_4510_init[2]},
+        .m = { .addr = ZMOD4XXX_M_ADDR, .len = 2, .data_buf = &data_set_4510_init[4]},
+        .s = { .addr = ZMOD4XXX_S_ADDR, .len = 4, .data_buf = &data_set_4510_init[6]},
+        .r = { .addr = ZMOD4510_RESULT_ADDR, .len = ZMOD4510_INIT_RESULT_LEN},
+    },
+
+    [MEASUREMENT] = {
+        .start = 0x80,
+        .h = {.addr = ZMOD4XXX_H_ADDR, .len = 8, .data_buf = &data_set_4510_no2_o3[0]},
+        .d = {.addr = ZMOD4XXX_D_ADDR, .len = 8, .data_buf = &data_set_4510_no2_o3[8]},
+        .m = {.addr = ZMOD4XXX_M_ADDR, .len = 2, .data_buf = &data_set_4510_no2_o3[16]},
+        .s = {.addr = ZMOD4XXX_S_ADDR, .len = 32, .data_buf = &data_set_4510_no2_o3[18]},
+        .r = {.addr = ZMOD4510_RESULT_ADDR, .len = ZMOD4510_ADC_DATA_LEN},
+        .prod_data_len = ZMOD4510_PROD_DATA_LEN,
+    },
+
+    /* Same sequence as MEASUREMENT, but the sleep timer restarts the
+     * sequencer every ZMOD4510_NO2_O3_SAMPLE_TIME without host commands. */
+    [MEASUREMENT_FREE_RUNNING] = {
+        .start = 0xC0,
+        .h = {.addr = ZMOD4XXX_H_ADDR, .len = 8, .data_buf = &data_set_4510_no2_o3[0]},
+        .d = {.addr = ZMOD4XXX_D_ADDR, .len = 8, .data_buf = &data_set_4510_no2_o3[8]},
+        .m = {.addr = ZMOD4XXX_M_ADDR, .len = 2, .data_buf = &data_set_4510_no2_o3[16]},
+        .s = {.addr = ZMOD4XXX_S_ADDR, .len = 32, .data_buf = &data_set_4510_no2_o3[18]},
+        .r = {.addr = ZMOD4510_RESULT_ADDR, .len = ZMOD4510_ADC_DATA_LEN},
+        .prod_data_len = ZMOD4510_PROD_DATA_LEN,
+    },
+};
+
+zmod4xxx_err zmod4510_read_adc_result(zmod4xxx_dev_t *dev,
+                                      uint8_t adc_result[ZMOD4510_ADC_DATA_LEN])
+{
+    if (dev->read(dev->i2c_addr, ZMOD4510_RESULT_ADDR, adc_result,
+                  ZMOD4510_ADC_DATA_LEN)) {
+        return ERROR_I2C;
+    }
+    return ZMOD4XXX_OK;
+}
+
+/* Same arithmetic as zmod4xxx_calc_single_rmox, written as selects instead
+ * of branches. The quotient is only used where the generic function
+ * computes it, the denominator of the discarded lanes is kept non-zero. */
+static inline float single_rmox(float scale, int32_t lr, int32_t er,
+                                int32_t adc)
+{
+    int32_t den = er - adc;
+    float r = scale * (adc - lr) / (den > 0 ? den : 1);
+
+    r = er <= adc ? 1e12F : r;
+    r = adc <= lr ? 1e2F : r;
+    r = r > 1e12F ? 1e12F : r;
+    r = r < 1e2F ? 1e2F : r;
+    return r;
+}
+
+void zmod4510_calc_rmox(const zmod4xxx_dev_t *dev,
+                        const uint8_t adc_result[ZMOD4510_ADC_DATA_LEN],
+                        float rmox[ZMOD4510_RMOX_COUNT])
+{
+    const float scale = dev->config[0] * 1e3F;
+    const int32_t lr = dev->mox_lr;
+    const int32_t er = dev->mox_er;
+
+    for (int i = 0; i < ZMOD4510_RMOX_COUNT; i++) {
+        int32_t adc = (adc_result[2 * i] << 8) | adc_result[2 * i + 1];
+        rmox[i] = single_rmox(scale, lr, er, adc);
+    }
+}
+
+uint32_t zmod4510_rmox_lut_span(const zmod4xxx_dev_t *dev, uint16_t *first)
+{
+    int32_t lo = dev->mox_lr + 1;
+    int32_t hi = dev->mox_er - 1;
+
+    /* outside (mox_lr, mox_er) the result is one of the two clamp values */
+    *first = (uint16_t)(lo < 0xFFFF ? lo : 0xFFFF);
+    return hi >= lo ? (uint32_t)(hi - lo + 1) : 0;
+}
+
+void zmod4510_rmox_lut_init(zmod4510_rmox_lut_t *lut,
+                            const zmod4xxx_dev_t *dev, float *table,
+                            uint16_t first, uint32_t count)
+{
+    lut->scale = dev->config[0] * 1e3F;
+    lut->mox_lr = dev->mox_lr;
+    lut->mox_er = dev->mox_er;
+    if (count > ZMOD4510_RMOX_LUT_FULL - first) {
+        count = ZMOD4510_RMOX_LUT_FULL - first;
+    }
+    lut->table = table;
+    lut->first = first;
+    lut->count = table ? count : 0;
+    for (uint32_t i = 0; i < lut->count; i++) {
+        table[i] = single_rmox(lut->scale, lut->mox_lr, lut->mox_er,
+                               (int32_t)(first + i));
+    }
+}
+
+void zmod4510_calc_rmox_lut(const zmod4510_rmox_lut_t *lut,
+                            const uint8_t adc_result[ZMOD4510_ADC_DATA_LEN],
+                            float rmox[ZMOD4510_RMOX_COUNT])
+{
+    for (int i = 0; i < ZMOD4510_RMOX_COUNT; i++) {
+        int32_t adc = (adc_result[2 * i] << 8) | adc_result[2 * i + 1];
+        uint32_t index = (uint32_t)(adc - lut->first);
+
+        rmox[i] = index < lut->count
+                      ? lut->table[index]
+                      : single_rmox(lut->scale, lut->mox_lr, lut->mox_er, adc);
+    }
+}
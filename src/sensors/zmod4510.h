@@ -0,0 +1,121 @@
+/*****************************************************************************
+ * Copyright (c) 2024 Renesas Electronics Corporation
+ * All Rights Reserved.
+ * 
+ * This code is proprietary to Renesas, and is license pursuant to the terms and
+ * conditions that may be accessed at:
+ * https://www.renesas.com/eu/en/document/msc/renesas-software-license-terms-gas-sensor-software
+ *****************************************************************************/
+
+/**
+ * @addtogroup zmod_api
+ * @{
+ * @file    zmod4510.h
+ * @brief   ZMOD4510 NO2/O3 specialized driver path
+ *
+ * The generic zmod4xxx functions take every register address and length
+ *  from the configuration at runtime. These variants are fixed to the
+ *  ZMOD4510 NO2/O3 configuration (zmod4510_config_no2_o3.h), so all loop
+ *  bounds are compile-time constants and the conversion loop can be
+ *  unrolled and vectorized. Results are identical to the generic functions.
+ */
+
+#ifndef _ZMOD4510_H
+#define _ZMOD4510_H
+
+#include "zmod4xxx_types.h"
+#include "zmod4510_config_no2_o3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of table entries covering every ADC word */
+#define ZMOD4510_RMOX_LUT_FULL 0x10000U
+
+/**
+ * @brief Per-device ADC to resistance lookup table
+ *
+ * Entries cover the ADC words [first, first + count); words outside are
+ *  converted arithmetically, so any size gives the same results and only
+ *  the speed changes. A full table (ZMOD4510_RMOX_LUT_FULL entries, 256 KiB)
+ *  makes every conversion a load; the span reported by
+ *  zmod4510_rmox_lut_span() is enough for the same, since all words outside
+ *  it convert to a clamp value after two compares.
+ */
+typedef struct {
+    const float *table; /**< caller-provided storage, count entries */
+    uint16_t first;     /**< ADC word of table[0] */
+    uint32_t count;     /**< number of entries */
+    float scale;        /**< config[0] * 1e3 */
+    int32_t mox_lr;
+    int32_t mox_er;
+} zmod4510_rmox_lut_t;
+
+/**
+ * @brief   Read the ADC results of the NO2/O3 measurement sequence.
+ * @note    Equivalent to zmod4xxx_read_adc_result with the NO2/O3
+ *          measurement configuration.
+ * @param   [in] dev pointer to the device
+ * @param   [out] adc_result ADC words, big endian
+ * @return  error code
+ * @retval  0 success
+ * @retval  ERROR_I2C communication failed
+ */
+zmod4xxx_err zmod4510_read_adc_result(zmod4xxx_dev_t *dev,
+                                      uint8_t adc_result[ZMOD4510_ADC_DATA_LEN]);
+
+/**
+ * @brief   Convert the ADC results of the NO2/O3 sequence to resistances.
+ * @note    Bit-exact with zmod4xxx_calc_rmox for the NO2/O3 measurement
+ *          configuration.
+ * @param   [in] dev pointer to the device
+ * @param   [in] adc_result ADC words, big endian
+ * @param   [out] rmox resistances in Ohm
+ */
+void zmod4510_calc_rmox(const zmod4xxx_dev_t *dev,
+                        const uint8_t adc_result[ZMOD4510_ADC_DATA_LEN],
+                        float rmox[ZMOD4510_RMOX_COUNT]);
+
+/**
+ * @brief   ADC words for which the resistance is not a clamp value.
+ * @param   [in] dev pointer to the prepared device
+ * @param   [out] first first ADC word of the span
+ * @return  number of ADC words in the span, at most 65534
+ */
+uint32_t zmod4510_rmox_lut_span(const zmod4xxx_dev_t *dev, uint16_t *first);
+
+/**
+ * @brief   Fill a lookup table for a device.
+ * @note    Call after zmod4xxx_prepare_sensor, which sets config[0],
+ *          mox_lr and mox_er, and again whenever the sensor is prepared
+ *          anew. Building a full table takes well below a millisecond.
+ * @param   [out] lut table object
+ * @param   [in] dev pointer to the prepared device
+ * @param   [out] table storage for count entries, may be NULL for none
+ * @param   [in] first ADC word of the first entry
+ * @param   [in] count number of entries, capped at the last ADC word
+ */
+void zmod4510_rmox_lut_init(zmod4510_rmox_lut_t *lut,
+                            const zmod4xxx_dev_t *dev, float *table,
+                            uint16_t first, uint32_t count);
+
+/**
+ * @brief   Convert the ADC results of the NO2/O3 sequence with a table.
+ * @note    Bit-exact with zmod4510_calc_rmox for the device the table was
+ *          built for.
+ * @param   [in] lut table of the device
+ * @param   [in] adc_result ADC words, big endian
+ * @param   [out] rmox resistances in Ohm
+ */
+void zmod4510_calc_rmox_lut(const zmod4510_rmox_lut_t *lut,
+                            const uint8_t adc_result[ZMOD4510_ADC_DATA_LEN],
+                            float rmox[ZMOD4510_RMOX_COUNT]);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
+
+#endif /* _ZMOD4510_H */
@@ -15,6 +15,50 @@
  */
 
 #include "zmod4xxx.h"
+#include <string.h>
+#include "util/ztrace.h"
+
+static int shadow_known(zmod4xxx_dev_t *dev, uint8_t i)
+{
+    return dev->shadow_valid[i >> 3] & (1U << (i & 7));
+}
+
+/* Write a configuration block unless the shadow shows that the sensor
+ * already holds exactly these values; blocks outside the shadowed range
+ * are always written. */
+static int8_t write_conf(zmod4xxx_dev_t *dev, uint8_t addr,
+                         const uint8_t *data, uint8_t len)
+{
+    uint8_t off = addr - ZMOD4XXX_SHADOW_ADDR;
+    int8_t ret;
+    uint8_t i;
+
+    if (addr < ZMOD4XXX_SHADOW_ADDR ||
+        off + len > ZMOD4XXX_SHADOW_LEN) {
+        return dev->write(dev->i2c_addr, addr, (uint8_t *)data, len);
+    }
+    for (i = 0; i < len; i++) {
+        if (!shadow_known(dev, off + i) || dev->shadow[off + i] != data[i]) {
+            break;
+        }
+    }
+    if (i == len) {
+        ZTRACE_INSTANT("write_skipped", dev->i2c_addr, addr);
+        return 0;
+    }
+
+    /* write callbacks do not modify the buffer */
+    ret = dev->write(dev->i2c_addr, addr, (uint8_t *)data, len);
+    for (i = 0; i < len; i++) {
+        if (ret) {
+            dev->shadow_valid[(off + i) >> 3] &= ~(1U << ((off + i) & 7));
+        } else {
+            dev->shadow[off + i] = data[i];
+            dev->shadow_valid[(off + i) >> 3] |= 1U << ((off + i) & 7);
+        }
+    }
+    return ret;
+}
 
 zmod4xxx_err zmod4xxx_read_status(zmod4xxx_dev_t *dev, uint8_t *status)
 {
@@ -40,7 +84,10 @@ zmod4xxx_err zmod4xxx_check_error_event(zmod4xxx_dev_t *dev)
     }
 
     if (0 != data_buf) {
+        ZTRACE_INSTANT("error_event", dev->i2c_addr, data_buf);
         if (STATUS_POR_EVENT_MASK & data_buf) {
+            /* the configuration registers are back at their reset values */
+            zmod4xxx_invalidate_shadow(dev);
             return ERROR_POR_EVENT;
         } else if (STATUS_ACCESS_CONFLICT_MASK & data_buf) {
             return ERROR_ACCESS_CONFLICT;
@@ -132,7 +179,7 @@ zmod4xxx_err zmod4xxx_read_tracking_number(zmod4xxx_dev_t *dev,
     return ZMOD4XXX_OK;
 }
 
-zmod4xxx_err zmod4xxx_calc_factor(zmod4xxx_conf *conf, uint8_t *hsp,
+zmod4xxx_err zmod4xxx_calc_factor(const zmod4xxx_conf *conf, uint8_t *hsp,
                                   uint8_t *config)
 {
     int16_t hsp_temp[HSP_MAX];
@@ -153,7 +200,7 @@ zmod4xxx_err zmod4xxx_calc_factor(zmod4xxx_conf *conf, uint8_t *hsp,
     return ZMOD4XXX_OK;
 }
 
-zmod4xxx_err zmod4xxx_init_sensor(zmod4xxx_dev_t *dev)
+static zmod4xxx_err init_sensor(zmod4xxx_dev_t *dev)
 {
     int8_t i2c_ret;
     zmod4xxx_err api_ret;
@@ -171,31 +218,30 @@ zmod4xxx_err zmod4xxx_init_sensor(zmod4xxx_dev_t *dev)
         return api_ret;
     }
 
-    i2c_ret = dev->write(dev->i2c_addr, dev->init_conf->h.addr, hsp,
+    i2c_ret = write_conf(dev, dev->init_conf->h.addr, hsp,
                          dev->init_conf->h.len);
     if (i2c_ret) {
         return ERROR_I2C;
     }
-    i2c_ret = dev->write(dev->i2c_addr, dev->init_conf->d.addr,
+    i2c_ret = write_conf(dev, dev->init_conf->d.addr,
                          dev->init_conf->d.data_buf, dev->init_conf->d.len);
     if (i2c_ret) {
         return ERROR_I2C;
     }
-    i2c_ret = dev->write(dev->i2c_addr, dev->init_conf->m.addr,
+    i2c_ret = write_conf(dev, dev->init_conf->m.addr,
                          dev->init_conf->m.data_buf, dev->init_conf->m.len);
     if (i2c_ret) {
         return ERROR_I2C;
     }
-    i2c_ret = dev->write(dev->i2c_addr, dev->init_conf->s.addr,
+    i2c_ret = write_conf(dev, dev->init_conf->s.addr,
                          dev->init_conf->s.data_buf, dev->init_conf->s.len);
     if (i2c_ret) {
         return ERROR_I2C;
     }
 
-    i2c_ret =
-        dev->write(dev->i2c_addr, ZMOD4XXX_ADDR_CMD, &dev->init_conf->start, 1);
-    if (i2c_ret) {
-        return ERROR_I2C;
+    api_ret = zmod4xxx_start_measurement_at(dev, dev->init_conf->start);
+    if (api_ret) {
+        return api_ret;
     }
     do {
         api_ret = zmod4xxx_read_status(dev, &zmod4xxx_status);
@@ -216,7 +262,17 @@ zmod4xxx_err zmod4xxx_init_sensor(zmod4xxx_dev_t *dev)
     return ZMOD4XXX_OK;
 }
 
-zmod4xxx_err zmod4xxx_init_measurement(zmod4xxx_dev_t *dev)
+zmod4xxx_err zmod4xxx_init_sensor(zmod4xxx_dev_t *dev)
+{
+    zmod4xxx_err ret;
+
+    ZTRACE_BEGIN("init_sensor", dev->i2c_addr, 0);
+    ret = init_sensor(dev);
+    ZTRACE_END("init_sensor", dev->i2c_addr, ret);
+    return ret;
+}
+
+static zmod4xxx_err init_measurement(zmod4xxx_dev_t *dev)
 {
     int8_t i2c_ret;
     zmod4xxx_err api_ret;
@@ -227,22 +283,22 @@ zmod4xxx_err zmod4xxx_init_measurement(zmod4xxx_dev_t *dev)
         return api_ret;
     }
 
-    i2c_ret = dev->write(dev->i2c_addr, dev->meas_conf->h.addr, hsp,
+    i2c_ret = write_conf(dev, dev->meas_conf->h.addr, hsp,
                          dev->meas_conf->h.len);
     if (i2c_ret) {
         return ERROR_I2C;
     }
-    i2c_ret = dev->write(dev->i2c_addr, dev->meas_conf->d.addr,
+    i2c_ret = write_conf(dev, dev->meas_conf->d.addr,
                          dev->meas_conf->d.data_buf, dev->meas_conf->d.len);
     if (i2c_ret) {
         return ERROR_I2C;
     }
-    i2c_ret = dev->write(dev->i2c_addr, dev->meas_conf->m.addr,
+    i2c_ret = write_conf(dev, dev->meas_conf->m.addr,
                          dev->meas_conf->m.data_buf, dev->meas_conf->m.len);
     if (i2c_ret) {
         return ERROR_I2C;
     }
-    i2c_ret = dev->write(dev->i2c_addr, dev->meas_conf->s.addr,
+    i2c_ret = write_conf(dev, dev->meas_conf->s.addr,
                          dev->meas_conf->s.data_buf, dev->meas_conf->s.len);
     if (i2c_ret) {
         return ERROR_I2C;
@@ -250,10 +306,21 @@ zmod4xxx_err zmod4xxx_init_measurement(zmod4xxx_dev_t *dev)
     return ZMOD4XXX_OK;
 }
 
+zmod4xxx_err zmod4xxx_init_measurement(zmod4xxx_dev_t *dev)
+{
+    zmod4xxx_err ret;
+
+    ZTRACE_BEGIN("init_measurement", dev->i2c_addr, 0);
+    ret = init_measurement(dev);
+    ZTRACE_END("init_measurement", dev->i2c_addr, ret);
+    return ret;
+}
+
 zmod4xxx_err zmod4xxx_start_measurement_at(zmod4xxx_dev_t *dev, uint8_t  step)
 {
     int8_t ret;
 
+    ZTRACE_INSTANT(step ? "start" : "stop", dev->i2c_addr, step);
     ret =
         dev->write(dev->i2c_addr, ZMOD4XXX_ADDR_CMD, &step, 1);
     if (ret) {
@@ -267,12 +334,50 @@ zmod4xxx_err zmod4xxx_start_measurement(zmod4xxx_dev_t *dev)
     return zmod4xxx_start_measurement_at ( dev, dev->meas_conf->start );
 }
 
+zmod4xxx_err zmod4xxx_wait_measurement(zmod4xxx_dev_t *dev, uint32_t poll_ms,
+                                       uint32_t timeout_ms,
+                                       uint32_t *waited_ms)
+{
+    zmod4xxx_err ret;
+    uint8_t status;
+    uint32_t waited = 0;
+
+    ZTRACE_BEGIN("wait_measurement", dev->i2c_addr, 0);
+    for (;;) {
+        ret = zmod4xxx_read_status(dev, &status);
+        if (ret) {
+            break;
+        }
+        if (!(status & STATUS_SEQUENCER_RUNNING_MASK)) {
+            break;
+        }
+        if (waited >= timeout_ms) {
+            ret = ERROR_GAS_TIMEOUT;
+            break;
+        }
+        dev->delay_ms(poll_ms);
+        waited += poll_ms;
+    }
+    ZTRACE_END("wait_measurement", dev->i2c_addr, ret ? ret : (int32_t)waited);
+    if (waited_ms) {
+        *waited_ms = waited;
+    }
+    return ret;
+}
+
+zmod4xxx_err zmod4xxx_stop_measurement(zmod4xxx_dev_t *dev)
+{
+    return zmod4xxx_start_measurement_at ( dev, ZMOD4XXX_CMD_STOP );
+}
+
 zmod4xxx_err zmod4xxx_read_adc_result(zmod4xxx_dev_t *dev, uint8_t *adc_result)
 {
     int8_t ret;
 
+    ZTRACE_BEGIN("read_adc_result", dev->i2c_addr, 0);
     ret = dev->read(dev->i2c_addr, dev->meas_conf->r.addr, adc_result,
                     dev->meas_conf->r.len);
+    ZTRACE_END("read_adc_result", dev->i2c_addr, ret);
     if (ret) {
         return ERROR_I2C;
     }
@@ -347,3 +452,38 @@ zmod4xxx_err zmod4xxx_read_rmox(zmod4xxx_dev_t *dev, uint8_t *adc_result,
     }
     return ZMOD4XXX_OK;
 }
+
+void zmod4xxx_invalidate_shadow(zmod4xxx_dev_t *dev)
+{
+    memset(dev->shadow_valid, 0, sizeof(dev->shadow_valid));
+}
+
+zmod4xxx_err zmod4xxx_verify_config(zmod4xxx_dev_t *dev)
+{
+    uint8_t data[ZMOD4XXX_SHADOW_LEN];
+    int8_t ret;
+    uint8_t i;
+
+    ZTRACE_BEGIN("verify_config", dev->i2c_addr, 0);
+    ret = dev->read(dev->i2c_addr, ZMOD4XXX_SHADOW_ADDR, data,
+                    ZMOD4XXX_SHADOW_LEN);
+    if (ret) {
+        ZTRACE_END("verify_config", dev->i2c_addr, ERROR_I2C);
+        return ERROR_I2C;
+    }
+    for (i = 0; i < ZMOD4XXX_SHADOW_LEN; i++) {
+        if (shadow_known(dev, i) && dev->shadow[i] != data[i]) {
+            break;
+        }
+    }
+    if (i < ZMOD4XXX_SHADOW_LEN) {
+        /* the next configuration rewrites every block */
+        zmod4xxx_invalidate_shadow(dev);
+        ZTRACE_END("verify_config", dev->i2c_addr, ERROR_CONFIG_MISMATCH);
+        return ERROR_CONFIG_MISMATCH;
+    }
+    memcpy(dev->shadow, data, sizeof(data));
+    memset(dev->shadow_valid, 0xFF, sizeof(dev->shadow_valid));
+    ZTRACE_END("verify_config", dev->i2c_addr, 0);
+    return ZMOD4XXX_OK;
+}
@@ -42,6 +42,10 @@
 #define STATUS_POR_EVENT_MASK           (0x80) /**< POR_event */
 #define STATUS_ACCESS_CONFLICT_MASK     (0x40) /**< AccessConflict */
 
+#define ZMOD4XXX_CMD_STOP        (0x00) /**< Stop the sequencer */
+#define ZMOD4XXX_CMD_START       (0x80) /**< Start the sequencer */
+#define ZMOD4XXX_CMD_SLEEP_TIMER (0x40) /**< Let the sleep timer restart the sequencer */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -55,7 +59,7 @@ extern "C" {
  * @return error code
  * @retval 0 success
  */
-zmod4xxx_err zmod4xxx_calc_factor(zmod4xxx_conf *conf, uint8_t *hsp,
+zmod4xxx_err zmod4xxx_calc_factor(const zmod4xxx_conf *conf, uint8_t *hsp,
                                   uint8_t *config);
 
 /**
@@ -209,6 +213,59 @@ zmod4xxx_err zmod4xxx_start_measurement(zmod4xxx_dev_t *dev);
  */
 zmod4xxx_err zmod4xxx_start_measurement_at(zmod4xxx_dev_t *dev, uint8_t step );
 
+/**
+ * @brief   Wait for the running measurement sequence to complete.
+ * @note    The status register is polled every poll_ms until the sequencer
+ *          is idle. Call this shortly before the expected end of the
+ *          sequence to read the results at the earliest valid moment.
+ * @param   [in] dev pointer to the device
+ * @param   [in] poll_ms interval between two status reads
+ * @param   [in] timeout_ms maximum time to wait
+ * @param   [out] waited_ms time spent waiting, 0 if the sequencer was
+ *          already idle at the first read; may be NULL
+ * @return  error code
+ * @retval  0 success
+ * @retval  ERROR_GAS_TIMEOUT sequencer still running after timeout_ms
+ * @retval  "!= 0" error
+ */
+zmod4xxx_err zmod4xxx_wait_measurement(zmod4xxx_dev_t *dev, uint32_t poll_ms,
+                                       uint32_t timeout_ms,
+                                       uint32_t *waited_ms);
+
+/**
+ * @brief   Stop the sequencer, including a free-running sleep timer cycle.
+ * @param   [in] dev pointer to the device
+ * @return  error code
+ * @retval  0 success
+ * @retval  "!= 0" error
+ */
+zmod4xxx_err zmod4xxx_stop_measurement(zmod4xxx_dev_t *dev);
+
+/**
+ * @brief   Verify the configuration registers with one burst read.
+ * @note    The driver keeps a shadow of the configuration registers
+ *          (ZMOD4XXX_SHADOW_ADDR, ZMOD4XXX_SHADOW_LEN) and skips writes of
+ *          blocks the sensor already holds. This reads the whole range back
+ *          and compares it with the known registers. On success all
+ *          registers become known; on a mismatch the shadow is discarded so
+ *          that the next configuration rewrites every block. Code that
+ *          writes configuration registers by other means, such as the
+ *          cleaning procedure, must call zmod4xxx_invalidate_shadow.
+ * @param   [in] dev pointer to the device
+ * @return  error code
+ * @retval  0 success
+ * @retval  ERROR_CONFIG_MISMATCH the sensor does not hold the values written
+ * @retval  "!= 0" error
+ */
+zmod4xxx_err zmod4xxx_verify_config(zmod4xxx_dev_t *dev);
+
+/**
+ * @brief   Forget the shadowed configuration, e.g. after a sensor reset.
+ * @note    Called by zmod4xxx_check_error_event on a POR event.
+ * @param   [in] dev pointer to the device
+ */
+void zmod4xxx_invalidate_shadow(zmod4xxx_dev_t *dev);
+
 #ifdef __cplusplus
 }
 #endif
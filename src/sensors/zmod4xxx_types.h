@@ -48,8 +48,11 @@ typedef enum {
         -8, /**< The maximum numbers of cleaning cycles ran on this sensor.
                  Cleaning function has no effect anymore. */
     ERROR_NULL_PTR =
-        -9 /**< The dev structure did not receive the pointers for I2C read,
+        -9, /**< The dev structure did not receive the pointers for I2C read,
                 write and/or delay.*/
+    ERROR_CONFIG_MISMATCH =
+        -10 /**< The configuration registers read back differ from the
+                 values written. */
 } zmod4xxx_err;
 
 /**
@@ -78,7 +81,7 @@ typedef void (*zmod4xxx_delay_ptr_p)(uint32_t ms);
 typedef struct {
     uint8_t addr;
     uint8_t len;
-    uint8_t *data_buf;
+    const uint8_t *data_buf;
 } zmod4xxx_conf_str;
 
 /**
@@ -94,6 +97,12 @@ typedef struct {
     uint8_t prod_data_len;
 } zmod4xxx_conf;
 
+/** First register of the writable configuration space (heater, delay,
+ *  measurement and sequencer blocks). */
+#define ZMOD4XXX_SHADOW_ADDR (0x40)
+/** Length of the writable configuration space, 0x40 to 0x88. */
+#define ZMOD4XXX_SHADOW_LEN  (0x49)
+
 /**
  * @brief Device structure ZMOD4xxx
  */
@@ -107,8 +116,14 @@ typedef struct {
     zmod4xxx_i2c_ptr_t read; /**< function pointer to i2c read */
     zmod4xxx_i2c_ptr_t write; /**< function pointer to i2c write */
     zmod4xxx_delay_ptr_p delay_ms; /**< function pointer to delay function */
-    zmod4xxx_conf *init_conf; /**< pointer to the init configuration */
-    zmod4xxx_conf *meas_conf; /**< pointer to the measurement configuration */
+    const zmod4xxx_conf *init_conf; /**< pointer to the init configuration */
+    const zmod4xxx_conf *meas_conf; /**< pointer to the measurement
+                                         configuration */
+    /* The members below are only used by zmod4xxx.c and must stay at the
+     * end of the structure. */
+    uint8_t shadow[ZMOD4XXX_SHADOW_LEN]; /**< known configuration registers */
+    uint8_t shadow_valid[(ZMOD4XXX_SHADOW_LEN + 7) / 8]; /**< bit per known
+                                                              register */
 } zmod4xxx_dev_t;
 
 /** @} */
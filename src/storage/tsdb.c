@@ -0,0 +1,579 @@
+/**
+ * @file    tsdb.c
+ * @brief   Append-only compressed time-series store for sensor results
+ *
+ * Block layout (little endian):
+ *   0  magic    u32   "ZTS1"
+ *   4  count    u16   number of samples in the block
+ *   6  flags    u16   TSDB_FLAG_SEALED once the block is complete
+ *   8  nbits    u32   number of valid bits in the data area
+ *  12  reserved u32
+ *  16  t_first  i64   timestamp of the first sample (ms)
+ *  24  t_last   i64   timestamp of the last sample (ms)
+ *  32  data           bit stream, MSB first
+ *
+ * Each sample is encoded as:
+ *  - timestamp: nothing for the first sample (t_first), otherwise the
+ *    delta-of-delta using the prefixes 0 / 10+7 / 110+9 / 1110+12 / 1111+32
+ *  - floats: raw 32 bits for the first sample, otherwise the XOR with the
+ *    previous value as '0' (equal), '10'+bits (fits the previous window) or
+ *    '11'+5 bit leading zeros+5 bit length-1+bits
+ *  - integers: '0' if all are unchanged, otherwise '1' followed by the zigzag
+ *    varint of each difference
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "tsdb.h"
+
+#define TSDB_MAGIC        (0x5A545331U)
+#define TSDB_FLAG_SEALED  (0x0001)
+#define TSDB_DATA_BITS    ((TSDB_BLOCK_SIZE - TSDB_HEADER_SIZE) * 8)
+#define TSDB_NO_WINDOW    (0xFF)
+
+typedef struct {
+    uint8_t *buf;
+    uint32_t pos;
+    int overflow;
+} bitw_t;
+
+typedef struct {
+    const uint8_t *buf;
+    uint32_t pos;
+} bitr_t;
+
+static void put_bits(bitw_t *w, uint64_t v, unsigned n)
+{
+    if (w->overflow || w->pos + n > TSDB_DATA_BITS) {
+        w->overflow = 1;
+        return;
+    }
+    while (n) {
+        unsigned used = w->pos & 7;
+        unsigned room = 8 - used;
+        unsigned take = n < room ? n : room;
+        uint8_t chunk = (uint8_t)((v >> (n - take)) & ((1U << take) - 1));
+
+        w->buf[w->pos >> 3] |= (uint8_t)(chunk << (room - take));
+        w->pos += take;
+        n -= take;
+    }
+}
+
+static uint64_t get_bits(bitr_t *r, unsigned n)
+{
+    uint64_t v = 0;
+
+    while (n) {
+        unsigned used = r->pos & 7;
+        unsigned room = 8 - used;
+        unsigned take = n < room ? n : room;
+        uint8_t byte = r->buf[r->pos >> 3];
+
+        v = (v << take) | ((byte >> (room - take)) & ((1U << take) - 1));
+        r->pos += take;
+        n -= take;
+    }
+    return v;
+}
+
+static int64_t sign_extend(uint64_t v, unsigned n)
+{
+    if (v & (1ULL << (n - 1))) {
+        return (int64_t)v - (int64_t)(1ULL << n);
+    }
+    return (int64_t)v;
+}
+
+static void put_le(uint8_t *p, uint64_t v, unsigned bytes)
+{
+    for (unsigned i = 0; i < bytes; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, unsigned bytes)
+{
+    uint64_t v = 0;
+    for (unsigned i = 0; i < bytes; i++) {
+        v |= (uint64_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+static void pack(const sensor_results_t *r, uint32_t *v, int32_t *iv)
+{
+    memcpy(&v[0], &r->o3_ppb, 4);
+    memcpy(&v[1], &r->no2_ppb, 4);
+    memcpy(&v[2], r->rmox, 16);
+    iv[0] = r->fast_aqi;
+    iv[1] = r->epa_aqi;
+    iv[2] = r->status;
+}
+
+static void unpack(const uint32_t *v, const int32_t *iv, sensor_results_t *r)
+{
+    memcpy(&r->o3_ppb, &v[0], 4);
+    memcpy(&r->no2_ppb, &v[1], 4);
+    memcpy(r->rmox, &v[2], 16);
+    r->fast_aqi = iv[0];
+    r->epa_aqi = iv[1];
+    r->status = iv[2];
+}
+
+static void put_dod(bitw_t *w, int64_t dod)
+{
+    if (0 == dod) {
+        put_bits(w, 0x0, 1);
+    } else if (dod >= -64 && dod <= 63) {
+        put_bits(w, 0x2, 2);
+        put_bits(w, (uint64_t)dod & 0x7F, 7);
+    } else if (dod >= -256 && dod <= 255) {
+        put_bits(w, 0x6, 3);
+        put_bits(w, (uint64_t)dod & 0x1FF, 9);
+    } else if (dod >= -2048 && dod <= 2047) {
+        put_bits(w, 0xE, 4);
+        put_bits(w, (uint64_t)dod & 0xFFF, 12);
+    } else {
+        put_bits(w, 0xF, 4);
+        put_bits(w, (uint64_t)dod & 0xFFFFFFFFU, 32);
+    }
+}
+
+static int64_t get_dod(bitr_t *r)
+{
+    if (!get_bits(r, 1)) {
+        return 0;
+    }
+    if (!get_bits(r, 1)) {
+        return sign_extend(get_bits(r, 7), 7);
+    }
+    if (!get_bits(r, 1)) {
+        return sign_extend(get_bits(r, 9), 9);
+    }
+    if (!get_bits(r, 1)) {
+        return sign_extend(get_bits(r, 12), 12);
+    }
+    return sign_extend(get_bits(r, 32), 32);
+}
+
+static void put_xor(bitw_t *w, tsdb_enc_t *e, int i, uint32_t v)
+{
+    uint32_t x = v ^ e->v_prev[i];
+    unsigned lz, tz, sig;
+
+    e->v_prev[i] = v;
+    if (0 == x) {
+        put_bits(w, 0x0, 1);
+        return;
+    }
+    lz = (unsigned)__builtin_clz(x);
+    tz = (unsigned)__builtin_ctz(x);
+    if (TSDB_NO_WINDOW != e->lead[i] && lz >= e->lead[i] &&
+        tz >= e->trail[i]) {
+        put_bits(w, 0x2, 2);
+        put_bits(w, x >> e->trail[i], 32 - e->lead[i] - e->trail[i]);
+        return;
+    }
+    sig = 32 - lz - tz;
+    put_bits(w, 0x3, 2);
+    put_bits(w, lz, 5);
+    put_bits(w, sig - 1, 5);
+    put_bits(w, x >> tz, sig);
+    e->lead[i] = (uint8_t)lz;
+    e->trail[i] = (uint8_t)tz;
+}
+
+static uint32_t get_xor(bitr_t *r, tsdb_enc_t *s, int i)
+{
+    uint32_t x;
+
+    if (!get_bits(r, 1)) {
+        return s->v_prev[i];
+    }
+    if (!get_bits(r, 1)) {
+        x = (uint32_t)get_bits(r, 32 - s->lead[i] - s->trail[i]) << s->trail[i];
+    } else {
+        unsigned lz = (unsigned)get_bits(r, 5);
+        unsigned sig = (unsigned)get_bits(r, 5) + 1;
+        unsigned tz = 32 - lz - sig;
+
+        x = (uint32_t)get_bits(r, sig) << tz;
+        s->lead[i] = (uint8_t)lz;
+        s->trail[i] = (uint8_t)tz;
+    }
+    s->v_prev[i] ^= x;
+    return s->v_prev[i];
+}
+
+static void put_varint(bitw_t *w, int64_t d)
+{
+    uint64_t z = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+
+    while (z >= 0x80) {
+        put_bits(w, (z & 0x7F) | 0x80, 8);
+        z >>= 7;
+    }
+    put_bits(w, z, 8);
+}
+
+static int64_t get_varint(bitr_t *r)
+{
+    uint64_t z = 0;
+    unsigned shift = 0;
+    uint64_t byte;
+
+    do {
+        byte = get_bits(r, 8);
+        z |= (byte & 0x7F) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && shift < 64);
+    return (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+}
+
+static void reset_state(tsdb_enc_t *e)
+{
+    memset(e, 0, sizeof(*e));
+    memset(e->lead, TSDB_NO_WINDOW, sizeof(e->lead));
+}
+
+/* Encode one sample at the end of the block. Returns 0 and leaves state and
+ * buffer untouched if the sample does not fit. */
+static int encode_sample(tsdb_enc_t *e, uint8_t *data,
+                         const sensor_results_t *r)
+{
+    tsdb_enc_t saved = *e;
+    bitw_t w = { data, e->nbits, 0 };
+    uint32_t v[TSDB_NUM_FLOATS];
+    int32_t iv[TSDB_NUM_INTS];
+    int changed = 0;
+    int i;
+
+    pack(r, v, iv);
+    if (0 == e->count) {
+        e->t_first = r->timestamp_ms;
+        for (i = 0; i < TSDB_NUM_FLOATS; i++) {
+            put_bits(&w, v[i], 32);
+            e->v_prev[i] = v[i];
+        }
+    } else {
+        int64_t delta = r->timestamp_ms - e->t_prev;
+        int64_t dod = delta - e->delta_prev;
+
+        if (dod < INT32_MIN || dod > INT32_MAX) {
+            return 0;
+        }
+        put_dod(&w, dod);
+        e->delta_prev = delta;
+        for (i = 0; i < TSDB_NUM_FLOATS; i++) {
+            put_xor(&w, e, i, v[i]);
+        }
+    }
+    e->t_prev = r->timestamp_ms;
+
+    for (i = 0; i < TSDB_NUM_INTS; i++) {
+        changed |= (iv[i] != e->i_prev[i]);
+    }
+    put_bits(&w, changed ? 1 : 0, 1);
+    if (changed) {
+        for (i = 0; i < TSDB_NUM_INTS; i++) {
+            put_varint(&w, (int64_t)iv[i] - e->i_prev[i]);
+            e->i_prev[i] = iv[i];
+        }
+    }
+
+    if (w.overflow) {
+        uint32_t byte = saved.nbits >> 3;
+        if (byte < (TSDB_DATA_BITS >> 3)) {
+            data[byte] &= (uint8_t)~(0xFFU >> (saved.nbits & 7));
+            memset(data + byte + 1, 0, (TSDB_DATA_BITS >> 3) - byte - 1);
+        }
+        *e = saved;
+        return 0;
+    }
+    e->nbits = w.pos;
+    e->count++;
+    return 1;
+}
+
+static void decode_sample(tsdb_enc_t *s, bitr_t *r, sensor_results_t *out)
+{
+    uint32_t v[TSDB_NUM_FLOATS];
+    int i;
+
+    if (0 == s->count) {
+        s->t_prev = s->t_first;
+        for (i = 0; i < TSDB_NUM_FLOATS; i++) {
+            v[i] = s->v_prev[i] = (uint32_t)get_bits(r, 32);
+        }
+    } else {
+        s->delta_prev += get_dod(r);
+        s->t_prev += s->delta_prev;
+        for (i = 0; i < TSDB_NUM_FLOATS; i++) {
+            v[i] = get_xor(r, s, i);
+        }
+    }
+    if (get_bits(r, 1)) {
+        for (i = 0; i < TSDB_NUM_INTS; i++) {
+            s->i_prev[i] = (int32_t)(s->i_prev[i] + get_varint(r));
+        }
+    }
+    s->count++;
+    unpack(v, s->i_prev, out);
+    out->timestamp_ms = s->t_prev;
+}
+
+static void write_header(uint8_t *block, const tsdb_enc_t *e, uint16_t flags)
+{
+    put_le(block + 0, TSDB_MAGIC, 4);
+    put_le(block + 4, e->count, 2);
+    put_le(block + 6, flags, 2);
+    put_le(block + 8, e->nbits, 4);
+    put_le(block + 12, 0, 4);
+    put_le(block + 16, (uint64_t)e->t_first, 8);
+    put_le(block + 24, (uint64_t)e->t_prev, 8);
+}
+
+static tsdb_err write_block(tsdb_t *db, uint16_t flags)
+{
+    off_t off = (off_t)db->nblocks * TSDB_BLOCK_SIZE;
+
+    write_header(db->block, &db->enc, flags);
+    if (pwrite(db->fd, db->block, TSDB_BLOCK_SIZE, off) != TSDB_BLOCK_SIZE) {
+        return TSDB_ERR_IO;
+    }
+    return TSDB_OK;
+}
+
+static tsdb_err add_index(tsdb_t *db, int64_t t_first, int64_t t_last,
+                          uint16_t count)
+{
+    if (db->nblocks == db->capacity) {
+        uint32_t cap = db->capacity ? db->capacity * 2 : 64;
+        tsdb_index_t *idx = realloc(db->index, cap * sizeof(*idx));
+        if (!idx) {
+            return TSDB_ERR_NOMEM;
+        }
+        db->index = idx;
+        db->capacity = cap;
+    }
+    db->index[db->nblocks].t_first = t_first;
+    db->index[db->nblocks].t_last = t_last;
+    db->index[db->nblocks].count = count;
+    db->nblocks++;
+    return TSDB_OK;
+}
+
+static tsdb_err seal_block(tsdb_t *db)
+{
+    tsdb_err ret;
+
+    ret = write_block(db, TSDB_FLAG_SEALED);
+    if (ret) {
+        return ret;
+    }
+    ret = add_index(db, db->enc.t_first, db->enc.t_prev, db->enc.count);
+    if (ret) {
+        return ret;
+    }
+    reset_state(&db->enc);
+    memset(db->block, 0, sizeof(db->block));
+    return TSDB_OK;
+}
+
+/* Decode all samples of a block with timestamps in [from, to]. Returns 1 if
+ * the visitor asked to stop. */
+static int visit_block(const uint8_t *block, int64_t from, int64_t to,
+                       tsdb_visit_fn fn, void *ctx)
+{
+    tsdb_enc_t s;
+    bitr_t r = { block + TSDB_HEADER_SIZE, 0 };
+    uint16_t count = (uint16_t)get_le(block + 4, 2);
+    sensor_results_t sample;
+
+    reset_state(&s);
+    s.t_first = (int64_t)get_le(block + 16, 8);
+    memset(&sample, 0, sizeof(sample));
+    while (s.count < count) {
+        decode_sample(&s, &r, &sample);
+        if (sample.timestamp_ms > to) {
+            break;
+        }
+        if (sample.timestamp_ms >= from && fn(ctx, &sample)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int replay_sample(void *ctx, const sensor_results_t *sample)
+{
+    tsdb_t *db = ctx;
+    encode_sample(&db->enc, db->block + TSDB_HEADER_SIZE, sample);
+    return 0;
+}
+
+tsdb_err tsdb_open(tsdb_t *db, const char *path)
+{
+    uint8_t block[TSDB_BLOCK_SIZE];
+    off_t size;
+    uint32_t n, i;
+    tsdb_err ret;
+
+    memset(db, 0, sizeof(*db));
+    reset_state(&db->enc);
+    db->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (db->fd < 0) {
+        return TSDB_ERR_IO;
+    }
+    size = lseek(db->fd, 0, SEEK_END);
+    if (size < 0) {
+        ret = TSDB_ERR_IO;
+        goto fail;
+    }
+    if (size % TSDB_BLOCK_SIZE) {
+        ret = TSDB_ERR_FORMAT;
+        goto fail;
+    }
+
+    n = (uint32_t)(size / TSDB_BLOCK_SIZE);
+    for (i = 0; i < n; i++) {
+        off_t off = (off_t)i * TSDB_BLOCK_SIZE;
+        uint16_t flags;
+
+        if (pread(db->fd, block, TSDB_HEADER_SIZE, off) != TSDB_HEADER_SIZE) {
+            ret = TSDB_ERR_IO;
+            goto fail;
+        }
+        if (TSDB_MAGIC != get_le(block, 4)) {
+            ret = TSDB_ERR_FORMAT;
+            goto fail;
+        }
+        flags = (uint16_t)get_le(block + 6, 2);
+        if (flags & TSDB_FLAG_SEALED) {
+            ret = add_index(db, (int64_t)get_le(block + 16, 8),
+                            (int64_t)get_le(block + 24, 8),
+                            (uint16_t)get_le(block + 4, 2));
+            if (ret) {
+                goto fail;
+            }
+        } else if (i == n - 1) {
+            /* Resume the partially filled block by re-encoding it. */
+            if (pread(db->fd, block, TSDB_BLOCK_SIZE, off) !=
+                TSDB_BLOCK_SIZE) {
+                ret = TSDB_ERR_IO;
+                goto fail;
+            }
+            visit_block(block, INT64_MIN, INT64_MAX, replay_sample, db);
+        } else {
+            ret = TSDB_ERR_FORMAT;
+            goto fail;
+        }
+    }
+    return TSDB_OK;
+
+fail:
+    close(db->fd);
+    free(db->index);
+    db->fd = -1;
+    db->index = NULL;
+    return ret;
+}
+
+tsdb_err tsdb_append(tsdb_t *db, const sensor_results_t *r)
+{
+    tsdb_err ret;
+
+    if (db->enc.count && r->timestamp_ms < db->enc.t_prev) {
+        return TSDB_ERR_ORDER;
+    }
+    if (!db->enc.count && db->nblocks &&
+        r->timestamp_ms < db->index[db->nblocks - 1].t_last) {
+        return TSDB_ERR_ORDER;
+    }
+    if (encode_sample(&db->enc, db->block + TSDB_HEADER_SIZE, r)) {
+        return TSDB_OK;
+    }
+    ret = seal_block(db);
+    if (ret) {
+        return ret;
+    }
+    encode_sample(&db->enc, db->block + TSDB_HEADER_SIZE, r);
+    return TSDB_OK;
+}
+
+tsdb_err tsdb_flush(tsdb_t *db)
+{
+    tsdb_err ret;
+
+    if (db->enc.count) {
+        ret = write_block(db, 0);
+        if (ret) {
+            return ret;
+        }
+    }
+    if (fdatasync(db->fd)) {
+        return TSDB_ERR_IO;
+    }
+    return TSDB_OK;
+}
+
+tsdb_err tsdb_close(tsdb_t *db)
+{
+    tsdb_err ret = TSDB_OK;
+
+    if (db->fd < 0) {
+        return TSDB_OK;
+    }
+    ret = tsdb_flush(db);
+    if (close(db->fd) && !ret) {
+        ret = TSDB_ERR_IO;
+    }
+    free(db->index);
+    db->index = NULL;
+    db->fd = -1;
+    return ret;
+}
+
+tsdb_err tsdb_query(tsdb_t *db, int64_t from, int64_t to, tsdb_visit_fn fn,
+                    void *ctx)
+{
+    uint8_t block[TSDB_BLOCK_SIZE];
+    uint32_t lo = 0, hi = db->nblocks;
+
+    /* first sealed block that may contain samples >= from */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (db->index[mid].t_last < from) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (; lo < db->nblocks && db->index[lo].t_first <= to; lo++) {
+        off_t off = (off_t)lo * TSDB_BLOCK_SIZE;
+        if (pread(db->fd, block, TSDB_BLOCK_SIZE, off) != TSDB_BLOCK_SIZE) {
+            return TSDB_ERR_IO;
+        }
+        if (visit_block(block, from, to, fn, ctx)) {
+            return TSDB_OK;
+        }
+    }
+    if (db->enc.count && db->enc.t_prev >= from && db->enc.t_first <= to) {
+        write_header(db->block, &db->enc, 0);
+        visit_block(db->block, from, to, fn, ctx);
+    }
+    return TSDB_OK;
+}
+
+uint64_t tsdb_count(const tsdb_t *db)
+{
+    uint64_t n = db->enc.count;
+    for (uint32_t i = 0; i < db->nblocks; i++) {
+        n += db->index[i].count;
+    }
+    return n;
+}
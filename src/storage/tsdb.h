@@ -0,0 +1,140 @@
+/**
+ * @file    tsdb.h
+ * @brief   Append-only compressed time-series store for sensor results
+ *
+ * Results are packed into fixed-size blocks using delta-of-delta encoded
+ *  timestamps, XOR encoded floats (o3, no2, rmox) and zigzag varints for the
+ *  integer fields (AQIs, status). Every block starts with the timestamp range
+ *  it covers, so a range query only decodes the blocks that overlap it.
+ *  Sealed blocks are written once and never rewritten; the block being filled
+ *  is kept in memory until it is full or tsdb_flush() is called.
+ */
+
+#ifndef TSDB_H
+#define TSDB_H
+
+#include <stdint.h>
+#include "sensor_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size of a block on disk, chosen to match typical flash erase pages. */
+#define TSDB_BLOCK_SIZE   (4096)
+/** Size of the block header preceding the encoded samples. */
+#define TSDB_HEADER_SIZE  (32)
+/** Number of float channels encoded per sample (o3, no2, rmox[4]). */
+#define TSDB_NUM_FLOATS   (6)
+/** Number of integer channels encoded per sample (fast_aqi, epa_aqi, status). */
+#define TSDB_NUM_INTS     (3)
+
+/**
+ * @brief Error codes
+ */
+typedef enum {
+    TSDB_OK = 0,
+    TSDB_ERR_IO = -1,      /**< A read, write or sync on the store failed. */
+    TSDB_ERR_FORMAT = -2,  /**< The file does not contain valid blocks. */
+    TSDB_ERR_ORDER = -3,   /**< Timestamp is older than the last sample. */
+    TSDB_ERR_NOMEM = -4,   /**< The block index could not be grown. */
+} tsdb_err;
+
+/**
+ * @brief Per-block encoder state
+ */
+typedef struct {
+    int64_t t_first;
+    int64_t t_prev;
+    int64_t delta_prev;
+    uint32_t v_prev[TSDB_NUM_FLOATS];
+    uint8_t lead[TSDB_NUM_FLOATS];
+    uint8_t trail[TSDB_NUM_FLOATS];
+    int32_t i_prev[TSDB_NUM_INTS];
+    uint16_t count;
+    uint32_t nbits;
+} tsdb_enc_t;
+
+/**
+ * @brief Index entry describing one block of the store
+ */
+typedef struct {
+    int64_t t_first;
+    int64_t t_last;
+    uint16_t count;
+} tsdb_index_t;
+
+/**
+ * @brief Store handle
+ */
+typedef struct {
+    int fd;
+    tsdb_index_t *index; /**< one entry per sealed block */
+    uint32_t nblocks;    /**< number of sealed blocks */
+    uint32_t capacity;   /**< allocated entries in index */
+    tsdb_enc_t enc;      /**< state of the block being filled */
+    uint8_t block[TSDB_BLOCK_SIZE];
+} tsdb_t;
+
+/**
+ * @brief Callback receiving decoded samples from tsdb_query()
+ * @param [in] ctx user pointer passed to tsdb_query()
+ * @param [in] sample decoded sample
+ * @return 0 to continue, != 0 to stop the query
+ */
+typedef int (*tsdb_visit_fn)(void *ctx, const sensor_results_t *sample);
+
+/**
+ * @brief Open or create a store and rebuild its block index
+ * @param [out] db store handle
+ * @param [in] path file backing the store
+ * @return error code
+ */
+tsdb_err tsdb_open(tsdb_t *db, const char *path);
+
+/**
+ * @brief Append one result
+ * @param [in] db store handle
+ * @param [in] r result; r->timestamp_ms must not decrease between calls
+ * @return error code
+ */
+tsdb_err tsdb_append(tsdb_t *db, const sensor_results_t *r);
+
+/**
+ * @brief Persist the partially filled block and sync the file
+ * @param [in] db store handle
+ * @return error code
+ */
+tsdb_err tsdb_flush(tsdb_t *db);
+
+/**
+ * @brief Flush and close the store
+ * @param [in] db store handle
+ * @return error code
+ */
+tsdb_err tsdb_close(tsdb_t *db);
+
+/**
+ * @brief Visit all samples with from <= timestamp <= to
+ * @param [in] db store handle
+ * @param [in] from first timestamp of the range in ms
+ * @param [in] to last timestamp of the range in ms
+ * @param [in] fn callback invoked for each sample in time order
+ * @param [in] ctx user pointer handed to fn
+ * @return error code
+ */
+tsdb_err tsdb_query(tsdb_t *db, int64_t from, int64_t to, tsdb_visit_fn fn,
+                    void *ctx);
+
+/**
+ * @brief Number of samples stored, including the block being filled
+ * @param [in] db store handle
+ * @return sample count
+ */
+uint64_t tsdb_count(const tsdb_t *db);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TSDB_H */
@@ -0,0 +1,190 @@
+/**
+ * @file    zlog.c
+ * @brief   Asynchronous leveled logging for the HAL, driver and library
+ *
+ * The ring is a bounded multi-producer queue: every slot carries a sequence
+ * number telling whether it is free for the producer at a given position or
+ * holds a message for the consumer at that position. Producers claim
+ * positions with a compare-and-swap on the head and publish the slot by
+ * advancing its sequence number; the single writer thread consumes in order.
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "zlog.h"
+
+#define ZLOG_MASK (ZLOG_RING_SIZE - 1)
+
+typedef struct {
+    uint32_t seq;
+    int level;
+    uint64_t timestamp_ms;
+    char msg[ZLOG_MSG_LEN];
+} zlog_slot_t;
+
+static zlog_slot_t ring[ZLOG_RING_SIZE];
+static uint32_t head;
+static uint32_t tail;
+static uint32_t dropped;
+static int min_level = ZLOG_INFO;
+
+static void stderr_sink(void *ctx, int level, uint64_t timestamp_ms,
+                        const char *msg);
+
+/* the sink and its context are only read and written together */
+static pthread_mutex_t sink_lock = PTHREAD_MUTEX_INITIALIZER;
+static zlog_sink_t sink = stderr_sink;
+static void *sink_ctx;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static sem_t pending;
+static int writer_running;
+
+static const char *const level_names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+static void stderr_sink(void *ctx, int level, uint64_t timestamp_ms,
+                        const char *msg)
+{
+    (void)ctx;
+    (void)timestamp_ms;
+    fprintf(stderr, "[%s] %s\n", level_names[level], msg);
+}
+
+static uint64_t clock_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Pass one message to the sink. Returns 0 if the ring is empty. */
+static int drain_one(void)
+{
+    zlog_slot_t *slot = &ring[tail & ZLOG_MASK];
+    zlog_sink_t fn;
+    void *ctx;
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+        return 0;
+    }
+    pthread_mutex_lock(&sink_lock);
+    fn = sink;
+    ctx = sink_ctx;
+    pthread_mutex_unlock(&sink_lock);
+    if (fn) {
+        fn(ctx, slot->level, slot->timestamp_ms, slot->msg);
+    }
+    __atomic_store_n(&slot->seq, tail + ZLOG_RING_SIZE, __ATOMIC_RELEASE);
+    __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static void *writer(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        while (sem_wait(&pending)) {
+        }
+        while (drain_one()) {
+        }
+    }
+    return NULL;
+}
+
+static void init(void)
+{
+    pthread_t thread;
+
+    for (uint32_t i = 0; i < ZLOG_RING_SIZE; i++) {
+        ring[i].seq = i;
+    }
+    sem_init(&pending, 0, 0);
+    if (0 == pthread_create(&thread, NULL, writer, NULL)) {
+        pthread_detach(thread);
+        writer_running = 1;
+    }
+}
+
+void zlog_set_sink(zlog_sink_t fn, void *ctx)
+{
+    pthread_mutex_lock(&sink_lock);
+    sink = fn;
+    sink_ctx = ctx;
+    pthread_mutex_unlock(&sink_lock);
+}
+
+void zlog_set_level(int level)
+{
+    __atomic_store_n(&min_level, level, __ATOMIC_RELAXED);
+}
+
+void zlog_write(int level, const char *fmt, ...)
+{
+    zlog_slot_t *slot;
+    uint32_t pos;
+    va_list ap;
+
+    if (level < __atomic_load_n(&min_level, __ATOMIC_RELAXED) ||
+        level >= ZLOG_OFF) {
+        return;
+    }
+    pthread_once(&once, init);
+
+    pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    for (;;) {
+        int32_t diff;
+
+        slot = &ring[pos & ZLOG_MASK];
+        diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (0 == diff) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->level = level;
+    slot->timestamp_ms = clock_ms();
+    va_start(ap, fmt);
+    vsnprintf(slot->msg, sizeof(slot->msg), fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    if (writer_running) {
+        sem_post(&pending);
+    } else {
+        /* no writer thread could be started, deliver synchronously */
+        static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        pthread_mutex_lock(&lock);
+        while (drain_one()) {
+        }
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+void zlog_flush(void)
+{
+    for (int i = 0; i < 1000; i++) {
+        if (__atomic_load_n(&tail, __ATOMIC_ACQUIRE) ==
+            __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+        usleep(1000);
+    }
+}
+
+uint32_t zlog_dropped(void)
+{
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,100 @@
+/**
+ * @file    zlog.h
+ * @brief   Asynchronous leveled logging for the HAL, driver and library
+ *
+ * Messages are formatted by the caller into a slot of a lock-free ring and
+ *  handed to a background writer thread, which passes them to the sink. A
+ *  caller never blocks on console or file I/O; if the ring is full the
+ *  message is dropped and counted.
+ *
+ * The default sink writes to stderr. Applications embedding the library can
+ *  install their own sink, e.g. to forward messages to their logging
+ *  framework, or pass NULL to discard all messages.
+ *
+ * In the minimal build (ZMOD4510_MINIMAL) the macros below compile to
+ *  nothing, arguments included, so no formatting code is linked; failures
+ *  are reported by their error codes only.
+ */
+
+#ifndef ZLOG_H
+#define ZLOG_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of messages the ring can hold (power of two). */
+#define ZLOG_RING_SIZE (256)
+/** Maximum message length including the terminating zero. */
+#define ZLOG_MSG_LEN   (128)
+
+/**
+ * @brief Severity levels
+ */
+typedef enum {
+    ZLOG_DEBUG = 0,
+    ZLOG_INFO,
+    ZLOG_WARN,
+    ZLOG_ERROR,
+    ZLOG_OFF
+} zlog_level_t;
+
+/**
+ * @brief Sink receiving formatted messages on the writer thread
+ * @param [in] ctx user pointer passed to zlog_set_sink()
+ * @param [in] level severity of the message
+ * @param [in] timestamp_ms monotonic time the message was logged
+ * @param [in] msg zero terminated message without trailing newline
+ */
+typedef void (*zlog_sink_t)(void *ctx, int level, uint64_t timestamp_ms,
+                            const char *msg);
+
+/**
+ * @brief Install the sink, NULL discards all messages
+ */
+void zlog_set_sink(zlog_sink_t sink, void *ctx);
+
+/**
+ * @brief Set the minimum severity that is logged (default ZLOG_INFO)
+ */
+void zlog_set_level(int level);
+
+/**
+ * @brief Log a message; never blocks on I/O
+ * @param [in] level severity
+ * @param [in] fmt printf style format
+ */
+void zlog_write(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Wait until all queued messages have been passed to the sink
+ * @note  Intended for shutdown paths; waits at most about one second.
+ */
+void zlog_flush(void);
+
+/**
+ * @brief Number of messages dropped because the ring was full
+ */
+uint32_t zlog_dropped(void);
+
+#ifndef ZMOD4510_MINIMAL
+#define zlog_debug(...) zlog_write(ZLOG_DEBUG, __VA_ARGS__)
+#define zlog_info(...)  zlog_write(ZLOG_INFO, __VA_ARGS__)
+#define zlog_warn(...)  zlog_write(ZLOG_WARN, __VA_ARGS__)
+#define zlog_error(...) zlog_write(ZLOG_ERROR, __VA_ARGS__)
+#else
+#define zlog_debug(...) ((void)0)
+#define zlog_info(...)  ((void)0)
+#define zlog_warn(...)  ((void)0)
+#define zlog_error(...) ((void)0)
+#define zlog_flush()    ((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZLOG_H */
@@ -0,0 +1,125 @@
+/**
+ * @file    zrt.c
+ * @brief   Real-time mode of an acquisition thread
+ */
+
+#define _GNU_SOURCE /* pthread_setaffinity_np, RUSAGE_THREAD */
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include "zrt.h"
+#include "zlog.h"
+
+#define PAGE_SIZE_MIN (4096)
+
+/* lock pages as they are touched rather than all mappings up front */
+#ifdef MCL_ONFAULT
+#define LOCK_ON_FAULT MCL_ONFAULT
+#else
+#define LOCK_ON_FAULT 0
+#endif
+
+const zrt_config_t zrt_default_config = {
+    .policy = SCHED_FIFO,
+    .priority = 50,
+    .cpu = -1,
+    .lock_memory = 1,
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int locked;
+
+/* Touch the stack the thread may use, so it is resident before the loop */
+static __attribute__((noinline)) void prefault_stack(void)
+{
+    volatile uint8_t stack[ZRT_PREFAULT_STACK];
+
+    for (size_t i = 0; i < sizeof(stack); i += PAGE_SIZE_MIN) {
+        stack[i] = 0;
+    }
+}
+
+static int lock_memory(void)
+{
+    int err = 0;
+
+    pthread_mutex_lock(&lock);
+    if (!locked) {
+        /* freed memory stays in the heap, never trimmed nor unmapped */
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+        if (mlockall(MCL_CURRENT | MCL_FUTURE | LOCK_ON_FAULT) &&
+            (EINVAL != errno || mlockall(MCL_CURRENT | MCL_FUTURE))) {
+            err = errno;
+        } else {
+            void *heap = malloc(ZRT_PREFAULT_HEAP);
+
+            if (heap) {
+                memset(heap, 0, ZRT_PREFAULT_HEAP);
+                free(heap);
+            }
+            locked = 1;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+int zrt_enter(const zrt_config_t *cfg)
+{
+    int failed = 0, err;
+
+    if (!cfg) {
+        cfg = &zrt_default_config;
+    }
+    if (SCHED_OTHER != cfg->policy) {
+        struct sched_param sp = { .sched_priority = cfg->priority };
+
+        err = pthread_setschedparam(pthread_self(), cfg->policy, &sp);
+        if (err) {
+            zlog_warn("Real-time priority %d not applied: %s", cfg->priority,
+                      strerror(err));
+            failed |= ZRT_SCHED;
+        }
+    }
+    if (SCHED_OTHER == cfg->policy || failed & ZRT_SCHED) {
+        /* wake up on time at least as far as timers go */
+        prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+    }
+    if (cfg->cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cfg->cpu, &set);
+        err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err) {
+            zlog_warn("Pinning to CPU %d failed: %s", cfg->cpu, strerror(err));
+            failed |= ZRT_AFFINITY;
+        }
+    }
+    if (cfg->lock_memory) {
+        err = lock_memory();
+        if (err) {
+            zlog_warn("Locking memory failed: %s", strerror(err));
+            failed |= ZRT_MEMORY;
+        }
+        prefault_stack();
+    }
+    return failed;
+}
+
+uint64_t zrt_page_faults(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_THREAD, &ru)) {
+        return 0;
+    }
+    return (uint64_t)ru.ru_minflt + (uint64_t)ru.ru_majflt;
+}
@@ -0,0 +1,91 @@
+/**
+ * @file    zrt.h
+ * @brief   Real-time mode of an acquisition thread
+ *
+ * On a busy host a sensor cycle overruns when the acquisition thread, once
+ *  its sleep ends, waits behind other runnable threads, or when it page
+ *  faults on memory that was never touched or has been reclaimed.
+ *  zrt_enter() gives the calling thread a real-time scheduling class and
+ *  priority, optionally pins it to one CPU, and locks and prefaults the
+ *  memory of the process.
+ *
+ * Memory is locked with mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT):
+ *  what is resident stays resident, and every page is locked when it is
+ *  first touched, so idle thread stacks are not made resident in full.
+ *  The stack and heap that the loop needs are touched in advance, and
+ *  anything else it touches is locked from its first cycle on. The
+ *  allocator keeps freed memory instead of returning it to the kernel, so
+ *  memory that is freed and allocated again does not fault again.
+ *
+ * A steady-state cycle of sensor_step() or of zmodd allocates nothing,
+ *  logs nothing unless the cycle fails, and in real-time mode takes no
+ *  page faults; bench/bench_rt.c checks this. The exception is exporting
+ *  to a file from sensor_step(), which writes to the file from the
+ *  acquisition thread.
+ *
+ * A real-time priority needs CAP_SYS_NICE or RLIMIT_RTPRIO, and locking
+ *  needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK. A step that is not
+ *  permitted is logged and skipped, and the other steps still apply.
+ */
+
+#ifndef ZRT_H
+#define ZRT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Stack of the calling thread that is touched in advance */
+#define ZRT_PREFAULT_STACK (64 * 1024)
+/** Heap that is touched in advance */
+#define ZRT_PREFAULT_HEAP  (1024 * 1024)
+
+/**
+ * @brief Steps of zrt_enter(), as bits
+ */
+typedef enum {
+    ZRT_SCHED = 1,     /**< scheduling class and priority */
+    ZRT_AFFINITY = 2,  /**< pinning to the CPU */
+    ZRT_MEMORY = 4,    /**< locking and prefaulting memory */
+} zrt_step_t;
+
+/**
+ * @brief Real-time settings
+ */
+typedef struct {
+    int policy;       /**< SCHED_FIFO or SCHED_RR; SCHED_OTHER keeps it */
+    int priority;     /**< 1 (lowest) to 99, for SCHED_FIFO and SCHED_RR */
+    int cpu;          /**< CPU to run on, -1 for any */
+    int lock_memory;  /**< if != 0, lock and prefault memory */
+} zrt_config_t;
+
+/**
+ * @brief Default settings: SCHED_FIFO at priority 50 on any CPU, locked
+ */
+extern const zrt_config_t zrt_default_config;
+
+/**
+ * @brief Put the calling thread into real-time mode
+ *
+ * Memory is locked once per process; later calls only prefault the stack
+ *  of the calling thread. If real-time scheduling is not permitted, the
+ *  timer slack of the thread is still reduced to the minimum.
+ *
+ * @param [in] cfg settings, NULL for zrt_default_config
+ * @return 0 if every step was applied, otherwise the zrt_step_t bits of
+ *         the steps that failed
+ */
+int zrt_enter(const zrt_config_t *cfg);
+
+/**
+ * @brief Page faults (minor and major) the calling thread has taken so far
+ */
+uint64_t zrt_page_faults(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZRT_H */
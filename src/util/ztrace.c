@@ -0,0 +1,170 @@
+/**
+ * @file    ztrace.c
+ * @brief   Event tracing of the measurement lifecycle
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "ztrace.h"
+
+typedef struct {
+    uint64_t ts_ns;
+    const char *name;
+    uint32_t sensor;
+    int32_t arg;
+    char phase;
+} ztrace_rec_t;
+
+typedef struct ztrace_buf {
+    struct ztrace_buf *next;
+    uint32_t tid;
+    int in_use;     /**< owned by a running thread */
+    uint64_t count; /**< events written, only changed by the owner */
+    uint64_t base;  /**< count at the last reset, guarded by lock */
+    ztrace_rec_t rec[ZTRACE_RING_SIZE];
+} ztrace_buf_t;
+
+static __thread ztrace_buf_t *local;
+static ztrace_buf_t *buffers;
+static uint32_t next_tid = 1;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t exit_key;
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+
+/* The buffer of an exited thread keeps its events for export until a new
+ * thread takes it over, so there are never more buffers than threads that
+ * traced at the same time. */
+static void detach(void *arg)
+{
+    ztrace_buf_t *buf = arg;
+
+    pthread_mutex_lock(&lock);
+    buf->in_use = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+static void make_exit_key(void)
+{
+    pthread_key_create(&exit_key, detach);
+}
+
+static ztrace_buf_t *attach(void)
+{
+    ztrace_buf_t *buf;
+
+    pthread_once(&exit_once, make_exit_key);
+    pthread_mutex_lock(&lock);
+    buf = buffers;
+    while (buf && buf->in_use) {
+        buf = buf->next;
+    }
+    if (!buf) {
+        buf = calloc(1, sizeof(*buf));
+        if (!buf) {
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+        buf->next = buffers;
+        buffers = buf;
+    }
+    buf->tid = next_tid++;
+    buf->in_use = 1;
+    buf->base = 0;
+    __atomic_store_n(&buf->count, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lock);
+    pthread_setspecific(exit_key, buf);
+    return buf;
+}
+
+void ztrace_event(char phase, const char *name, uint32_t sensor, int32_t arg)
+{
+    ztrace_buf_t *buf = local;
+    ztrace_rec_t *r;
+    struct timespec ts;
+    uint64_t n;
+
+    if (!buf) {
+        buf = local = attach();
+        if (!buf) {
+            return;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    n = __atomic_load_n(&buf->count, __ATOMIC_RELAXED);
+    r = &buf->rec[n % ZTRACE_RING_SIZE];
+    /* an exporter that sees any of the stores below also sees count == n,
+     * and so knows the slot is being overwritten */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&r->ts_ns,
+                     (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&r->name, name, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->sensor, sensor, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->arg, arg, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->phase, phase, __ATOMIC_RELAXED);
+    __atomic_store_n(&buf->count, n + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy event i of a buffer whose owner may still be recording. Returns 0
+ * if the owner overwrote or was overwriting the slot during the copy. */
+static int copy_event(const ztrace_buf_t *buf, uint64_t i, ztrace_rec_t *out)
+{
+    const ztrace_rec_t *r = &buf->rec[i % ZTRACE_RING_SIZE];
+
+    out->ts_ns = __atomic_load_n(&r->ts_ns, __ATOMIC_RELAXED);
+    out->name = __atomic_load_n(&r->name, __ATOMIC_RELAXED);
+    out->sensor = __atomic_load_n(&r->sensor, __ATOMIC_RELAXED);
+    out->arg = __atomic_load_n(&r->arg, __ATOMIC_RELAXED);
+    out->phase = __atomic_load_n(&r->phase, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    /* event i + ZTRACE_RING_SIZE reuses the slot */
+    return __atomic_load_n(&buf->count, __ATOMIC_RELAXED) <
+           i + ZTRACE_RING_SIZE;
+}
+
+int ztrace_export_json(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    const char *sep = "";
+
+    if (!f) {
+        return -1;
+    }
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    pthread_mutex_lock(&lock);
+    for (ztrace_buf_t *buf = buffers; buf; buf = buf->next) {
+        uint64_t end = __atomic_load_n(&buf->count, __ATOMIC_ACQUIRE);
+        uint64_t i = end > ZTRACE_RING_SIZE ? end - ZTRACE_RING_SIZE : 0;
+        ztrace_rec_t r;
+
+        for (i = i > buf->base ? i : buf->base; i < end; i++) {
+            if (!copy_event(buf, i, &r)) {
+                continue;
+            }
+            fprintf(f,
+                    "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                    "\"pid\":1,\"tid\":%u,%s\"args\":{\"sensor\":\"0x%02X\","
+                    "\"arg\":%d}}",
+                    sep, r.name, r.phase, r.ts_ns / 1000.0, buf->tid,
+                    r.phase == 'i' ? "\"s\":\"t\"," : "", r.sensor,
+                    r.arg);
+            sep = ",";
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    fprintf(f, "\n]}\n");
+    return fclose(f) ? -1 : 0;
+}
+
+/* The owner keeps counting; the export starts from the count of the reset,
+ * so a reset never races with the owner's update of count. */
+void ztrace_reset(void)
+{
+    pthread_mutex_lock(&lock);
+    for (ztrace_buf_t *buf = buffers; buf; buf = buf->next) {
+        buf->base = __atomic_load_n(&buf->count, __ATOMIC_ACQUIRE);
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,67 @@
+/**
+ * @file    ztrace.h
+ * @brief   Event tracing of the measurement lifecycle
+ *
+ * Trace points record begin/end/instant events into a binary ring buffer
+ *  owned by the calling thread, so recording takes no locks. The buffers of
+ *  all threads can be exported as Chrome trace JSON, which chrome://tracing
+ *  and ui.perfetto.dev open directly. When a thread exits, its buffer and
+ *  events stay until the next thread that starts tracing takes them over.
+ *  Export and reset may run while other threads record: an event that its
+ *  thread overwrites during the export is left out.
+ *
+ * Trace points are compiled in only if ZMOD4510_TRACE is defined (CMake
+ *  option ZMOD4510_TRACE); otherwise the macros expand to nothing.
+ *
+ * Every event carries the I2C address of the sensor it concerns and one
+ *  event specific argument (register address, error code, duration, ...).
+ */
+
+#ifndef ZTRACE_H
+#define ZTRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of events kept per thread; older events are overwritten. */
+#define ZTRACE_RING_SIZE (16384)
+
+/**
+ * @brief Record one event
+ * @param [in] phase 'B' (begin), 'E' (end) or 'i' (instant)
+ * @param [in] name static string naming the event
+ * @param [in] sensor I2C address of the sensor concerned
+ * @param [in] arg event specific argument
+ */
+void ztrace_event(char phase, const char *name, uint32_t sensor, int32_t arg);
+
+/**
+ * @brief Write all recorded events as Chrome trace JSON
+ * @param [in] path output file
+ * @return 0 on success, -1 if the file could not be written
+ */
+int ztrace_export_json(const char *path);
+
+/**
+ * @brief Discard all recorded events
+ */
+void ztrace_reset(void);
+
+#ifdef ZMOD4510_TRACE
+#define ZTRACE_BEGIN(name, sensor, arg)   ztrace_event('B', name, sensor, arg)
+#define ZTRACE_END(name, sensor, arg)     ztrace_event('E', name, sensor, arg)
+#define ZTRACE_INSTANT(name, sensor, arg) ztrace_event('i', name, sensor, arg)
+#else
+#define ZTRACE_BEGIN(name, sensor, arg)   ((void)0)
+#define ZTRACE_END(name, sensor, arg)     ((void)0)
+#define ZTRACE_INSTANT(name, sensor, arg) ((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZTRACE_H */